@@ -134,6 +134,23 @@ typedef struct Scope {
     Table(AstNode *) symbols;
 } Scope;
 
+// The instantiations of a polymorphic procedure, struct or union, looked up by their
+// polymorphic solutions. The key of an instantiation is three numbers per solution:
+// a hash of the name of the polymorphic variable, the kind of the solution, and the
+// id of the solved type or the value. See polymorph.h.
+typedef struct PolyCacheEntry {
+    u32 key_start;  // Index of the key in PolyCache.keys
+    u32 key_length;
+    i32 next;       // The previous entry with the same hash, or -1
+    void *value;
+} PolyCacheEntry;
+
+typedef struct PolyCache {
+    bh_imap lookup;    // Hash of the key -> index of the last entry with that hash, plus one
+    bh_arr(u64) keys;
+    bh_arr(PolyCacheEntry) entries;
+} PolyCache;
+
 
 typedef enum AstKind {
     Ast_Kind_Error,
@@ -1036,7 +1053,7 @@ struct AstPolyStructType {
 
     Scope *scope;
     bh_arr(AstPolyStructParam) poly_params;
-    Table(AstStructType *) concrete_structs;
+    PolyCache *concrete_structs; // Values are AstStructType *
 
     AstStructType* base_struct;
 };
@@ -1090,7 +1107,7 @@ struct AstPolyUnionType {
 
     Scope *scope;
     bh_arr(AstPolyStructParam) poly_params;
-    Table(AstUnionType *) concrete_unions;
+    PolyCache *concrete_unions;  // Values are AstUnionType *
 
     AstUnionType* base_union;
 };
@@ -1423,7 +1440,7 @@ struct AstFunction {
 
     bh_arr(AstPolySolution) known_slns;
 
-    Table(AstSolidifiedFunction) concrete_funcs;
+    PolyCache *concrete_funcs;   // Values are AstSolidifiedFunction *
     bh_imap active_queries;
 
     bh_arr(AstNode *) nodes_that_need_entities_after_clone;
@@ -1440,6 +1457,10 @@ struct AstFunction {
     b32 is_foreign         : 1;
     b32 is_foreign_dyncall : 1;
     b32 is_intrinsic       : 1;
+
+    // NOTE: Set by #inline and #no_inline. Only used when optimizing with -O.
+    b32 is_inline          : 1;
+    b32 is_no_inline       : 1;
 };
 
 struct AstCaptureBlock {
@@ -1676,11 +1697,18 @@ typedef struct Entity {
 
     b32 entered_in_queue : 1;
 
+    // Set while the entity is out of the heap, waiting on another entity or a symbol.
+    b32 parked : 1;
+
     Package *package;
     Scope *scope;
 
-    // TODO: This is incomplete. Add proper cycle detection and halting.
-    // struct Entity *waiting_on;
+    // While parked on another entity, that entity and the state it has to reach.
+    struct Entity *waiting_on;
+    EntityState waiting_for_state;
+
+    // The entities that are parked until this entity reaches some state.
+    bh_arr(struct Entity *) waiters;
 
     union {
         AstDirectiveError     *error;
@@ -1719,6 +1747,16 @@ typedef struct EntityHeap {
     i32 type_count[Entity_Type_Count];
 
     i32 all_count[Entity_State_Count][Entity_Type_Count];
+
+    // What the entity being processed said it is waiting on. If it yields, it is
+    // parked until that entity reaches the state, or until that symbol is introduced.
+    struct Entity *blocked_on_entity;
+    EntityState    blocked_until_state;
+    OnyxToken     *blocked_on_symbol;
+
+    bh_arr(Entity *) parked;
+    Table(bh_arr(Entity *)) symbol_waiters;
+    b32 parking_disabled;
 } EntityHeap;
 
 void entity_heap_init(EntityHeap* entities);
@@ -1731,9 +1769,24 @@ void entity_change_type(EntityHeap* entities, Entity *ent, EntityType new_type);
 void entity_change_state(EntityHeap* entities, Entity *ent, EntityState new_state);
 void entity_heap_add_job(EntityHeap *entities, enum TypeMatch (*func)(void *), void *job_data);
 
+// Called before yielding, when the entity being processed cannot make progress until
+// the dependency reaches the state, or until a symbol with that name is introduced.
+void entity_wait_on(Entity *dependency, EntityState state);
+void entity_wait_on_symbol(OnyxToken *symbol);
+
+b32  entity_heap_park(EntityHeap *entities, Entity *e);
+void entity_heap_wake_waiters(EntityHeap *entities, Entity *e);
+void entity_heap_wake_symbol_waiters(EntityHeap *entities, char *name);
+b32  entity_heap_wake_all_parked(EntityHeap *entities);
+b32  entity_heap_wake_if_stalled(EntityHeap *entities);
+
 // If target_arr is null, the entities will be placed directly in the heap.
 void add_entities_for_node(bh_arr(Entity *)* target_arr, AstNode* node, Scope* scope, Package* package);
 
+// NOTE: Defined in onyx.c. Starts reading and lexing the included file on another
+// thread, when compiling with more than one thread.
+void preload_included_file(AstInclude *include);
+
 void symres_entity(Entity* ent);
 void check_entity(Entity* ent);
 void emit_entity(Entity* ent);
@@ -1851,6 +1904,9 @@ struct CompileOptions {
     b32 generate_lsp_info_file    : 1;
 
     b32 running_perf : 1;
+    b32 optimize     : 1;
+
+    i32 thread_count;
 
     Runtime runtime;
 
@@ -1866,10 +1922,30 @@ struct CompileOptions {
     b32 debug_info_enabled;
     b32 stack_trace_enabled;
 
+    b32 ovm_instr_stats;
+    b32 ovm_no_superinstructions;
+    b32 ovm_jit;
+    b32 ovm_no_cache;
+    char *ovm_profile_path;
+
+    char *cache_dir;
+    char *trace_file;
+
     i32    passthrough_argument_count;
     char** passthrough_argument_data;
 };
 
+typedef struct OnyxRunOptions {
+    b32 debug_enabled;
+
+    // These only have an effect when using the OVM runtime.
+    b32 ovm_instr_stats;
+    b32 ovm_no_superinstructions;
+    b32 ovm_jit;
+    b32 ovm_no_cache;
+    char *ovm_profile_path;
+} OnyxRunOptions;
+
 typedef struct Context Context;
 struct Context {
     Table(Package *)      packages;
@@ -1906,10 +1982,23 @@ struct Context {
 
     u64 lexer_lines_processed;
     u64 lexer_tokens_processed;
+    u64 lexer_files_reused;
+
+    // Only used with --cache-dir.
+    u64 cache_key;
+    bh_arr(char *) cache_files;
+    bh_arr(char *) cache_folders;
+    bh_buffer cached_program; // Set when the program was loaded from the build cache.
 
     u64 microseconds_per_state[Entity_State_Count];
     u64 microseconds_per_type[Entity_Type_Count];
 
+    // Printed with --perf.
+    u64 productive_entity_passes;
+    u64 useless_entity_passes;
+    u64 entities_parked;
+    u64 stalled_wakes;
+
     u32 cycle_almost_detected : 2;
     b32 cycle_detected : 1;
 
@@ -0,0 +1,22 @@
+#ifndef ONYX_BUILD_CACHE_H
+#define ONYX_BUILD_CACHE_H
+
+#include "bh.h"
+#include "astnodes.h"
+
+// Build cache
+//
+// With --cache-dir, the compiled program is stored in the cache directory, along
+// with a hash of every file and folder it was compiled from. A later compilation
+// of the same input files with the same options loads the stored program instead
+// of compiling, as long as none of those files and folders changed.
+
+b32  build_cache_enabled();
+b32  build_cache_load(bh_buffer *program);
+void build_cache_store(bh_buffer program);
+
+// Records dependencies that are not loaded source files.
+void build_cache_add_file(const char *filename);
+void build_cache_add_folder(const char *folder);
+
+#endif
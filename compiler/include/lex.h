@@ -117,6 +117,11 @@ typedef struct OnyxTokenizer {
 
     b32 optional_semicolons : 1;
     b32 insert_semicolon: 1;
+
+    // NOTE: Errors cannot be reported from the threads that lex files ahead
+    // of time. Instead, had_error is set, and the file is lexed again later.
+    b32 defer_errors : 1;
+    b32 had_error    : 1;
 } OnyxTokenizer;
 
 const char *token_type_name(TokenType tkn_type);
@@ -0,0 +1,28 @@
+#ifndef ONYX_TRACE_H
+#define ONYX_TRACE_H
+
+#include "bh.h"
+#include "astnodes.h"
+
+// Compilation trace
+//
+// With --trace=<file>, every pass over an entity and every phase of the compilation
+// (lexing, parsing, linking, optimizing and outputting) is recorded. At the end of
+// the compilation, the events are written to <file> in the Chrome trace event format,
+// which chrome://tracing and Perfetto can open. The entities that took the longest
+// and the entities that were retried the most are printed as well.
+//
+// Times are in microseconds, from bh_time_curr_micro.
+
+b32  trace_enabled();
+void trace_begin();
+void trace_end();
+
+// Records a pass over the entity that started at `start`, in the state `before`.
+void trace_entity_pass(Entity *ent, EntityState before, u64 start);
+
+// Records a phase that started at `start`. `detail` can be NULL. Phases can be
+// recorded on any thread.
+void trace_phase(const char *name, const char *detail, u64 start);
+
+#endif
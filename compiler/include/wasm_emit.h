@@ -544,6 +544,10 @@ typedef struct WasmFunc {
     LocalAllocator locals;
     bh_arr(WasmInstruction) code;
     OnyxToken *location;
+
+    b32 is_inline    : 1;
+    b32 is_no_inline : 1;
+    b32 was_inlined  : 1;
 } WasmFunc;
 
 typedef struct WasmGlobal {
@@ -807,12 +811,14 @@ b32 onyx_wasm_build_link_options_from_node(OnyxWasmLinkOptions *opts, struct Ast
 
 OnyxWasmModule onyx_wasm_module_create(bh_allocator alloc);
 void onyx_wasm_module_link(OnyxWasmModule *module, OnyxWasmLinkOptions *options);
+void onyx_wasm_module_prune(OnyxWasmModule *module);
+void onyx_wasm_module_optimize(OnyxWasmModule *module);
 void onyx_wasm_module_free(OnyxWasmModule* module);
 void onyx_wasm_module_write_to_buffer(OnyxWasmModule* module, bh_buffer* buffer);
 void onyx_wasm_module_write_to_file(OnyxWasmModule* module, bh_file file);
 
 #ifdef ONYX_RUNTIME_LIBRARY
-void onyx_run_initialize(b32 debug_enabled);
+void onyx_run_initialize(OnyxRunOptions *options);
 b32 onyx_run_wasm(bh_buffer code_buffer, int argc, char *argv[]);
 #endif
 
@@ -0,0 +1,332 @@
+#include "build_cache.h"
+#include "utils.h"
+
+#ifdef _BH_WINDOWS
+    #include <direct.h>
+    #define cache_mkdir(path) _mkdir(path)
+#else
+    #include <sys/stat.h>
+    #define cache_mkdir(path) mkdir(path, 0755)
+#endif
+
+//
+// An entry in the cache is named by a hash of the compiler build, the options
+// and the input files. It contains:
+//
+//     "OCAC" | version (u32) | dependency count (u32)
+//     dependencies: kind (u32) | path length (u32) | path | length (u64) | hash (u64)
+//     program length (u64) | program
+//
+// The entry is only used if every dependency still hashes to the same value.
+//
+#define BUILD_CACHE_MAGIC   "OCAC"
+#define BUILD_CACHE_VERSION 1
+
+typedef enum CacheDependencyKind {
+    Cache_Dependency_File   = 0,
+    Cache_Dependency_Folder = 1,
+} CacheDependencyKind;
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME  0x100000001b3ull
+
+static u64 cache_hash_bytes(u64 hash, const void *data, u64 length) {
+    const u8 *bytes = data;
+    fori (i, 0, (i64) length) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static u64 cache_hash_string(u64 hash, const char *str) {
+    if (str == NULL) return cache_hash_bytes(hash, "", 1);
+    return cache_hash_bytes(hash, str, strlen(str) + 1);
+}
+
+static u64 cache_hash_u32(u64 hash, u32 value) {
+    return cache_hash_bytes(hash, &value, sizeof(value));
+}
+
+static u64 cache_key() {
+    CompileOptions *opts = context.options;
+
+    u64 hash = FNV_OFFSET;
+    hash = cache_hash_u32(hash, BUILD_CACHE_VERSION);
+    hash = cache_hash_u32(hash, VERSION_MAJOR);
+    hash = cache_hash_u32(hash, VERSION_MINOR);
+    hash = cache_hash_u32(hash, VERSION_PATCH);
+
+    // The code generation changes between builds of the compiler.
+    hash = cache_hash_string(hash, __DATE__ " " __TIME__);
+
+    u32 flags[] = {
+        opts->runtime,
+        opts->use_post_mvp_features,
+        opts->use_multi_threading,
+        opts->generate_foreign_info,
+        opts->generate_type_info,
+        opts->generate_method_info,
+        opts->no_core,
+        opts->no_stale_code,
+        opts->no_file_contents,
+        opts->enable_optional_semicolons,
+        opts->optimize,
+        opts->debug_info_enabled,
+        opts->stack_trace_enabled,
+    };
+    hash = cache_hash_bytes(hash, flags, sizeof(flags));
+
+    char *cwd = bh_path_get_full_name(".", global_scratch_allocator);
+    hash = cache_hash_string(hash, cwd);
+
+    bh_arr_each(const char *, folder, opts->included_folders) hash = cache_hash_string(hash, *folder);
+    bh_arr_each(const char *, file, opts->files)               hash = cache_hash_string(hash, *file);
+
+    bh_arr_each(DefinedVariable, dv, opts->defined_variables) {
+        hash = cache_hash_string(hash, dv->key);
+        hash = cache_hash_string(hash, dv->value);
+    }
+
+    return hash;
+}
+
+static char *cache_entry_path() {
+    char key[32];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long) context.cache_key);
+
+    return bh_aprintf(global_scratch_allocator, "%s/%s.ocache", context.options->cache_dir, key);
+}
+
+static b32 cache_hash_file(const char *filename, u64 *length, u64 *hash) {
+    bh_file file;
+    if (bh_file_open(&file, filename) != BH_FILE_ERROR_NONE) return 0;
+
+    bh_file_contents contents = bh_file_read_contents(bh_heap_allocator(), &file);
+    bh_file_close(&file);
+
+    *length = contents.length;
+    *hash   = cache_hash_bytes(FNV_OFFSET, contents.data, contents.length);
+
+    if (contents.data) bh_file_contents_free(&contents);
+    bh_free(bh_heap_allocator(), (char *) contents.filename);
+    return 1;
+}
+
+//
+// A folder is hashed by the names of its entries, so adding or removing a file
+// in a folder loaded with #load_all is noticed.
+static b32 cache_hash_folder(const char *folder, u64 *length, u64 *hash) {
+    bh_dir dir = bh_dir_open((char *) folder);
+    if (dir == NULL) return 0;
+
+    *length = 0;
+    *hash   = FNV_OFFSET;
+
+    bh_dirent entry;
+    while (bh_dir_read(dir, &entry)) {
+        *hash = cache_hash_u32(*hash, entry.type);
+        *hash = cache_hash_string(*hash, entry.name);
+        *length += 1;
+    }
+
+    bh_dir_close(dir);
+    return 1;
+}
+
+static void cache_create_folder(const char *path) {
+    char buffer[512];
+    bh_snprintf(buffer, 511, "%s", path);
+
+    fori (i, 1, (i64) strlen(buffer)) {
+        if (buffer[i] != '/' && buffer[i] != '\\') continue;
+
+        char c = buffer[i];
+        buffer[i] = '\0';
+        cache_mkdir(buffer);
+        buffer[i] = c;
+    }
+
+    cache_mkdir(buffer);
+}
+
+b32 build_cache_enabled() {
+    CompileOptions *opts = context.options;
+    if (opts == NULL || opts->cache_dir == NULL) return 0;
+
+    if (opts->action != ONYX_COMPILE_ACTION_COMPILE && opts->action != ONYX_COMPILE_ACTION_RUN) return 0;
+
+    // These produce output other than the program.
+    if (opts->documentation_file || opts->generate_tag_file || opts->generate_symbol_info_file
+        || opts->print_function_mappings || opts->print_static_if_results || opts->running_perf || opts->trace_file) return 0;
+
+    // The data is output to a second file in this case.
+    if (opts->use_multi_threading && !opts->use_post_mvp_features) return 0;
+
+    return 1;
+}
+
+void build_cache_add_file(const char *filename) {
+    if (!build_cache_enabled()) return;
+
+    if (context.cache_files == NULL) bh_arr_new(global_heap_allocator, context.cache_files, 4);
+    bh_arr_push(context.cache_files, bh_strdup(global_heap_allocator, (char *) filename));
+}
+
+void build_cache_add_folder(const char *folder) {
+    if (!build_cache_enabled()) return;
+
+    if (context.cache_folders == NULL) bh_arr_new(global_heap_allocator, context.cache_folders, 4);
+    bh_arr_push(context.cache_folders, bh_strdup(global_heap_allocator, (char *) folder));
+}
+
+b32 build_cache_load(bh_buffer *program) {
+    if (!build_cache_enabled()) return 0;
+
+    u64 start_time = bh_time_curr();
+    context.cache_key = cache_key();
+
+    b32 valid = 0;
+    bh_file_contents entry = { 0 };
+    char *entry_path = cache_entry_path();
+
+    bh_file file;
+    if (bh_file_open(&file, entry_path) != BH_FILE_ERROR_NONE) goto done;
+
+    entry = bh_file_read_contents(global_heap_allocator, &file);
+    bh_file_close(&file);
+
+    u8 *curr = entry.data;
+    u8 *end  = curr + entry.length;
+
+    #define READ(type) (curr + sizeof(type) <= end ? (curr += sizeof(type), *(type *) (curr - sizeof(type))) : (curr = end + 1, (type) 0))
+
+    if (entry.length < 12 || memcmp(curr, BUILD_CACHE_MAGIC, 4)) goto done;
+    curr += 4;
+
+    if (READ(u32) != BUILD_CACHE_VERSION) goto done;
+
+    u32 dependency_count = READ(u32);
+    fori (i, 0, dependency_count) {
+        u32 kind        = READ(u32);
+        u32 path_length = READ(u32);
+        if (curr > end || path_length >= 512 || curr + path_length > end) goto done;
+
+        char path[512];
+        memcpy(path, curr, path_length);
+        path[path_length] = '\0';
+        curr += path_length;
+
+        u64 expected_length = READ(u64);
+        u64 expected_hash   = READ(u64);
+        if (curr > end) goto done;
+
+        u64 length, hash;
+        b32 found = kind == Cache_Dependency_Folder
+            ? cache_hash_folder(path, &length, &hash)
+            : cache_hash_file(path, &length, &hash);
+
+        if (!found || length != expected_length || hash != expected_hash) goto done;
+    }
+
+    u64 program_length = READ(u64);
+    if (curr > end || curr + program_length != end) goto done;
+
+    #undef READ
+
+    bh_buffer_init(program, global_heap_allocator, program_length);
+    bh_buffer_append(program, curr, program_length);
+    valid = 1;
+
+  done:
+    if (entry.data) bh_file_contents_free(&entry);
+
+    if (context.options->verbose_output > 0) {
+        if (valid) {
+            // TODO: Replace these with bh_printf when padded formatting is added.
+            printf("Loaded the program from the build cache: %s\n", entry_path);
+            printf("\nStatistics:\n");
+            printf("    Time taken: %lf ms (build cache hit)\n", (double) bh_time_duration(start_time));
+            printf("\n");
+        } else {
+            bh_printf("No usable entry in the build cache. Compiling the program.\n");
+        }
+    }
+
+    return valid;
+}
+
+static void cache_write_dependency(bh_buffer *buffer, CacheDependencyKind kind, const char *path, u64 length, u64 hash) {
+    bh_buffer_write_u32(buffer, kind);
+    bh_buffer_write_u32(buffer, strlen(path));
+    bh_buffer_append(buffer, path, strlen(path));
+    bh_buffer_write_u64(buffer, length);
+    bh_buffer_write_u64(buffer, hash);
+}
+
+void build_cache_store(bh_buffer program) {
+    if (!build_cache_enabled()) return;
+
+    bh_buffer buffer;
+    bh_buffer_init(&buffer, global_heap_allocator, program.length + 4096);
+    bh_buffer_append(&buffer, BUILD_CACHE_MAGIC, 4);
+    bh_buffer_write_u32(&buffer, BUILD_CACHE_VERSION);
+
+    u32 dependency_count = bh_arr_length(context.loaded_files)
+                         + bh_arr_length(context.cache_files)
+                         + bh_arr_length(context.cache_folders);
+    bh_buffer_write_u32(&buffer, dependency_count);
+
+    // The source files are hashed as they were compiled, not as they are now.
+    bh_arr_each(bh_file_contents, fc, context.loaded_files) {
+        u64 hash = cache_hash_bytes(FNV_OFFSET, fc->data, fc->length);
+        cache_write_dependency(&buffer, Cache_Dependency_File, fc->filename, fc->length, hash);
+    }
+
+    bh_arr_each(char *, filename, context.cache_files) {
+        u64 length, hash;
+        if (!cache_hash_file(*filename, &length, &hash)) goto done;
+
+        cache_write_dependency(&buffer, Cache_Dependency_File, *filename, length, hash);
+    }
+
+    bh_arr_each(char *, folder, context.cache_folders) {
+        u64 length, hash;
+        if (!cache_hash_folder(*folder, &length, &hash)) goto done;
+
+        cache_write_dependency(&buffer, Cache_Dependency_Folder, *folder, length, hash);
+    }
+
+    bh_buffer_write_u64(&buffer, program.length);
+    bh_buffer_append(&buffer, program.data, program.length);
+
+    cache_create_folder(context.options->cache_dir);
+
+    //
+    // The entry is written to a temporary file and then renamed into place, so
+    // a compilation running at the same time never reads a partial entry.
+    char *entry_path = cache_entry_path();
+    char *temp_path  = bh_aprintf(global_scratch_allocator, "%s.%d.tmp", entry_path, (i32) bh_time_curr_micro());
+
+    bh_file file;
+    if (bh_file_create(&file, temp_path) != BH_FILE_ERROR_NONE) goto done;
+
+    bh_file_write(&file, buffer.data, buffer.length);
+    bh_file_close(&file);
+
+    #ifdef _BH_WINDOWS
+    remove(entry_path); // rename does not replace files on Windows.
+    #endif
+
+    if (rename(temp_path, entry_path) != 0) {
+        remove(temp_path);
+        goto done;
+    }
+
+    if (context.options->verbose_output > 0) {
+        bh_printf("Stored the program in the build cache: %s\n", entry_path);
+    }
+
+  done:
+    bh_buffer_free(&buffer);
+}
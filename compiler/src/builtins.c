@@ -617,6 +617,10 @@ void introduce_build_options(bh_allocator a) {
     multi_threaded->type_node = (AstType *) &basic_type_bool;
     symbol_builtin_introduce(p->scope, "Multi_Threading_Enabled", (AstNode *) multi_threaded);
 
+    AstNumLit* post_mvp_features = make_int_literal(a, context.options->use_post_mvp_features);
+    post_mvp_features->type_node = (AstType *) &basic_type_bool;
+    symbol_builtin_introduce(p->scope, "Post_MVP_Features_Enabled", (AstNode *) post_mvp_features);
+
     AstNumLit* debug_mode = make_int_literal(a, context.options->debug_info_enabled);
     debug_mode->type_node = (AstType *) &basic_type_bool;
     symbol_builtin_introduce(p->scope, "Debug_Mode_Enabled", (AstNode *) debug_mode);
@@ -1083,6 +1083,7 @@ CheckStatus check_binaryop_assignment(AstBinaryOp** pbinop) {
         // the right hand side.
         if (binop->left->type == NULL) {
             if (binop->left->type_node != NULL && binop->left->entity && binop->left->entity->state <= Entity_State_Check_Types) {
+                entity_wait_on(binop->left->entity, Entity_State_Code_Gen);
                 YIELD(binop->token->pos, "Waiting for type to be constructed on left hand side.");
             }
 
@@ -1098,6 +1099,7 @@ CheckStatus check_binaryop_assignment(AstBinaryOp** pbinop) {
                     ERROR(binop->token->pos, "Could not resolve type of right hand side to infer.");
 
                 } else {
+                    entity_wait_on(binop->right->entity, Entity_State_Code_Gen);
                     YIELD(binop->token->pos, "Trying to resolve type of right hand side.");
                 }
             }
@@ -1171,6 +1173,7 @@ CheckStatus check_binaryop_assignment(AstBinaryOp** pbinop) {
 
     if (binop->right->type == NULL) {
         if (binop->right->entity != NULL && binop->right->entity->state <= Entity_State_Check_Types) {
+            entity_wait_on(binop->right->entity, Entity_State_Code_Gen);
             YIELD(binop->token->pos, "Trying to resolve type of right hand side.");
         }
     }
@@ -1437,9 +1440,11 @@ CheckStatus check_binaryop(AstBinaryOp** pbinop) {
     if (binop_is_assignment(binop->operation)) return check_binaryop_assignment(pbinop);
 
     if (binop->left->type == NULL && binop->left->entity && binop->left->entity->state <= Entity_State_Check_Types) {
+        entity_wait_on(binop->left->entity, Entity_State_Code_Gen);
         YIELD(binop->left->token->pos, "Waiting for this type to be known");
     }
     if (binop->right->type == NULL && binop->right->entity && binop->right->entity->state <= Entity_State_Check_Types) {
+        entity_wait_on(binop->right->entity, Entity_State_Code_Gen);
         YIELD(binop->right->token->pos, "Waiting for this type to be known");
     }
 
@@ -1755,6 +1760,7 @@ CheckStatus check_struct_literal(AstStructLiteral* sl) {
 
         CHECK(expression, actual);
         if ((*actual)->type == NULL && (*actual)->entity != NULL && (*actual)->entity->state <= Entity_State_Check_Types) {
+            entity_wait_on((*actual)->entity, Entity_State_Code_Gen);
             YIELD((*actual)->token->pos, "Trying to resolve type of expression for member.");
         }
 
@@ -1813,6 +1819,7 @@ CheckStatus check_array_literal(AstArrayLiteral* al) {
         if ((*expr)->type == NULL &&
             (*expr)->entity != NULL &&
             (*expr)->entity->state <= Entity_State_Check_Types) {
+            entity_wait_on((*expr)->entity, Entity_State_Code_Gen);
             YIELD_(al->token->pos, "Trying to resolve type of %d%s element of array literal.", expr - al->values, bh_num_suffix(expr - al->values));
         }
 
@@ -2387,6 +2394,7 @@ CheckStatus check_expression(AstTyped** pexpr) {
         case Ast_Kind_Block:    retval = check_block((AstBlock *) expr); break;
 
         case Ast_Kind_Symbol:
+            entity_wait_on_symbol(expr->token);
             YIELD_(expr->token->pos, "Waiting to resolve symbol, '%b'.", expr->token->text, expr->token->length);
             break;
 
@@ -2895,8 +2903,10 @@ CheckStatus check_block(AstBlock* block) {
 
 CheckStatus check_function(AstFunction* func) {
     if (func->flags & Ast_Flag_Has_Been_Checked) return Check_Success;
-    if (func->entity_header && func->entity_header->state < Entity_State_Code_Gen)
+    if (func->entity_header && func->entity_header->state < Entity_State_Code_Gen) {
+        entity_wait_on(func->entity_header, Entity_State_Code_Gen);
         YIELD(func->token->pos, "Waiting for procedure header to pass type-checking");
+    }
 
     bh_arr_clear(context.checker.expected_return_type_stack);
     bh_arr_push(context.checker.expected_return_type_stack, &func->type->Function.return_type);
@@ -3047,8 +3057,10 @@ CheckStatus check_meta_tags(bh_arr(AstTyped *) tags) {
 }
 
 CheckStatus check_struct(AstStructType* s_node) {
-    if (s_node->entity_defaults && s_node->entity_defaults->state < Entity_State_Check_Types)
+    if (s_node->entity_defaults && s_node->entity_defaults->state < Entity_State_Check_Types) {
+        entity_wait_on(s_node->entity_defaults, Entity_State_Check_Types);
         YIELD(s_node->token->pos, "Waiting for struct member defaults to pass symbol resolution.");
+    }
 
     if (s_node->min_size_)      CHECK(expression, &s_node->min_size_);
     if (s_node->min_alignment_) CHECK(expression, &s_node->min_alignment_);
@@ -3135,8 +3147,10 @@ CheckStatus check_struct(AstStructType* s_node) {
 }
 
 CheckStatus check_struct_defaults(AstStructType* s_node) {
-    if (s_node->entity_type && s_node->entity_type->state < Entity_State_Code_Gen)
+    if (s_node->entity_type && s_node->entity_type->state < Entity_State_Code_Gen) {
+        entity_wait_on(s_node->entity_type, Entity_State_Code_Gen);
         YIELD(s_node->token->pos, "Waiting for struct type to be constructed before checking defaulted members.");
+    }
     if (s_node->entity_type && s_node->entity_type->state == Entity_State_Failed)
         return Check_Failed;
 
@@ -3390,6 +3404,7 @@ CheckStatus check_memres(AstMemRes* memres) {
         } else {
             resolve_expression_type(memres->initial_value);
             if (memres->initial_value->type == NULL && memres->initial_value->entity != NULL && memres->initial_value->entity->state <= Entity_State_Check_Types) {
+                entity_wait_on(memres->initial_value->entity, Entity_State_Code_Gen);
                 YIELD(memres->token->pos, "Waiting for global type to be constructed.");
             }
             memres->type = memres->initial_value->type;
@@ -3397,6 +3412,7 @@ CheckStatus check_memres(AstMemRes* memres) {
 
         if ((memres->initial_value->flags & Ast_Flag_Comptime) == 0) {
             if (memres->initial_value->entity != NULL && memres->initial_value->entity->state <= Entity_State_Check_Types) {
+                entity_wait_on(memres->initial_value->entity, Entity_State_Code_Gen);
                 YIELD(memres->token->pos, "Waiting for initial value to be checked.");
             }
 
@@ -3557,8 +3573,10 @@ CheckStatus check_process_directive(AstNode* directive) {
     if (directive->kind == Ast_Kind_Directive_Export) {
         AstDirectiveExport *export = (AstDirectiveExport *) directive;
         AstTyped *exported = export->export;
-        if (exported->entity && exported->entity->state <= Entity_State_Check_Types)
+        if (exported->entity && exported->entity->state <= Entity_State_Check_Types) {
+            entity_wait_on(exported->entity, Entity_State_Code_Gen);
             YIELD(directive->token->pos, "Waiting for exported type to be known.");
+        }
 
         if (exported->kind != Ast_Kind_Function) {
             onyx_report_error(export->token->pos, Error_Critical, "Cannot export something that is not a procedure.");
@@ -83,6 +83,9 @@ Entity* entity_heap_register(EntityHeap* entities, Entity e) {
     entity->macro_attempts = 0;
     entity->micro_attempts = 0;
     entity->entered_in_queue = 0;
+    entity->parked = 0;
+    entity->waiting_on = NULL;
+    entity->waiters = NULL;
 
     return entity;
 }
@@ -185,6 +188,153 @@ void entity_heap_add_job(EntityHeap *entities, TypeMatch (*func)(void *), void *
     entity_heap_insert(entities, ent);
 }
 
+//
+// Instead of retrying an entity that yielded until it makes progress, the entity can
+// say what it is waiting on: another entity reaching a state, or a symbol that is not
+// introduced yet. It is then parked outside of the heap until that happens, and never
+// retried before.
+//
+void entity_wait_on(Entity *dependency, EntityState state) {
+    context.entities.blocked_on_entity   = dependency;
+    context.entities.blocked_until_state = state;
+    context.entities.blocked_on_symbol   = NULL;
+}
+
+void entity_wait_on_symbol(OnyxToken *symbol) {
+    context.entities.blocked_on_entity = NULL;
+    context.entities.blocked_on_symbol = symbol;
+}
+
+// Returns 1 if the entity was parked. Otherwise, it has to be put back in the heap.
+b32 entity_heap_park(EntityHeap* entities, Entity* e) {
+    Entity    *dependency = entities->blocked_on_entity;
+    EntityState state     = entities->blocked_until_state;
+    OnyxToken *symbol     = entities->blocked_on_symbol;
+    entities->blocked_on_entity = NULL;
+    entities->blocked_on_symbol = NULL;
+
+    if (entities->parking_disabled || e->entered_in_queue) return 0;
+    if (e->state != Entity_State_Resolve_Symbols && e->state != Entity_State_Check_Types) return 0;
+
+    if (dependency) {
+        if (dependency == e || dependency->state >= state) return 0;
+
+        if (dependency->waiters == NULL) bh_arr_new(global_heap_allocator, dependency->waiters, 4);
+        bh_arr_push(dependency->waiters, e);
+
+        e->waiting_on        = dependency;
+        e->waiting_for_state = state;
+
+    } else if (symbol) {
+        if (entities->symbol_waiters == NULL) sh_new_arena(entities->symbol_waiters);
+
+        token_toggle_end(symbol);
+        i32 index = shgeti(entities->symbol_waiters, symbol->text);
+        if (index == -1) {
+            bh_arr(Entity *) waiters = NULL;
+            bh_arr_new(global_heap_allocator, waiters, 4);
+            shput(entities->symbol_waiters, symbol->text, waiters);
+            index = shgeti(entities->symbol_waiters, symbol->text);
+        }
+
+        bh_arr_push(entities->symbol_waiters[index].value, e);
+        token_toggle_end(symbol);
+
+        e->waiting_on = NULL;
+
+    } else {
+        return 0;
+    }
+
+    if (entities->parked == NULL) bh_arr_new(global_heap_allocator, entities->parked, 128);
+    bh_arr_push(entities->parked, e);
+
+    e->parked = 1;
+    context.entities_parked++;
+    return 1;
+}
+
+static void entity_heap_unpark(EntityHeap* entities, Entity* e) {
+    e->parked = 0;
+    e->waiting_on = NULL;
+    entity_heap_insert_existing(entities, e);
+}
+
+// The same entity can be in more than one list of waiters, if it was woken up
+// some other way before. Only the entities that are still parked are woken.
+static i32 entity_heap_wake(EntityHeap* entities, bh_arr(Entity *) waiters) {
+    i32 woken = 0;
+    bh_arr_each(Entity *, pent, waiters) {
+        if (!(*pent)->parked) continue;
+
+        entity_heap_unpark(entities, *pent);
+        woken++;
+    }
+
+    return woken;
+}
+
+// Wakes the waiters that wait for the state the entity is in now. The rest stay
+// parked, and the entities that were woken some other way are dropped.
+void entity_heap_wake_waiters(EntityHeap* entities, Entity* e) {
+    if (bh_arr_length(e->waiters) == 0) return;
+
+    b32 failed = e->state == Entity_State_Failed;
+
+    i32 kept = 0;
+    bh_arr_each(Entity *, pent, e->waiters) {
+        Entity *waiter = *pent;
+        if (!waiter->parked || waiter->waiting_on != e) continue;
+
+        if (!failed && e->state < waiter->waiting_for_state) {
+            e->waiters[kept++] = waiter;
+            continue;
+        }
+
+        entity_heap_unpark(entities, waiter);
+    }
+
+    bh_arr_set_length(e->waiters, kept);
+}
+
+void entity_heap_wake_symbol_waiters(EntityHeap* entities, char* name) {
+    if (shlen(entities->symbol_waiters) == 0) return;
+
+    i32 index = shgeti(entities->symbol_waiters, name);
+    if (index == -1) return;
+
+    bh_arr(Entity *) waiters = entities->symbol_waiters[index].value;
+    shdel(entities->symbol_waiters, name);
+
+    entity_heap_wake(entities, waiters);
+    bh_arr_free(waiters);
+}
+
+// What a parked entity waits on might never happen, if it was the wrong thing to
+// wait on or there is a cycle. When nothing else can make progress, every parked
+// entity is put back in the heap, and parking is disabled until one of them makes
+// progress. That way, the cycle detection in onyx_compile works like it would
+// without parking.
+b32 entity_heap_wake_all_parked(EntityHeap* entities) {
+    if (bh_arr_length(entities->parked) == 0) return 0;
+
+    i32 woken = entity_heap_wake(entities, entities->parked);
+    bh_arr_clear(entities->parked);
+    if (woken == 0) return 0;
+
+    entities->parking_disabled = 1;
+    context.stalled_wakes++;
+    return 1;
+}
+
+b32 entity_heap_wake_if_stalled(EntityHeap* entities) {
+    if (bh_arr_length(entities->parked) == 0) return 0;
+    if (bh_arr_length(entities->quick_unsorted_entities) > 0) return 0;
+    if (bh_arr_length(entities->entities) > 0 && entity_phase(entities->entities[0]) < 3) return 0;
+
+    return entity_heap_wake_all_parked(entities);
+}
+
 // NOTE(Brendan Hansen): Uses the entity heap in the context structure
 void add_entities_for_node(bh_arr(Entity *) *target_arr, AstNode* node, Scope* scope, Package* package) {
 #define ENTITY_INSERT(_ent)                                     \
@@ -214,6 +364,11 @@ void add_entities_for_node(bh_arr(Entity *) *target_arr, AstNode* node, Scope* s
             ent.type = Entity_Type_Load_File;
             ent.include = (AstInclude *) node;
             ENTITY_INSERT(ent);
+
+            // Files behind a static if might never be loaded, so they are not preloaded.
+            if (node->kind == Ast_Kind_Load_File && target_arr == NULL) {
+                preload_included_file(ent.include);
+            }
             break;
         }
 
@@ -288,7 +288,8 @@ whitespace_skipped:
 
             if (*tokenizer->curr == '\n' && ch == '\'') {
                 tk.pos.length = (u16) len;
-                onyx_report_error(tk.pos, Error_Critical, "Character literal not terminated by end of line.");
+                if (tokenizer->defer_errors) tokenizer->had_error = 1;
+                else onyx_report_error(tk.pos, Error_Critical, "Character literal not terminated by end of line.");
                 break;
             }
 
@@ -301,7 +302,8 @@ whitespace_skipped:
 
             INCREMENT_CURR_TOKEN(tokenizer);
             if (tokenizer->curr == tokenizer->end) {
-                onyx_report_error(tk.pos, Error_Critical, "String literal not closed. String literal starts here.");
+                if (tokenizer->defer_errors) tokenizer->had_error = 1;
+                else onyx_report_error(tk.pos, Error_Critical, "String literal not closed. String literal starts here.");
                 break;
             }
         }
@@ -580,9 +582,6 @@ void onyx_lex_tokens(OnyxTokenizer* tokenizer) {
     do {
         tk = onyx_get_token(tokenizer);
     } while (tk->type != Token_Type_End_Stream);
-
-    context.lexer_lines_processed += tokenizer->line_number - 1;
-    context.lexer_tokens_processed += bh_arr_length(tokenizer->tokens);
 }
 
 b32 token_equals(OnyxToken* tkn1, OnyxToken* tkn2) {
@@ -18,6 +18,8 @@ extern struct bh_allocator global_heap_allocator;
 #include "utils.h"
 #include "wasm_emit.h"
 #include "doc.h"
+#include "build_cache.h"
+#include "trace.h"
 
 
 #define VERSION__(m,i,p) "v" #m "." #i "." #p
@@ -94,6 +96,11 @@ static const char *build_docstring = DOCSTRING_HEADER
     "\t                        Can drastically increase binary size.\n"
     "\t--generate-foreign-info Generate information for foreign blocks. Rarely needed, so disabled by default.\n"
     "\t--wasm-mvp              Use only WebAssembly MVP features.\n"
+    "\t-O                      Optimize the generated code. Has no effect when generating debug info.\n"
+    "\t-j <threads>            Read and lex source files on <threads> threads (default: 1).\n"
+    "\t                        With -O, the generated code is also optimized on <threads> threads.\n"
+    "\t--cache-dir <dir>       Store the compiled program in <dir>, and reuse it when the\n"
+    "\t                        same program is compiled again without changes.\n"
     "\t--feature <feature>     Enable an experimental language feature.\n"
     "\n"
     "Developer options:\n"
@@ -102,6 +109,15 @@ static const char *build_docstring = DOCSTRING_HEADER
     "\t--show-all-errors         Print all errors (can result in many consequencial errors from a single error)\n"
     "\t--print-function-mappings Prints a mapping from WASM function index to source location.\n"
     "\t--print-static-if-results Prints the conditional result of each #if statement. Useful for debugging.\n"
+    "\t--ovm-stats               Prints the most common pairs of executed OVM instructions on exit.\n"
+    "\t--ovm-no-superinstructions Disables fusing common OVM instruction sequences.\n"
+    "\t--ovm-jit                 Compiles frequently called functions to native code (x86-64 only).\n"
+    "\t                          With --ovm-stats, prints which functions were compiled.\n"
+    "\t--ovm-no-cache            Disables caching translated programs in ~/.cache/onyx/ovm.\n"
+    "\t--ovm-profile=<file>      Samples where the program spends its time, and writes the samples\n"
+    "\t                          to <file> in the collapsed stack format used by flamegraph tools.\n"
+    "\t--trace=<file>            Records every step of the compilation, and writes them to <file> in the\n"
+    "\t                          Chrome trace event format. Prints the slowest and most retried entities.\n"
     "\n";
 
 
@@ -147,6 +163,8 @@ static CompileOptions compile_opts_parse(bh_allocator alloc, int argc, char *arg
         .generate_lsp_info_file = 0,
 
         .running_perf = 0,
+        .optimize     = 0,
+        .thread_count = 1,
     };
 
     bh_arr_new(alloc, options.files, 2);
@@ -348,6 +366,35 @@ static CompileOptions compile_opts_parse(bh_allocator alloc, int argc, char *arg
             else if (!strcmp(argv[i], "--perf")) {
                 options.running_perf = 1;
             }
+            else if (!strcmp(argv[i], "-O")) {
+                options.optimize = 1;
+            }
+            else if (!strcmp(argv[i], "-j")) {
+                options.thread_count = atoi(argv[++i]);
+            }
+            else if (!strcmp(argv[i], "--cache-dir")) {
+                options.cache_dir = argv[++i];
+            }
+            else if (!strcmp(argv[i], "--ovm-stats")) {
+                options.ovm_instr_stats = 1;
+            }
+            else if (!strcmp(argv[i], "--ovm-no-superinstructions")) {
+                options.ovm_no_superinstructions = 1;
+            }
+            else if (!strcmp(argv[i], "--ovm-jit")) {
+                options.ovm_jit = 1;
+            }
+            else if (!strcmp(argv[i], "--ovm-no-cache")) {
+                options.ovm_no_cache = 1;
+            }
+            else if (!strncmp(argv[i], "--ovm-profile=", 14)) {
+                // Function names and line numbers come from the debug info.
+                options.ovm_profile_path = argv[i] + 14;
+                options.debug_info_enabled = 1;
+            }
+            else if (!strncmp(argv[i], "--trace=", 8)) {
+                options.trace_file = argv[i] + 8;
+            }
             else if (!strcmp(argv[i], "--")) {
                 options.passthrough_argument_count = argc - i - 1;
                 options.passthrough_argument_data  = &argv[i + 1];
@@ -465,6 +512,9 @@ static Entity *runtime_info_proc_tags_entity;
 static Entity *runtime_info_global_tags_entity;
 static Entity *runtime_info_stack_trace_entity;
 
+static void preloader_start(i32 thread_count);
+static void preloader_stop();
+
 static void context_init(CompileOptions* opts) {
     memset(&context, 0, sizeof context);
 
@@ -491,6 +541,10 @@ static void context_init(CompileOptions* opts) {
 
     onyx_errors_init(&context.loaded_files);
 
+    trace_begin();
+
+    if (opts->thread_count > 1) preloader_start(opts->thread_count - 1);
+
     context.token_alloc = global_heap_allocator;
 
     // NOTE: Create the arena where tokens and AST nodes will exist
@@ -605,20 +659,392 @@ static void context_init(CompileOptions* opts) {
 }
 
 static void context_free() {
+    preloader_stop();
+
     bh_arena_free(&context.ast_arena);
     bh_arr_free(context.loaded_files);
 }
 
-static void parse_source_file(bh_file_contents* file_contents) {
-    // :Remove passing the allocators as parameters
-    OnyxTokenizer tokenizer = onyx_tokenizer_create(context.token_alloc, file_contents);
-    onyx_lex_tokens(&tokenizer);
+static char* lookup_included_file(AstInclude* include, char* name) {
+    // :RelativeFiles
+    const char* parent_file = include->token->pos.filename;
+    if (parent_file == NULL) parent_file = ".";
+
+    char* parent_folder = bh_path_get_parent(parent_file, global_scratch_allocator);
+
+    return bh_lookup_file(name, parent_folder, ".onyx", 1, context.options->included_folders, 1);
+}
+
+
+//
+// Lexed files
+//
+// A LexedFile is a source file that was read and lexed outside of the compilation's
+// allocators, so it can be done on another thread or kept between compilations.
+// Everything in it comes from the (thread-safe) C heap.
+//
+typedef enum LexState {
+    Lex_Queued,
+    Lex_Started,
+    Lex_Done,
+} LexState;
+
+typedef struct LexedFile {
+    char *filename;
+    LexState state;
+    b32 failed : 1;
+    b32 cached : 1; // Owned by the source cache.
+
+    bh_file_contents contents;
+    OnyxTokenizer tokenizer;
+} LexedFile;
+
+static LexedFile *lexed_file_new(char *filename) {
+    LexedFile *file = bh_alloc_item(bh_heap_allocator(), LexedFile);
+    memset(file, 0, sizeof *file);
+    file->filename = bh_strdup(bh_heap_allocator(), filename);
+    return file;
+}
+
+static void lexed_file_free(LexedFile *file) {
+    if (file->contents.data) bh_file_contents_free(&file->contents);
+    if (file->contents.filename) bh_free(bh_heap_allocator(), (char *) file->contents.filename);
+    if (file->tokenizer.tokens) onyx_tokenizer_free(&file->tokenizer);
+    bh_free(bh_heap_allocator(), file->filename);
+    bh_free(bh_heap_allocator(), file);
+}
+
+static void lex_file(LexedFile *file) {
+    u64 start = bh_time_curr_micro();
+
+    bh_file f;
+    if (bh_file_open(&f, file->filename) != BH_FILE_ERROR_NONE) {
+        file->failed = 1;
+        return;
+    }
+
+    file->contents = bh_file_read_contents(bh_heap_allocator(), &f);
+    bh_file_close(&f);
+
+    file->tokenizer = onyx_tokenizer_create(bh_heap_allocator(), &file->contents);
+    file->tokenizer.defer_errors = 1;
+    onyx_lex_tokens(&file->tokenizer);
+
+    // The file will be lexed again normally to report the error.
+    if (file->tokenizer.had_error) file->failed = 1;
+
+    trace_phase("Lex", file->filename, start);
+}
+
+
+//
+// Source cache
+//
+// `onyx watch` keeps the lexed source files between compilations, so a file whose
+// contents did not change is not read into a new buffer and lexed again. It also
+// makes it possible to tell when a file was written without being changed.
+//
+// Nothing after lexing is kept. Symbol resolution and type checking change the
+// AST and the global type table in place, so they are redone on every change.
+//
+// The cache outlives the global heap allocator, so it cannot be a stb_ds table.
+// It only holds a few hundred files, so it is searched linearly.
+//
+static b32 source_cache_enabled = 0;
+static bh_arr(LexedFile *) source_cache;
+
+static i32 source_cache_index(char *filename) {
+    bh_arr_each(LexedFile *, file, source_cache) {
+        if (!strcmp((*file)->filename, filename)) return file - source_cache;
+    }
+
+    return -1;
+}
+
+static b32 source_cache_file_is_current(LexedFile *file) {
+    bh_file f;
+    if (bh_file_open(&f, file->filename) != BH_FILE_ERROR_NONE) return 0;
+
+    b32 is_current = 0;
+    if (bh_file_size(&f) == file->contents.length) {
+        bh_file_contents current = bh_file_read_contents(bh_heap_allocator(), &f);
+        is_current = current.length == file->contents.length
+                  && (current.length == 0 || !memcmp(current.data, file->contents.data, current.length));
+
+        if (current.data) bh_file_contents_free(&current);
+        bh_free(bh_heap_allocator(), (char *) current.filename);
+    }
+
+    bh_file_close(&f);
+    return is_current;
+}
+
+//
+// Returns the cached file, if the file on disk has not changed since it was lexed.
+static LexedFile *source_cache_lookup(char *filename) {
+    if (!source_cache_enabled) return NULL;
+
+    i32 index = source_cache_index(filename);
+    if (index == -1) return NULL;
+
+    LexedFile *file = source_cache[index];
+    if (source_cache_file_is_current(file)) return file;
+
+    bh_arr_fastdelete(source_cache, index);
+    lexed_file_free(file);
+    return NULL;
+}
+
+static void source_cache_add(LexedFile *file) {
+    if (!source_cache_enabled || file->cached) return;
+
+    if (source_cache == NULL) bh_arr_new(bh_heap_allocator(), source_cache, 128);
+
+    file->cached = 1;
+    bh_arr_push(source_cache, file);
+}
+
+static b32 source_cache_has_changes(bh_arr(char *) filenames) {
+    bh_arr_each(char *, filename, filenames) {
+        i32 index = source_cache_index(*filename);
+        if (index == -1) return 1;
+
+        if (!source_cache_file_is_current(source_cache[index])) return 1;
+    }
+
+    return 0;
+}
+
+static void source_cache_free() {
+    bh_arr_each(LexedFile *, file, source_cache) lexed_file_free(*file);
+    bh_arr_free(source_cache);
+}
+
+
+//
+// File preloading
+//
+// With -j, source files are read and lexed on other threads as soon as a #load
+// of them is found, so they are usually ready by the time their Load_File entity
+// is processed. Parsing stays on the main thread, because it creates packages,
+// scopes and entities.
+//
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+
+typedef struct Preloader {
+    pthread_mutex_t mutex;
+    pthread_cond_t  work_available;
+    pthread_cond_t  work_done;
+    b32 stopping;
+
+    bh_arr(pthread_t) threads;
+
+    // Only accessed with the mutex held.
+    bh_arr(LexedFile *) queue;
+    i32 next_in_queue;
+
+    // Only accessed from the main thread.
+    Table(LexedFile *) files;
+} Preloader;
+
+static Preloader preloader;
+
+static void *preloader_thread(void *data) {
+    Preloader *p = data;
+
+    pthread_mutex_lock(&p->mutex);
+    while (1) {
+        while (!p->stopping && p->next_in_queue >= bh_arr_length(p->queue)) {
+            pthread_cond_wait(&p->work_available, &p->mutex);
+        }
+
+        if (p->stopping) break;
+
+        LexedFile *file = p->queue[p->next_in_queue++];
+        if (file->state != Lex_Queued) continue;
+        file->state = Lex_Started;
+
+        pthread_mutex_unlock(&p->mutex);
+        lex_file(file);
+        pthread_mutex_lock(&p->mutex);
+
+        file->state = Lex_Done;
+        pthread_cond_broadcast(&p->work_done);
+    }
+    pthread_mutex_unlock(&p->mutex);
+
+    return NULL;
+}
+
+static void preloader_start(i32 thread_count) {
+    Preloader *p = &preloader;
+    memset(p, 0, sizeof *p);
+
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->work_available, NULL);
+    pthread_cond_init(&p->work_done, NULL);
+
+    bh_arr_new(bh_heap_allocator(), p->queue, 128);
+    bh_arr_new(bh_heap_allocator(), p->threads, thread_count);
+
+    fori (i, 0, thread_count) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, preloader_thread, p) == 0) {
+            bh_arr_push(p->threads, thread);
+        }
+    }
+}
+
+static void preloader_stop() {
+    Preloader *p = &preloader;
+    if (p->threads == NULL) return;
+
+    pthread_mutex_lock(&p->mutex);
+    p->stopping = 1;
+    pthread_cond_broadcast(&p->work_available);
+    pthread_mutex_unlock(&p->mutex);
+
+    bh_arr_each(pthread_t, thread, p->threads) pthread_join(*thread, NULL);
+
+    bh_arr_each(LexedFile *, file, p->queue) {
+        if (!(*file)->cached) lexed_file_free(*file);
+    }
+
+    bh_arr_free(p->queue);
+    bh_arr_free(p->threads);
+    shfree(p->files);
+
+    pthread_mutex_destroy(&p->mutex);
+    pthread_cond_destroy(&p->work_available);
+    pthread_cond_destroy(&p->work_done);
+
+    memset(p, 0, sizeof *p);
+}
+
+void preload_included_file(AstInclude *include) {
+    Preloader *p = &preloader;
+    if (p->threads == NULL) return;
+
+    char *name = include->name;
+    if (name == NULL) {
+        // The name is only known this early if it is a string literal.
+        AstTyped *name_node = include->name_node;
+        if (name_node == NULL || name_node->kind != Ast_Kind_StrLit || name_node->token == NULL) return;
+
+        token_toggle_end(name_node->token);
+        name = bh_strdup(global_scratch_allocator, name_node->token->text);
+        string_process_escape_seqs(name, name, strlen(name));
+        token_toggle_end(name_node->token);
+    }
+
+    char *filename = lookup_included_file(include, name);
+    if (shgeti(p->files, filename) != -1) return;
+    if (source_cache_enabled && source_cache_index(filename) != -1) return;
+
+    bh_arr_each(bh_file_contents, fc, context.loaded_files) {
+        if (!strcmp(fc->filename, filename)) return;
+    }
+
+    LexedFile *file = lexed_file_new(filename);
+    shput(p->files, file->filename, file);
+
+    pthread_mutex_lock(&p->mutex);
+    bh_arr_push(p->queue, file);
+    pthread_cond_signal(&p->work_available);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+//
+// Returns the preloaded file, waiting for it if it is still being worked on.
+// Returns NULL if the file was not preloaded, or if it has to be loaded normally.
+static LexedFile *preloader_take(char *filename) {
+    Preloader *p = &preloader;
+    if (p->threads == NULL) return NULL;
+
+    i32 index = shgeti(p->files, filename);
+    if (index == -1) return NULL;
+
+    LexedFile *file = p->files[index].value;
+
+    pthread_mutex_lock(&p->mutex);
+    if (file->state == Lex_Queued) {
+        // No thread has gotten to this file yet, so it is quicker to do it here.
+        file->state = Lex_Started;
+
+        pthread_mutex_unlock(&p->mutex);
+        lex_file(file);
+        pthread_mutex_lock(&p->mutex);
+
+        file->state = Lex_Done;
+    }
+
+    while (file->state != Lex_Done) {
+        pthread_cond_wait(&p->work_done, &p->mutex);
+    }
+    pthread_mutex_unlock(&p->mutex);
+
+    if (file->failed) return NULL;
+    return file;
+}
+
+#else
+
+static void preloader_start(i32 thread_count) {}
+static void preloader_stop() {}
+void preload_included_file(AstInclude *include) {}
+static LexedFile *preloader_take(char *filename) { return NULL; }
+
+#endif
+
+
+static void parse_source_file(bh_file_contents* file_contents, OnyxTokenizer* tokenizer) {
+    OnyxTokenizer local_tokenizer;
+    if (tokenizer == NULL) {
+        u64 lex_start = bh_time_curr_micro();
+
+        // :Remove passing the allocators as parameters
+        local_tokenizer = onyx_tokenizer_create(context.token_alloc, file_contents);
+        onyx_lex_tokens(&local_tokenizer);
+        tokenizer = &local_tokenizer;
 
-    file_contents->line_count = tokenizer.line_number;
+        trace_phase("Lex", file_contents->filename, lex_start);
+    }
+
+    file_contents->line_count = tokenizer->line_number;
+
+    context.lexer_lines_processed += tokenizer->line_number - 1;
+    context.lexer_tokens_processed += bh_arr_length(tokenizer->tokens);
 
-    OnyxParser parser = onyx_parser_create(context.ast_alloc, &tokenizer);
+    u64 parse_start = bh_time_curr_micro();
+
+    OnyxParser parser = onyx_parser_create(context.ast_alloc, tokenizer);
     onyx_parse(&parser);
     onyx_parser_free(&parser);
+
+    trace_phase("Parse", file_contents->filename, parse_start);
+}
+
+static LexedFile *get_lexed_file(char *filename) {
+    LexedFile *file = source_cache_lookup(filename);
+    if (file != NULL) {
+        context.lexer_files_reused += 1;
+        return file;
+    }
+
+    file = preloader_take(filename);
+
+    if (file == NULL && source_cache_enabled) {
+        file = lexed_file_new(filename);
+        lex_file(file);
+
+        if (file->failed) {
+            lexed_file_free(file);
+            return NULL;
+        }
+    }
+
+    if (file != NULL) source_cache_add(file);
+    return file;
 }
 
 static b32 process_source_file(char* filename, OnyxFilePos error_pos) {
@@ -628,6 +1054,17 @@ static b32 process_source_file(char* filename, OnyxFilePos error_pos) {
         if (!strcmp(fc->filename, filename)) return 1;
     }
 
+    LexedFile *lexed = get_lexed_file(filename);
+    if (lexed != NULL) {
+        bh_arr_push(context.loaded_files, lexed->contents);
+
+        if (context.options->verbose_output == 2)
+            bh_printf("Processing source file:    %s (%d bytes)\n", filename, lexed->contents.length);
+
+        parse_source_file(&bh_arr_last(context.loaded_files), &lexed->tokenizer);
+        return 1;
+    }
+
     bh_file file;
     bh_file_error err = bh_file_open(&file, filename);
     if (err != BH_FILE_ERROR_NONE) {
@@ -645,7 +1082,7 @@ static b32 process_source_file(char* filename, OnyxFilePos error_pos) {
     if (context.options->verbose_output == 2)
         bh_printf("Processing source file:    %s (%d bytes)\n", file.filename, fc.length);
 
-    parse_source_file(&bh_arr_last(context.loaded_files));
+    parse_source_file(&bh_arr_last(context.loaded_files), NULL);
     return 1;
 }
 
@@ -654,13 +1091,7 @@ static b32 process_load_entity(Entity* ent) {
     AstInclude* include = ent->include;
 
     if (include->kind == Ast_Kind_Load_File) {
-        // :RelativeFiles
-        const char* parent_file = include->token->pos.filename;
-        if (parent_file == NULL) parent_file = ".";
-
-        char* parent_folder = bh_path_get_parent(parent_file, global_scratch_allocator);
-
-        char* filename = bh_lookup_file(include->name, parent_folder, ".onyx", 1, context.options->included_folders, 1);
+        char* filename = lookup_included_file(include, include->name);
         char* formatted_name = bh_strdup(global_heap_allocator, filename);
 
         return process_source_file(formatted_name, include->token->pos);
@@ -693,6 +1124,8 @@ static b32 process_load_entity(Entity* ent) {
                 return 0;
             }
 
+            build_cache_add_folder(folder);
+
             bh_dirent entry;
             char fullpath[512];
             while (bh_dir_read(dir, &entry)) {
@@ -757,6 +1190,9 @@ static b32 process_entity(Entity* ent) {
                    (u32) ent->micro_attempts);
     }
 
+    context.entities.blocked_on_entity = NULL;
+    context.entities.blocked_on_symbol = NULL;
+
     EntityState before_state = ent->state;
     switch (before_state) {
         case Entity_State_Error:
@@ -898,7 +1334,7 @@ static i32 onyx_compile() {
     if (context.options->fun_output)
         printf("\e[2J");
 
-    while (!bh_arr_is_empty(context.entities.entities)) {
+    while (entity_heap_wake_if_stalled(&context.entities) || !bh_arr_is_empty(context.entities.entities)) {
         Entity* ent = entity_heap_top(&context.entities);
 
 #if defined(_BH_LINUX)
@@ -935,16 +1371,23 @@ static i32 onyx_compile() {
         onyx_errors_enable();
         entity_heap_remove_top(&context.entities);
 
-        u64 perf_start;
-        EntityType perf_entity_type;
-        EntityState perf_entity_state;
-        if (context.options->running_perf) {
+        u64 perf_start = 0;
+        EntityType perf_entity_type = ent->type;
+        EntityState perf_entity_state = ent->state;
+        if (context.options->running_perf || trace_enabled()) {
             perf_start = bh_time_curr_micro();
-            perf_entity_type = ent->type;
-            perf_entity_state = ent->state;
         }
 
         b32 changed = process_entity(ent);
+        trace_entity_pass(ent, perf_entity_state, perf_start);
+
+        if (changed) {
+            context.productive_entity_passes++;
+            context.entities.parking_disabled = 0;
+            entity_heap_wake_waiters(&context.entities, ent);
+        } else {
+            context.useless_entity_passes++;
+        }
 
         // NOTE: VERY VERY dumb cycle breaking. Basically, remember the first entity that did
         // not change (i.e. did not make any progress). Then everytime an entity doesn't change,
@@ -968,7 +1411,12 @@ static i32 onyx_compile() {
                 if (ent->macro_attempts > highest_watermark) {
                     entity_heap_insert_existing(&context.entities, ent);
 
-                    if (context.cycle_almost_detected == 3) {
+                    // The parked entities have not been retried, so they have to be
+                    // before it can be said that nothing can make progress.
+                    if (entity_heap_wake_all_parked(&context.entities)) {
+                        context.cycle_almost_detected = 0;
+
+                    } else if (context.cycle_almost_detected == 3) {
                         dump_cycles();
                     } else {
                         context.cycle_almost_detected += 1;
@@ -989,8 +1437,10 @@ static i32 onyx_compile() {
             return ONYX_COMPILER_PROGRESS_ERROR;
         }
 
-        if (ent->state != Entity_State_Finalized && ent->state != Entity_State_Failed)
-            entity_heap_insert_existing(&context.entities, ent);
+        if (ent->state != Entity_State_Finalized && ent->state != Entity_State_Failed) {
+            if (changed || !entity_heap_park(&context.entities, ent))
+                entity_heap_insert_existing(&context.entities, ent);
+        }
 
         if (context.options->running_perf) {
             u64 perf_end = bh_time_curr_micro();
@@ -1013,6 +1463,9 @@ static i32 onyx_compile() {
         printf("    Time taken: %lf ms\n", (double) duration);
         printf("    Processed %llu lines (%f lines/second).\n", context.lexer_lines_processed, ((f32) 1000 * context.lexer_lines_processed) / (duration));
         printf("    Processed %llu tokens (%f tokens/second).\n", context.lexer_tokens_processed, ((f32) 1000 * context.lexer_tokens_processed) / (duration));
+        if (source_cache_enabled) {
+            printf("    Reused %llu unchanged source files.\n", context.lexer_files_reused);
+        }
         printf("\n");
     }
 
@@ -1037,6 +1490,11 @@ static i32 onyx_compile() {
             printf("| %27s | %10lu us |\n", entity_type_strings[i], context.microseconds_per_type[i]);
         }
         printf("\n");
+        printf("| %27s | %13lu |\n", "Productive entity passes", context.productive_entity_passes);
+        printf("| %27s | %13lu |\n", "Useless entity passes", context.useless_entity_passes);
+        printf("| %27s | %13lu |\n", "Entities parked", context.entities_parked);
+        printf("| %27s | %13lu |\n", "Wakes after stalling", context.stalled_wakes);
+        printf("\n");
     }
 
     return ONYX_COMPILER_PROGRESS_SUCCESS;
@@ -1055,11 +1513,13 @@ static void link_wasm_module() {
     // CLEANUP: Properly handle this case.
     assert(onyx_wasm_build_link_options_from_node(&link_opts, link_options_node));
 
+    u64 start = bh_time_curr_micro();
     onyx_wasm_module_link(context.wasm_module, &link_opts);
+    trace_phase("Link", NULL, start);
 }
 
 static CompilerProgress onyx_flush_module() {
-    link_wasm_module();
+    if (context.cached_program.data == NULL) link_wasm_module();
 
     // NOTE: Output to file
     bh_file output_file;
@@ -1079,7 +1539,10 @@ static CompilerProgress onyx_flush_module() {
     // to be fine since the browser is really the only place that multi-threading can be used to any
     // degree of competency. But still... This is god awful and I hope that there is some other way to
     // around this down the line.
-    if (context.options->use_multi_threading && !context.options->use_post_mvp_features) {
+    if (context.cached_program.data != NULL) {
+        bh_file_write(&output_file, context.cached_program.data, context.cached_program.length);
+
+    } else if (context.options->use_multi_threading && !context.options->use_post_mvp_features) {
         bh_file data_file;
         if (bh_file_create(&data_file, bh_aprintf(global_scratch_allocator, "%s.data", context.options->target_file)) != BH_FILE_ERROR_NONE)
             return ONYX_COMPILER_PROGRESS_FAILED_OUTPUT;
@@ -1095,7 +1558,15 @@ static CompilerProgress onyx_flush_module() {
 
         bh_file_close(&data_file);
     } else {
-        onyx_wasm_module_write_to_file(context.wasm_module, output_file);
+        u64 start = bh_time_curr_micro();
+
+        bh_buffer code_buffer;
+        onyx_wasm_module_write_to_buffer(context.wasm_module, &code_buffer);
+        trace_phase("Output", NULL, start);
+
+        build_cache_store(code_buffer);
+
+        bh_file_write(&output_file, code_buffer.data, code_buffer.length);
     }
 
     bh_file_close(&output_file);
@@ -1105,7 +1576,14 @@ static CompilerProgress onyx_flush_module() {
 
 #ifdef ONYX_RUNTIME_LIBRARY
 static b32 onyx_run_module(bh_buffer code_buffer) {
-    onyx_run_initialize(context.options->debug_session);
+    OnyxRunOptions run_options = { 0 };
+    run_options.debug_enabled = context.options->debug_session;
+    run_options.ovm_instr_stats = context.options->ovm_instr_stats;
+    run_options.ovm_no_superinstructions = context.options->ovm_no_superinstructions;
+    run_options.ovm_jit = context.options->ovm_jit;
+    run_options.ovm_no_cache = context.options->ovm_no_cache;
+    run_options.ovm_profile_path = context.options->ovm_profile_path;
+    onyx_run_initialize(&run_options);
 
     if (context.options->verbose_output > 0)
         bh_printf("Running program:\n");
@@ -1124,10 +1602,22 @@ static b32 onyx_run_wasm_file(const char *filename) {
 }
 
 static b32 onyx_run() {
+    if (context.cached_program.data != NULL) {
+        return onyx_run_module(context.cached_program);
+    }
+
     link_wasm_module();
 
+    u64 start = bh_time_curr_micro();
+
     bh_buffer code_buffer;
     onyx_wasm_module_write_to_buffer(context.wasm_module, &code_buffer);
+    trace_phase("Output", NULL, start);
+
+    build_cache_store(code_buffer);
+
+    // The trace is written before running, so it only has the compilation in it.
+    trace_end();
 
     return onyx_run_module(code_buffer);
 
@@ -1145,10 +1635,15 @@ CompilerProgress do_compilation(CompileOptions *compile_opts) {
     // global_heap_allocator = bh_heap_allocator();
     context_init(compile_opts);
 
+    if (build_cache_load(&context.cached_program)) {
+        return ONYX_COMPILER_PROGRESS_SUCCESS;
+    }
+
     return onyx_compile();
 }
 
 void cleanup_compilation() {
+    trace_end();
     context_free();
 
     bh_scratch_free(&global_scratch);
@@ -1169,6 +1664,10 @@ static void onyx_watch(CompileOptions *compile_opts) {
     signal(SIGINT, onyx_watch_stop);
 
     b32 running_watch = 1;
+    source_cache_enabled = 1;
+
+    bh_arr(char *) watched_files = NULL;
+    bh_arr_new(bh_heap_allocator(), watched_files, 64);
 
     do {
         bh_printf("\e[2J\e[?25l\n");
@@ -1191,21 +1690,39 @@ static void onyx_watch(CompileOptions *compile_opts) {
             bh_printf("\e[30;101m Error%s %d \e[0m", bh_num_plural(errors), errors);
         }
 
-        watches = bh_file_watch_new();
+        bh_arr_each(char *, filename, watched_files) bh_free(bh_heap_allocator(), *filename);
+        bh_arr_clear(watched_files);
 
         bh_arr_each(bh_file_contents, file, context.loaded_files) {
-            bh_file_watch_add(&watches, file->filename);
+            bh_arr_push(watched_files, bh_strdup(bh_heap_allocator(), (char *) file->filename));
         }
 
         cleanup_compilation();
 
-        if (!bh_file_watch_wait(&watches)) {
-            running_watch = 0;
+        watches = bh_file_watch_new();
+        bh_arr_each(char *, filename, watched_files) bh_file_watch_add(&watches, *filename);
+
+        // Files are often written without being changed, so wait until
+        // one of them actually changed before recompiling.
+        while (1) {
+            if (!bh_file_watch_wait(&watches)) {
+                running_watch = 0;
+                break;
+            }
+
+            bh_file_watch_free(&watches);
+            watches = bh_file_watch_new();
+            bh_arr_each(char *, filename, watched_files) bh_file_watch_add(&watches, *filename);
+
+            if (source_cache_has_changes(watched_files)) break;
         }
 
         bh_file_watch_free(&watches);
     } while(running_watch);
 
+    bh_arr_each(char *, filename, watched_files) bh_free(bh_heap_allocator(), *filename);
+    bh_arr_free(watched_files);
+    source_cache_free();
 
     bh_printf("\e[2J\e[1;1H\e[?25h\n");
 }
@@ -23,7 +23,9 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    onyx_run_initialize(debug);
+    OnyxRunOptions run_options = { 0 };
+    run_options.debug_enabled = debug;
+    onyx_run_initialize(&run_options);
 
     bh_file wasm_file;
     bh_file_error err = bh_file_open(&wasm_file, argv[wasm_file_idx]);
@@ -3050,6 +3050,14 @@ static AstFunction* parse_function_definition(OnyxParser* parser, OnyxToken* tok
             func_def->deprecated_warning = (AstStrLit *) parse_expression(parser, 0);
         }
 
+        else if (parse_possible_directive(parser, "inline")) {
+            func_def->is_inline = 1;
+        }
+
+        else if (parse_possible_directive(parser, "no_inline")) {
+            func_def->is_no_inline = 1;
+        }
+
         else {
             OnyxToken* directive_token = expect_token(parser, '#');
             OnyxToken* symbol_token = expect_token(parser, Token_Type_Symbol);
@@ -3058,6 +3066,10 @@ static AstFunction* parse_function_definition(OnyxParser* parser, OnyxToken* tok
         }
     }
 
+    if (func_def->is_inline && func_def->is_no_inline) {
+        onyx_report_error(func_def->token->pos, Error_Critical, "A procedure cannot be both '#inline' and '#no_inline'.");
+    }
+
     func_def->body = parse_block(parser, 1, name);
 
     // :LinearTokenDependent
@@ -20,8 +20,127 @@ static b32 doing_nested_polymorph_lookup = 0;
 AstTyped node_that_signals_a_yield = { Ast_Kind_Function, 0 };
 AstTyped node_that_signals_failure = { Ast_Kind_Error, 0 };
 
+//
+// Polymorphic Instantiation Cache
+//
+// The key of a set of solutions is three numbers per solution: a hash of the name of the
+// polymorphic variable, the kind of the solution, and what it was solved to. Types are
+// unique, so a type is keyed by its id. Number literals are keyed by their value, and
+// other values by their pointer.
+#define POLY_CACHE_MAX_SOLUTIONS 64
+
+typedef struct PolyCacheKey {
+    u64 hash;
+    u32 length;
+    u64 data[3 * POLY_CACHE_MAX_SOLUTIONS];
+} PolyCacheKey;
+
+typedef enum PolyCacheKeyKind {
+    Poly_Cache_Key_Type,
+    Poly_Cache_Key_NumLit,
+    Poly_Cache_Key_Value,
+} PolyCacheKeyKind;
+
+static u64 poly_cache_mix(u64 hash, u64 value) {
+    hash = (hash ^ value) * 0x100000001b3ull;
+    return hash ^ (hash >> 29);
+}
+
+static void build_poly_cache_key(PolyCacheKey *key, bh_arr(AstPolySolution) slns) {
+    key->hash = 0xcbf29ce484222325ull;
+    key->length = 0;
+
+    bh_arr_each(AstPolySolution, sln, slns) {
+        // NOTE: This should never happen, as no polymorphic thing has this many variables.
+        // If it does, the remaining solutions are only part of the hash.
+        b32 has_room = key->length < 3 * POLY_CACHE_MAX_SOLUTIONS;
+
+        OnyxToken *name = sln->poly_sym->token;
+        u64 name_hash = 0xcbf29ce484222325ull;
+        fori (i, 0, name->length) name_hash = (name_hash ^ (u8) name->text[i]) * 0x100000001b3ull;
+
+        u64 kind = Poly_Cache_Key_Value;
+        u64 payload = 0;
+        if (sln->kind == PSK_Type) {
+            kind = Poly_Cache_Key_Type;
+            payload = sln->type ? sln->type->id : 0;
+
+        } else if (sln->kind == PSK_Value) {
+            if (sln->value->kind == Ast_Kind_NumLit) {
+                kind = Poly_Cache_Key_NumLit;
+                payload = ((AstNumLit *) sln->value)->value.l;
+
+            } else {
+                // HACK: For now, the value pointer is just used. This means that
+                // sometimes, even through the solution is the same, it won't be
+                // stored the same.
+                payload = (u64) sln->value;
+            }
+        }
+
+        key->hash = poly_cache_mix(key->hash, name_hash);
+        key->hash = poly_cache_mix(key->hash, kind);
+        key->hash = poly_cache_mix(key->hash, payload);
+
+        if (has_room) {
+            key->data[key->length++] = name_hash;
+            key->data[key->length++] = kind;
+            key->data[key->length++] = payload;
+        }
+    }
+}
+
+static PolyCache *poly_cache_new() {
+    PolyCache *cache = bh_alloc_item(context.ast_alloc, PolyCache);
+    memset(cache, 0, sizeof(PolyCache));
+
+    bh_imap_init(&cache->lookup, global_heap_allocator, 31);
+    bh_arr_new(global_heap_allocator, cache->keys, 12);
+    bh_arr_new(global_heap_allocator, cache->entries, 4);
+    return cache;
+}
+
+static PolyCacheEntry *poly_cache_find(PolyCache *cache, PolyCacheKey *key) {
+    i32 index = (i32) bh_imap_get(&cache->lookup, key->hash) - 1;
+    while (index >= 0) {
+        PolyCacheEntry *entry = &cache->entries[index];
+        if (entry->key_length == key->length
+            && !memcmp(&cache->keys[entry->key_start], key->data, key->length * sizeof(u64))) {
+            return entry;
+        }
+
+        index = entry->next;
+    }
+
+    return NULL;
+}
+
+static void *poly_cache_get(PolyCache *cache, PolyCacheKey *key) {
+    PolyCacheEntry *entry = poly_cache_find(cache, key);
+    return entry ? entry->value : NULL;
+}
+
+static void poly_cache_put(PolyCache *cache, PolyCacheKey *key, void *value) {
+    PolyCacheEntry *existing = poly_cache_find(cache, key);
+    if (existing) {
+        existing->value = value;
+        return;
+    }
+
+    PolyCacheEntry entry;
+    entry.key_start  = bh_arr_length(cache->keys);
+    entry.key_length = key->length;
+    entry.next       = (i32) bh_imap_get(&cache->lookup, key->hash) - 1;
+    entry.value      = value;
+
+    fori (i, 0, key->length) bh_arr_push(cache->keys, key->data[i]);
+    bh_arr_push(cache->entries, entry);
+
+    bh_imap_put(&cache->lookup, key->hash, bh_arr_length(cache->entries));
+}
+
 static void ensure_polyproc_cache_is_created(AstFunction* pp) {
-    if (pp->concrete_funcs == NULL)        sh_new_arena(pp->concrete_funcs);
+    if (pp->concrete_funcs == NULL)        pp->concrete_funcs = poly_cache_new();
     if (pp->active_queries.hashes == NULL) bh_imap_init(&pp->active_queries, global_heap_allocator, 31);
 }
 
@@ -60,52 +179,6 @@ static void insert_poly_slns_into_scope(Scope* scope, bh_arr(AstPolySolution) sl
     }
 }
 
-// NOTE: This might return a volatile string. Do not store it without copying it.
-static char* build_poly_solution_key(AstPolySolution* sln) {
-    if (sln->kind == PSK_Type) {
-        return (char *) type_get_unique_name(sln->type);
-
-    } else if (sln->kind == PSK_Value) {
-        static char buffer[256];
-
-        fori (i, 0, 256) buffer[i] = 0;
-
-        if (sln->value->kind == Ast_Kind_NumLit) {
-            strncat(buffer, "NUMLIT:", 127);
-            strncat(buffer, bh_bprintf("%l", ((AstNumLit *) sln->value)->value.l), 127);
-
-        } else {
-            // HACK: For now, the value pointer is just used. This means that
-            // sometimes, even through the solution is the same, it won't be
-            // stored the same.
-            bh_snprintf(buffer, 128, "%p", sln->value);
-        }
-
-        return buffer;
-    }
-
-    return NULL;
-}
-
-// NOTE: This returns a volatile string. Do not store it without copying it.
-static char* build_poly_slns_unique_key(bh_arr(AstPolySolution) slns) {
-    static char key_buf[1024];
-    fori (i, 0, 1024) key_buf[i] = 0;
-
-    bh_arr_each(AstPolySolution, sln, slns) {
-        token_toggle_end(sln->poly_sym->token);
-
-        strncat(key_buf, sln->poly_sym->token->text, 1023);
-        strncat(key_buf, "=", 1023);
-        strncat(key_buf, build_poly_solution_key(sln), 1023);
-        strncat(key_buf, ";", 1023);
-
-        token_toggle_end(sln->poly_sym->token);
-    }
-
-    return key_buf;
-}
-
 // NOTE: This function adds a solidified function to the entity heap for it to be processed
 // later. It optionally can start the function header entity at the code generation state if
 // the header has already been processed.
@@ -779,6 +852,7 @@ static bh_arr(AstPolySolution) find_polymorphic_slns(AstFunction* pp, PolyProcLo
         if (query->entity->state == Entity_State_Finalized) return query->slns;
         if (query->entity->state == Entity_State_Failed)    return NULL;
 
+        entity_wait_on(query->entity, Entity_State_Finalized);
         flag_to_yield = 1;
         return NULL;
     }
@@ -806,6 +880,7 @@ static bh_arr(AstPolySolution) find_polymorphic_slns(AstFunction* pp, PolyProcLo
 
     bh_imap_put(&pp->active_queries, (u64) actual, (u64) query);
     add_entities_for_node(NULL, (AstNode *) query, NULL, NULL);
+    entity_wait_on(query->entity, Entity_State_Finalized);
 
     flag_to_yield = 1;
     return NULL;
@@ -818,7 +893,10 @@ AstFunction* polymorphic_proc_lookup(AstFunction* pp, PolyProcLookupMethod pp_lo
 
     // Ensure the polymorphic procedure is ready to be solved for.
     assert(pp->entity);
-    if (pp->entity->state < Entity_State_Check_Types) return (AstFunction *) &node_that_signals_a_yield;
+    if (pp->entity->state < Entity_State_Check_Types) {
+        entity_wait_on(pp->entity, Entity_State_Check_Types);
+        return (AstFunction *) &node_that_signals_a_yield;
+    }
 
     ensure_polyproc_cache_is_created(pp);
 
@@ -840,10 +918,12 @@ AstFunction* polymorphic_proc_solidify(AstFunction* pp, bh_arr(AstPolySolution)
     ensure_polyproc_cache_is_created(pp);
 
     // NOTE: Check if a version of this polyproc has already been created.
-    char* unique_key = build_poly_slns_unique_key(slns);
-    i32 index = shgeti(pp->concrete_funcs, unique_key);
-    if (index != -1) {
-        AstSolidifiedFunction solidified_func = pp->concrete_funcs[index].value;
+    PolyCacheKey key;
+    build_poly_cache_key(&key, slns);
+
+    AstSolidifiedFunction* cached_func = poly_cache_get(pp->concrete_funcs, &key);
+    if (cached_func) {
+        AstSolidifiedFunction solidified_func = *cached_func;
 
         // NOTE: If this solution was originally created from a "build_only_header" call, then the body
         // will not have been or type checked, or anything. This ensures that the body is copied, the
@@ -861,9 +941,12 @@ AstFunction* polymorphic_proc_solidify(AstFunction* pp, bh_arr(AstPolySolution)
 
     AstSolidifiedFunction solidified_func = generate_solidified_function(pp, slns, tkn, 0);
     add_solidified_function_entities(&solidified_func);
+    entity_wait_on(solidified_func.func_header_entity, Entity_State_Code_Gen);
 
     // NOTE: Cache the function for later use, reducing duplicate functions.
-    shput(pp->concrete_funcs, unique_key, solidified_func);
+    cached_func = bh_alloc_item(context.ast_alloc, AstSolidifiedFunction);
+    *cached_func = solidified_func;
+    poly_cache_put(pp->concrete_funcs, &key, cached_func);
 
     return (AstFunction *) &node_that_signals_a_yield;
 }
@@ -940,10 +1023,12 @@ AstFunction* polymorphic_proc_build_only_header(AstFunction* pp, PolyProcLookupM
 AstFunction* polymorphic_proc_build_only_header_with_slns(AstFunction* pp, bh_arr(AstPolySolution) slns, b32 error_if_failed) {
     AstSolidifiedFunction solidified_func;
 
-    char* unique_key = build_poly_slns_unique_key(slns);
-    i32 index = shgeti(pp->concrete_funcs, unique_key);
-    if (index != -1) {
-        solidified_func = pp->concrete_funcs[index].value;
+    PolyCacheKey key;
+    build_poly_cache_key(&key, slns);
+
+    AstSolidifiedFunction* cached_func = poly_cache_get(pp->concrete_funcs, &key);
+    if (cached_func) {
+        solidified_func = *cached_func;
 
     } else {
         // NOTE: This function is only going to have the header of it correctly created.
@@ -956,6 +1041,7 @@ AstFunction* polymorphic_proc_build_only_header_with_slns(AstFunction* pp, bh_ar
         if (solidified_func.func_header_entity->state == Entity_State_Finalized) return solidified_func.func;
         if (solidified_func.func_header_entity->state == Entity_State_Failed)    return NULL;
 
+        entity_wait_on(solidified_func.func_header_entity, Entity_State_Finalized);
         return (AstFunction *) &node_that_signals_a_yield;
     }
 
@@ -971,9 +1057,15 @@ AstFunction* polymorphic_proc_build_only_header_with_slns(AstFunction* pp, bh_ar
 
     Entity* func_header_entity_ptr = entity_heap_insert(&context.entities, func_header_entity);
     solidified_func.func_header_entity = func_header_entity_ptr;
+    entity_wait_on(func_header_entity_ptr, Entity_State_Finalized);
 
     // NOTE: Cache the function for later use.
-    shput(pp->concrete_funcs, unique_key, solidified_func);
+    if (cached_func == NULL) {
+        cached_func = bh_alloc_item(context.ast_alloc, AstSolidifiedFunction);
+        poly_cache_put(pp->concrete_funcs, &key, cached_func);
+    }
+
+    *cached_func = solidified_func;
 
     return (AstFunction *) &node_that_signals_a_yield;
 }
@@ -1168,7 +1260,7 @@ Type* polymorphic_struct_lookup(AstPolyStructType* ps_type, bh_arr(AstPolySoluti
     assert(!ps_type->base_struct->scope);
 
     if (ps_type->concrete_structs == NULL) {
-        sh_new_arena(ps_type->concrete_structs);
+        ps_type->concrete_structs = poly_cache_new();
     }
 
     if (bh_arr_length(slns) != bh_arr_length(ps_type->poly_params)) {
@@ -1186,12 +1278,15 @@ Type* polymorphic_struct_lookup(AstPolyStructType* ps_type, bh_arr(AstPolySoluti
         i++;
     }
 
-    char* unique_key = build_poly_slns_unique_key(slns);
-    i32 index = shgeti(ps_type->concrete_structs, unique_key);
-    if (index != -1) {
-        AstStructType* concrete_struct = ps_type->concrete_structs[index].value;
+    PolyCacheKey key;
+    build_poly_cache_key(&key, slns);
+
+    AstStructType* cached_struct = poly_cache_get(ps_type->concrete_structs, &key);
+    if (cached_struct) {
+        AstStructType* concrete_struct = cached_struct;
 
         if (concrete_struct->entity_type->state < Entity_State_Check_Types) {
+            entity_wait_on(concrete_struct->entity_type, Entity_State_Check_Types);
             return NULL;
         }
 
@@ -1228,8 +1323,9 @@ Type* polymorphic_struct_lookup(AstPolyStructType* ps_type, bh_arr(AstPolySoluti
         concrete_struct->polymorphic_argument_types[i] = (AstType *) ast_clone(context.ast_alloc, ps_type->poly_params[i].type_node);
     }
 
-    shput(ps_type->concrete_structs, unique_key, concrete_struct);
+    poly_cache_put(ps_type->concrete_structs, &key, concrete_struct);
     add_entities_for_node(NULL, (AstNode *) concrete_struct, sln_scope, NULL);
+    entity_wait_on(concrete_struct->entity_type, Entity_State_Check_Types);
     return NULL;
 }
 
@@ -1241,7 +1337,7 @@ Type* polymorphic_union_lookup(AstPolyUnionType* pu_type, bh_arr(AstPolySolution
     assert(!pu_type->base_union->scope);
 
     if (pu_type->concrete_unions == NULL) {
-        sh_new_arena(pu_type->concrete_unions);
+        pu_type->concrete_unions = poly_cache_new();
     }
 
     if (bh_arr_length(slns) != bh_arr_length(pu_type->poly_params)) {
@@ -1259,12 +1355,15 @@ Type* polymorphic_union_lookup(AstPolyUnionType* pu_type, bh_arr(AstPolySolution
         i++;
     }
 
-    char* unique_key = build_poly_slns_unique_key(slns);
-    i32 index = shgeti(pu_type->concrete_unions, unique_key);
-    if (index != -1) {
-        AstUnionType* concrete_union = pu_type->concrete_unions[index].value;
+    PolyCacheKey key;
+    build_poly_cache_key(&key, slns);
+
+    AstUnionType* cached_union = poly_cache_get(pu_type->concrete_unions, &key);
+    if (cached_union) {
+        AstUnionType* concrete_union = cached_union;
 
         if (concrete_union->entity->state < Entity_State_Check_Types) {
+            entity_wait_on(concrete_union->entity, Entity_State_Check_Types);
             return NULL;
         }
 
@@ -1301,7 +1400,8 @@ Type* polymorphic_union_lookup(AstPolyUnionType* pu_type, bh_arr(AstPolySolution
         concrete_union->polymorphic_argument_types[i] = (AstType *) ast_clone(context.ast_alloc, pu_type->poly_params[i].type_node);
     }
 
-    shput(pu_type->concrete_unions, unique_key, concrete_union);
+    poly_cache_put(pu_type->concrete_unions, &key, concrete_union);
     add_entities_for_node(NULL, (AstNode *) concrete_union, sln_scope, NULL);
+    entity_wait_on(concrete_union->entity, Entity_State_Check_Types);
     return NULL;
 }
@@ -94,6 +94,7 @@ static SymresStatus symres_symbol(AstNode** symbol_node) {
 
             return Symres_Error;
         } else {
+            entity_wait_on_symbol(token);
             return Symres_Yield_Macro;
         }
 
@@ -1207,7 +1208,10 @@ SymresStatus symres_function_header(AstFunction* func) {
 }
 
 SymresStatus symres_function(AstFunction* func) {
-    if (func->entity_header && func->entity_header->state < Entity_State_Check_Types) return Symres_Yield_Macro;
+    if (func->entity_header && func->entity_header->state < Entity_State_Check_Types) {
+        entity_wait_on(func->entity_header, Entity_State_Check_Types);
+        return Symres_Yield_Macro;
+    }
     if (func->kind == Ast_Kind_Polymorphic_Proc) return Symres_Complete;
     if (func->flags & Ast_Flag_Function_Is_Lambda_Inside_PolyProc) return Symres_Complete;
     assert(func->scope);
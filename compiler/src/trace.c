@@ -0,0 +1,326 @@
+#include "trace.h"
+#include "utils.h"
+
+#define TRACE_REPORT_COUNT 10
+
+typedef struct TraceEvent {
+    // NULL for a pass over an entity.
+    const char *name;
+    char *detail;
+
+    Entity *entity;
+    EntityType type;
+    EntityState before, after;
+
+    u64 start, duration;
+    u32 thread;
+} TraceEvent;
+
+typedef struct TraceEntityStats {
+    Entity *entity;
+    u64 total_duration;
+    u32 passes;
+    u32 useless_passes;
+} TraceEntityStats;
+
+//
+// Everything is allocated on the C heap, because phases can be recorded on the
+// preloader threads, and the global heap allocator is not thread-safe.
+//
+static struct {
+    b32 active;
+    u64 start_time;
+
+    bh_arr(TraceEvent) events;
+
+    // Indexed by the id of the entity.
+    bh_arr(TraceEntityStats) entities;
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    bh_arr(pthread_t) threads;
+#endif
+} trace;
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+
+// Never destroyed, because a preloader thread can still be running after trace_end.
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void trace_lock()   { pthread_mutex_lock(&trace_mutex); }
+static void trace_unlock() { pthread_mutex_unlock(&trace_mutex); }
+
+// Threads are numbered in the order they first record something. The thread
+// that called trace_begin is 0.
+static u32 trace_current_thread() {
+    pthread_t self = pthread_self();
+    fori (i, 0, bh_arr_length(trace.threads)) {
+        if (pthread_equal(trace.threads[i], self)) return i;
+    }
+
+    bh_arr_push(trace.threads, self);
+    return bh_arr_length(trace.threads) - 1;
+}
+
+#else
+
+static void trace_lock()   {}
+static void trace_unlock() {}
+static u32 trace_current_thread() { return 0; }
+
+#endif
+
+b32 trace_enabled() {
+    return context.options != NULL && context.options->trace_file != NULL;
+}
+
+void trace_begin() {
+    if (!trace_enabled() || trace.active) return;
+
+    memset(&trace, 0, sizeof(trace));
+    bh_arr_new(bh_heap_allocator(), trace.events, 4096);
+    bh_arr_new(bh_heap_allocator(), trace.entities, 4096);
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    bh_arr_new(bh_heap_allocator(), trace.threads, 4);
+    trace_current_thread();
+#endif
+
+    trace.start_time = bh_time_curr_micro();
+    trace.active = 1;
+}
+
+void trace_entity_pass(Entity *ent, EntityState before, u64 start) {
+    if (!trace.active) return;
+
+    u64 end = bh_time_curr_micro();
+
+    TraceEvent event = { 0 };
+    event.entity   = ent;
+    event.type     = ent->type;
+    event.before   = before;
+    event.after    = ent->state;
+    event.start    = start;
+    event.duration = end - start;
+
+    trace_lock();
+    event.thread = trace_current_thread();
+    bh_arr_push(trace.events, event);
+
+    if ((i32) ent->id >= bh_arr_length(trace.entities)) {
+        i32 old_length = bh_arr_length(trace.entities);
+        bh_arr_grow(trace.entities, (i32) ent->id + 1);
+        bh_arr_set_length(trace.entities, (i32) ent->id + 1);
+        memset(&trace.entities[old_length], 0, sizeof(TraceEntityStats) * (ent->id + 1 - old_length));
+    }
+
+    TraceEntityStats *stats = &trace.entities[ent->id];
+    stats->entity = ent;
+    stats->total_duration += event.duration;
+    stats->passes += 1;
+    if (event.before == event.after) stats->useless_passes += 1;
+    trace_unlock();
+}
+
+void trace_phase(const char *name, const char *detail, u64 start) {
+    if (!trace.active) return;
+
+    u64 end = bh_time_curr_micro();
+
+    TraceEvent event = { 0 };
+    event.name     = name;
+    event.detail   = detail ? bh_strdup(bh_heap_allocator(), (char *) detail) : NULL;
+    event.start    = start;
+    event.duration = end - start;
+
+    trace_lock();
+    if (trace.active) {
+        event.thread = trace_current_thread();
+        bh_arr_push(trace.events, event);
+        event.detail = NULL;
+    }
+    trace_unlock();
+
+    if (event.detail) bh_free(bh_heap_allocator(), event.detail);
+}
+
+static OnyxToken *trace_entity_token(Entity *ent) {
+    if (ent->type == Entity_Type_Job || ent->expr == NULL) return NULL;
+    return ent->expr->token;
+}
+
+static void trace_append(bh_buffer *buffer, char const *fmt, ...) {
+    char text[1024];
+
+    va_list va;
+    va_start(va, fmt);
+    isize length = bh_snprintf_va(text, sizeof(text), fmt, va);
+    va_end(va);
+
+    bh_buffer_append(buffer, text, length - 1);
+}
+
+static void trace_append_string(bh_buffer *buffer, const char *str) {
+    static const char hex[] = "0123456789abcdef";
+
+    bh_buffer_write_byte(buffer, '"');
+
+    for (const char *c = str; *c; c++) {
+        switch (*c) {
+            case '"':  bh_buffer_append(buffer, "\\\"", 2); break;
+            case '\\': bh_buffer_append(buffer, "\\\\", 2); break;
+            case '\n': bh_buffer_append(buffer, "\\n", 2);  break;
+            case '\t': bh_buffer_append(buffer, "\\t", 2);  break;
+            default:
+                if ((u8) *c < 0x20) {
+                    char escape[] = { '\\', 'u', '0', '0', hex[(u8) *c >> 4], hex[(u8) *c & 0xf] };
+                    bh_buffer_append(buffer, escape, sizeof(escape));
+                } else {
+                    bh_buffer_write_byte(buffer, *c);
+                }
+                break;
+        }
+    }
+
+    bh_buffer_write_byte(buffer, '"');
+}
+
+static void trace_append_location(bh_buffer *buffer, Entity *ent) {
+    OnyxToken *token = trace_entity_token(ent);
+    if (token == NULL || token->pos.filename == NULL) {
+        trace_append_string(buffer, "");
+        return;
+    }
+
+    char *location = bh_aprintf(global_scratch_allocator, "%s:%d:%d", token->pos.filename, token->pos.line, token->pos.column);
+    trace_append_string(buffer, location);
+}
+
+static void trace_write_file(const char *filename) {
+    bh_buffer buffer;
+    bh_buffer_init(&buffer, bh_heap_allocator(), 256 * bh_arr_length(trace.events) + 1024);
+
+    trace_append(&buffer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    i32 thread_count = 1;
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    thread_count = bh_arr_length(trace.threads);
+#endif
+
+    fori (i, 0, thread_count) {
+        trace_append(&buffer, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+            (i32) i, i == 0 ? "Compiler" : "Preloader");
+    }
+
+    bh_arr_each(TraceEvent, event, trace.events) {
+        trace_append(&buffer, "{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%l,\"dur\":%l,",
+            event->thread, (long) (event->start - trace.start_time), (long) event->duration);
+
+        if (event->name) {
+            trace_append(&buffer, "\"cat\":\"phase\",\"name\":");
+            trace_append_string(&buffer, event->name);
+
+            if (event->detail) {
+                trace_append(&buffer, ",\"args\":{\"detail\":");
+                trace_append_string(&buffer, event->detail);
+                trace_append(&buffer, "}");
+            }
+
+        } else {
+            Entity *ent = event->entity;
+
+            trace_append(&buffer, "\"cat\":\"entity\",\"name\":\"%s (%s)\",\"args\":{\"id\":%d,\"type\":\"%s\",\"before\":\"%s\",\"after\":\"%s\",\"progress\":%s,\"location\":",
+                entity_type_strings[event->type], entity_state_strings[event->before], ent->id,
+                entity_type_strings[event->type], entity_state_strings[event->before], entity_state_strings[event->after],
+                event->before != event->after ? "true" : "false");
+            trace_append_location(&buffer, ent);
+            trace_append(&buffer, "}");
+        }
+
+        trace_append(&buffer, "}%s\n", event == &bh_arr_last(trace.events) ? "" : ",");
+    }
+
+    trace_append(&buffer, "]}\n");
+
+    bh_file file;
+    if (bh_file_create(&file, filename) == BH_FILE_ERROR_NONE) {
+        bh_file_write(&file, buffer.data, buffer.length);
+        bh_file_close(&file);
+    } else {
+        bh_printf_err("Failed to open file for writing: '%s'\n", filename);
+    }
+
+    bh_buffer_free(&buffer);
+}
+
+static int trace_compare_duration(const void *a, const void *b) {
+    const TraceEntityStats *sa = *(const TraceEntityStats **) a;
+    const TraceEntityStats *sb = *(const TraceEntityStats **) b;
+    if (sa->total_duration != sb->total_duration) return sa->total_duration > sb->total_duration ? -1 : 1;
+    return (i32) sa->entity->id - (i32) sb->entity->id;
+}
+
+static int trace_compare_useless_passes(const void *a, const void *b) {
+    const TraceEntityStats *sa = *(const TraceEntityStats **) a;
+    const TraceEntityStats *sb = *(const TraceEntityStats **) b;
+    if (sa->useless_passes != sb->useless_passes) return sa->useless_passes > sb->useless_passes ? -1 : 1;
+    return (i32) sa->entity->id - (i32) sb->entity->id;
+}
+
+static void trace_print_entity(TraceEntityStats *stats) {
+    Entity *ent = stats->entity;
+    OnyxToken *token = trace_entity_token(ent);
+
+    // TODO: Replace these with bh_printf when padded formatting is added.
+    printf("| %10lu us | %6u | %7u | %27s | ", stats->total_duration, stats->passes, stats->useless_passes, entity_type_strings[ent->type]);
+    if (token && token->pos.filename) printf("%s:%d:%d\n", token->pos.filename, token->pos.line, token->pos.column);
+    else                              printf("\n");
+}
+
+static void trace_print_report() {
+    bh_arr(TraceEntityStats *) sorted = NULL;
+    bh_arr_new(bh_heap_allocator(), sorted, bh_arr_length(trace.entities));
+
+    bh_arr_each(TraceEntityStats, stats, trace.entities) {
+        if (stats->entity) bh_arr_push(sorted, stats);
+    }
+
+    i32 count = bh_min(bh_arr_length(sorted), TRACE_REPORT_COUNT);
+
+    printf("\nSlowest entities:\n");
+    printf("| %13s | %6s | %7s | %27s | %s\n", "Time", "Passes", "Useless", "Entity", "Location");
+    qsort(sorted, bh_arr_length(sorted), sizeof(TraceEntityStats *), trace_compare_duration);
+    fori (i, 0, count) trace_print_entity(sorted[i]);
+
+    printf("\nMost retried entities:\n");
+    printf("| %13s | %6s | %7s | %27s | %s\n", "Time", "Passes", "Useless", "Entity", "Location");
+    qsort(sorted, bh_arr_length(sorted), sizeof(TraceEntityStats *), trace_compare_useless_passes);
+    fori (i, 0, count) {
+        if (sorted[i]->useless_passes == 0) break;
+        trace_print_entity(sorted[i]);
+    }
+
+    printf("\n");
+    bh_arr_free(sorted);
+}
+
+void trace_end() {
+    if (!trace.active) return;
+
+    trace_lock();
+    trace.active = 0;
+    trace_unlock();
+
+    trace_write_file(context.options->trace_file);
+    trace_print_report();
+
+    bh_arr_each(TraceEvent, event, trace.events) {
+        if (event->detail) bh_free(bh_heap_allocator(), event->detail);
+    }
+
+    bh_arr_free(trace.events);
+    bh_arr_free(trace.entities);
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    bh_arr_free(trace.threads);
+#endif
+}
@@ -47,7 +47,12 @@ static bh_imap type_array_map;
 static bh_imap type_slice_map;
 static bh_imap type_dynarr_map;
 static bh_imap type_vararg_map;
-static Table(u64) type_func_map;
+
+// Function and compound types are hash-consed on their structure: their kind,
+// their counts and the ids of the types they are made of. As every other type is
+// already unique, two function or compound types are the same if those match.
+static bh_imap type_structural_map;  // Structural hash -> id of the last type with that hash.
+static bh_imap type_structural_next; // Type id -> id of the type before it with the same hash.
 
 static Type* type_create(TypeKind kind, bh_allocator a, u32 extra_type_pointer_count) {
     Type* type = bh_alloc(a, sizeof(Type) + sizeof(Type *) * extra_type_pointer_count);
@@ -65,6 +70,87 @@ static void type_register(Type* type) {
     bh_imap_put(&type_map, type->id, (u64) type);
 }
 
+static u64 type_structural_hash(Type* type) {
+    u64 hash = 0xcbf29ce484222325ull;
+
+    #define MIX(x) (hash = (hash ^ (u64) (x)) * 0x100000001b3ull, hash ^= hash >> 29)
+
+    MIX(type->kind);
+    switch (type->kind) {
+        case Type_Kind_Function:
+            MIX(type->Function.param_count);
+            MIX(type->Function.needed_param_count);
+            MIX(type->Function.return_type->id);
+            fori (i, 0, type->Function.param_count) MIX(type->Function.params[i]->id);
+            break;
+
+        case Type_Kind_Compound:
+            MIX(type->Compound.count);
+            MIX(type->Compound.size);
+            fori (i, 0, type->Compound.count) MIX(type->Compound.types[i]->id);
+            break;
+
+        default:
+            MIX(type->id);
+            break;
+    }
+
+    #undef MIX
+
+    return hash;
+}
+
+static b32 types_are_structurally_equal(Type* t1, Type* t2) {
+    if (t1->kind != t2->kind) return 0;
+
+    switch (t1->kind) {
+        case Type_Kind_Function:
+            if (t1->Function.param_count != t2->Function.param_count)               return 0;
+            if (t1->Function.needed_param_count != t2->Function.needed_param_count) return 0;
+            if (t1->Function.return_type != t2->Function.return_type)               return 0;
+
+            fori (i, 0, t1->Function.param_count) {
+                if (t1->Function.params[i] != t2->Function.params[i]) return 0;
+            }
+            return 1;
+
+        case Type_Kind_Compound:
+            // The size is compared because a compound type built from partial types
+            // can have the wrong size, and should not be used in place of a complete one.
+            if (t1->Compound.count != t2->Compound.count) return 0;
+            if (t1->Compound.size != t2->Compound.size)   return 0;
+
+            fori (i, 0, t1->Compound.count) {
+                if (t1->Compound.types[i] != t2->Compound.types[i]) return 0;
+            }
+            return 1;
+
+        default:
+            return t1 == t2;
+    }
+}
+
+static Type* type_lookup_structural(Type* type, u64 hash) {
+    u64 id = bh_imap_get(&type_structural_map, hash);
+    while (id > 0) {
+        Type* existing_type = (Type *) bh_imap_get(&type_map, id);
+        if (types_are_structurally_equal(type, existing_type)) return existing_type;
+
+        id = bh_imap_get(&type_structural_next, id);
+    }
+
+    return NULL;
+}
+
+static void type_register_structural(Type* type, u64 hash) {
+    type_register(type);
+
+    u64 previous_id = bh_imap_get(&type_structural_map, hash);
+    if (previous_id > 0) bh_imap_put(&type_structural_next, type->id, previous_id);
+
+    bh_imap_put(&type_structural_map, hash, type->id);
+}
+
 void types_init() {
 #define MAKE_MAP(x) (memset(&x, 0, sizeof(x)), bh_imap_init(&x, global_heap_allocator, 255))
     MAKE_MAP(type_map);
@@ -74,9 +160,8 @@ void types_init() {
     MAKE_MAP(type_slice_map);
     MAKE_MAP(type_dynarr_map);
     MAKE_MAP(type_vararg_map);
-
-    type_func_map = NULL;
-    sh_new_arena(type_func_map);
+    MAKE_MAP(type_structural_map);
+    MAKE_MAP(type_structural_next);
 
     fori (i, 0, Basic_Kind_Count) type_register(&basic_types[i]);
 #undef MAKE_MAP
@@ -343,21 +428,21 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
                 }
             }
 
-            char* name = (char *) type_get_unique_name(func_type);
-            if (func_type->Function.return_type != &type_auto_return) {
-                i32 index = shgeti(type_func_map, name);
-                if (index != -1) {
-                    u64 id = type_func_map[index].value;
-                    Type* existing_type = (Type *) bh_imap_get(&type_map, id);
-
-                    // LEAK LEAK LEAK the func_type that is created
-                    return existing_type;
-                }
+            // The return type of a function type with an automatic return type is filled
+            // in later, so those are never shared. :AutoReturnType
+            if (func_type->Function.return_type == &type_auto_return) {
+                type_register(func_type);
+                return func_type;
             }
 
-            type_register(func_type);
-            shput(type_func_map, name, func_type->id);
+            u64 hash = type_structural_hash(func_type);
+            Type* existing_type = type_lookup_structural(func_type, hash);
+            if (existing_type) {
+                // LEAK LEAK LEAK the func_type that is created
+                return existing_type;
+            }
 
+            type_register_structural(func_type, hash);
             return func_type;
         }
 
@@ -416,7 +501,10 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
             AstStructType* s_node = (AstStructType *) type_node;
             if (s_node->stcache != NULL) return s_node->stcache;
             if (s_node->pending_type != NULL && s_node->pending_type_is_valid) return s_node->pending_type;
-            if (!s_node->ready_to_build_type) return NULL;
+            if (!s_node->ready_to_build_type) {
+                if (s_node->entity_type) entity_wait_on(s_node->entity_type, Entity_State_Code_Gen);
+                return NULL;
+            }
 
             Type* s_type;
             if (s_node->pending_type == NULL) {
@@ -684,11 +772,18 @@ static Type* type_build_from_ast_inner(bh_allocator alloc, AstType* type_node, b
 
             bh_align(comp_type->Compound.size, 4);
 
+            u64 hash = type_structural_hash(comp_type);
+            Type* existing_type = type_lookup_structural(comp_type, hash);
+            if (existing_type) {
+                // LEAK LEAK LEAK the comp_type that is created
+                return existing_type;
+            }
+
             comp_type->Compound.linear_members = NULL;
             bh_arr_new(global_heap_allocator, comp_type->Compound.linear_members, comp_type->Compound.count);
             build_linear_types_with_offset(comp_type, &comp_type->Compound.linear_members, 0);
 
-            type_register(comp_type);
+            type_register_structural(comp_type, hash);
             return comp_type;
         }
 
@@ -884,21 +979,19 @@ Type* type_build_function_type(bh_allocator alloc, AstFunction* func) {
     }
 
     // CopyPaste from above in type_build_from_ast
-    char* name = (char *) type_get_unique_name(func_type);
-    if (func_type->Function.return_type != &type_auto_return) {
-        i32 index = shgeti(type_func_map, name);
-        if (index != -1) {
-            u64 id = type_func_map[index].value;
-            Type* existing_type = (Type *) bh_imap_get(&type_map, id);
-
-            // LEAK LEAK LEAK the func_type that is created
-            return existing_type;
-        }
+    if (func_type->Function.return_type == &type_auto_return) {
+        type_register(func_type);
+        return func_type;
     }
 
-    type_register(func_type);
-    shput(type_func_map, name, func_type->id);
+    u64 hash = type_structural_hash(func_type);
+    Type* existing_type = type_lookup_structural(func_type, hash);
+    if (existing_type) {
+        // LEAK LEAK LEAK the func_type that is created
+        return existing_type;
+    }
 
+    type_register_structural(func_type, hash);
     return func_type;
 }
 
@@ -925,11 +1018,18 @@ Type* type_build_compound_type(bh_allocator alloc, AstCompound* compound) {
 
     bh_align(comp_type->Compound.size, 4);
 
+    u64 hash = type_structural_hash(comp_type);
+    Type* existing_type = type_lookup_structural(comp_type, hash);
+    if (existing_type) {
+        // LEAK LEAK LEAK the comp_type that is created
+        return existing_type;
+    }
+
     comp_type->Compound.linear_members = NULL;
     bh_arr_new(global_heap_allocator, comp_type->Compound.linear_members, comp_type->Compound.count);
     build_linear_types_with_offset(comp_type, &comp_type->Compound.linear_members, 0);
 
-    type_register(comp_type);
+    type_register_structural(comp_type, hash);
     return comp_type;
 }
 
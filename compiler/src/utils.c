@@ -163,11 +163,13 @@ b32 symbol_raw_introduce(Scope* scope, char* name, OnyxFilePos pos, AstNode* sym
 
     shput(scope->symbols, name, symbol);
     track_declaration_for_symbol_info(pos, symbol);
+    entity_heap_wake_symbol_waiters(&context.entities, name);
     return 1;
 }
 
 void symbol_builtin_introduce(Scope* scope, char* sym, AstNode *node) {
     shput(scope->symbols, sym, node);
+    entity_heap_wake_symbol_waiters(&context.entities, sym);
 }
 
 void symbol_subpackage_introduce(Package* parent, char* sym, AstPackage* subpackage) {
@@ -182,6 +184,7 @@ void symbol_subpackage_introduce(Package* parent, char* sym, AstPackage* subpack
 
     } else {
         shput(scope->symbols, sym, (AstNode *) subpackage);
+        entity_heap_wake_symbol_waiters(&context.entities, sym);
 
         // Parent: parent->id
         // Child:  subpackage->package->id
@@ -17,6 +17,8 @@
 #define BH_DEBUG
 #include "wasm_emit.h"
 #include "utils.h"
+#include "build_cache.h"
+#include "trace.h"
 
 #define WASM_TYPE_INT32   0x7F
 #define WASM_TYPE_INT64   0x7E
@@ -4521,6 +4523,8 @@ static void emit_function(OnyxWasmModule* mod, AstFunction* fd) {
     WasmFunc wasm_func = { 0 };
     wasm_func.type_idx = type_idx;
     wasm_func.location = fd->token;
+    wasm_func.is_inline = fd->is_inline;
+    wasm_func.is_no_inline = fd->is_no_inline;
 
     bh_arr_new(mod->allocator, wasm_func.code, 16);
 
@@ -5156,6 +5160,8 @@ static void emit_file_contents(OnyxWasmModule* mod, AstFileContents* fc) {
     // file in which is was inclded. The loaded file info above should probably use the full
     // file path in order to avoid duplicates.
     bh_file_contents contents = bh_file_read_contents(global_heap_allocator, fc->filename);
+    build_cache_add_file(fc->filename);
+
     u8* actual_data = bh_alloc(global_heap_allocator, contents.length + 1);
     u32 length = contents.length + 1;
     memcpy(actual_data, contents.data, contents.length);
@@ -5582,9 +5588,24 @@ void onyx_wasm_module_link(OnyxWasmModule *module, OnyxWasmLinkOptions *options)
     }
 
 
+    // The debug info refers to every function, instruction and local, so the
+    // code cannot be changed once it has been generated.
+    if (!context.options->debug_info_enabled) {
+        if (context.options->optimize) {
+            u64 start = bh_time_curr_micro();
+            onyx_wasm_module_optimize(module);
+            trace_phase("Optimize", NULL, start);
+        }
+
+        u64 start = bh_time_curr_micro();
+        onyx_wasm_module_prune(module);
+        trace_phase("Prune", NULL, start);
+    }
+
     if (context.options->print_function_mappings) {
         bh_arr_each(AstFunction *, pfunc, module->all_procedures) {
             AstFunction *func = *pfunc;
+            if (!bh_imap_has(&module->index_map, (u64) func)) continue;
 
             u64 func_idx = (u64) bh_imap_get(&module->index_map, (u64) func);
 
@@ -5683,4 +5704,6 @@ b32 onyx_wasm_build_link_options_from_node(OnyxWasmLinkOptions *opts, AstTyped *
     return 1;
 }
 
+#include "wasm_optimize.h"
 #include "wasm_output.h"
+#include "wasm_prune.h"
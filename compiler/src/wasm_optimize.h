@@ -0,0 +1,1576 @@
+// This file is directly included in src/wasm_emit.c.
+// It is separated because it only works on the finished instruction streams.
+
+//-------------------------------------------------
+// OPTIMIZATION PASSES
+//-------------------------------------------------
+//
+// These passes run over the code of every function when compiling with -O.
+// They run at the end of linking, after every code patch has been applied, so
+// no instruction is referred to by its index anymore. That means
+// instructions can freely be removed. Removed instructions are first replaced
+// with a `nop`, and the `nop`s are taken out at the end of every pass.
+//
+// They do not run when debug info is generated, because the debug info maps
+// every instruction to a source location, and every local to a variable.
+//
+// Like the rest of the code generator, the passes assume that pointer arithmetic
+// never wraps around the address space, so `(p + 8).load offset=4` can become
+// `p.load offset=12`.
+//
+
+typedef struct OptimizeLoop {
+    i32 start, end;
+} OptimizeLoop;
+
+typedef struct OptimizeContext {
+    bh_arr(i32)             counts;
+    bh_arr(i32)             pending;
+    bh_arr(i32)             active;
+    bh_arr(u8)              has_source;
+    bh_arr(WasmInstruction) sources;
+
+    bh_arr(i32)          first;
+    bh_arr(i32)          last;
+    bh_arr(u64)          values;
+    bh_arr(u64)          sorted;
+    bh_arr(i32)          slot_ends;
+    bh_arr(i32)          block_stack;
+    bh_arr(OptimizeLoop) loops;
+
+    OnyxWasmModule          *module;
+    bh_arr(WasmInstruction)  inlined;
+    bh_arr(u64)              inline_locals;
+    u64                      inlined_calls;
+} OptimizeContext;
+
+typedef void (*OptimizePassFunc)(OptimizeContext *ctx, WasmFunc *func);
+
+typedef struct OptimizePass {
+    const char *name;
+    OptimizePassFunc run;
+
+    // Set if the pass looks at the code of other functions than the one it works on.
+    b32 reads_other_funcs;
+} OptimizePass;
+
+#define OPTIMIZE_RESIZE(arr, n) (bh_arr_grow(arr, n), bh_arr_set_length(arr, n))
+
+static u32 optimize_local_count(WasmFunc *func) {
+    LocalAllocator *la = &func->locals;
+    return la->param_count
+        + la->allocated[0] + la->allocated[1] + la->allocated[2]
+        + la->allocated[3] + la->allocated[4];
+}
+
+static b32 optimize_is_local_access(WasmInstructionType t) {
+    return t == WI_LOCAL_GET || t == WI_LOCAL_SET || t == WI_LOCAL_TEE;
+}
+
+//
+// Instructions that change where control goes, or that control can reach from
+// somewhere other than the instruction before it. Nothing known about locals
+// is kept across these.
+static b32 optimize_is_control_flow(WasmInstructionType t) {
+    switch (t) {
+        case WI_UNREACHABLE:
+        case WI_BLOCK_START:
+        case WI_LOOP_START:
+        case WI_IF_START:
+        case WI_ELSE:
+        case WI_BLOCK_END:
+        case WI_JUMP:
+        case WI_COND_JUMP:
+        case WI_JUMP_TABLE:
+        case WI_RETURN:
+            return 1;
+
+        default: return 0;
+    }
+}
+
+//
+// Instructions that push one value without popping any, and have no other
+// effect. They can be repeated or removed freely.
+static b32 optimize_is_simple_producer(WasmInstructionType t) {
+    switch (t) {
+        case WI_LOCAL_GET:
+        case WI_GLOBAL_GET:
+        case WI_I32_CONST:
+        case WI_I64_CONST:
+        case WI_F32_CONST:
+        case WI_F64_CONST:
+        case WI_V128_CONST:
+        case WI_MEMORY_SIZE:
+            return 1;
+
+        default: return 0;
+    }
+}
+
+//
+// Pure instructions that pop one value and push one value, and never trap.
+static b32 optimize_is_pure_unary(WasmInstructionType t) {
+    if (t == WI_I32_EQZ || t == WI_I64_EQZ) return 1;
+    if (t >= WI_I32_CLZ && t <= WI_I32_POPCNT) return 1;
+    if (t >= WI_I64_CLZ && t <= WI_I64_POPCNT) return 1;
+    if (t >= WI_F32_ABS && t <= WI_F32_SQRT) return 1;
+    if (t >= WI_F64_ABS && t <= WI_F64_SQRT) return 1;
+    if (t == WI_I32_FROM_I64) return 1;
+    if (t == WI_I64_FROM_I32_S || t == WI_I64_FROM_I32_U) return 1;
+    if (t >= WI_F32_FROM_I32_S && t <= WI_I64_EXTEND_32_S) return 1;
+    return 0;
+}
+
+//
+// Pure instructions that pop two values and push one value, and never trap.
+// Division and remainder are not here, because they trap on zero.
+static b32 optimize_is_pure_binary(WasmInstructionType t) {
+    if (t >= WI_I32_EQ && t <= WI_I32_GE_U) return 1;
+    if (t >= WI_I64_EQ && t <= WI_F64_GE) return 1;
+    if (t >= WI_I32_ADD && t <= WI_I32_MUL) return 1;
+    if (t >= WI_I32_AND && t <= WI_I32_ROTR) return 1;
+    if (t >= WI_I64_ADD && t <= WI_I64_MUL) return 1;
+    if (t >= WI_I64_AND && t <= WI_I64_ROTR) return 1;
+    if (t >= WI_F32_ADD && t <= WI_F32_COPYSIGN) return 1;
+    if (t >= WI_F64_ADD && t <= WI_F64_COPYSIGN) return 1;
+    return 0;
+}
+
+static b32 optimize_is_plain_load(WasmInstructionType t) {
+    return (t >= WI_I32_LOAD && t <= WI_I64_LOAD_32_U) || t == WI_V128_LOAD;
+}
+
+static b32 optimize_is_plain_store(WasmInstructionType t) {
+    return (t >= WI_I32_STORE && t <= WI_I64_STORE_32) || t == WI_V128_STORE;
+}
+
+//
+// The load that reads back exactly the value the store wrote.
+static WasmInstructionType optimize_load_matching_store(WasmInstructionType t) {
+    switch (t) {
+        case WI_I32_STORE:  return WI_I32_LOAD;
+        case WI_I64_STORE:  return WI_I64_LOAD;
+        case WI_F32_STORE:  return WI_F32_LOAD;
+        case WI_F64_STORE:  return WI_F64_LOAD;
+        case WI_V128_STORE: return WI_V128_LOAD;
+        default:            return WI_NOP;
+    }
+}
+
+static b32 optimize_is_int_const(WasmInstruction *instr) {
+    return instr->type == WI_I32_CONST || instr->type == WI_I64_CONST;
+}
+
+static i64 optimize_int_value(WasmInstruction *instr) {
+    if (instr->type == WI_I32_CONST) return (i64) instr->data.i1;
+    return instr->data.l;
+}
+
+static WasmInstruction optimize_i32_const(u32 value) {
+    WasmInstruction instr = { WI_I32_CONST, { .l = 0 } };
+    instr.data.i1 = (i32) value;
+    return instr;
+}
+
+static WasmInstruction optimize_i64_const(u64 value) {
+    WasmInstruction instr = { WI_I64_CONST, { .l = 0 } };
+    instr.data.l = (i64) value;
+    return instr;
+}
+
+static void optimize_remove_nops(WasmFunc *func) {
+    i32 write = 0;
+    bh_arr_each(WasmInstruction, instr, func->code) {
+        if (instr->type != WI_NOP) func->code[write++] = *instr;
+    }
+
+    bh_arr_set_length(func->code, write);
+}
+
+
+//
+// Constant folding
+//
+// Instructions are moved one by one to the end of the output, and then the
+// end of the output is folded for as long as possible. This way, folding one
+// instruction can enable folding the instructions before it.
+//
+
+static b32 optimize_fold_i32_binary(WasmInstructionType op, u32 a, u32 b, WasmInstruction *out) {
+    u32 r;
+    switch (op) {
+        case WI_I32_ADD:   r = a + b; break;
+        case WI_I32_SUB:   r = a - b; break;
+        case WI_I32_MUL:   r = a * b; break;
+        case WI_I32_AND:   r = a & b; break;
+        case WI_I32_OR:    r = a | b; break;
+        case WI_I32_XOR:   r = a ^ b; break;
+        case WI_I32_SHL:   r = a << (b & 31); break;
+        case WI_I32_SHR_U: r = a >> (b & 31); break;
+        case WI_I32_SHR_S: r = (u32) ((i32) a >> (b & 31)); break;
+        case WI_I32_EQ:    r = a == b; break;
+        case WI_I32_NE:    r = a != b; break;
+        case WI_I32_LT_S:  r = (i32) a <  (i32) b; break;
+        case WI_I32_LT_U:  r = a <  b; break;
+        case WI_I32_GT_S:  r = (i32) a >  (i32) b; break;
+        case WI_I32_GT_U:  r = a >  b; break;
+        case WI_I32_LE_S:  r = (i32) a <= (i32) b; break;
+        case WI_I32_LE_U:  r = a <= b; break;
+        case WI_I32_GE_S:  r = (i32) a >= (i32) b; break;
+        case WI_I32_GE_U:  r = a >= b; break;
+        default: return 0;
+    }
+
+    *out = optimize_i32_const(r);
+    return 1;
+}
+
+static b32 optimize_fold_i64_binary(WasmInstructionType op, u64 a, u64 b, WasmInstruction *out) {
+    u64 r;
+    switch (op) {
+        case WI_I64_ADD:   r = a + b; break;
+        case WI_I64_SUB:   r = a - b; break;
+        case WI_I64_MUL:   r = a * b; break;
+        case WI_I64_AND:   r = a & b; break;
+        case WI_I64_OR:    r = a | b; break;
+        case WI_I64_XOR:   r = a ^ b; break;
+        case WI_I64_SHL:   r = a << (b & 63); break;
+        case WI_I64_SHR_U: r = a >> (b & 63); break;
+        case WI_I64_SHR_S: r = (u64) ((i64) a >> (b & 63)); break;
+
+        case WI_I64_EQ:    *out = optimize_i32_const(a == b); return 1;
+        case WI_I64_NE:    *out = optimize_i32_const(a != b); return 1;
+        case WI_I64_LT_S:  *out = optimize_i32_const((i64) a <  (i64) b); return 1;
+        case WI_I64_LT_U:  *out = optimize_i32_const(a <  b); return 1;
+        case WI_I64_GT_S:  *out = optimize_i32_const((i64) a >  (i64) b); return 1;
+        case WI_I64_GT_U:  *out = optimize_i32_const(a >  b); return 1;
+        case WI_I64_LE_S:  *out = optimize_i32_const((i64) a <= (i64) b); return 1;
+        case WI_I64_LE_U:  *out = optimize_i32_const(a <= b); return 1;
+        case WI_I64_GE_S:  *out = optimize_i32_const((i64) a >= (i64) b); return 1;
+        case WI_I64_GE_U:  *out = optimize_i32_const(a >= b); return 1;
+        default: return 0;
+    }
+
+    *out = optimize_i64_const(r);
+    return 1;
+}
+
+static b32 optimize_fold_unary(WasmInstructionType op, WasmInstruction *in, WasmInstruction *out) {
+    if (in->type == WI_I32_CONST) {
+        i32 a = in->data.i1;
+        switch (op) {
+            case WI_I32_EQZ:         *out = optimize_i32_const(a == 0); return 1;
+            case WI_I32_EXTEND_8_S:  *out = optimize_i32_const((i32) (i8) a); return 1;
+            case WI_I32_EXTEND_16_S: *out = optimize_i32_const((i32) (i16) a); return 1;
+            case WI_I64_FROM_I32_S:  *out = optimize_i64_const((i64) a); return 1;
+            case WI_I64_FROM_I32_U:  *out = optimize_i64_const((u64) (u32) a); return 1;
+            default: return 0;
+        }
+    }
+
+    if (in->type == WI_I64_CONST) {
+        i64 a = in->data.l;
+        switch (op) {
+            case WI_I64_EQZ:         *out = optimize_i32_const(a == 0); return 1;
+            case WI_I32_FROM_I64:    *out = optimize_i32_const((u32) a); return 1;
+            case WI_I64_EXTEND_8_S:  *out = optimize_i64_const((i64) (i8) a); return 1;
+            case WI_I64_EXTEND_16_S: *out = optimize_i64_const((i64) (i16) a); return 1;
+            case WI_I64_EXTEND_32_S: *out = optimize_i64_const((i64) (i32) a); return 1;
+            default: return 0;
+        }
+    }
+
+    return 0;
+}
+
+//
+// Operations that do nothing when their second operand is 0 or 1.
+static b32 optimize_is_identity(WasmInstructionType op, WasmInstruction *operand) {
+    if (!optimize_is_int_const(operand)) return 0;
+
+    b32 is_i32 = operand->type == WI_I32_CONST;
+    i64 value  = optimize_int_value(operand);
+
+    if (value == 0) {
+        switch (op) {
+            case WI_I32_ADD: case WI_I32_SUB: case WI_I32_OR: case WI_I32_XOR:
+            case WI_I32_SHL: case WI_I32_SHR_S: case WI_I32_SHR_U:
+            case WI_I32_ROTL: case WI_I32_ROTR:
+                return is_i32;
+
+            case WI_I64_ADD: case WI_I64_SUB: case WI_I64_OR: case WI_I64_XOR:
+            case WI_I64_SHL: case WI_I64_SHR_S: case WI_I64_SHR_U:
+            case WI_I64_ROTL: case WI_I64_ROTR:
+                return !is_i32;
+
+            default: return 0;
+        }
+    }
+
+    if (value == 1) {
+        switch (op) {
+            case WI_I32_MUL: case WI_I32_DIV_S: case WI_I32_DIV_U: return is_i32;
+            case WI_I64_MUL: case WI_I64_DIV_S: case WI_I64_DIV_U: return !is_i32;
+            default: return 0;
+        }
+    }
+
+    return 0;
+}
+
+static b32 optimize_fold_end(WasmInstruction *code, i32 *pcount) {
+    i32 n = *pcount;
+    if (n < 2) return 0;
+
+    WasmInstruction *last = &code[n - 1];
+    WasmInstruction *prev = &code[n - 2];
+    WasmInstruction folded;
+
+    //
+    // c1; c2; op  =>  c
+    if (n >= 3 && prev->type == code[n - 3].type) {
+        if (prev->type == WI_I32_CONST
+            && optimize_fold_i32_binary(last->type, code[n - 3].data.i1, prev->data.i1, &folded)) {
+            code[n - 3] = folded;
+            *pcount = n - 2;
+            return 1;
+        }
+
+        if (prev->type == WI_I64_CONST
+            && optimize_fold_i64_binary(last->type, code[n - 3].data.l, prev->data.l, &folded)) {
+            code[n - 3] = folded;
+            *pcount = n - 2;
+            return 1;
+        }
+    }
+
+    //
+    // c; op  =>  c
+    if (optimize_fold_unary(last->type, prev, &folded)) {
+        code[n - 2] = folded;
+        *pcount = n - 1;
+        return 1;
+    }
+
+    //
+    // x; 0; add  =>  x
+    if (optimize_is_identity(last->type, prev)) {
+        *pcount = n - 2;
+        return 1;
+    }
+
+    //
+    // x; c; sub  =>  x; -c; add
+    if ((last->type == WI_I32_SUB && prev->type == WI_I32_CONST)
+        || (last->type == WI_I64_SUB && prev->type == WI_I64_CONST)) {
+        if (prev->type == WI_I32_CONST) {
+            *prev = optimize_i32_const(0u - (u32) prev->data.i1);
+            last->type = WI_I32_ADD;
+        } else {
+            *prev = optimize_i64_const(0ull - (u64) prev->data.l);
+            last->type = WI_I64_ADD;
+        }
+
+        return 1;
+    }
+
+    //
+    // x; c1; add; c2; add  =>  x; c1 + c2; add
+    if (n >= 4 && (last->type == WI_I32_ADD || last->type == WI_I64_ADD)
+        && code[n - 3].type == last->type
+        && optimize_is_int_const(prev) && prev->type == code[n - 4].type) {
+        if (prev->type == WI_I32_CONST) {
+            code[n - 4] = optimize_i32_const((u32) code[n - 4].data.i1 + (u32) prev->data.i1);
+        } else {
+            code[n - 4] = optimize_i64_const((u64) code[n - 4].data.l + (u64) prev->data.l);
+        }
+
+        *pcount = n - 2;
+        return 1;
+    }
+
+    //
+    // p; c; add; load offset=k  =>  p; load offset=k+c
+    if (n >= 3 && optimize_is_plain_load(last->type)
+        && prev->type == WI_I32_ADD && code[n - 3].type == WI_I32_CONST) {
+        i64 offset = (i64) code[n - 3].data.i1 + (i64) last->data.i2;
+        if (code[n - 3].data.i1 >= 0 && offset <= 0x7fffffff) {
+            last->data.i2 = (i32) offset;
+            code[n - 3] = *last;
+            *pcount = n - 2;
+            return 1;
+        }
+    }
+
+    //
+    // p; c; add; v; store offset=k  =>  p; v; store offset=k+c
+    if (n >= 4 && optimize_is_plain_store(last->type)
+        && optimize_is_simple_producer(prev->type)
+        && code[n - 3].type == WI_I32_ADD && code[n - 4].type == WI_I32_CONST) {
+        i64 offset = (i64) code[n - 4].data.i1 + (i64) last->data.i2;
+        if (code[n - 4].data.i1 >= 0 && offset <= 0x7fffffff) {
+            last->data.i2 = (i32) offset;
+            code[n - 4] = *prev;
+            code[n - 3] = *last;
+            *pcount = n - 2;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void optimize_fold_constants(OptimizeContext *ctx, WasmFunc *func) {
+    WasmInstruction *code = func->code;
+    i32 count = 0;
+
+    fori (i, 0, bh_arr_length(func->code)) {
+        if (code[i].type == WI_NOP) continue;
+
+        code[count++] = code[i];
+        while (optimize_fold_end(code, &count));
+    }
+
+    bh_arr_set_length(func->code, count);
+}
+
+
+//
+// Copy propagation
+//
+// After `local.get a; local.set b` or `i32.const c; local.set b`, reads of `b`
+// are replaced with reads of `a`, or with the constant, until either local is
+// written again. Often that leaves the write to `b` without any reads, so dead
+// local elimination can remove it.
+//
+// Only straight-line code is considered; everything is forgotten at the start
+// of a loop, and wherever control flow merges (`else` and `end`).
+//
+
+static void optimize_copy_forget(OptimizeContext *ctx, WasmFunc *func, u32 local) {
+    ctx->has_source[local] = 0;
+
+    i32 write = 0;
+    bh_arr_each(i32, other, ctx->active) {
+        WasmInstruction *source = &ctx->sources[*other];
+        if (!ctx->has_source[*other]) continue;
+
+        if (source->type == WI_LOCAL_GET && local_lookup_idx(&func->locals, source->data.l) == local) {
+            ctx->has_source[*other] = 0;
+            continue;
+        }
+
+        ctx->active[write++] = *other;
+    }
+
+    bh_arr_set_length(ctx->active, write);
+}
+
+static void optimize_copy_forget_all(OptimizeContext *ctx) {
+    bh_arr_each(i32, local, ctx->active) ctx->has_source[*local] = 0;
+    bh_arr_clear(ctx->active);
+}
+
+static void optimize_propagate_copies(OptimizeContext *ctx, WasmFunc *func) {
+    u32 local_count = optimize_local_count(func);
+    OPTIMIZE_RESIZE(ctx->has_source, local_count);
+    OPTIMIZE_RESIZE(ctx->sources, local_count);
+    bh_arr_zero(ctx->has_source);
+    bh_arr_clear(ctx->active);
+
+    WasmInstruction *code = func->code;
+    fori (i, 0, bh_arr_length(func->code)) {
+        WasmInstruction *instr = &code[i];
+
+        switch (instr->type) {
+            case WI_LOOP_START:
+            case WI_ELSE:
+            case WI_BLOCK_END:
+                optimize_copy_forget_all(ctx);
+                break;
+
+            case WI_LOCAL_GET: {
+                u32 local = local_lookup_idx(&func->locals, instr->data.l);
+                if (ctx->has_source[local]) *instr = ctx->sources[local];
+                break;
+            }
+
+            case WI_LOCAL_SET:
+            case WI_LOCAL_TEE: {
+                u32 local = local_lookup_idx(&func->locals, instr->data.l);
+                optimize_copy_forget(ctx, func, local);
+
+                if (i == 0) break;
+
+                WasmInstruction *value = &code[i - 1];
+                if (value->type == WI_LOCAL_GET) {
+                    if (local_lookup_idx(&func->locals, value->data.l) == local) break;
+
+                } else if (!optimize_is_int_const(value)) {
+                    break;
+                }
+
+                ctx->sources[local] = *value;
+                ctx->has_source[local] = 1;
+                bh_arr_push(ctx->active, local);
+                break;
+            }
+
+            default: break;
+        }
+    }
+}
+
+
+//
+// Unreachable code removal
+//
+// An `if` or `br_if` whose condition is a constant always goes the same way, so
+// the arm that is never taken is removed, and the `if` becomes a `block`, which
+// keeps the branch depths of everything inside the same. Everything after an
+// unconditional branch, up to the `else` or `end` of its block, is removed too.
+//
+// Removing the code that calls a function can leave that function unreachable,
+// so this runs before unreachable functions are removed at the end of linking.
+//
+
+typedef enum OptimizeBlockKind {
+    Optimize_Block_Normal,
+    Optimize_Block_Then_Taken,
+    Optimize_Block_Else_Taken,
+} OptimizeBlockKind;
+
+static void optimize_remove_unreachable_code(OptimizeContext *ctx, WasmFunc *func) {
+    bh_arr_clear(ctx->block_stack);
+
+    WasmInstruction *code = func->code;
+    i32 prev = -1;       // The last live instruction that was not a nop.
+    i32 dead_depth = -1; // How many blocks deep into removed code, or -1 when live.
+
+    fori (i, 0, bh_arr_length(func->code)) {
+        WasmInstruction *instr = &code[i];
+        if (instr->type == WI_NOP) continue;
+
+        if (dead_depth >= 0) {
+            switch (instr->type) {
+                case WI_BLOCK_START:
+                case WI_LOOP_START:
+                case WI_IF_START:
+                    dead_depth++;
+                    instr->type = WI_NOP;
+                    continue;
+
+                case WI_ELSE: {
+                    if (dead_depth > 0) {
+                        instr->type = WI_NOP;
+                        continue;
+                    }
+
+                    // The other arm of an `if` can be reached, unless it is the
+                    // arm that was removed because the condition is constant.
+                    OptimizeBlockKind kind = bh_arr_last(ctx->block_stack);
+                    if (kind == Optimize_Block_Then_Taken) {
+                        instr->type = WI_NOP;
+                        continue;
+                    }
+
+                    if (kind == Optimize_Block_Else_Taken) {
+                        instr->type = WI_NOP;
+                    }
+
+                    dead_depth = -1;
+                    break;
+                }
+
+                case WI_BLOCK_END:
+                    if (dead_depth > 0) {
+                        dead_depth--;
+                        instr->type = WI_NOP;
+                        continue;
+                    }
+
+                    dead_depth = -1;
+                    break;
+
+                default:
+                    instr->type = WI_NOP;
+                    continue;
+            }
+        }
+
+        switch (instr->type) {
+            case WI_BLOCK_START:
+            case WI_LOOP_START:
+                bh_arr_push(ctx->block_stack, Optimize_Block_Normal);
+                break;
+
+            case WI_IF_START:
+                if (prev >= 0 && code[prev].type == WI_I32_CONST) {
+                    b32 taken = code[prev].data.i1 != 0;
+                    code[prev].type = WI_NOP;
+                    instr->type = WI_BLOCK_START;
+
+                    bh_arr_push(ctx->block_stack, taken ? Optimize_Block_Then_Taken : Optimize_Block_Else_Taken);
+                    if (!taken) dead_depth = 0;
+                } else {
+                    bh_arr_push(ctx->block_stack, Optimize_Block_Normal);
+                }
+                break;
+
+            case WI_ELSE:
+                if (bh_arr_last(ctx->block_stack) == Optimize_Block_Then_Taken) {
+                    instr->type = WI_NOP;
+                    dead_depth = 0;
+                }
+                break;
+
+            case WI_BLOCK_END:
+                // The `end` of the function does not have a block.
+                if (bh_arr_length(ctx->block_stack) > 0) bh_arr_pop(ctx->block_stack);
+                break;
+
+            case WI_COND_JUMP:
+                if (prev >= 0 && code[prev].type == WI_I32_CONST) {
+                    b32 taken = code[prev].data.i1 != 0;
+                    code[prev].type = WI_NOP;
+
+                    if (taken) {
+                        instr->type = WI_JUMP;
+                        dead_depth = 0;
+                    } else {
+                        instr->type = WI_NOP;
+                    }
+                }
+                break;
+
+            case WI_JUMP:
+            case WI_JUMP_TABLE:
+            case WI_RETURN:
+            case WI_UNREACHABLE:
+                dead_depth = 0;
+                break;
+
+            default: break;
+        }
+
+        if (instr->type != WI_NOP) prev = i;
+    }
+
+    optimize_remove_nops(func);
+}
+
+
+//
+// Redundant load/store removal
+//
+// Locals are the registers of WebAssembly, so most of this is about the loads
+// and stores of locals:
+//
+//     local.set x; local.get x   =>  local.tee x
+//     local.tee x; drop          =>  local.set x
+//     local.get x; local.set x   =>
+//     local.get x; local.tee x   =>  local.get x
+//     local.tee x; local.set x   =>  local.set x
+//
+// A value that is stored to memory and then immediately loaded back from the
+// same address is not loaded again:
+//
+//     local.get p; v; i32.store offset=k; local.get p; i32.load offset=k
+//         =>  local.get p; v; i32.store offset=k; v
+//
+
+static b32 optimize_same_local(WasmInstruction *a, WasmInstruction *b) {
+    return a->data.l == b->data.l;
+}
+
+static b32 optimize_redundant_end(WasmInstruction *code, i32 *pcount) {
+    i32 n = *pcount;
+    if (n < 2) return 0;
+
+    WasmInstruction *last = &code[n - 1];
+    WasmInstruction *prev = &code[n - 2];
+
+    if (last->type == WI_LOCAL_GET && prev->type == WI_LOCAL_SET && optimize_same_local(last, prev)) {
+        prev->type = WI_LOCAL_TEE;
+        *pcount = n - 1;
+        return 1;
+    }
+
+    if (last->type == WI_DROP && prev->type == WI_LOCAL_TEE) {
+        prev->type = WI_LOCAL_SET;
+        *pcount = n - 1;
+        return 1;
+    }
+
+    if (last->type == WI_LOCAL_SET && prev->type == WI_LOCAL_GET && optimize_same_local(last, prev)) {
+        *pcount = n - 2;
+        return 1;
+    }
+
+    if (last->type == WI_LOCAL_TEE && prev->type == WI_LOCAL_GET && optimize_same_local(last, prev)) {
+        *pcount = n - 1;
+        return 1;
+    }
+
+    if ((last->type == WI_LOCAL_SET || last->type == WI_LOCAL_TEE)
+        && prev->type == WI_LOCAL_TEE && optimize_same_local(last, prev)) {
+        *prev = *last;
+        *pcount = n - 1;
+        return 1;
+    }
+
+    if (n >= 5 && optimize_is_plain_load(last->type)
+        && prev->type == WI_LOCAL_GET
+        && optimize_load_matching_store(code[n - 3].type) == last->type
+        && code[n - 3].data.i2 == last->data.i2
+        && optimize_is_simple_producer(code[n - 4].type)
+        && code[n - 5].type == WI_LOCAL_GET && optimize_same_local(&code[n - 5], prev)) {
+        code[n - 2] = code[n - 4];
+        *pcount = n - 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void optimize_remove_redundant_accesses(OptimizeContext *ctx, WasmFunc *func) {
+    WasmInstruction *code = func->code;
+    i32 count = 0;
+
+    fori (i, 0, bh_arr_length(func->code)) {
+        if (code[i].type == WI_NOP) continue;
+
+        code[count++] = code[i];
+        while (optimize_redundant_end(code, &count));
+    }
+
+    bh_arr_set_length(func->code, count);
+}
+
+
+//
+// Dead local elimination
+//
+// Writes to locals that are never read are turned into `drop`s. So are writes
+// that are overwritten later in the same straight-line code, before being read.
+// Then the `drop`s remove the pure instructions that computed the dropped value.
+//
+
+static void optimize_kill_store(WasmInstruction *instr) {
+    if (instr->type == WI_LOCAL_SET) instr->type = WI_DROP;
+    else                             instr->type = WI_NOP;
+}
+
+static void optimize_simplify_drop(WasmInstruction *code, i32 drop_idx) {
+    i32 needed = 1;
+    i32 i = drop_idx - 1;
+
+    while (needed > 0 && i >= 0) {
+        WasmInstructionType t = code[i].type;
+
+        if (t == WI_NOP) {
+            i--;
+
+        } else if (optimize_is_simple_producer(t)) {
+            code[i--].type = WI_NOP;
+            needed--;
+
+        } else if (optimize_is_pure_unary(t)) {
+            code[i--].type = WI_NOP;
+
+        } else if (optimize_is_pure_binary(t)) {
+            code[i--].type = WI_NOP;
+            needed++;
+
+        } else if (t == WI_LOCAL_TEE) {
+            code[i].type = WI_LOCAL_SET;
+            needed--;
+            break;
+
+        } else {
+            break;
+        }
+    }
+
+    //
+    // Everything between the instruction that stopped the search and the
+    // original drop is a nop now, so there is room for the drops that are
+    // still needed.
+    for (i32 j = drop_idx; j > i; j--) {
+        if (needed > 0) {
+            code[j].type = WI_DROP;
+            needed--;
+        } else {
+            code[j].type = WI_NOP;
+        }
+    }
+}
+
+static void optimize_eliminate_dead_locals(OptimizeContext *ctx, WasmFunc *func) {
+    u32 local_count = optimize_local_count(func);
+    OPTIMIZE_RESIZE(ctx->counts, local_count);
+    OPTIMIZE_RESIZE(ctx->pending, local_count);
+    bh_arr_zero(ctx->counts);
+    bh_arr_clear(ctx->active);
+
+    WasmInstruction *code = func->code;
+    i32 code_length = bh_arr_length(func->code);
+
+    fori (i, 0, code_length) {
+        if (code[i].type == WI_LOCAL_GET) {
+            ctx->counts[local_lookup_idx(&func->locals, code[i].data.l)] += 1;
+        }
+    }
+
+    fori (i, 0, (i32) local_count) ctx->pending[i] = -1;
+
+    fori (i, 0, code_length) {
+        WasmInstruction *instr = &code[i];
+
+        if (optimize_is_control_flow(instr->type)) {
+            bh_arr_each(i32, local, ctx->active) ctx->pending[*local] = -1;
+            bh_arr_clear(ctx->active);
+            continue;
+        }
+
+        if (!optimize_is_local_access(instr->type)) continue;
+
+        u32 local = local_lookup_idx(&func->locals, instr->data.l);
+        if (instr->type == WI_LOCAL_GET) {
+            ctx->pending[local] = -1;
+            continue;
+        }
+
+        if (ctx->counts[local] == 0) {
+            optimize_kill_store(instr);
+            continue;
+        }
+
+        if (ctx->pending[local] >= 0) {
+            optimize_kill_store(&code[ctx->pending[local]]);
+        } else {
+            bh_arr_push(ctx->active, local);
+        }
+
+        ctx->pending[local] = i;
+    }
+
+    fori (i, 0, code_length) {
+        if (code[i].type == WI_DROP) optimize_simplify_drop(code, i);
+    }
+
+    optimize_remove_nops(func);
+}
+
+
+//
+// Local coalescing
+//
+// Locals of the same type whose live ranges do not overlap are merged into
+// one, and locals that are not used anymore are removed. Live ranges are
+// approximated with the range of instructions between the first and the last
+// use of a local. A local that is used inside of a loop could carry its value
+// around the loop, so its range covers the whole loop. A local that is read
+// before it is written could be reading its initial zero, so its range starts
+// at the beginning of the function.
+//
+
+static i32 optimize_local_group(u64 value) {
+    switch ((value >> 32) & 0xf) {
+        case 0x0: return 0;
+        case 0x1: return 1;
+        case 0x3: return 2;
+        case 0x7: return 3;
+        case 0xf: return 4;
+        default:  assert(0); return 0;
+    }
+}
+
+//
+// The locals are sorted by their first use, then by their index. Both are in
+// the key, so the comparison does not need the context. The passes can run on
+// more than one thread at once.
+static int optimize_compare_first_use(const void *a, const void *b) {
+    u64 key_a = *(u64 *) a;
+    u64 key_b = *(u64 *) b;
+    if (key_a != key_b) return key_a < key_b ? -1 : 1;
+    return 0;
+}
+
+static void optimize_coalesce_locals(OptimizeContext *ctx, WasmFunc *func) {
+    u32 local_count = optimize_local_count(func);
+    u32 param_count = func->locals.param_count;
+    if (local_count == param_count) return;
+
+    //
+    // Indices depend on how many locals of each type there are, so the old
+    // counts are needed to look up the old indices while rewriting.
+    LocalAllocator old_locals = func->locals;
+
+    OPTIMIZE_RESIZE(ctx->first,  local_count);
+    OPTIMIZE_RESIZE(ctx->last,   local_count);
+    OPTIMIZE_RESIZE(ctx->values, local_count);
+    bh_arr_clear(ctx->loops);
+    bh_arr_clear(ctx->block_stack);
+
+    fori (i, 0, (i32) local_count) ctx->first[i] = -1;
+
+    WasmInstruction *code = func->code;
+    i32 code_length = bh_arr_length(func->code);
+
+    fori (i, 0, code_length) {
+        WasmInstruction *instr = &code[i];
+
+        switch (instr->type) {
+            case WI_BLOCK_START:
+            case WI_IF_START:
+                bh_arr_push(ctx->block_stack, -1);
+                break;
+
+            case WI_LOOP_START:
+                bh_arr_push(ctx->block_stack, i);
+                break;
+
+            case WI_BLOCK_END: {
+                if (bh_arr_length(ctx->block_stack) == 0) break;
+
+                i32 start = bh_arr_pop(ctx->block_stack);
+                if (start >= 0) bh_arr_push(ctx->loops, ((OptimizeLoop) { start, i }));
+                break;
+            }
+
+            case WI_LOCAL_GET:
+            case WI_LOCAL_SET:
+            case WI_LOCAL_TEE: {
+                u32 local = local_lookup_idx(&func->locals, instr->data.l);
+                if (local < param_count) break;
+
+                if (ctx->first[local] < 0) {
+                    ctx->first[local]  = instr->type == WI_LOCAL_GET ? 0 : i;
+                    ctx->values[local] = instr->data.l;
+                }
+
+                ctx->last[local] = i;
+                break;
+            }
+
+            default: break;
+        }
+    }
+
+    bh_arr_clear(ctx->sorted);
+    fori (local, param_count, local_count) {
+        if (ctx->first[local] < 0) continue;
+
+        b32 changed = 1;
+        while (changed) {
+            changed = 0;
+            bh_arr_each(OptimizeLoop, loop, ctx->loops) {
+                if (loop->start > ctx->last[local] || loop->end < ctx->first[local]) continue;
+                if (loop->start >= ctx->first[local] && loop->end <= ctx->last[local]) continue;
+
+                ctx->first[local] = bh_min(ctx->first[local], loop->start);
+                ctx->last[local]  = bh_max(ctx->last[local],  loop->end);
+                changed = 1;
+            }
+        }
+
+        bh_arr_push(ctx->sorted, ((u64) ctx->first[local] << 32) | (u64) local);
+    }
+
+    qsort(ctx->sorted, bh_arr_length(ctx->sorted), sizeof(u64), optimize_compare_first_use);
+
+    //
+    // Locals are given new slots in order of their first use, reusing the first
+    // slot of the same type whose last local is no longer live.
+    fori (group, 0, 5) {
+        bh_arr_clear(ctx->slot_ends);
+
+        bh_arr_each(u64, pkey, ctx->sorted) {
+            i32 local = (i32) (*pkey & 0xffffffff);
+            if (optimize_local_group(ctx->values[local]) != group) continue;
+
+            i32 slot = -1;
+            fori (s, 0, bh_arr_length(ctx->slot_ends)) {
+                if (ctx->slot_ends[s] < ctx->first[local]) {
+                    slot = s;
+                    break;
+                }
+            }
+
+            if (slot < 0) {
+                slot = bh_arr_length(ctx->slot_ends);
+                bh_arr_push(ctx->slot_ends, 0);
+            }
+
+            ctx->slot_ends[slot] = ctx->last[local];
+            ctx->values[local] = (ctx->values[local] & ~0xffffffffull) | (u64) (param_count + slot);
+        }
+
+        func->locals.allocated[group] = bh_arr_length(ctx->slot_ends);
+        func->locals.freed[group] = 0;
+    }
+
+    fori (i, 0, code_length) {
+        WasmInstruction *instr = &code[i];
+        if (!optimize_is_local_access(instr->type)) continue;
+
+        u32 local = local_lookup_idx(&old_locals, instr->data.l);
+        if (local >= param_count) instr->data.l = ctx->values[local];
+    }
+}
+
+
+//
+// Inlining
+//
+// Calls to small functions are replaced with the code of the function. The
+// arguments are stored in new locals. If the function returns before its end,
+// the code is wrapped in a `block`, so the branch depths inside it stay the
+// same, and a `return` becomes a branch to the end of that block, with the
+// result stored in another new local.
+//
+// A function marked `#inline` is inlined regardless of its size, and a function
+// marked `#no_inline` never is. Recursive calls are never inlined.
+//
+// This runs after the first round of the other passes, so the sizes of the
+// functions are closer to their final sizes, and the second round can clean up
+// the inlined code in the context of the caller.
+//
+
+#define OPTIMIZE_INLINE_MAX_SIZE      24
+#define OPTIMIZE_INLINE_MAX_CALLER 10000
+
+static WasmType optimize_group_type(i32 group) {
+    static const WasmType types[] = {
+        WASM_TYPE_INT32, WASM_TYPE_INT64, WASM_TYPE_FLOAT32, WASM_TYPE_FLOAT64, WASM_TYPE_VAR128
+    };
+
+    return types[group];
+}
+
+static WasmType optimize_local_type(WasmFunc *func, WasmFuncType *type, u32 local) {
+    if (local < func->locals.param_count) return type->param_types[local];
+
+    local -= func->locals.param_count;
+    fori (group, 0, 5) {
+        if (local < func->locals.allocated[group]) return optimize_group_type(group);
+        local -= func->locals.allocated[group];
+    }
+
+    assert(0);
+    return WASM_TYPE_VOID;
+}
+
+static WasmFunc *optimize_inline_target(OptimizeContext *ctx, WasmFunc *caller, u64 func_idx) {
+    OnyxWasmModule *module = ctx->module;
+
+    if (func_idx < (u64) module->next_foreign_func_idx) return NULL;
+
+    WasmFunc *callee = &module->funcs[func_idx - module->next_foreign_func_idx];
+    if (callee == caller || callee->is_no_inline) return NULL;
+
+    WasmFuncType *type = module->types[callee->type_idx];
+    if (type->return_type == WASM_TYPE_VAR128 || callee->locals.allocated[4] > 0) return NULL;
+    fori (i, 0, type->param_count) {
+        if (type->param_types[i] == WASM_TYPE_VAR128) return NULL;
+    }
+
+    //
+    // A branch to the label of the function itself returns from the function.
+    // The block that replaces the function does not have a result, so this
+    // only works when the function does not return anything.
+    b32 has_result = type->return_type != WASM_TYPE_VOID;
+    i32 size = 0;
+    i32 depth = 0;
+
+    bh_arr_each(WasmInstruction, instr, callee->code) {
+        switch (instr->type) {
+            case WI_NOP: continue;
+
+            case WI_BLOCK_START:
+            case WI_LOOP_START:
+            case WI_IF_START:
+                depth++;
+                break;
+
+            case WI_BLOCK_END:
+                depth--;
+                break;
+
+            case WI_CALL:
+                if ((u64) instr->data.l == func_idx) return NULL;
+                break;
+
+            case WI_JUMP:
+            case WI_COND_JUMP:
+                if (has_result && instr->data.i1 == depth) return NULL;
+                break;
+
+            case WI_JUMP_TABLE: {
+                if (!has_result) break;
+
+                BranchTable *bt = (BranchTable *) instr->data.p;
+                if (bt->default_case == (u32) depth) return NULL;
+                fori (i, 0, bt->count) {
+                    if (bt->cases[i] == (u32) depth) return NULL;
+                }
+                break;
+            }
+
+            default: break;
+        }
+
+        size++;
+        if (size > OPTIMIZE_INLINE_MAX_SIZE && !callee->is_inline) return NULL;
+    }
+
+    return callee;
+}
+
+//
+// The code of a function can be inlined without a `block` around it, when it
+// only returns at the very end, and never branches to its own label.
+static b32 optimize_inline_needs_block(WasmFunc *callee, i32 *final_return) {
+    WasmInstruction *code = callee->code;
+
+    i32 last = bh_arr_length(callee->code) - 2;
+    while (last >= 0 && code[last].type == WI_NOP) last--;
+
+    *final_return = -1;
+    if (last >= 0) {
+        switch (code[last].type) {
+            case WI_RETURN: *final_return = last; break;
+
+            // The value would be missing from the stack after the inlined code.
+            case WI_JUMP:
+            case WI_JUMP_TABLE:
+            case WI_UNREACHABLE:
+                return 1;
+
+            default: break;
+        }
+    }
+
+    i32 depth = 0;
+    fori (i, 0, last + 1) {
+        switch (code[i].type) {
+            case WI_BLOCK_START:
+            case WI_LOOP_START:
+            case WI_IF_START:
+                depth++;
+                break;
+
+            case WI_BLOCK_END:
+                depth--;
+                break;
+
+            case WI_RETURN:
+                if (i != *final_return) return 1;
+                break;
+
+            case WI_JUMP:
+            case WI_COND_JUMP:
+                if (code[i].data.i1 == depth) return 1;
+                break;
+
+            case WI_JUMP_TABLE: {
+                BranchTable *bt = (BranchTable *) code[i].data.p;
+                if (bt->default_case == (u32) depth) return 1;
+                fori (j, 0, bt->count) {
+                    if (bt->cases[j] == (u32) depth) return 1;
+                }
+                break;
+            }
+
+            default: break;
+        }
+    }
+
+    return 0;
+}
+
+static void optimize_inline_call(OptimizeContext *ctx, WasmFunc *caller, WasmFunc *callee) {
+    WasmFuncType *type = ctx->module->types[callee->type_idx];
+    u32 param_count = callee->locals.param_count;
+    assert(param_count == (u32) type->param_count);
+
+    callee->was_inlined = 1;
+
+    i32 final_return;
+    b32 needs_block = optimize_inline_needs_block(callee, &final_return);
+
+    u32 local_count = optimize_local_count(callee);
+    OPTIMIZE_RESIZE(ctx->inline_locals, local_count);
+    fori (i, 0, (i32) local_count) ctx->inline_locals[i] = 0;
+
+    //
+    // The arguments are on the stack, with the last one on top.
+    fori (i, 0, (i32) param_count) {
+        ctx->inline_locals[i] = local_raw_allocate(&caller->locals, type->param_types[i]);
+    }
+
+    for (i32 i = param_count - 1; i >= 0; i--) {
+        bh_arr_push(ctx->inlined, ((WasmInstruction) { WI_LOCAL_SET, { .l = ctx->inline_locals[i] } }));
+    }
+
+    if (needs_block) {
+        bh_arr_push(ctx->inlined, ((WasmInstruction) { WI_BLOCK_START, { .l = 0x40 } }));
+    }
+
+    //
+    // The locals of the function start out as zero. When the inlined code runs
+    // in a loop, they would keep their values from the previous iteration, so
+    // they are cleared, unless they are always written before they are read.
+    i32 depth = 0;
+    bh_arr_each(WasmInstruction, instr, callee->code) {
+        switch (instr->type) {
+            case WI_BLOCK_START:
+            case WI_LOOP_START:
+            case WI_IF_START:
+                depth++;
+                break;
+
+            case WI_BLOCK_END:
+                depth--;
+                break;
+
+            case WI_LOCAL_GET:
+            case WI_LOCAL_SET:
+            case WI_LOCAL_TEE: {
+                u32 local = local_lookup_idx(&callee->locals, instr->data.l);
+                if (ctx->inline_locals[local] != 0) break;
+
+                WasmType wt = optimize_local_type(callee, type, local);
+                ctx->inline_locals[local] = local_raw_allocate(&caller->locals, wt);
+
+                if (instr->type == WI_LOCAL_GET || depth > 0) {
+                    WasmInstruction zero = { WI_I32_CONST, { .l = 0 } };
+                    if (wt == WASM_TYPE_INT64)   zero.type = WI_I64_CONST;
+                    if (wt == WASM_TYPE_FLOAT32) zero.type = WI_F32_CONST;
+                    if (wt == WASM_TYPE_FLOAT64) zero.type = WI_F64_CONST;
+
+                    bh_arr_push(ctx->inlined, zero);
+                    bh_arr_push(ctx->inlined, ((WasmInstruction) { WI_LOCAL_SET, { .l = ctx->inline_locals[local] } }));
+                }
+                break;
+            }
+
+            default: break;
+        }
+    }
+
+    //
+    // Without a block, the result is simply left on the stack. With one, the
+    // result is stored in a local by every `return`, and read after the block.
+    u64 result_local = 0;
+    if (needs_block && type->return_type != WASM_TYPE_VOID) {
+        result_local = local_raw_allocate(&caller->locals, type->return_type);
+    }
+
+    depth = 0;
+    fori (i, 0, bh_arr_length(callee->code)) {
+        WasmInstruction copy = callee->code[i];
+        if (i == final_return) continue;
+
+        switch (copy.type) {
+            case WI_NOP: continue;
+
+            case WI_BLOCK_START:
+            case WI_LOOP_START:
+            case WI_IF_START:
+                depth++;
+                break;
+
+            case WI_BLOCK_END:
+                depth--;
+                break;
+
+            case WI_LOCAL_GET:
+            case WI_LOCAL_SET:
+            case WI_LOCAL_TEE:
+                copy.data.l = ctx->inline_locals[local_lookup_idx(&callee->locals, copy.data.l)];
+                break;
+
+            case WI_RETURN:
+                if (result_local) {
+                    bh_arr_push(ctx->inlined, ((WasmInstruction) { WI_LOCAL_SET, { .l = result_local } }));
+                }
+
+                copy = (WasmInstruction) { WI_JUMP, { .l = depth } };
+                break;
+
+            default: break;
+        }
+
+        if (depth < 0) break;
+        bh_arr_push(ctx->inlined, copy);
+    }
+
+    if (!needs_block) return;
+
+    //
+    // The result is left on the stack when the end of the function is reached.
+    if (result_local) {
+        WasmInstructionType last = bh_arr_last(ctx->inlined).type;
+        if (last != WI_JUMP && last != WI_JUMP_TABLE && last != WI_UNREACHABLE) {
+            bh_arr_push(ctx->inlined, ((WasmInstruction) { WI_LOCAL_SET, { .l = result_local } }));
+        }
+    }
+
+    bh_arr_push(ctx->inlined, ((WasmInstruction) { WI_BLOCK_END, { .l = 0 } }));
+
+    if (result_local) {
+        bh_arr_push(ctx->inlined, ((WasmInstruction) { WI_LOCAL_GET, { .l = result_local } }));
+    }
+}
+
+static void optimize_inline_calls(OptimizeContext *ctx, WasmFunc *func) {
+    bh_arr_clear(ctx->inlined);
+
+    //
+    // Locals are only ever added, so the locals of the caller that were freed
+    // while it was generated cannot be handed out again.
+    fori (group, 0, 5) func->locals.freed[group] = 0;
+
+    b32 changed = 0;
+    bh_arr_each(WasmInstruction, instr, func->code) {
+        if (instr->type == WI_CALL && bh_arr_length(ctx->inlined) < OPTIMIZE_INLINE_MAX_CALLER) {
+            WasmFunc *callee = optimize_inline_target(ctx, func, instr->data.l);
+            if (callee) {
+                optimize_inline_call(ctx, func, callee);
+                ctx->inlined_calls += 1;
+                changed = 1;
+                continue;
+            }
+        }
+
+        bh_arr_push(ctx->inlined, *instr);
+    }
+
+    if (!changed) return;
+
+    OPTIMIZE_RESIZE(func->code, bh_arr_length(ctx->inlined));
+    memcpy(func->code, ctx->inlined, bh_arr_length(ctx->inlined) * sizeof(WasmInstruction));
+}
+
+
+static OptimizePass optimize_passes[] = {
+    { "Constant folding",             optimize_fold_constants },
+    { "Copy propagation",             optimize_propagate_copies },
+    { "Redundant access removal",     optimize_remove_redundant_accesses },
+    { "Dead local elimination",       optimize_eliminate_dead_locals },
+    { "Local coalescing",             optimize_coalesce_locals },
+    { "Unreachable code removal",     optimize_remove_unreachable_code },
+    { "Inlining",                     optimize_inline_calls, 1 },
+};
+
+#define OPTIMIZE_PASS_COUNT ((i32) (sizeof(optimize_passes) / sizeof(optimize_passes[0])))
+
+//
+// Removing instructions often makes more of the earlier passes possible, so
+// the pipeline runs twice before the locals are coalesced. Functions are
+// inlined in between.
+static const i32 optimize_pipeline[] = { 0, 5, 1, 0, 2, 3, 6, 0, 5, 1, 0, 2, 3, 2, 4 };
+
+static u64 optimize_count_instructions(OnyxWasmModule *module) {
+    u64 count = 0;
+    bh_arr_each(WasmFunc, func, module->funcs) {
+        bh_arr_each(WasmInstruction, instr, func->code) {
+            if (instr->type != WI_NOP) count += 1;
+        }
+    }
+
+    return count;
+}
+
+static void optimize_context_init(OptimizeContext *ctx, OnyxWasmModule *module) {
+    // The C heap is used, because the contexts of other threads allocate at the same time.
+    bh_allocator alloc = bh_heap_allocator();
+
+    memset(ctx, 0, sizeof *ctx);
+    bh_arr_new(alloc, ctx->counts, 64);
+    bh_arr_new(alloc, ctx->pending, 64);
+    bh_arr_new(alloc, ctx->active, 64);
+    bh_arr_new(alloc, ctx->has_source, 64);
+    bh_arr_new(alloc, ctx->sources, 64);
+    bh_arr_new(alloc, ctx->first, 64);
+    bh_arr_new(alloc, ctx->last, 64);
+    bh_arr_new(alloc, ctx->values, 64);
+    bh_arr_new(alloc, ctx->sorted, 64);
+    bh_arr_new(alloc, ctx->slot_ends, 64);
+    bh_arr_new(alloc, ctx->block_stack, 64);
+    bh_arr_new(alloc, ctx->loops, 64);
+    bh_arr_new(alloc, ctx->inlined, 256);
+    bh_arr_new(alloc, ctx->inline_locals, 64);
+    ctx->module = module;
+}
+
+static void optimize_context_free(OptimizeContext *ctx) {
+    bh_arr_free(ctx->counts);
+    bh_arr_free(ctx->pending);
+    bh_arr_free(ctx->active);
+    bh_arr_free(ctx->has_source);
+    bh_arr_free(ctx->sources);
+    bh_arr_free(ctx->first);
+    bh_arr_free(ctx->last);
+    bh_arr_free(ctx->values);
+    bh_arr_free(ctx->sorted);
+    bh_arr_free(ctx->slot_ends);
+    bh_arr_free(ctx->block_stack);
+    bh_arr_free(ctx->loops);
+    bh_arr_free(ctx->inlined);
+    bh_arr_free(ctx->inline_locals);
+}
+
+
+//
+// Running the pipeline
+//
+// Most passes only look at the function they work on, so the pipeline is split
+// into rounds at the passes that read other functions. In a round, a function
+// goes through every pass of the round before the next function is taken.
+//
+// With -j, the functions of a round are split between that many threads, each
+// with its own context. They take a few functions at a time, so a thread that
+// got small functions takes more of them. The passes that read other functions
+// always run on the main thread, over every function in the module, so the
+// output is the same with any number of threads.
+//
+
+#define OPTIMIZE_FUNCS_PER_TAKE 16
+
+typedef struct OptimizeRound {
+    OnyxWasmModule *module;
+    const i32 *passes;
+    i32 pass_count;
+
+    // The next function to be taken. Changed atomically.
+    i32 next_func;
+} OptimizeRound;
+
+typedef struct OptimizeWorker {
+    OptimizeRound  *round;
+    OptimizeContext ctx;
+    u64 microseconds[OPTIMIZE_PASS_COUNT];
+} OptimizeWorker;
+
+static i32 optimize_take_funcs(OptimizeRound *round) {
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    return __atomic_fetch_add(&round->next_func, OPTIMIZE_FUNCS_PER_TAKE, __ATOMIC_RELAXED);
+#else
+    i32 start = round->next_func;
+    round->next_func += OPTIMIZE_FUNCS_PER_TAKE;
+    return start;
+#endif
+}
+
+static void *optimize_run_worker(void *data) {
+    OptimizeWorker *worker = data;
+    OptimizeRound  *round  = worker->round;
+    i32 func_count = bh_arr_length(round->module->funcs);
+
+    while (1) {
+        i32 start = optimize_take_funcs(round);
+        if (start >= func_count) break;
+
+        fori (i, start, bh_min(start + OPTIMIZE_FUNCS_PER_TAKE, func_count)) {
+            WasmFunc *func = &round->module->funcs[i];
+
+            fori (p, 0, round->pass_count) {
+                i32 pass = round->passes[p];
+
+                u64 pass_start = bh_time_curr_micro();
+                optimize_passes[pass].run(&worker->ctx, func);
+                worker->microseconds[pass] += bh_time_curr_micro() - pass_start;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void optimize_run_round(OptimizeRound *round, OptimizeWorker *workers, i32 worker_count) {
+    fori (i, 0, worker_count) workers[i].round = round;
+
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    bh_arr(pthread_t) threads = NULL;
+    bh_arr_new(bh_heap_allocator(), threads, worker_count);
+
+    // If a thread cannot be created, the others take its functions.
+    fori (i, 1, worker_count) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, optimize_run_worker, &workers[i]) == 0) {
+            bh_arr_push(threads, thread);
+        }
+    }
+
+    optimize_run_worker(&workers[0]);
+
+    bh_arr_each(pthread_t, thread, threads) pthread_join(*thread, NULL);
+    bh_arr_free(threads);
+#else
+    optimize_run_worker(&workers[0]);
+#endif
+}
+
+void onyx_wasm_module_optimize(OnyxWasmModule *module) {
+    i32 worker_count = 1;
+#if defined(_BH_LINUX) || defined(_BH_DARWIN)
+    // Unlike reading files, the passes only use the processor, so more threads
+    // than processors would only take turns.
+    i32 processor_count = (i32) sysconf(_SC_NPROCESSORS_ONLN);
+    worker_count = bh_max(bh_min(context.options->thread_count, processor_count), 1);
+#endif
+
+    OptimizeWorker *workers = bh_alloc_array(global_heap_allocator, OptimizeWorker, worker_count);
+    memset(workers, 0, sizeof(OptimizeWorker) * worker_count);
+    fori (i, 0, worker_count) optimize_context_init(&workers[i].ctx, module);
+
+    u64 instructions_before = optimize_count_instructions(module);
+
+    i32 pipeline_length = (i32) (sizeof(optimize_pipeline) / sizeof(optimize_pipeline[0]));
+    i32 round_start = 0;
+
+    fori (i, 0, pipeline_length + 1) {
+        b32 at_end = i == pipeline_length;
+        if (!at_end && !optimize_passes[optimize_pipeline[i]].reads_other_funcs) continue;
+
+        if (i > round_start) {
+            OptimizeRound round = { 0 };
+            round.module = module;
+            round.passes = &optimize_pipeline[round_start];
+            round.pass_count = i - round_start;
+            optimize_run_round(&round, workers, worker_count);
+        }
+
+        if (!at_end) {
+            i32 pass = optimize_pipeline[i];
+
+            u64 start = bh_time_curr_micro();
+            bh_arr_each(WasmFunc, func, module->funcs) optimize_passes[pass].run(&workers[0].ctx, func);
+            workers[0].microseconds[pass] += bh_time_curr_micro() - start;
+        }
+
+        round_start = i + 1;
+    }
+
+    if (context.options->running_perf) {
+        u64 instructions_after = optimize_count_instructions(module);
+
+        // With more than one thread, these are the times of all threads added together.
+        fori (p, 0, OPTIMIZE_PASS_COUNT) {
+            u64 microseconds = 0;
+            fori (i, 0, worker_count) microseconds += workers[i].microseconds[p];
+
+            printf("| %27s | %10lu us |\n", optimize_passes[p].name, microseconds);
+        }
+        printf("| %27s | %10lu -> %lu |\n", "Instructions", instructions_before, instructions_after);
+        printf("| %27s | %10lu    |\n", "Inlined calls", workers[0].ctx.inlined_calls);
+        printf("\n");
+    }
+
+    fori (i, 0, worker_count) optimize_context_free(&workers[i].ctx);
+    bh_free(global_heap_allocator, workers);
+}
@@ -0,0 +1,280 @@
+// This file is directly included in src/wasm_emit.c.
+// It is separated because it needs to be able to output functions to measure them.
+
+//-------------------------------------------------
+// DEAD FUNCTION AND DATA ELIMINATION
+//-------------------------------------------------
+//
+// Everything that was emitted ends up in the module, even when nothing uses it.
+// This removes the functions that cannot be reached from an export or from the
+// function table, and the data segments that no reachable function or data
+// segment points to. The types that are no longer used are removed as well.
+//
+// This runs at the end of linking, so the addresses of the removed data are
+// already baked into the code. The data that stays does not move; the removed
+// data just leaves unused space in memory.
+//
+// It does not run when debug info is generated, because the debug info refers
+// to every function by its index.
+//
+
+typedef struct PruneInfo {
+    bh_arr(u8)  func_live;
+    bh_arr(i32) func_worklist;
+
+    bh_arr(u8)  data_live;
+    bh_arr(i32) data_worklist;
+    bh_arr(i32) first_data_patch; // Indexed by datum, the first patch that writes into it.
+    bh_arr(i32) next_data_patch;  // Indexed by patch, the next patch that writes into the same datum.
+
+    bh_arr(i32) func_remap;
+    bh_arr(i32) type_remap;
+    bh_arr(i32) data_remap;
+} PruneInfo;
+
+static void prune_mark_func(PruneInfo *info, OnyxWasmModule *module, i32 func_idx) {
+    // Imported functions are not part of module->funcs, and are always kept.
+    func_idx -= module->next_foreign_func_idx;
+    if (func_idx < 0 || func_idx >= bh_arr_length(info->func_live)) return;
+    if (info->func_live[func_idx]) return;
+
+    info->func_live[func_idx] = 1;
+    bh_arr_push(info->func_worklist, func_idx);
+}
+
+static void prune_mark_data(PruneInfo *info, u32 data_id) {
+    i32 idx = (i32) data_id - 1;
+    if (idx < 0 || idx >= bh_arr_length(info->data_live)) return;
+    if (info->data_live[idx]) return;
+
+    info->data_live[idx] = 1;
+    bh_arr_push(info->data_worklist, idx);
+}
+
+static void prune_find_reachable(PruneInfo *info, OnyxWasmModule *module) {
+    fori (i, 0, shlen(module->exports)) {
+        WasmExport *export = &module->exports[i].value;
+        if (export->kind == WASM_FOREIGN_FUNCTION) prune_mark_func(info, module, export->idx);
+    }
+
+    bh_arr_each(i32, elem, module->elems) prune_mark_func(info, module, *elem);
+
+    while (bh_arr_length(info->func_worklist) > 0) {
+        WasmFunc *func = &module->funcs[bh_arr_pop(info->func_worklist)];
+
+        bh_arr_each(WasmInstruction, instr, func->code) {
+            if (instr->type == WI_CALL) prune_mark_func(info, module, (i32) instr->data.l);
+        }
+    }
+
+    //
+    // Data is referenced through the patches that put its address into code or
+    // other data. The patches that write into a datum are chained together, so
+    // everything a datum points to can be found quickly.
+    bh_arr_each(DatumPatchInfo, patch, module->data_patches) {
+        i32 patch_idx = patch - module->data_patches;
+
+        switch (patch->kind) {
+            case Datum_Patch_Instruction:
+                // The instructions of a function that was inlined live on in
+                // its callers, even when the function itself is removed.
+                if (info->func_live[patch->index] || module->funcs[patch->index].was_inlined) {
+                    prune_mark_data(info, patch->data_id);
+                }
+                break;
+
+            case Datum_Patch_Data:
+            case Datum_Patch_Relative:
+                info->next_data_patch[patch_idx] = info->first_data_patch[patch->index - 1];
+                info->first_data_patch[patch->index - 1] = patch_idx;
+                break;
+        }
+    }
+
+    while (bh_arr_length(info->data_worklist) > 0) {
+        i32 datum_idx = bh_arr_pop(info->data_worklist);
+
+        for (i32 p = info->first_data_patch[datum_idx]; p >= 0; p = info->next_data_patch[p]) {
+            prune_mark_data(info, module->data_patches[p].data_id);
+        }
+    }
+}
+
+static i32 prune_func_size(WasmFunc *func) {
+    bh_buffer buff;
+    bh_buffer_init(&buff, global_heap_allocator, 128);
+    output_code(func, &buff);
+
+    i32 size = buff.length;
+    bh_buffer_free(&buff);
+    return size;
+}
+
+void onyx_wasm_module_prune(OnyxWasmModule *module) {
+    i32 func_count = bh_arr_length(module->funcs);
+    i32 data_count = bh_arr_length(module->data);
+    i32 type_count = bh_arr_length(module->types);
+    i32 patch_count = bh_arr_length(module->data_patches);
+    i32 foreign_count = module->next_foreign_func_idx;
+
+    PruneInfo info = { 0 };
+    bh_arr_new(global_heap_allocator, info.func_live, func_count);
+    bh_arr_new(global_heap_allocator, info.func_worklist, 64);
+    bh_arr_new(global_heap_allocator, info.data_live, data_count);
+    bh_arr_new(global_heap_allocator, info.data_worklist, 64);
+    bh_arr_new(global_heap_allocator, info.first_data_patch, data_count);
+    bh_arr_new(global_heap_allocator, info.next_data_patch, patch_count);
+    bh_arr_new(global_heap_allocator, info.func_remap, func_count);
+    bh_arr_new(global_heap_allocator, info.type_remap, type_count);
+    bh_arr_new(global_heap_allocator, info.data_remap, data_count);
+
+    bh_arr_set_length(info.func_live, func_count);
+    bh_arr_set_length(info.data_live, data_count);
+    bh_arr_set_length(info.first_data_patch, data_count);
+    bh_arr_set_length(info.next_data_patch, patch_count);
+    bh_arr_set_length(info.func_remap, func_count);
+    bh_arr_set_length(info.type_remap, type_count);
+    bh_arr_set_length(info.data_remap, data_count);
+
+    bh_arr_zero(info.func_live);
+    bh_arr_zero(info.data_live);
+    fori (i, 0, data_count)  info.first_data_patch[i] = -1;
+    fori (i, 0, patch_count) info.next_data_patch[i] = -1;
+    fori (i, 0, type_count)  info.type_remap[i] = -1;
+
+    prune_find_reachable(&info, module);
+
+    //
+    // Types are kept if a function, an import or an indirect call uses them.
+    bh_arr_each(WasmImport, import, module->imports) {
+        if (import->kind == WASM_FOREIGN_FUNCTION) info.type_remap[import->idx] = 0;
+    }
+
+    fori (i, 0, func_count) {
+        if (!info.func_live[i]) continue;
+
+        info.type_remap[module->funcs[i].type_idx] = 0;
+        bh_arr_each(WasmInstruction, instr, module->funcs[i].code) {
+            if (instr->type == WI_CALL_INDIRECT) info.type_remap[instr->data.i1] = 0;
+        }
+    }
+
+    i32 bytes_saved = 0;
+
+    i32 live_types = 0;
+    fori (i, 0, type_count) {
+        if (info.type_remap[i] < 0) continue;
+
+        info.type_remap[i] = live_types;
+        module->types[live_types++] = module->types[i];
+    }
+
+    i32 live_funcs = 0;
+    fori (i, 0, func_count) {
+        if (!info.func_live[i]) {
+            info.func_remap[i] = -1;
+            bytes_saved += prune_func_size(&module->funcs[i]) + 1;
+            continue;
+        }
+
+        info.func_remap[i] = live_funcs;
+        module->funcs[live_funcs++] = module->funcs[i];
+    }
+
+    i32 live_data = 0;
+    fori (i, 0, data_count) {
+        if (!info.data_live[i]) {
+            info.data_remap[i] = -1;
+            bytes_saved += module->data[i].length + 4;
+            continue;
+        }
+
+        info.data_remap[i] = live_data;
+        module->data[live_data] = module->data[i];
+        module->data[live_data].id = live_data + 1;
+        live_data++;
+    }
+
+    i32 removed_funcs = func_count - live_funcs;
+    i32 removed_types = type_count - live_types;
+    i32 removed_data  = data_count - live_data;
+
+    bh_arr_set_length(module->types, live_types);
+    bh_arr_set_length(module->funcs, live_funcs);
+    bh_arr_set_length(module->data,  live_data);
+
+    //
+    // Everything that refers to a function, a type or a data segment by its
+    // index has to be updated.
+    bh_arr_each(WasmFunc, func, module->funcs) {
+        func->type_idx = info.type_remap[func->type_idx];
+
+        bh_arr_each(WasmInstruction, instr, func->code) {
+            switch (instr->type) {
+                case WI_CALL:
+                    if ((i64) instr->data.l >= foreign_count) {
+                        instr->data.l = info.func_remap[instr->data.l - foreign_count] + foreign_count;
+                    }
+                    break;
+
+                case WI_CALL_INDIRECT:
+                    instr->data.i1 = info.type_remap[instr->data.i1];
+                    break;
+
+                case WI_MEMORY_INIT: {
+                    // These only appear in __initialize_data_segments, as
+                    // `dest; src; length; memory.init`. The whole sequence is
+                    // removed if its data segment was.
+                    i32 new_idx = info.data_remap[instr->data.i1];
+                    if (new_idx >= 0) {
+                        instr->data.i1 = new_idx;
+                    } else {
+                        fori (j, 0, 4) instr[-j].type = WI_NOP;
+                    }
+                    break;
+                }
+
+                default: break;
+            }
+        }
+    }
+
+    bh_arr_each(WasmImport, import, module->imports) {
+        if (import->kind == WASM_FOREIGN_FUNCTION) import->idx = info.type_remap[import->idx];
+    }
+
+    bh_arr_each(i32, elem, module->elems) {
+        if (*elem >= foreign_count) *elem = info.func_remap[*elem - foreign_count] + foreign_count;
+    }
+
+    fori (i, 0, shlen(module->exports)) {
+        WasmExport *export = &module->exports[i].value;
+        if (export->kind == WASM_FOREIGN_FUNCTION && export->idx >= foreign_count) {
+            export->idx = info.func_remap[export->idx - foreign_count] + foreign_count;
+        }
+    }
+
+    bh_arr_each(AstFunction *, pfunc, module->all_procedures) {
+        AstFunction *func = *pfunc;
+        if (func->is_foreign || !bh_imap_has(&module->index_map, (u64) func)) continue;
+
+        i32 new_idx = info.func_remap[bh_imap_get(&module->index_map, (u64) func)];
+        if (new_idx >= 0) bh_imap_put(&module->index_map, (u64) func, new_idx);
+        else              bh_imap_delete(&module->index_map, (u64) func);
+    }
+
+    if (context.options->verbose_output > 0) {
+        bh_printf("Removed %d unreachable functions, %d types and %d data segments, saving about %d bytes.\n",
+            removed_funcs, removed_types, removed_data, bytes_saved);
+    }
+
+    bh_arr_free(info.func_live);
+    bh_arr_free(info.func_worklist);
+    bh_arr_free(info.data_live);
+    bh_arr_free(info.data_worklist);
+    bh_arr_free(info.first_data_patch);
+    bh_arr_free(info.next_data_patch);
+    bh_arr_free(info.func_remap);
+    bh_arr_free(info.type_remap);
+    bh_arr_free(info.data_remap);
+}
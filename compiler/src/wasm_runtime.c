@@ -553,7 +553,9 @@ static b32 link_wasm_imports(
     return 1;
 }
 
-void onyx_run_initialize(b32 debug_enabled) {
+void onyx_run_initialize(OnyxRunOptions *options) {
+    b32 debug_enabled = options->debug_enabled;
+
     wasm_config = wasm_config_new();
     if (!wasm_config) {
         cleanup_wasm_objects();
@@ -574,6 +576,32 @@ void onyx_run_initialize(b32 debug_enabled) {
         void wasm_config_set_listen_path(wasm_config_t *config, char *listen_path);
         wasm_config_set_listen_path(wasm_config, socket_path);
     #endif
+
+    void wasm_config_enable_instr_stats(wasm_config_t *config, int value);
+    wasm_config_enable_instr_stats(wasm_config, options->ovm_instr_stats);
+
+    void wasm_config_enable_superinstructions(wasm_config_t *config, int value);
+    wasm_config_enable_superinstructions(wasm_config, !options->ovm_no_superinstructions);
+
+    void wasm_config_enable_jit(wasm_config_t *config, int value);
+    wasm_config_enable_jit(wasm_config, options->ovm_jit);
+
+    // Translated programs are cached in $XDG_CACHE_HOME/onyx/ovm, or
+    // ~/.cache/onyx/ovm, so running the same program again skips translation.
+    if (!options->ovm_no_cache) {
+        char *cache_dir = NULL;
+        if (getenv("XDG_CACHE_HOME")) {
+            cache_dir = bh_aprintf(bh_heap_allocator(), "%s/onyx/ovm", getenv("XDG_CACHE_HOME"));
+        } else if (getenv("HOME")) {
+            cache_dir = bh_aprintf(bh_heap_allocator(), "%s/.cache/onyx/ovm", getenv("HOME"));
+        }
+
+        void wasm_config_set_program_cache_dir(wasm_config_t *config, char *dir);
+        if (cache_dir) wasm_config_set_program_cache_dir(wasm_config, cache_dir);
+    }
+
+    void wasm_config_set_profile_path(wasm_config_t *config, char *path);
+    wasm_config_set_profile_path(wasm_config, options->ovm_profile_path);
 #endif
 
 #ifndef USE_OVM_DEBUGGER
@@ -692,6 +720,16 @@ b32 onyx_run_wasm(bh_buffer wasm_bytes, int argc, char *argv[]) {
 #endif
 
 end:
-    cleanup_wasm_objects();
+    //
+    // Threads are joined by waiting for them to call _thread_exit, so they can
+    // still be running the rest of their exit when the main thread gets here.
+    // They use the store and the engine until the very end, so those are left
+    // for the process exit to clean up.
+#ifdef USE_OVM_DEBUGGER
+    void wasm_module_report(wasm_module_t *module);
+    if (wasm_module) wasm_module_report(wasm_module);
+#endif
+
+    if (wasm_instance) wasm_instance_delete(wasm_instance);
     return run_trap == NULL;
 }
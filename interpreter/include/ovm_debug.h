@@ -321,6 +321,11 @@ typedef struct debug_thread_state_t {
 
     u32 last_breakpoint_hit;
 
+    // When the thread pauses for any other reason right before an instruction
+    // with a breakpoint, the breakpoint is skipped when the thread resumes, so
+    // the thread does not pause twice in the same place.
+    i32 skip_breakpoint_at;
+
     u32 state_change_write_fd;
 } debug_thread_state_t;
 
@@ -345,6 +350,17 @@ typedef struct debug_state_t {
     u32 next_breakpoint_id;
     bh_arr(debug_breakpoint_t) breakpoints;
 
+    //
+    // Breakpoints are set by patching the code of the program. The code is
+    // copied before anything is patched, so the original instructions can be
+    // run and restored.
+    struct ovm_program_t *program;
+    struct ovm_instr_t *original_code;
+    u32 instruction_count;
+
+    // Bit `i` is set when instruction `i` is the first one of a source line.
+    u64 *line_boundaries;
+
     pthread_t debug_thread;
     bool debug_thread_running;
 
@@ -361,6 +377,14 @@ void debug_host_start(debug_state_t *debug);
 void debug_host_stop(debug_state_t *debug);
 u32  debug_host_register_thread(debug_state_t *debug, struct ovm_state_t *ovm_state);
 debug_thread_state_t *debug_host_lookup_thread(debug_state_t *debug, u32 id);
+void debug_host_attach_program(debug_state_t *debug, struct ovm_program_t *program);
+void debug_host_patch_breakpoint(debug_state_t *debug, u32 instr);
+void debug_host_unpatch_breakpoint(debug_state_t *debug, u32 instr);
+
+static inline bool debug_host_is_line_boundary(debug_state_t *debug, u32 instr) {
+    if (!debug->line_boundaries || instr >= debug->instruction_count) return false;
+    return (debug->line_boundaries[instr >> 6] >> (instr & 63)) & 1;
+}
 
 
 
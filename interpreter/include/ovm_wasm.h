@@ -10,10 +10,26 @@
 struct wasm_config_t {
     bool debug_enabled;
     char *listen_path;
+
+    bool instr_stats_enabled;
+    bool superinstructions_enabled;
+    bool jit_enabled;
+
+    // When set, translated programs are cached in this directory.
+    char *program_cache_dir;
+
+    // When set, the running program is profiled, and the profile is written
+    // to this file by wasm_module_report.
+    char *profile_path;
 };
 
 void wasm_config_enable_debug(wasm_config_t *config, bool enabled);
 void wasm_config_set_listen_path(wasm_config_t *config, char *listen_path);
+void wasm_config_enable_instr_stats(wasm_config_t *config, bool enabled);
+void wasm_config_enable_superinstructions(wasm_config_t *config, bool enabled);
+void wasm_config_enable_jit(wasm_config_t *config, bool enabled);
+void wasm_config_set_program_cache_dir(wasm_config_t *config, char *dir);
+void wasm_config_set_profile_path(wasm_config_t *config, char *path);
 
 struct wasm_engine_t {
     wasm_config_t *config;
@@ -30,6 +46,11 @@ struct wasm_store_t {
 
 // Types
 
+//
+// wasm.h does not have a kind for v128 values, so one is defined here that does
+// not collide with any of the standard kinds.
+#define WASM_V128 ((wasm_valkind_t) 4)
+
 struct wasm_valtype_t {
     wasm_valkind_t kind;
 };
@@ -168,6 +189,8 @@ struct wasm_module_t {
     debug_info_t debug_info;
 };
 
+void wasm_module_report(wasm_module_t *module);
+
 struct wasm_func_inner_t {
     bool env_present;
     void *env;
@@ -23,6 +23,10 @@ typedef struct ovm_value_t ovm_value_t;
 typedef struct ovm_instr_t ovm_instr_t;
 typedef struct ovm_static_data_t ovm_static_data_t;
 typedef struct ovm_static_integer_array_t ovm_static_integer_array_t;
+typedef struct ovm_jit_t ovm_jit_t;
+typedef struct ovm_profiler_t ovm_profiler_t;
+
+typedef void (*ovm_jit_func_t)(ovm_state_t *state, ovm_value_t *values, u8 *memory, ovm_value_t *result);
 
 
 //
@@ -70,6 +74,18 @@ struct ovm_value_t {
         u64 u64;
         f32 f32;
         f64 f64;
+
+        // Lanes of a v128 value.
+        i8  i8x16[16];
+        u8  u8x16[16];
+        i16 i16x8[8];
+        u16 u16x8[8];
+        i32 i32x4[4];
+        u32 u32x4[4];
+        i64 i64x2[2];
+        u64 u64x2[2];
+        f32 f32x4[4];
+        f64 f64x2[2];
     };
     ovm_valtype_t type;
 };
@@ -110,22 +126,89 @@ void ovm_program_modify_static_int(ovm_program_t *program, int arr, int idx, int
 struct ovm_engine_t {
     ovm_store_t *store;
 
-    pthread_mutex_t atomic_mutex;
-
-    i64   memory_size; // This is probably going to always be 4GiB.
+    //
+    // Linear memory is placed at the start of a single reservation that never
+    // moves. Only the first memory_size bytes are readable and writable; the
+    // rest of the reservation is left PROT_NONE, so any access past the end of
+    // memory faults and is turned into a trap. See ovm_engine_memory_ensure_capacity.
+    i64   memory_size;
+    i64   memory_reserved;
     void *memory;
 
     debug_state_t *debug;
+
+    //
+    // When non-NULL, every dynamically executed pair of instructions is
+    // counted here, indexed by (OVM_INSTR_INSTR(prev) << 8) | OVM_INSTR_INSTR(next).
+    // The counts are not synchronized between threads, so they are only
+    // approximate for multi-threaded programs.
+    u64 *instr_pair_counts;
+
+    //
+    // Whether programs built for this engine should have superinstructions
+    // fused into them. This is always disabled when debugging.
+    bool fuse_superinstructions;
+
+    //
+    // When non-NULL, functions that are called often enough are translated
+    // to native code. See jit.c.
+    ovm_jit_t *jit;
+
+    //
+    // When non-NULL, the running states are sampled on a CPU time timer.
+    // See profiler.c.
+    ovm_profiler_t *profiler;
 };
 
+//
+// A 32-bit address plus a 32-bit offset is always below 8GiB, so reserving that
+// much address space (and one more wasm page, for the width of the access)
+// means no load or store can reach outside of the reservation.
+#define OVM_MEMORY_RESERVATION_SIZE ((1ll << 33) + (1ll << 16))
+
 ovm_engine_t *ovm_engine_new(ovm_store_t *store);
 void          ovm_engine_delete(ovm_engine_t *engine);
 void          ovm_engine_enable_debug(ovm_engine_t *engine, debug_state_t *debug);
+void          ovm_engine_enable_instr_stats(ovm_engine_t *engine);
+void          ovm_engine_print_instr_stats(ovm_engine_t *engine);
+void          ovm_engine_enable_jit(ovm_engine_t *engine);
+void          ovm_engine_enable_profiler(ovm_engine_t *engine, i32 interval_us);
+bool          ovm_engine_write_profile(ovm_engine_t *engine, ovm_program_t *program, debug_info_t *info, char *filename);
 bool          ovm_engine_memory_ensure_capacity(ovm_engine_t *engine, i64 minimum_size);
 void          ovm_engine_memory_copy(ovm_engine_t *engine, i64 target, void *data, i64 size);
 
 bool ovm_program_load_from_file(ovm_program_t *program, ovm_engine_t *engine, char *filename);
 
+//
+// Program images
+//
+// An image holds everything that was added to a program (and its debug info)
+// after a mark was taken, so a translated program can be saved to disk and
+// loaded again without translating it. An image is only loaded into a program
+// that is in exactly the same state as when the mark was taken, and whose key
+// matches. The key should cover everything that the translation depends on.
+// See program_loader.c for the format.
+//
+
+#define OVM_PROGRAM_IMAGE_VERSION 2
+
+typedef struct ovm_program_mark_t {
+    i32 code_count;
+    i32 func_count;
+    i32 static_data_count;
+    i32 static_integer_count;
+
+    i32 line_info_count;
+    i32 instruction_reducer_count;
+    i32 symbol_scope_count;
+    i32 file_count;
+} ovm_program_mark_t;
+
+void ovm_program_mark(ovm_program_t *program, debug_info_t *debug, ovm_program_mark_t *mark);
+bool ovm_program_image_save(ovm_program_t *program, debug_info_t *debug, ovm_program_mark_t *mark, u64 key, char *filename);
+bool ovm_program_image_load(ovm_program_t *program, debug_info_t *debug, u64 key, char *filename);
+u64  ovm_program_image_key(u8 *data, i64 size, u32 flags);
+
 //
 // Represents ephemeral state / execution context.
 // If multiple threads are used, multiple states are needed.
@@ -133,6 +216,13 @@ bool ovm_program_load_from_file(ovm_program_t *program, ovm_engine_t *engine, ch
 
 #define OVM_MAX_PARAM_COUNT 64
 
+//
+// Every state reserves room for this many value numbers and stack frames when
+// it is created. The reservations never move, so calling and returning only
+// bump a pointer. Going past either one is reported as a stack overflow.
+#define OVM_MAX_VALUE_NUMBERS (1 << 21)
+#define OVM_MAX_STACK_FRAMES  (1 << 17)
+
 struct ovm_state_t {
     ovm_store_t *store;
     ovm_engine_t *engine;
@@ -141,8 +231,12 @@ struct ovm_state_t {
     i32 pc;
     i32 value_number_offset;
 
-    bh_arr(ovm_value_t) numbered_values;
-    bh_arr(ovm_stack_frame_t) stack_frames;
+    ovm_value_t       *numbered_values;
+    i32                numbered_values_count;
+
+    ovm_stack_frame_t *stack_frames;
+    i32                stack_frame_count;
+
     bh_arr(ovm_value_t) registers;
 
     ovm_value_t *param_buf;
@@ -160,12 +254,20 @@ struct ovm_state_t {
     // Temporary value used in computations. Should not be used otherwise.
     ovm_value_t __tmp_value;
 
+    //
+    // The value returned by the last call to ovm_run_code. See vm_instrs.h.
+    ovm_value_t __return_value;
+
     //
     // TODO Doc
     ovm_value_t *__frame_values;
 
     debug_thread_state_t *debug;
     i32                   call_depth;
+
+    //
+    // How many jitted functions are currently on the native stack.
+    i32 jit_depth;
 };
 
 ovm_state_t *ovm_state_new(ovm_engine_t *engine, ovm_program_t *program);
@@ -175,6 +277,10 @@ void ovm_state_register_external_func(ovm_state_t *state, i32 idx, void (*func)(
 ovm_value_t ovm_state_register_get(ovm_state_t *state, i32 idx);
 void ovm_state_register_set(ovm_state_t *state, i32 idx, ovm_value_t val);
 
+//
+// The state that is running on this thread, if any.
+extern _Thread_local ovm_state_t *ovm__current_state;
+
 //
 //
 struct ovm_stack_frame_t {
@@ -184,6 +290,11 @@ struct ovm_stack_frame_t {
 
     i32 return_address;
     i32 return_number_value;
+
+    //
+    // Set when this frame is being interpreted on behalf of jitted code,
+    // so the interpreter has to return to it instead of continuing.
+    bool return_to_jit;
 };
 
 
@@ -209,6 +320,13 @@ struct ovm_func_t {
         i32 start_instr;
         i32 external_func_idx;
     };
+
+    //
+    // Only used when the JIT is enabled. `call_count` is not synchronized
+    // between threads, so it is only approximate.
+    u32             call_count;
+    ovm_jit_func_t  jit_func;
+    char           *jit_failure;
 };
 
 struct ovm_external_func_t {
@@ -229,6 +347,62 @@ void         ovm_func_delete(ovm_func_t *func);
 ovm_value_t ovm_func_call(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program, i32 func_idx,
         i32 param_count, ovm_value_t *params);
 ovm_value_t ovm_run_code(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program);
+void        ovm_print_stack_trace(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program);
+
+//
+// Rewrites common instruction sequences in [start_instr, end_instr) into
+// superinstructions. See superinstructions.c for the list of fusions.
+void ovm_program_fuse_superinstructions(ovm_program_t *program, i32 start_instr, i32 end_instr);
+
+//
+// Baseline JIT
+//
+// Internal functions count how many times they are called, and once a function
+// has been called OVM_JIT_CALL_THRESHOLD times it is translated to native code.
+// Functions that cannot be translated, and every function while the debugger is
+// attached, stay in the interpreter. Only x86-64 is supported currently.
+//
+
+#define OVM_JIT_CALL_THRESHOLD 1000
+
+//
+// Jitted code uses the native stack, so after this many nested jitted calls
+// everything else is interpreted.
+#define OVM_JIT_MAX_DEPTH 1024
+
+struct ovm_jit_t {
+    pthread_mutex_t lock;
+
+    u8 *code;
+    i64 code_size;
+    i64 code_used;
+};
+
+ovm_jit_t *ovm_jit_new();
+void       ovm_jit_delete(ovm_jit_t *jit);
+bool       ovm_jit_compile_func(ovm_jit_t *jit, ovm_program_t *program, ovm_func_t *func);
+void       ovm_program_print_jit_stats(ovm_program_t *program);
+
+
+//
+// Sampling profiler
+//
+struct ovm_profiler_t {
+    i32 interval_us;
+
+    u32 *samples;
+    u64  sample_words;
+    u64  sample_capacity;
+    u64  dropped_samples;
+};
+
+void ovm_profiler_delete(ovm_profiler_t *profiler);
+
+//
+// These are called from jitted code.
+void  ovm__jit_call(ovm_state_t *state, i32 func_idx, i32 result_number);
+void  ovm__jit_call_internal(ovm_state_t *state, i32 func_idx, i32 result_number);
+void *ovm__single_instr_handler(u32 full_instr);
 
 //
 // Instruction encoding
@@ -261,8 +435,6 @@ struct ovm_instr_t {
 #define OVM_INSTR_INSTR(instr) (((instr).full_instr >> 3) & 0xff)
 #define OVM_INSTR_MASK         0x7ff
 
-#define OVMI_ATOMIC            0x00800000 // Flag an instruction as atomic
-
 #define OVMI_NOP               0x00
 #define OVMI_ADD               0x01   // %r = %a + %b
 #define OVMI_SUB               0x02   // %r = %a - %b
@@ -359,6 +531,140 @@ struct ovm_instr_t {
 #define OVMI_MEM_SIZE          0x4e   // %r = <size in bytes of memory>
 #define OVMI_MEM_GROW          0x4f   // %r = <grow memory, return new size in bytes>
 
+//
+// Superinstructions
+//
+// These are never emitted by the code builder directly. They are produced by
+// ovm_program_fuse_superinstructions, which overwrites the first instruction of
+// a sequence with one of these. The rest of the sequence is left untouched, so
+// a branch into the middle of a fused sequence still executes correctly. The
+// superinstruction reads its extra operands from the instructions following it
+// and then skips over them.
+#define OVMI_ADD_IMM           0x50   // %r = i; (next) %r' = %a' + %b'; skip 1
+#define OVMI_LOAD_IDX          0x51   // %r = %a + %b; (next) %r' = mem[%r + b']; skip 1
+#define OVMI_PARAM_CALL        0x52   // push %a, then the next r-1 params; call; skip r
+
+#define OVMI_BR_EQ             0x53   // %r = %a == %b; (next) br_z/br_nz on %r; skip 1
+#define OVMI_BR_NE             0x54   // %r = %a != %b; ...
+#define OVMI_BR_LT             0x55   // %r = %a <  %b; ...
+#define OVMI_BR_LT_S           0x56   // %r = %a <  %b; ...
+#define OVMI_BR_LE             0x57   // %r = %a <= %b; ...
+#define OVMI_BR_LE_S           0x58   // %r = %a <= %b; ...
+#define OVMI_BR_GT             0x59   // %r = %a >  %b; ...
+#define OVMI_BR_GT_S           0x5a   // %r = %a >  %b; ...
+#define OVMI_BR_GE             0x5b   // %r = %a >= %b; ...
+#define OVMI_BR_GE_S           0x5c   // %r = %a >= %b; ...
+
+//
+// Breakpoints
+//
+// This is never emitted by the code builder either. The debugger overwrites the
+// opcode of the instruction that a breakpoint is set on with this one, and keeps
+// an unpatched copy of the code to run the original instruction from. This way,
+// only instructions with a breakpoint pay for checking for one.
+#define OVMI_BREAKPOINT        0x5d
+
+//
+// Calls with the arguments already in the callee's frame
+//
+// The frame of a callee starts at the value number right after the last one of
+// its caller. The code builder knows how many value numbers a function uses once
+// it is done with it, so it writes the arguments of these calls directly into
+// those slots, instead of pushing them with `param` and copying them from the
+// parameter buffer. `call_internal` is only used when the callee is known to be
+// an internal function. If the callee of `calli_internal` turns out to be an
+// external function, its arguments are copied from those slots.
+#define OVMI_CALL_INTERNAL     0x5e   // %r = a(...)
+#define OVMI_CALLI_INTERNAL    0x5f   // %r = %a(...)
+
+//
+// SIMD
+//
+// Most of these are typed by their lane type, so OVM_TYPED_INSTR(OVMI_V_ADD, OVM_TYPE_I32)
+// is i32x4.add. The operations that do not care about lanes are typed as OVM_TYPE_V128.
+// Loads, stores and immediates of v128 values use the normal instructions with
+// OVM_TYPE_V128. A v128 immediate is followed by a NOP that holds its upper 8 bytes.
+// Instructions that need more operands than fit in one instruction take the rest
+// from the NOPs that follow them, written here as (next).
+#define OVMI_V_SPLAT           0x60   // %r = (t) %a in every lane
+#define OVMI_V_EXTRACT         0x61   // %r = %a[b]
+#define OVMI_V_EXTRACT_S       0x62   // %r = %a[b] (sign aware)
+#define OVMI_V_REPLACE         0x63   // %r = %a; %r[(next) i] = %b; skip 1
+#define OVMI_V_SHUFFLE         0x64   // %r = [ (%a ++ %b)[mask[i]] for each byte i ]; mask in (next) l, (next) l; skip 2
+#define OVMI_V_SWIZZLE         0x65   // %r = [ %a[%b[i]] for each byte i ]
+
+#define OVMI_V_NOT             0x66   // %r = ~%a
+#define OVMI_V_AND             0x67   // %r = %a & %b
+#define OVMI_V_ANDNOT          0x68   // %r = %a & ~%b
+#define OVMI_V_OR              0x69   // %r = %a | %b
+#define OVMI_V_XOR             0x6a   // %r = %a ^ %b
+#define OVMI_V_BITSELECT       0x6b   // %r = (%a & %c) | (%b & ~%c); %c is (next) a; skip 1
+#define OVMI_V_ANY_TRUE        0x6c   // %r = any lane of %a != 0
+#define OVMI_V_ALL_TRUE        0x6d   // %r = all lanes of %a != 0
+#define OVMI_V_BITMASK         0x6e   // %r = top bit of each lane of %a
+
+#define OVMI_V_EQ              0x6f   // %r = %a == %b (lane-wise, all ones or zero)
+#define OVMI_V_NE              0x70   // %r = %a != %b
+#define OVMI_V_LT              0x71   // %r = %a <  %b
+#define OVMI_V_LT_S            0x72   // %r = %a <  %b (sign aware)
+#define OVMI_V_LE              0x73   // %r = %a <= %b
+#define OVMI_V_LE_S            0x74   // %r = %a <= %b (sign aware)
+#define OVMI_V_GT              0x75   // %r = %a >  %b
+#define OVMI_V_GT_S            0x76   // %r = %a >  %b (sign aware)
+#define OVMI_V_GE              0x77   // %r = %a >= %b
+#define OVMI_V_GE_S            0x78   // %r = %a >= %b (sign aware)
+
+#define OVMI_V_ABS             0x79   // %r = |%a|
+#define OVMI_V_NEG             0x7a   // %r = -%a
+#define OVMI_V_SQRT            0x7b   // %r = sqrt(%a)
+#define OVMI_V_ADD             0x7c   // %r = %a + %b
+#define OVMI_V_ADD_SAT         0x7d   // %r = %a + %b (saturating)
+#define OVMI_V_ADD_SAT_S       0x7e   // %r = %a + %b (saturating, sign aware)
+#define OVMI_V_SUB             0x7f   // %r = %a - %b
+#define OVMI_V_SUB_SAT         0x80   // %r = %a - %b (saturating)
+#define OVMI_V_SUB_SAT_S       0x81   // %r = %a - %b (saturating, sign aware)
+#define OVMI_V_MUL             0x82   // %r = %a * %b
+#define OVMI_V_DIV             0x83   // %r = %a / %b
+#define OVMI_V_MIN             0x84   // %r = min(%a, %b)
+#define OVMI_V_MIN_S           0x85   // %r = min(%a, %b) (sign aware)
+#define OVMI_V_MAX             0x86   // %r = max(%a, %b)
+#define OVMI_V_MAX_S           0x87   // %r = max(%a, %b) (sign aware)
+#define OVMI_V_AVGR            0x88   // %r = (%a + %b + 1) / 2
+#define OVMI_V_SHL             0x89   // %r = %a << %b
+#define OVMI_V_SHR             0x8a   // %r = %a >> %b
+#define OVMI_V_SAR             0x8b   // %r = %a >>> %b
+
+// For these, the type is the lane type of the result.
+#define OVMI_V_NARROW          0x8c   // %r = saturate(%a ++ %b)
+#define OVMI_V_NARROW_S        0x8d   // %r = saturate(%a ++ %b) (sign aware)
+#define OVMI_V_WIDEN_LOW       0x8e   // %r = (t) low half of %a
+#define OVMI_V_WIDEN_LOW_S     0x8f   // %r = (t) low half of %a (sign aware)
+#define OVMI_V_WIDEN_HIGH      0x90   // %r = (t) high half of %a
+#define OVMI_V_WIDEN_HIGH_S    0x91   // %r = (t) high half of %a (sign aware)
+#define OVMI_V_TRUNC_SAT       0x92   // %r = (t) %a, f32x4 to i32x4 (saturating)
+#define OVMI_V_TRUNC_SAT_S     0x93   // %r = (t) %a, f32x4 to i32x4 (saturating, sign aware)
+#define OVMI_V_CONVERT         0x94   // %r = (t) %a, i32x4 to f32x4
+#define OVMI_V_CONVERT_S       0x95   // %r = (t) %a, i32x4 to f32x4 (sign aware)
+
+//
+// Atomics
+//
+// These work directly on linear memory with the __atomic builtins, so threads
+// never take a lock. Like cmpxchg, the read-modify-write instructions take the
+// address in %r and replace it with the value that was in memory. Narrow
+// accesses are zero extended.
+#define OVMI_ATOMIC_LOAD       0x96   // %r = mem[%a + b]
+#define OVMI_ATOMIC_STORE      0x97   // mem[%r + b] = %a
+#define OVMI_ATOMIC_ADD        0x98   // %r = mem[%r]; mem[%r] += %a
+#define OVMI_ATOMIC_SUB        0x99   // %r = mem[%r]; mem[%r] -= %a
+#define OVMI_ATOMIC_AND        0x9a   // %r = mem[%r]; mem[%r] &= %a
+#define OVMI_ATOMIC_OR         0x9b   // %r = mem[%r]; mem[%r] |= %a
+#define OVMI_ATOMIC_XOR        0x9c   // %r = mem[%r]; mem[%r] ^= %a
+#define OVMI_ATOMIC_XCHG       0x9d   // %r = mem[%r]; mem[%r] = %a
+#define OVMI_ATOMIC_WAIT       0x9e   // %r = <wait while mem[%r] == %a, for at most %b nanoseconds>
+#define OVMI_ATOMIC_NOTIFY     0x9f   // %r = <wake up at most %a threads waiting on mem[%r]>
+#define OVMI_ATOMIC_FENCE      0xa0
+
 //
 // OVM_TYPED_INSTR(OVMI_ADD, OVM_TYPE_I32) == instruction for adding i32s
 //
@@ -366,6 +672,7 @@ struct ovm_instr_t {
 
 
 void ovm_disassemble(ovm_program_t *program, u32 instr_addr, bh_buffer *instr_text);
+char *ovm_instr_name(u32 instr);
 
 #endif
 
@@ -19,6 +19,13 @@ struct ovm_code_builder_t {
     bh_arr(label_target_t) label_stack;
     bh_arr(branch_patch_t) branch_patches;
 
+    //
+    // The arguments of OVMI_CALL_INTERNAL and OVMI_CALLI_INTERNAL are written
+    // past the last value number of the function, which is not known until the
+    // whole function has been built. Until then, the destination of each of the
+    // instructions listed here is the index of the argument it writes.
+    bh_arr(i32) frame_arg_patches;
+
     i32 param_count, result_count, local_count;
 
     ovm_program_t *program;
@@ -65,6 +72,7 @@ i32                ovm_code_builder_push_label_target(ovm_code_builder_t *builde
 void               ovm_code_builder_pop_label_target(ovm_code_builder_t *builder);
 void               ovm_code_builder_patch_else(ovm_code_builder_t *builder, label_target_t if_target);
 void               ovm_code_builder_free(ovm_code_builder_t *builder);
+void               ovm_code_builder_finish(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_nop(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_break(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_binop(ovm_code_builder_t *builder, u32 instr);
@@ -75,6 +83,7 @@ void               ovm_code_builder_add_cond_branch(ovm_code_builder_t *builder,
 void               ovm_code_builder_add_branch_table(ovm_code_builder_t *builder, i32 count, i32 *label_indicies, i32 default_label_idx);
 void               ovm_code_builder_add_return(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_call(ovm_code_builder_t *builder, i32 func_idx, i32 param_count, bool has_return_value);
+void               ovm_code_builder_add_internal_call(ovm_code_builder_t *builder, i32 func_idx, i32 param_count, bool has_return_value);
 void               ovm_code_builder_add_indirect_call(ovm_code_builder_t *builder, i32 param_count, bool has_return_value);
 void               ovm_code_builder_drop_value(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_local_get(ovm_code_builder_t *builder, i32 local_idx);
@@ -87,9 +96,17 @@ void               ovm_code_builder_add_store(ovm_code_builder_t *builder, u32 o
 void               ovm_code_builder_add_atomic_load(ovm_code_builder_t *builder, u32 ovm_type, i32 offset);
 void               ovm_code_builder_add_atomic_store(ovm_code_builder_t *builder, u32 ovm_type, i32 offset);
 void               ovm_code_builder_add_cmpxchg(ovm_code_builder_t *builder, u32 ovm_type, i32 offset);
+void               ovm_code_builder_add_atomic_rmw(ovm_code_builder_t *builder, u32 instr_kind, u32 ovm_type, i32 offset);
+void               ovm_code_builder_add_atomic_wait(ovm_code_builder_t *builder, u32 ovm_type, i32 offset);
+void               ovm_code_builder_add_atomic_notify(ovm_code_builder_t *builder, i32 offset);
+void               ovm_code_builder_add_atomic_fence(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_memory_copy(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_memory_fill(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_memory_size(ovm_code_builder_t *builder);
 void               ovm_code_builder_add_memory_grow(ovm_code_builder_t *builder);
+void               ovm_code_builder_add_v128_extract(ovm_code_builder_t *builder, u32 instr, i32 lane);
+void               ovm_code_builder_add_v128_replace(ovm_code_builder_t *builder, u32 instr, i32 lane);
+void               ovm_code_builder_add_v128_shuffle(ovm_code_builder_t *builder, u8 *mask);
+void               ovm_code_builder_add_v128_bitselect(ovm_code_builder_t *builder);
 
 #endif
@@ -34,6 +34,11 @@ void debug_host_start(debug_state_t *debug) {
 void debug_host_stop(debug_state_t *debug) {
     debug->debug_thread_running = false;
     pthread_join(debug->debug_thread, NULL);
+
+    if (debug->original_code)   bh_free(debug->alloc, debug->original_code);
+    if (debug->line_boundaries) bh_free(debug->alloc, debug->line_boundaries);
+    debug->original_code = NULL;
+    debug->line_boundaries = NULL;
 }
 
 u32 debug_host_register_thread(debug_state_t *debug, ovm_state_t *ovm_state) {
@@ -43,12 +48,13 @@ u32 debug_host_register_thread(debug_state_t *debug, ovm_state_t *ovm_state) {
     new_thread->state = debug_state_starting;
     new_thread->ovm_state = ovm_state;
     new_thread->run_count = 0;                    // Start threads in stopped state.
+    new_thread->skip_breakpoint_at = -1;
 
     u32 id = debug->next_thread_id++;
     new_thread->id = id;
 
     char name_buf[256];
-    bh_bprintf(name_buf, 256, "/ovm_thread_%d", new_thread->id);
+    bh_snprintf(name_buf, 256, "/ovm_thread_%d", new_thread->id);
     new_thread->wait_semaphore = semaphore_create(name_buf, O_CREAT, 0664, 0);
 
     new_thread->state_change_write_fd = debug->state_change_pipes[1];
@@ -64,3 +70,59 @@ debug_thread_state_t *debug_host_lookup_thread(debug_state_t *debug, u32 id) {
     return NULL;
 }
 
+
+//
+// This has to be called once the program is fully built, because the line
+// boundaries come from its debug info. Breakpoints that were set before are
+// patched in now.
+void debug_host_attach_program(debug_state_t *debug, ovm_program_t *program) {
+    u32 count = bh_arr_length(program->code);
+
+    debug->original_code = bh_alloc_array(debug->alloc, ovm_instr_t, count);
+    memcpy(debug->original_code, program->code, count * sizeof(ovm_instr_t));
+
+    debug->line_boundaries = bh_alloc_array(debug->alloc, u64, (count + 63) / 64);
+    memset(debug->line_boundaries, 0, ((count + 63) / 64) * sizeof(u64));
+
+    debug_loc_info_t prev = {0};
+    bool prev_found = false;
+    fori (i, 0, (i32) count) {
+        debug_loc_info_t loc;
+        bool found = debug_info_lookup_location(debug->info, i, &loc);
+
+        if (found && (!prev_found || loc.file_id != prev.file_id || loc.line != prev.line)) {
+            debug->line_boundaries[i >> 6] |= 1ull << (i & 63);
+        }
+
+        prev = loc;
+        prev_found = found;
+    }
+
+    debug->instruction_count = count;
+    debug->program = program;
+
+    bh_arr_each(debug_breakpoint_t, bp, debug->breakpoints) {
+        debug_host_patch_breakpoint(debug, bp->instr);
+    }
+}
+
+void debug_host_patch_breakpoint(debug_state_t *debug, u32 instr) {
+    if (!debug->program || instr >= debug->instruction_count) return;
+
+    __atomic_store_n(&debug->program->code[instr].full_instr,
+        OVM_TYPED_INSTR(OVMI_BREAKPOINT, OVM_TYPE_NONE), __ATOMIC_RELEASE);
+}
+
+//
+// The original instruction is only put back when no other breakpoint is
+// set on the same instruction.
+void debug_host_unpatch_breakpoint(debug_state_t *debug, u32 instr) {
+    if (!debug->program || instr >= debug->instruction_count) return;
+
+    bh_arr_each(debug_breakpoint_t, bp, debug->breakpoints) {
+        if (bp->instr == instr) return;
+    }
+
+    __atomic_store_n(&debug->program->code[instr].full_instr,
+        debug->original_code[instr].full_instr, __ATOMIC_RELEASE);
+}
@@ -233,7 +233,7 @@ void debug_info_import_type_info(debug_info_t *info, u8 *data, u32 len) {
 bool debug_info_lookup_location(debug_info_t *info, u32 instruction, debug_loc_info_t *out) {
     if (!info || !info->has_debug_info) return false;
 
-    if (instruction > (u32) bh_arr_length(info->instruction_reducer)) return false;
+    if (instruction >= (u32) bh_arr_length(info->instruction_reducer)) return false;
     i32 loc = info->instruction_reducer[instruction];
     if (loc < 0) return false;
 
@@ -53,6 +53,9 @@ ovm_code_builder_t ovm_code_builder_new(ovm_program_t *program, debug_info_build
     bh_arr_new(bh_heap_allocator(), builder.label_stack, 32);
     bh_arr_new(bh_heap_allocator(), builder.branch_patches, 32);
 
+    builder.frame_arg_patches = NULL;
+    bh_arr_new(bh_heap_allocator(), builder.frame_arg_patches, 32);
+
     builder.highest_value_number = param_count + local_count;
 
     builder.debug_builder = debug;
@@ -64,6 +67,20 @@ void ovm_code_builder_free(ovm_code_builder_t *builder) {
     bh_arr_free(builder->execution_stack);
     bh_arr_free(builder->label_stack);
     bh_arr_free(builder->branch_patches);
+    bh_arr_free(builder->frame_arg_patches);
+}
+
+//
+// Must be called once the whole function has been built, and before it is
+// registered, because this is when the number of value numbers it uses is known.
+void ovm_code_builder_finish(ovm_code_builder_t *builder) {
+    i32 value_number_count = builder->highest_value_number + 1;
+
+    bh_arr_each(i32, instr, builder->frame_arg_patches) {
+        builder->program->code[*instr].r += value_number_count;
+    }
+
+    bh_arr_clear(builder->frame_arg_patches);
 }
 
 label_target_t ovm_code_builder_wasm_target_idx(ovm_code_builder_t *builder, i32 idx) {
@@ -72,7 +89,35 @@ label_target_t ovm_code_builder_wasm_target_idx(ovm_code_builder_t *builder, i32
     return builder->label_stack[walker];
 }
 
+//
+// A local.get only pushes the register of the local, and the register is
+// copied when the local is about to be replaced (see local_set). That copy
+// only happens on the path where the local is replaced, so the values that
+// stay on the stack while a block runs have to be copied before it starts.
+// The condition of an if is consumed before the block, so it does not need to be.
+static void copy_locals_on_stack_before_block(ovm_code_builder_t *builder, label_kind_t kind) {
+    i32 count = bh_arr_length(builder->execution_stack);
+    if (kind == label_kind_if) count -= 1;
+
+    fori (i, 0, count) {
+        i32 reg = builder->execution_stack[i];
+        if (IS_TEMPORARY_VALUE(builder, reg)) continue;
+
+        ovm_instr_t instr = {0};
+        instr.full_instr = OVM_TYPED_INSTR(OVMI_MOV, OVM_TYPE_NONE);
+        instr.r = NEXT_VALUE(builder);
+        instr.a = reg;
+
+        debug_info_builder_emit_location(builder->debug_builder);
+        ovm_program_add_instructions(builder->program, 1, &instr);
+
+        builder->execution_stack[i] = instr.r;
+    }
+}
+
 i32 ovm_code_builder_push_label_target(ovm_code_builder_t *builder, label_kind_t kind) {
+    copy_locals_on_stack_before_block(builder, kind);
+
     label_target_t target;
     target.kind = kind;
     target.idx = builder->next_label_idx++;
@@ -165,6 +210,21 @@ void ovm_code_builder_add_break(ovm_code_builder_t *builder) {
     ovm_program_add_instructions(builder->program, 1, &break_);
 }
 
+//
+// Some instructions need more operands than fit in a single instruction. The rest
+// are stored in NOPs that directly follow the instruction, which skips over them.
+// The NOP's destination is -1, so the :PrimitiveOptimization in local_set never
+// mistakes it for the instruction that produced the top of the stack.
+static void add_extra_operand(ovm_code_builder_t *builder, u64 operand) {
+    ovm_instr_t nop = {0};
+    nop.full_instr = OVM_TYPED_INSTR(OVMI_NOP, OVM_TYPE_NONE);
+    nop.r = -1;
+    nop.l = operand;
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &nop);
+}
+
 void ovm_code_builder_add_binop(ovm_code_builder_t *builder, u32 instr) {
     i32 right  = POP_VALUE(builder);
     i32 left   = POP_VALUE(builder);
@@ -193,6 +253,18 @@ void ovm_code_builder_add_imm(ovm_code_builder_t *builder, u32 ovm_type, void *i
         case OVM_TYPE_I64: imm_instr.l =       *(u64 *) imm; break;
         case OVM_TYPE_F32: imm_instr.f =       *(f32 *) imm; break;
         case OVM_TYPE_F64: imm_instr.d =       *(f64 *) imm; break;
+
+        case OVM_TYPE_V128: {
+            // The upper 8 bytes do not fit, so they go in a NOP after the immediate.
+            imm_instr.l = ((u64 *) imm)[0];
+
+            debug_info_builder_emit_location(builder->debug_builder);
+            ovm_program_add_instructions(builder->program, 1, &imm_instr);
+            add_extra_operand(builder, ((u64 *) imm)[1]);
+            PUSH_VALUE(builder, imm_instr.r);
+            return;
+        }
+
         default: assert(0 && "bad ovm type for add_imm");
     }
 
@@ -365,6 +437,95 @@ void ovm_code_builder_add_call(ovm_code_builder_t *builder, i32 func_idx, i32 pa
     }
 }
 
+//
+// Only instructions that do nothing but compute %r can be told to put their
+// result somewhere else. Some instructions use `r` for something else, like the
+// register index of `reg_set`, or the address of `store`.
+static bool instr_only_writes_r(ovm_instr_t *instr) {
+    u32 kind = OVM_INSTR_INSTR(*instr);
+
+    if (kind >= OVMI_ADD && kind <= OVMI_SAR)           return true;
+    if (kind >= OVMI_LT && kind <= OVMI_NE)             return true;
+    if (kind >= OVMI_CLZ && kind <= OVMI_TRANSMUTE_F64) return true;
+
+    switch (kind) {
+        case OVMI_IMM:
+        case OVMI_MOV:
+        case OVMI_LOAD:
+        case OVMI_REG_GET:
+        case OVMI_IDX_ARR:
+        case OVMI_CALL:
+        case OVMI_CALLI:
+        case OVMI_CALL_INTERNAL:
+        case OVMI_CALLI_INTERNAL:
+        case OVMI_MEM_SIZE:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+//
+// Writes the arguments of a call into the frame of the callee, for
+// OVMI_CALL_INTERNAL and OVMI_CALLI_INTERNAL. Usually, the last argument was
+// computed by the instruction right before the call, which can write it there
+// itself, the same way :PrimitiveOptimization in local_set works.
+static void ovm_code_builder_add_frame_args(ovm_code_builder_t *builder, i32 param_count) {
+    if (param_count == 0) return;
+
+    ovm_instr_t *last_instr = &bh_arr_last(builder->program->code);
+    if (bh_arr_length(builder->program->code) > builder->start_instr && instr_only_writes_r(last_instr)
+        && IS_TEMPORARY_VALUE(builder, last_instr->r) && last_instr->r == LAST_VALUE(builder)) {
+        last_instr->r = param_count - 1;
+        bh_arr_push(builder->frame_arg_patches, bh_arr_length(builder->program->code) - 1);
+
+        POP_VALUE(builder);
+        param_count -= 1;
+    }
+
+    i32 *args = alloca(param_count * sizeof(i32));
+
+    fori (i, 0, param_count) {
+        args[param_count - 1 - i] = POP_VALUE(builder);
+    }
+
+    fori (i, 0, param_count) {
+        ovm_instr_t mov_instr = {0};
+        mov_instr.full_instr = OVM_TYPED_INSTR(OVMI_MOV, OVM_TYPE_NONE);
+        mov_instr.r = i;
+        mov_instr.a = args[i];
+
+        bh_arr_push(builder->frame_arg_patches, bh_arr_length(builder->program->code));
+
+        debug_info_builder_emit_location(builder->debug_builder);
+        ovm_program_add_instructions(builder->program, 1, &mov_instr);
+    }
+}
+
+//
+// This is used instead of ovm_code_builder_add_call when the callee is known to
+// be an internal function.
+void ovm_code_builder_add_internal_call(ovm_code_builder_t *builder, i32 func_idx, i32 param_count, bool has_return_value) {
+    ovm_code_builder_add_frame_args(builder, param_count);
+
+    ovm_instr_t call_instr = {0};
+    call_instr.full_instr = OVM_TYPED_INSTR(OVMI_CALL_INTERNAL, OVM_TYPE_NONE);
+    call_instr.a = func_idx;
+    call_instr.r = -1;
+
+    if (has_return_value) {
+        call_instr.r = NEXT_VALUE(builder);
+    }
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &call_instr);
+
+    if (has_return_value) {
+        PUSH_VALUE(builder, call_instr.r);
+    }
+}
+
 void ovm_code_builder_add_indirect_call(ovm_code_builder_t *builder, i32 param_count, bool has_return_value) {
     ovm_instr_t call_instrs[2] = {0};
 
@@ -374,11 +535,11 @@ void ovm_code_builder_add_indirect_call(ovm_code_builder_t *builder, i32 param_c
     call_instrs[0].a = builder->func_table_arr_idx;
     call_instrs[0].b = POP_VALUE(builder);
 
-    call_instrs[1].full_instr = OVM_TYPED_INSTR(OVMI_CALLI, OVM_TYPE_NONE);
+    call_instrs[1].full_instr = OVM_TYPED_INSTR(OVMI_CALLI_INTERNAL, OVM_TYPE_NONE);
     call_instrs[1].a = call_instrs[0].r;
     call_instrs[1].r = -1;
 
-    ovm_code_builder_add_params(builder, param_count);
+    ovm_code_builder_add_frame_args(builder, param_count);
 
     if (has_return_value) {
         call_instrs[1].r = NEXT_VALUE(builder);
@@ -430,6 +591,15 @@ static void maybe_copy_register_if_going_to_be_replaced(ovm_code_builder_t *buil
 }
 
 void ovm_code_builder_add_local_set(ovm_code_builder_t *builder, i32 local_idx) {
+    // Setting a local to its own value does nothing. This has to be checked
+    // before copying the register below, because otherwise the copy would
+    // be folded back into the local by the :PrimitiveOptimization, leaving
+    // other references to the copy on the stack uninitialized.
+    if (LAST_VALUE(builder) == local_idx) {
+        POP_VALUE(builder);
+        return;
+    }
+
     maybe_copy_register_if_going_to_be_replaced(builder, local_idx);
 
     // :PrimitiveOptimization
@@ -520,53 +690,113 @@ void ovm_code_builder_add_store(ovm_code_builder_t *builder, u32 ovm_type, i32 o
     return;
 }
 
-void ovm_code_builder_add_cmpxchg(ovm_code_builder_t *builder, u32 ovm_type, i32 offset) {
-    // This is an optimization for a 0 offset that could come back, but since CMPXCHG is
-    // not a common instruction (I think it is used in one place in the entire standard library),
-    // it does not make much of a difference.
-    //
-    // if (offset == 0) {
-    //     ovm_instr_t cmpxchg_instr = {0};
-    //     cmpxchg_instr.full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_CMPXCHG, ovm_type);
-    //     cmpxchg_instr.b = POP_VALUE(builder);
-    //     cmpxchg_instr.a = POP_VALUE(builder);
-    //     cmpxchg_instr.r = POP_VALUE(builder);
-
-    //     debug_info_builder_emit_location(builder->debug_builder);
-    //     ovm_program_add_instructions(builder->program, 1, &cmpxchg_instr);
-
-    //     PUSH_VALUE(builder, cmpxchg_instr.r);
-    //     return;
-    // }
-
-    ovm_instr_t instrs[3] = {0};
+//
+// The atomic instructions other than load and store have no offset, so the
+// offset is added to the address ahead of time. The address is computed into
+// `result_reg`, which the atomic instruction then replaces with its result.
+// `result_reg` has to be taken before the operands are popped, so it cannot
+// be the same value number as any of them.
+static void add_atomic_address(ovm_code_builder_t *builder, i32 result_reg, i32 addr_reg, i32 offset) {
+    ovm_instr_t instrs[2] = {0};
     // imm.i32 %n, offset
     instrs[0].full_instr = OVM_TYPED_INSTR(OVMI_IMM, OVM_TYPE_I32);
     instrs[0].i = offset;
-    instrs[0].r = NEXT_VALUE(builder);
-
-    int value_reg = POP_VALUE(builder);
-    int expected_reg = POP_VALUE(builder);
-    int addr_reg = POP_VALUE(builder);
+    instrs[0].r = result_reg;
 
-    // add.i32 %n, %n, %i
+    // add.i32 %n, %a, %n
     instrs[1].full_instr = OVM_TYPED_INSTR(OVMI_ADD, OVM_TYPE_I32);
     instrs[1].r = instrs[0].r;
     instrs[1].a = addr_reg;
     instrs[1].b = instrs[0].r;
 
+    debug_info_builder_emit_location(builder->debug_builder);
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 2, instrs);
+}
+
+void ovm_code_builder_add_cmpxchg(ovm_code_builder_t *builder, u32 ovm_type, i32 offset) {
+    int result_reg = NEXT_VALUE(builder);
+    int value_reg = POP_VALUE(builder);
+    int expected_reg = POP_VALUE(builder);
+    int addr_reg = POP_VALUE(builder);
+
+    add_atomic_address(builder, result_reg, addr_reg, offset);
+
     // cmpxchg.x %n, %e, %v
-    instrs[2].full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_CMPXCHG, ovm_type);
-    instrs[2].r = instrs[1].r;
-    instrs[2].a = expected_reg;
-    instrs[2].b = value_reg;
+    ovm_instr_t instr = {0};
+    instr.full_instr = OVM_TYPED_INSTR(OVMI_CMPXCHG, ovm_type);
+    instr.r = result_reg;
+    instr.a = expected_reg;
+    instr.b = value_reg;
 
     debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &instr);
+
+    PUSH_VALUE(builder, instr.r);
+}
+
+void ovm_code_builder_add_atomic_rmw(ovm_code_builder_t *builder, u32 instr_kind, u32 ovm_type, i32 offset) {
+    int result_reg = NEXT_VALUE(builder);
+    int value_reg = POP_VALUE(builder);
+    int addr_reg = POP_VALUE(builder);
+
+    add_atomic_address(builder, result_reg, addr_reg, offset);
+
+    ovm_instr_t instr = {0};
+    instr.full_instr = OVM_TYPED_INSTR(instr_kind, ovm_type);
+    instr.r = result_reg;
+    instr.a = value_reg;
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &instr);
+
+    PUSH_VALUE(builder, instr.r);
+}
+
+void ovm_code_builder_add_atomic_wait(ovm_code_builder_t *builder, u32 ovm_type, i32 offset) {
+    int result_reg = NEXT_VALUE(builder);
+    int timeout_reg = POP_VALUE(builder);
+    int expected_reg = POP_VALUE(builder);
+    int addr_reg = POP_VALUE(builder);
+
+    add_atomic_address(builder, result_reg, addr_reg, offset);
+
+    ovm_instr_t instr = {0};
+    instr.full_instr = OVM_TYPED_INSTR(OVMI_ATOMIC_WAIT, ovm_type);
+    instr.r = result_reg;
+    instr.a = expected_reg;
+    instr.b = timeout_reg;
+
     debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &instr);
+
+    PUSH_VALUE(builder, instr.r);
+}
+
+void ovm_code_builder_add_atomic_notify(ovm_code_builder_t *builder, i32 offset) {
+    int result_reg = NEXT_VALUE(builder);
+    int count_reg = POP_VALUE(builder);
+    int addr_reg = POP_VALUE(builder);
+
+    add_atomic_address(builder, result_reg, addr_reg, offset);
+
+    ovm_instr_t instr = {0};
+    instr.full_instr = OVM_TYPED_INSTR(OVMI_ATOMIC_NOTIFY, OVM_TYPE_NONE);
+    instr.r = result_reg;
+    instr.a = count_reg;
+
     debug_info_builder_emit_location(builder->debug_builder);
-    ovm_program_add_instructions(builder->program, 3, instrs);
+    ovm_program_add_instructions(builder->program, 1, &instr);
 
-    PUSH_VALUE(builder, instrs[2].r);
+    PUSH_VALUE(builder, instr.r);
+}
+
+void ovm_code_builder_add_atomic_fence(ovm_code_builder_t *builder) {
+    ovm_instr_t instr = {0};
+    instr.full_instr = OVM_TYPED_INSTR(OVMI_ATOMIC_FENCE, OVM_TYPE_NONE);
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &instr);
 }
 
 void ovm_code_builder_add_memory_size(ovm_code_builder_t *builder) {
@@ -618,7 +848,7 @@ void ovm_code_builder_add_memory_fill(ovm_code_builder_t *builder) {
 // CopyNPaste from _add_load
 void ovm_code_builder_add_atomic_load(ovm_code_builder_t *builder, u32 ovm_type, i32 offset) {
     ovm_instr_t load_instr = {0};
-    load_instr.full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_LOAD, ovm_type);
+    load_instr.full_instr = OVM_TYPED_INSTR(OVMI_ATOMIC_LOAD, ovm_type);
     load_instr.b = offset;
     load_instr.a = POP_VALUE(builder);
     load_instr.r = NEXT_VALUE(builder);
@@ -633,7 +863,7 @@ void ovm_code_builder_add_atomic_load(ovm_code_builder_t *builder, u32 ovm_type,
 // CopyNPaste from _add_store
 void ovm_code_builder_add_atomic_store(ovm_code_builder_t *builder, u32 ovm_type, i32 offset) {
     ovm_instr_t store_instr = {0};
-    store_instr.full_instr = OVMI_ATOMIC | OVM_TYPED_INSTR(OVMI_STORE, ovm_type);
+    store_instr.full_instr = OVM_TYPED_INSTR(OVMI_ATOMIC_STORE, ovm_type);
     store_instr.b = offset;
     store_instr.a = POP_VALUE(builder);
     store_instr.r = POP_VALUE(builder);
@@ -641,3 +871,61 @@ void ovm_code_builder_add_atomic_store(ovm_code_builder_t *builder, u32 ovm_type
     debug_info_builder_emit_location(builder->debug_builder);
     ovm_program_add_instructions(builder->program, 1, &store_instr);
 }
+
+void ovm_code_builder_add_v128_extract(ovm_code_builder_t *builder, u32 instr, i32 lane) {
+    ovm_instr_t extract = {0};
+    extract.full_instr = instr;
+    extract.a = POP_VALUE(builder);
+    extract.b = lane;
+    extract.r = NEXT_VALUE(builder);
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &extract);
+    PUSH_VALUE(builder, extract.r);
+}
+
+void ovm_code_builder_add_v128_replace(ovm_code_builder_t *builder, u32 instr, i32 lane) {
+    ovm_instr_t replace = {0};
+    replace.full_instr = instr;
+    replace.b = POP_VALUE(builder);
+    replace.a = POP_VALUE(builder);
+    replace.r = NEXT_VALUE(builder);
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &replace);
+    add_extra_operand(builder, (u64) lane);
+    PUSH_VALUE(builder, replace.r);
+}
+
+void ovm_code_builder_add_v128_shuffle(ovm_code_builder_t *builder, u8 *mask) {
+    ovm_instr_t shuffle = {0};
+    shuffle.full_instr = OVM_TYPED_INSTR(OVMI_V_SHUFFLE, OVM_TYPE_V128);
+    shuffle.b = POP_VALUE(builder);
+    shuffle.a = POP_VALUE(builder);
+    shuffle.r = NEXT_VALUE(builder);
+
+    u64 mask_low, mask_high;
+    memcpy(&mask_low,  &mask[0], 8);
+    memcpy(&mask_high, &mask[8], 8);
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &shuffle);
+    add_extra_operand(builder, mask_low);
+    add_extra_operand(builder, mask_high);
+    PUSH_VALUE(builder, shuffle.r);
+}
+
+void ovm_code_builder_add_v128_bitselect(ovm_code_builder_t *builder) {
+    i32 mask = POP_VALUE(builder);
+
+    ovm_instr_t bitselect = {0};
+    bitselect.full_instr = OVM_TYPED_INSTR(OVMI_V_BITSELECT, OVM_TYPE_V128);
+    bitselect.b = POP_VALUE(builder);
+    bitselect.a = POP_VALUE(builder);
+    bitselect.r = NEXT_VALUE(builder);
+
+    debug_info_builder_emit_location(builder->debug_builder);
+    ovm_program_add_instructions(builder->program, 1, &bitselect);
+    add_extra_operand(builder, (u64) (u32) mask);
+    PUSH_VALUE(builder, bitselect.r);
+}
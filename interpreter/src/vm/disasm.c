@@ -127,9 +127,100 @@ static instr_format_t instr_formats[] = {
     { "break", instr_format_none },
 
     { "memory_size", instr_format_none },
-    { "memory_grow", instr_format_ra }
+    { "memory_grow", instr_format_ra },
+
+    { "add_imm", instr_format_imm },
+    { "load_idx", instr_format_rab },
+    { "param_call", instr_format_a },
+
+    { "br_eq", instr_format_rab },
+    { "br_ne", instr_format_rab },
+    { "br_lt", instr_format_rab },
+    { "br_lt_s", instr_format_rab },
+    { "br_le", instr_format_rab },
+    { "br_le_s", instr_format_rab },
+    { "br_gt", instr_format_rab },
+    { "br_gt_s", instr_format_rab },
+    { "br_ge", instr_format_rab },
+    { "br_ge_s", instr_format_rab },
+
+    { "breakpoint", instr_format_none },
+    { "call_internal", instr_format_call },
+    { "calli_internal", instr_format_calli },
+
+    { "v_splat", instr_format_ra },
+    { "v_extract", instr_format_rab },
+    { "v_extract_s", instr_format_rab },
+    { "v_replace", instr_format_rab },
+    { "v_shuffle", instr_format_rab },
+    { "v_swizzle", instr_format_rab },
+    { "v_not", instr_format_ra },
+    { "v_and", instr_format_rab },
+    { "v_andnot", instr_format_rab },
+    { "v_or", instr_format_rab },
+    { "v_xor", instr_format_rab },
+    { "v_bitselect", instr_format_rab },
+    { "v_any_true", instr_format_ra },
+    { "v_all_true", instr_format_ra },
+    { "v_bitmask", instr_format_ra },
+    { "v_eq", instr_format_rab },
+    { "v_ne", instr_format_rab },
+    { "v_lt", instr_format_rab },
+    { "v_lt_s", instr_format_rab },
+    { "v_le", instr_format_rab },
+    { "v_le_s", instr_format_rab },
+    { "v_gt", instr_format_rab },
+    { "v_gt_s", instr_format_rab },
+    { "v_ge", instr_format_rab },
+    { "v_ge_s", instr_format_rab },
+    { "v_abs", instr_format_ra },
+    { "v_neg", instr_format_ra },
+    { "v_sqrt", instr_format_ra },
+    { "v_add", instr_format_rab },
+    { "v_add_sat", instr_format_rab },
+    { "v_add_sat_s", instr_format_rab },
+    { "v_sub", instr_format_rab },
+    { "v_sub_sat", instr_format_rab },
+    { "v_sub_sat_s", instr_format_rab },
+    { "v_mul", instr_format_rab },
+    { "v_div", instr_format_rab },
+    { "v_min", instr_format_rab },
+    { "v_min_s", instr_format_rab },
+    { "v_max", instr_format_rab },
+    { "v_max_s", instr_format_rab },
+    { "v_avgr", instr_format_rab },
+    { "v_shl", instr_format_rab },
+    { "v_shr", instr_format_rab },
+    { "v_sar", instr_format_rab },
+    { "v_narrow", instr_format_rab },
+    { "v_narrow_s", instr_format_rab },
+    { "v_widen_low", instr_format_ra },
+    { "v_widen_low_s", instr_format_ra },
+    { "v_widen_high", instr_format_ra },
+    { "v_widen_high_s", instr_format_ra },
+    { "v_trunc_sat", instr_format_ra },
+    { "v_trunc_sat_s", instr_format_ra },
+    { "v_convert", instr_format_ra },
+    { "v_convert_s", instr_format_ra },
+
+    { "atomic_load", instr_format_load },
+    { "atomic_store", instr_format_store },
+    { "atomic_add", instr_format_ra },
+    { "atomic_sub", instr_format_ra },
+    { "atomic_and", instr_format_ra },
+    { "atomic_or", instr_format_ra },
+    { "atomic_xor", instr_format_ra },
+    { "atomic_xchg", instr_format_ra },
+    { "atomic_wait", instr_format_rab },
+    { "atomic_notify", instr_format_ra },
+    { "atomic_fence", instr_format_none },
 };
 
+char *ovm_instr_name(u32 instr) {
+    if (instr >= sizeof(instr_formats) / sizeof(instr_formats[0])) return "illegal";
+    return instr_formats[instr].instr;
+}
+
 void ovm_disassemble(ovm_program_t *program, u32 instr_addr, bh_buffer *instr_text) {
     static char buf[256];
 
@@ -162,6 +253,7 @@ void ovm_disassemble(ovm_program_t *program, u32 instr_addr, bh_buffer *instr_te
                 case OVM_TYPE_I64:  formatted = snprintf(buf, 255, "%%%d, %lld", instr->r, instr->l); break;
                 case OVM_TYPE_F32:  formatted = snprintf(buf, 255, "%%%d, %f",   instr->r, instr->f); break;
                 case OVM_TYPE_F64:  formatted = snprintf(buf, 255, "%%%d, %lf",  instr->r, instr->d); break;
+                case OVM_TYPE_V128: formatted = snprintf(buf, 255, "%%%d, 0x%016llx%016llx", instr->r, instr[1].l, instr->l); break;
             }
             break;
 
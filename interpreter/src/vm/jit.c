@@ -0,0 +1,872 @@
+//
+// Baseline JIT
+//
+// This translates the instructions of a single OVM function into native code.
+// It is a "baseline" compiler: every value number still lives in its slot in
+// the frame's value array, and each instruction is translated on its own into
+// a short sequence of native instructions that loads its operands from the
+// value array and stores the result back. There is no register allocation and
+// no optimization across instructions. This removes the dispatch overhead of
+// the interpreter, which is most of the cost of running simple instructions.
+//
+// Jitted functions are called with the stack frame already set up and the
+// parameters already copied into the value array, exactly like the interpreter
+// expects when entering a function. They return the function's result through
+// the `result` pointer and do not tear down their frame; the caller does that.
+//
+// Calls from jitted code go through ovm__jit_call (or ovm__jit_call_internal, when
+// the arguments are already in the callee's frame), which either calls the jitted
+// version of the callee or interprets it. Instructions that are uncommon or too
+// complicated to be worth translating are executed by calling the interpreter's
+// implementation of that single instruction (see ovm__single_instr_handler).
+//
+
+#define _GNU_SOURCE
+
+#include "vm.h"
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//
+// Size of the region reserved for native code. Each function is placed on its
+// own pages, so they can be made executable without affecting the others.
+#define OVM_JIT_CODE_SIZE (64 * 1024 * 1024)
+
+ovm_jit_t *ovm_jit_new() {
+    void *code = mmap(NULL, OVM_JIT_CODE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (code == MAP_FAILED) return NULL;
+
+    ovm_jit_t *jit = bh_alloc_item(bh_heap_allocator(), ovm_jit_t);
+    pthread_mutex_init(&jit->lock, NULL);
+    jit->code = code;
+    jit->code_size = OVM_JIT_CODE_SIZE;
+    jit->code_used = 0;
+
+    return jit;
+}
+
+void ovm_jit_delete(ovm_jit_t *jit) {
+    munmap(jit->code, jit->code_size);
+    pthread_mutex_destroy(&jit->lock);
+    bh_free(bh_heap_allocator(), jit);
+}
+
+static u8 *ovm_jit_reserve_code(ovm_jit_t *jit, i64 length) {
+    i64 size = length;
+    bh_align(size, sysconf(_SC_PAGESIZE));
+    if (jit->code_used + size > jit->code_size) return NULL;
+
+    u8 *dest = jit->code + jit->code_used;
+    jit->code_used += size;
+    return dest;
+}
+
+static bool ovm_jit_write_code(u8 *dest, u8 *data, i64 length) {
+    i64 size = length;
+    bh_align(size, sysconf(_SC_PAGESIZE));
+
+    if (mprotect(dest, size, PROT_READ | PROT_WRITE)) return false;
+    memcpy(dest, data, length);
+    if (mprotect(dest, size, PROT_READ | PROT_EXEC)) return false;
+
+    return true;
+}
+
+//
+// Returns the exclusive end of the instructions belonging to `func`. Functions
+// do not record their length, but their code is contiguous, so the function ends
+// where the next function starts.
+static i32 ovm_jit_func_end(ovm_program_t *program, ovm_func_t *func) {
+    i32 end = bh_arr_length(program->code);
+
+    bh_arr_each(ovm_func_t, other, program->funcs) {
+        if (other->kind != OVM_FUNC_INTERNAL) continue;
+        if (other->start_instr > func->start_instr && other->start_instr < end) {
+            end = other->start_instr;
+        }
+    }
+
+    return end;
+}
+
+
+#if defined(__x86_64__)
+
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8,  R9,  R10, R11, R12, R13, R14, R15,
+};
+
+//
+// Registers that hold the same thing for the whole function.
+#define REG_VALUES RBX
+#define REG_MEMORY R12
+#define REG_STATE  R13
+#define REG_RESULT R14
+
+#define NO_INDEX -1
+
+#define VALUE_OFFSET(v) ((i32) ((v) * sizeof(ovm_value_t)))
+#define TYPE_OFFSET(v)  ((i32) ((v) * sizeof(ovm_value_t) + offsetof(ovm_value_t, type)))
+
+typedef struct jit_patch_t {
+    i32 offset;        // Offset of the rel32 to patch.
+    i32 target_instr;
+} jit_patch_t;
+
+typedef struct jit_builder_t {
+    bh_buffer buffer;
+
+    ovm_program_t *program;
+    ovm_func_t    *func;
+    i32 start_instr;
+    i32 end_instr;
+
+    i32 *instr_offsets;
+    bh_arr(jit_patch_t) patches;
+
+    //
+    // Set if the function uses `bri`, which requires a table from instruction
+    // to native address.
+    bool needs_jump_table;
+
+    char *failure;
+} jit_builder_t;
+
+
+//
+// Encoding helpers
+//
+
+static inline void emit_u8(jit_builder_t *b, u8 v)   { bh_buffer_write_byte(&b->buffer, v); }
+static inline void emit_u32(jit_builder_t *b, u32 v) { bh_buffer_write_u32(&b->buffer, v); }
+static inline void emit_u64(jit_builder_t *b, u64 v) { bh_buffer_write_u64(&b->buffer, v); }
+
+static void emit_prefix_and_rex(jit_builder_t *b, u8 prefix, bool wide, i32 reg, i32 index, i32 base) {
+    if (prefix) emit_u8(b, prefix);
+
+    u8 rex = 0x40;
+    if (wide)                   rex |= 0x08;
+    if (reg & 8)                rex |= 0x04;
+    if (index >= 0 && index & 8) rex |= 0x02;
+    if (base & 8)               rex |= 0x01;
+
+    if (rex != 0x40) emit_u8(b, rex);
+}
+
+static void emit_opcode(jit_builder_t *b, u32 opcode) {
+    if (opcode > 0xffff) emit_u8(b, (opcode >> 16) & 0xff);
+    if (opcode > 0xff)   emit_u8(b, (opcode >> 8) & 0xff);
+    emit_u8(b, opcode & 0xff);
+}
+
+//
+// Emits `op reg, [base + index * scale + disp]`, or the reverse, depending on the opcode.
+static void emit_rm(jit_builder_t *b, u8 prefix, u32 opcode, bool wide, i32 reg, i32 base, i32 index, i32 scale, i32 disp) {
+    emit_prefix_and_rex(b, prefix, wide, reg, index, base);
+    emit_opcode(b, opcode);
+
+    u8 mod;
+    if (disp == 0 && (base & 7) != RBP) mod = 0x00;
+    else if (disp >= -128 && disp <= 127) mod = 0x40;
+    else mod = 0x80;
+
+    if (index >= 0 || (base & 7) == RSP) {
+        u8 scale_bits = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+        i32 index_bits = index >= 0 ? (index & 7) : RSP;
+
+        emit_u8(b, mod | ((reg & 7) << 3) | RSP);
+        emit_u8(b, (scale_bits << 6) | (index_bits << 3) | (base & 7));
+    } else {
+        emit_u8(b, mod | ((reg & 7) << 3) | (base & 7));
+    }
+
+    if (mod == 0x40) emit_u8(b, (u8) disp);
+    if (mod == 0x80) emit_u32(b, (u32) disp);
+}
+
+//
+// Emits `op reg, rm` with both operands being registers.
+static void emit_rr(jit_builder_t *b, u8 prefix, u32 opcode, bool wide, i32 reg, i32 rm) {
+    emit_prefix_and_rex(b, prefix, wide, reg, NO_INDEX, rm);
+    emit_opcode(b, opcode);
+    emit_u8(b, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+#define emit_value_op(b, prefix, opcode, wide, reg, value) \
+    emit_rm((b), (prefix), (opcode), (wide), (reg), REG_VALUES, NO_INDEX, 1, VALUE_OFFSET(value))
+
+static void emit_set_type(jit_builder_t *b, i32 value, u8 type) {
+    emit_rm(b, 0, 0xC6, false, 0, REG_VALUES, NO_INDEX, 1, TYPE_OFFSET(value));
+    emit_u8(b, type);
+}
+
+static void emit_mov_imm64(jit_builder_t *b, i32 reg, u64 imm) {
+    emit_prefix_and_rex(b, 0, true, 0, NO_INDEX, reg);
+    emit_u8(b, 0xB8 + (reg & 7));
+    emit_u64(b, imm);
+}
+
+static void emit_mov_imm32(jit_builder_t *b, i32 reg, u32 imm) {
+    emit_prefix_and_rex(b, 0, false, 0, NO_INDEX, reg);
+    emit_u8(b, 0xB8 + (reg & 7));
+    emit_u32(b, imm);
+}
+
+static void emit_call_abs(jit_builder_t *b, void *func) {
+    emit_mov_imm64(b, RAX, (u64) func);
+    emit_rr(b, 0, 0xFF, false, 2, RAX); // call rax
+}
+
+static void emit_jump_to_instr(jit_builder_t *b, u32 opcode, i32 target_instr) {
+    emit_opcode(b, opcode);
+
+    jit_patch_t patch;
+    patch.offset = b->buffer.length;
+    patch.target_instr = target_instr;
+    bh_arr_push(b->patches, patch);
+
+    emit_u32(b, 0);
+}
+
+#define JMP  0xE9
+#define JZ   0x0F84
+#define JNZ  0x0F85
+
+//
+// Copies an entire ovm_value_t.
+static void emit_copy_value(jit_builder_t *b, i32 dest_base, i32 dest_disp, i32 src_base, i32 src_disp) {
+    i32 offset = 0;
+    for (; offset + 16 <= (i32) sizeof(ovm_value_t); offset += 16) {
+        emit_rm(b, 0, 0x0F10, false, 0, src_base, NO_INDEX, 1, src_disp + offset);   // movups xmm0, [src]
+        emit_rm(b, 0, 0x0F11, false, 0, dest_base, NO_INDEX, 1, dest_disp + offset); // movups [dest], xmm0
+    }
+
+    // RCX, not RAX, because OVMI_PARAM passes the destination in RAX.
+    for (; offset < (i32) sizeof(ovm_value_t); offset += 8) {
+        emit_rm(b, 0, 0x8B, true, RCX, src_base, NO_INDEX, 1, src_disp + offset);
+        emit_rm(b, 0, 0x89, true, RCX, dest_base, NO_INDEX, 1, dest_disp + offset);
+    }
+}
+
+//
+// After anything that could push a stack frame or grow memory, the frame
+// pointer and memory have to be reloaded.
+static void emit_reload_frame(jit_builder_t *b) {
+    emit_rm(b, 0, 0x8B, true, REG_VALUES, REG_STATE, NO_INDEX, 1, offsetof(ovm_state_t, __frame_values));
+    emit_rm(b, 0, 0x8B, true, RAX, REG_STATE, NO_INDEX, 1, offsetof(ovm_state_t, engine));
+    emit_rm(b, 0, 0x8B, true, REG_MEMORY, RAX, NO_INDEX, 1, offsetof(ovm_engine_t, memory));
+}
+
+static void emit_prologue(jit_builder_t *b) {
+    emit_u8(b, 0x53);             // push rbx
+    emit_u8(b, 0x41); emit_u8(b, 0x54); // push r12
+    emit_u8(b, 0x41); emit_u8(b, 0x55); // push r13
+    emit_u8(b, 0x41); emit_u8(b, 0x56); // push r14
+    emit_u8(b, 0x41); emit_u8(b, 0x57); // push r15
+
+    emit_rr(b, 0, 0x89, true, RDI, REG_STATE);  // mov r13, rdi
+    emit_rr(b, 0, 0x89, true, RSI, REG_VALUES); // mov rbx, rsi
+    emit_rr(b, 0, 0x89, true, RDX, REG_MEMORY); // mov r12, rdx
+    emit_rr(b, 0, 0x89, true, RCX, REG_RESULT); // mov r14, rcx
+}
+
+static void emit_epilogue(jit_builder_t *b) {
+    emit_u8(b, 0x41); emit_u8(b, 0x5F); // pop r15
+    emit_u8(b, 0x41); emit_u8(b, 0x5E); // pop r14
+    emit_u8(b, 0x41); emit_u8(b, 0x5D); // pop r13
+    emit_u8(b, 0x41); emit_u8(b, 0x5C); // pop r12
+    emit_u8(b, 0x5B);             // pop rbx
+    emit_u8(b, 0xC3);             // ret
+}
+
+
+//
+// Instruction translation
+//
+
+static bool is_wide(u32 type) {
+    return type == OVM_TYPE_I64 || type == OVM_TYPE_F64;
+}
+
+//
+// Superinstructions only replace the opcode of the first instruction in the
+// sequence, so the JIT translates them as that original instruction, and
+// translates the rest of the sequence normally.
+static u32 unfuse_instr(ovm_instr_t *instr) {
+    u32 type = OVM_INSTR_TYPE(*instr);
+
+    switch (OVM_INSTR_INSTR(*instr)) {
+        case OVMI_ADD_IMM:    return OVM_TYPED_INSTR(OVMI_IMM, type);
+        case OVMI_LOAD_IDX:   return OVM_TYPED_INSTR(OVMI_ADD, OVM_TYPE_I32);
+        case OVMI_PARAM_CALL: return OVM_TYPED_INSTR(OVMI_PARAM, OVM_TYPE_NONE);
+        case OVMI_BR_EQ:      return OVM_TYPED_INSTR(OVMI_EQ, type);
+        case OVMI_BR_NE:      return OVM_TYPED_INSTR(OVMI_NE, type);
+        case OVMI_BR_LT:      return OVM_TYPED_INSTR(OVMI_LT, type);
+        case OVMI_BR_LT_S:    return OVM_TYPED_INSTR(OVMI_LT_S, type);
+        case OVMI_BR_LE:      return OVM_TYPED_INSTR(OVMI_LE, type);
+        case OVMI_BR_LE_S:    return OVM_TYPED_INSTR(OVMI_LE_S, type);
+        case OVMI_BR_GT:      return OVM_TYPED_INSTR(OVMI_GT, type);
+        case OVMI_BR_GT_S:    return OVM_TYPED_INSTR(OVMI_GT_S, type);
+        case OVMI_BR_GE:      return OVM_TYPED_INSTR(OVMI_GE, type);
+        case OVMI_BR_GE_S:    return OVM_TYPED_INSTR(OVMI_GE_S, type);
+        default:              return instr->full_instr;
+    }
+}
+
+static bool jit_int_binop(jit_builder_t *b, ovm_instr_t *instr, u32 kind, u32 type) {
+    bool wide = type == OVM_TYPE_I64;
+
+    u32 opcode;
+    switch (kind) {
+        case OVMI_ADD: opcode = 0x03; break;
+        case OVMI_SUB: opcode = 0x2B; break;
+        case OVMI_MUL: opcode = 0x0FAF; break;
+        case OVMI_AND: opcode = 0x23; break;
+        case OVMI_OR:  opcode = 0x0B; break;
+        case OVMI_XOR: opcode = 0x33; break;
+
+        case OVMI_SHL: case OVMI_SHR: case OVMI_SAR: {
+            u8 ext = kind == OVMI_SHL ? 4 : kind == OVMI_SHR ? 5 : 7;
+            emit_value_op(b, 0, 0x8B, wide, RAX, instr->a);
+            emit_value_op(b, 0, 0x8B, false, RCX, instr->b);
+            emit_rr(b, 0, 0xD3, wide, ext, RAX);
+            emit_value_op(b, 0, 0x89, wide, RAX, instr->r);
+            emit_set_type(b, instr->r, type);
+            return true;
+        }
+
+        case OVMI_DIV: case OVMI_DIV_S: case OVMI_REM: case OVMI_REM_S: {
+            bool is_signed = kind == OVMI_DIV_S || kind == OVMI_REM_S;
+            emit_value_op(b, 0, 0x8B, wide, RAX, instr->a);
+
+            if (is_signed) {
+                if (wide) emit_u8(b, 0x48);
+                emit_u8(b, 0x99); // cdq / cqo
+            } else {
+                emit_rr(b, 0, 0x31, false, RDX, RDX); // xor edx, edx
+            }
+
+            emit_value_op(b, 0, 0xF7, wide, is_signed ? 7 : 6, instr->b); // (i)div [b]
+
+            i32 result_reg = (kind == OVMI_DIV || kind == OVMI_DIV_S) ? RAX : RDX;
+            emit_value_op(b, 0, 0x89, wide, result_reg, instr->r);
+            emit_set_type(b, instr->r, type);
+            return true;
+        }
+
+        default: return false;
+    }
+
+    emit_value_op(b, 0, 0x8B, wide, RAX, instr->a);
+    emit_value_op(b, 0, opcode, wide, RAX, instr->b);
+    emit_value_op(b, 0, 0x89, wide, RAX, instr->r);
+    emit_set_type(b, instr->r, type);
+    return true;
+}
+
+static bool jit_float_binop(jit_builder_t *b, ovm_instr_t *instr, u32 kind, u32 type) {
+    u8 prefix = type == OVM_TYPE_F32 ? 0xF3 : 0xF2;
+
+    u32 opcode;
+    switch (kind) {
+        case OVMI_ADD: opcode = 0x0F58; break;
+        case OVMI_SUB: opcode = 0x0F5C; break;
+        case OVMI_MUL: opcode = 0x0F59; break;
+        case OVMI_DIV: opcode = 0x0F5E; break;
+        default: return false;
+    }
+
+    emit_value_op(b, prefix, 0x0F10, false, 0, instr->a);  // movs[sd] xmm0, [a]
+    emit_value_op(b, prefix, opcode, false, 0, instr->b);  // op xmm0, [b]
+    emit_value_op(b, prefix, 0x0F11, false, 0, instr->r);  // movs[sd] [r], xmm0
+    emit_set_type(b, instr->r, type);
+    return true;
+}
+
+static bool jit_compare(jit_builder_t *b, ovm_instr_t *instr, u32 kind, u32 type) {
+    if (type == OVM_TYPE_I32 || type == OVM_TYPE_I64) {
+        u32 setcc;
+        switch (kind) {
+            case OVMI_EQ:   setcc = 0x0F94; break;
+            case OVMI_NE:   setcc = 0x0F95; break;
+            case OVMI_LT:   setcc = 0x0F92; break;
+            case OVMI_LE:   setcc = 0x0F96; break;
+            case OVMI_GT:   setcc = 0x0F97; break;
+            case OVMI_GE:   setcc = 0x0F93; break;
+            case OVMI_LT_S: setcc = 0x0F9C; break;
+            case OVMI_LE_S: setcc = 0x0F9E; break;
+            case OVMI_GT_S: setcc = 0x0F9F; break;
+            case OVMI_GE_S: setcc = 0x0F9D; break;
+            default: return false;
+        }
+
+        bool wide = type == OVM_TYPE_I64;
+        emit_value_op(b, 0, 0x8B, wide, RAX, instr->a);
+        emit_value_op(b, 0, 0x3B, wide, RAX, instr->b);
+        emit_rr(b, 0, setcc, false, 0, RAX);
+
+    } else {
+        //
+        // ucomis[sd] sets ZF, PF and CF when either side is NaN, so only "above"
+        // and "above or equal" are false for NaN. Less-than comparisons are done
+        // with the operands swapped, and equality has to check PF as well.
+        u8 prefix = type == OVM_TYPE_F32 ? 0 : 0x66;
+        u8 load_prefix = type == OVM_TYPE_F32 ? 0xF3 : 0xF2;
+
+        bool swap = false;
+        u32 setcc;
+        switch (kind) {
+            case OVMI_EQ:   setcc = 0x0F94; break;
+            case OVMI_NE:   setcc = 0x0F95; break;
+            case OVMI_LT: case OVMI_LT_S: setcc = 0x0F97; swap = true; break;
+            case OVMI_LE: case OVMI_LE_S: setcc = 0x0F93; swap = true; break;
+            case OVMI_GT: case OVMI_GT_S: setcc = 0x0F97; break;
+            case OVMI_GE: case OVMI_GE_S: setcc = 0x0F93; break;
+            default: return false;
+        }
+
+        emit_value_op(b, load_prefix, 0x0F10, false, 0, swap ? instr->b : instr->a);
+        emit_value_op(b, prefix, 0x0F2E, false, 0, swap ? instr->a : instr->b);
+        emit_rr(b, 0, setcc, false, 0, RAX);
+
+        if (kind == OVMI_EQ) {
+            emit_rr(b, 0, 0x0F9B, false, 0, RCX); // setnp cl
+            emit_rr(b, 0, 0x20, false, RCX, RAX); // and al, cl
+        }
+
+        if (kind == OVMI_NE) {
+            emit_rr(b, 0, 0x0F9A, false, 0, RCX); // setp cl
+            emit_rr(b, 0, 0x08, false, RCX, RAX); // or al, cl
+        }
+    }
+
+    emit_rr(b, 0, 0x0FB6, false, RAX, RAX);  // movzx eax, al
+    emit_value_op(b, 0, 0x89, false, RAX, instr->r);
+    emit_set_type(b, instr->r, OVM_TYPE_I32);
+    return true;
+}
+
+//
+// Computes the effective address `%base + offset` into eax. This wraps at 32-bits,
+// just like the interpreter.
+static void emit_effective_address(jit_builder_t *b, i32 base, i32 offset) {
+    emit_value_op(b, 0, 0x8B, false, RAX, base);
+    if (offset != 0) {
+        emit_u8(b, 0x05); // add eax, imm32
+        emit_u32(b, offset);
+    }
+}
+
+static bool jit_load(jit_builder_t *b, ovm_instr_t *instr, u32 type) {
+    emit_effective_address(b, instr->a, instr->b);
+
+    switch (type) {
+        case OVM_TYPE_I8:
+            emit_rm(b, 0, 0x8A, false, RCX, REG_MEMORY, RAX, 1, 0);
+            emit_value_op(b, 0, 0x88, false, RCX, instr->r);
+            break;
+
+        case OVM_TYPE_I16:
+            emit_rm(b, 0x66, 0x8B, false, RCX, REG_MEMORY, RAX, 1, 0);
+            emit_value_op(b, 0x66, 0x89, false, RCX, instr->r);
+            break;
+
+        case OVM_TYPE_I32: case OVM_TYPE_F32:
+        case OVM_TYPE_I64: case OVM_TYPE_F64:
+            emit_rm(b, 0, 0x8B, is_wide(type), RCX, REG_MEMORY, RAX, 1, 0);
+            emit_value_op(b, 0, 0x89, is_wide(type), RCX, instr->r);
+            break;
+
+        default: return false;
+    }
+
+    emit_set_type(b, instr->r, type);
+    return true;
+}
+
+static bool jit_store(jit_builder_t *b, ovm_instr_t *instr, u32 type) {
+    emit_effective_address(b, instr->r, instr->b);
+
+    switch (type) {
+        case OVM_TYPE_I8:
+            emit_value_op(b, 0, 0x8A, false, RCX, instr->a);
+            emit_rm(b, 0, 0x88, false, RCX, REG_MEMORY, RAX, 1, 0);
+            break;
+
+        case OVM_TYPE_I16:
+            emit_value_op(b, 0x66, 0x8B, false, RCX, instr->a);
+            emit_rm(b, 0x66, 0x89, false, RCX, REG_MEMORY, RAX, 1, 0);
+            break;
+
+        case OVM_TYPE_I32: case OVM_TYPE_F32:
+        case OVM_TYPE_I64: case OVM_TYPE_F64:
+            emit_value_op(b, 0, 0x8B, is_wide(type), RCX, instr->a);
+            emit_rm(b, 0, 0x89, is_wide(type), RCX, REG_MEMORY, RAX, 1, 0);
+            break;
+
+        default: return false;
+    }
+
+    return true;
+}
+
+static bool jit_convert(jit_builder_t *b, ovm_instr_t *instr, u32 kind, u32 type) {
+    if (kind == OVMI_CVT_I32 && type == OVM_TYPE_I64) {
+        emit_value_op(b, 0, 0x8B, false, RAX, instr->a);   // mov eax, [a] (zero extends)
+        emit_value_op(b, 0, 0x89, true, RAX, instr->r);
+
+    } else if (kind == OVMI_CVT_I32_S && type == OVM_TYPE_I64) {
+        emit_value_op(b, 0, 0x63, true, RAX, instr->a);    // movsxd rax, [a]
+        emit_value_op(b, 0, 0x89, true, RAX, instr->r);
+
+    } else if ((kind == OVMI_CVT_I64 || kind == OVMI_CVT_I64_S) && type == OVM_TYPE_I32) {
+        emit_value_op(b, 0, 0x8B, false, RAX, instr->a);
+        emit_value_op(b, 0, 0x89, false, RAX, instr->r);
+
+    } else if ((kind == OVMI_CVT_I8_S || kind == OVMI_CVT_I16_S) && (type == OVM_TYPE_I32 || type == OVM_TYPE_I64)) {
+        u32 opcode = kind == OVMI_CVT_I8_S ? 0x0FBE : 0x0FBF; // movsx
+        emit_value_op(b, 0, opcode, type == OVM_TYPE_I64, RAX, instr->a);
+        emit_value_op(b, 0, 0x89, type == OVM_TYPE_I64, RAX, instr->r);
+
+    } else if ((kind == OVMI_CVT_I8 || kind == OVMI_CVT_I16) && (type == OVM_TYPE_I32 || type == OVM_TYPE_I64)) {
+        u32 opcode = kind == OVMI_CVT_I8 ? 0x0FB6 : 0x0FB7; // movzx
+        emit_value_op(b, 0, opcode, false, RAX, instr->a);
+        emit_value_op(b, 0, 0x89, type == OVM_TYPE_I64, RAX, instr->r);
+
+    } else {
+        return false;
+    }
+
+    emit_set_type(b, instr->r, type);
+    return true;
+}
+
+//
+// Executes a single instruction with the interpreter's implementation of it.
+static bool jit_single_instr(jit_builder_t *b, ovm_instr_t *instr) {
+    void *handler = ovm__single_instr_handler(instr->full_instr);
+    if (!handler) return false;
+
+    emit_mov_imm64(b, RDI, (u64) instr);
+    emit_rr(b, 0, 0x89, true, REG_STATE, RSI);   // mov rsi, r13
+    emit_rr(b, 0, 0x89, true, REG_VALUES, RDX);  // mov rdx, rbx
+    emit_rr(b, 0, 0x89, true, REG_MEMORY, RCX);  // mov rcx, r12
+    emit_mov_imm64(b, R8, (u64) b->program->code);
+    emit_call_abs(b, handler);
+    emit_reload_frame(b);
+    return true;
+}
+
+static bool jit_instr(jit_builder_t *b, i32 instr_idx) {
+    ovm_instr_t *instr = &b->program->code[instr_idx];
+
+    u32 full_instr = unfuse_instr(instr);
+    u32 kind = (full_instr >> 3) & 0xff;
+    u32 type = full_instr & 0x7;
+
+    switch (kind) {
+        case OVMI_NOP: return true;
+
+        case OVMI_IMM: {
+            switch (type) {
+                case OVM_TYPE_I32: case OVM_TYPE_F32:
+                    emit_mov_imm32(b, RAX, (u32) instr->i);
+                    break;
+
+                case OVM_TYPE_I64: case OVM_TYPE_F64:
+                    emit_mov_imm64(b, RAX, (u64) instr->l);
+                    break;
+
+                // The NOP holding the upper half is translated to nothing.
+                case OVM_TYPE_V128: return jit_single_instr(b, instr);
+
+                default: return false;
+            }
+
+            emit_value_op(b, 0, 0x89, true, RAX, instr->r);
+            emit_set_type(b, instr->r, type);
+            return true;
+        }
+
+        case OVMI_MOV: {
+            emit_copy_value(b, REG_VALUES, VALUE_OFFSET(instr->r), REG_VALUES, VALUE_OFFSET(instr->a));
+            return true;
+        }
+
+        case OVMI_ADD: case OVMI_SUB: case OVMI_MUL:
+        case OVMI_DIV: case OVMI_DIV_S: case OVMI_REM: case OVMI_REM_S:
+        case OVMI_AND: case OVMI_OR: case OVMI_XOR:
+        case OVMI_SHL: case OVMI_SHR: case OVMI_SAR: {
+            if (type == OVM_TYPE_I32 || type == OVM_TYPE_I64) {
+                if (jit_int_binop(b, instr, kind, type)) return true;
+            }
+
+            if (type == OVM_TYPE_F32 || type == OVM_TYPE_F64) {
+                if (jit_float_binop(b, instr, kind, type)) return true;
+            }
+
+            return jit_single_instr(b, instr);
+        }
+
+        case OVMI_EQ: case OVMI_NE:
+        case OVMI_LT: case OVMI_LT_S:
+        case OVMI_LE: case OVMI_LE_S:
+        case OVMI_GT: case OVMI_GT_S:
+        case OVMI_GE: case OVMI_GE_S: {
+            if (jit_compare(b, instr, kind, type)) return true;
+            return jit_single_instr(b, instr);
+        }
+
+        case OVMI_LOAD:
+        case OVMI_STORE: {
+            if (type == OVM_TYPE_V128) return jit_single_instr(b, instr);
+            if (kind == OVMI_LOAD) return jit_load(b, instr, type);
+            else                   return jit_store(b, instr, type);
+        }
+
+        case OVMI_CVT_I8:  case OVMI_CVT_I8_S:
+        case OVMI_CVT_I16: case OVMI_CVT_I16_S:
+        case OVMI_CVT_I32: case OVMI_CVT_I32_S:
+        case OVMI_CVT_I64: case OVMI_CVT_I64_S: {
+            if (jit_convert(b, instr, kind, type)) return true;
+            return jit_single_instr(b, instr);
+        }
+
+        case OVMI_PARAM: {
+            emit_rm(b, 0, 0x8B, false, RAX, REG_STATE, NO_INDEX, 1, offsetof(ovm_state_t, param_count));
+            emit_rm(b, 0, 0x8D, false, RCX, RAX, NO_INDEX, 1, 1);  // lea ecx, [rax + 1]
+            emit_rm(b, 0, 0x89, false, RCX, REG_STATE, NO_INDEX, 1, offsetof(ovm_state_t, param_count));
+
+            emit_rr(b, 0, 0x6B, true, RAX, RAX);                    // imul rax, rax, sizeof(ovm_value_t)
+            emit_u8(b, sizeof(ovm_value_t));
+            emit_rm(b, 0, 0x03, true, RAX, REG_STATE, NO_INDEX, 1, offsetof(ovm_state_t, param_buf));
+
+            emit_copy_value(b, RAX, 0, REG_VALUES, VALUE_OFFSET(instr->a));
+            return true;
+        }
+
+        case OVMI_CALL: case OVMI_CALLI: {
+            emit_rr(b, 0, 0x89, true, REG_STATE, RDI);  // mov rdi, r13
+
+            if (kind == OVMI_CALL) emit_mov_imm32(b, RSI, instr->a);
+            else                   emit_value_op(b, 0, 0x8B, false, RSI, instr->a);
+
+            emit_mov_imm32(b, RDX, instr->r);
+            emit_call_abs(b, ovm__jit_call);
+            emit_reload_frame(b);
+            return true;
+        }
+
+        case OVMI_CALL_INTERNAL: case OVMI_CALLI_INTERNAL: {
+            emit_rr(b, 0, 0x89, true, REG_STATE, RDI);  // mov rdi, r13
+
+            if (kind == OVMI_CALL_INTERNAL) emit_mov_imm32(b, RSI, instr->a);
+            else                            emit_value_op(b, 0, 0x8B, false, RSI, instr->a);
+
+            emit_mov_imm32(b, RDX, instr->r);
+            emit_call_abs(b, ovm__jit_call_internal);
+            emit_reload_frame(b);
+            return true;
+        }
+
+        case OVMI_RETURN: {
+            emit_copy_value(b, REG_RESULT, 0, REG_VALUES, VALUE_OFFSET(instr->a));
+            emit_epilogue(b);
+            return true;
+        }
+
+        case OVMI_BR: {
+            emit_jump_to_instr(b, JMP, instr_idx + 1 + instr->a);
+            return true;
+        }
+
+        case OVMI_BR_Z: case OVMI_BR_NZ: {
+            // cmp dword [b], 0
+            emit_value_op(b, 0, 0x83, false, 7, instr->b);
+            emit_u8(b, 0);
+
+            emit_jump_to_instr(b, kind == OVMI_BR_Z ? JZ : JNZ, instr_idx + 1 + instr->a);
+            return true;
+        }
+
+        case OVMI_BRI: {
+            //
+            // The target is relative to the next instruction, so the jump table is
+            // indexed from there.
+            b->needs_jump_table = true;
+            emit_value_op(b, 0, 0x63, true, RAX, instr->a);           // movsxd rax, [a]
+
+            emit_prefix_and_rex(b, 0, true, 0, NO_INDEX, RCX);
+            emit_u8(b, 0xB8 + RCX);                                   // mov rcx, imm64
+            bh_arr_push(b->patches, ((jit_patch_t) { b->buffer.length, -(instr_idx + 1) }));
+            emit_u64(b, 0);
+
+            emit_rm(b, 0, 0xFF, false, 4, RCX, RAX, 8, 0);            // jmp [rcx + rax * 8]
+            return true;
+        }
+
+        case OVMI_BRI_Z:
+        case OVMI_BRI_NZ:
+            b->failure = "bri_z/bri_nz";
+            return false;
+
+        case OVMI_BREAK:
+            b->failure = "unreachable";
+            return false;
+
+        default:
+            return jit_single_instr(b, instr);
+    }
+}
+
+static bool ovm_jit_translate(jit_builder_t *b) {
+    emit_prologue(b);
+
+    fori (i, b->start_instr, b->end_instr) {
+        b->instr_offsets[i - b->start_instr] = b->buffer.length;
+
+        if (!jit_instr(b, i)) {
+            if (!b->failure) {
+                b->failure = bh_aprintf(bh_heap_allocator(), "unsupported instruction '%s'",
+                    ovm_instr_name(OVM_INSTR_INSTR(b->program->code[i])));
+            }
+
+            return false;
+        }
+    }
+
+    //
+    // Every function ends in a return, but this makes sure that falling off the
+    // end can never run into whatever comes next.
+    b->instr_offsets[b->end_instr - b->start_instr] = b->buffer.length;
+    emit_u8(b, 0x0F); emit_u8(b, 0x0B); // ud2
+    return true;
+}
+
+bool ovm_jit_compile_func(ovm_jit_t *jit, ovm_program_t *program, ovm_func_t *func) {
+    pthread_mutex_lock(&jit->lock);
+
+    if (func->jit_func || func->jit_failure) {
+        pthread_mutex_unlock(&jit->lock);
+        return func->jit_func != NULL;
+    }
+
+    jit_builder_t b = {0};
+    b.program = program;
+    b.func = func;
+    b.start_instr = func->start_instr;
+    b.end_instr = ovm_jit_func_end(program, func);
+    b.instr_offsets = bh_alloc_array(bh_heap_allocator(), i32, b.end_instr - b.start_instr + 1);
+    bh_arr_new(bh_heap_allocator(), b.patches, 32);
+    bh_buffer_init(&b.buffer, bh_heap_allocator(), 1024);
+
+    bool success = ovm_jit_translate(&b);
+    i32 instr_count = b.end_instr - b.start_instr;
+
+    //
+    // The jump table for `bri` is placed after the code.
+    i32 table_offset = 0;
+    if (success && b.needs_jump_table) {
+        bh_buffer_align(&b.buffer, 8);
+        table_offset = b.buffer.length;
+        fori (i, 0, instr_count) emit_u64(&b, 0);
+    }
+
+    u8 *code = NULL;
+    if (success) {
+        code = ovm_jit_reserve_code(jit, b.buffer.length);
+        if (!code) {
+            b.failure = "out of space for native code";
+            success = false;
+        }
+    }
+
+    if (success) {
+        bh_arr_each(jit_patch_t, patch, b.patches) {
+            if (patch->target_instr >= 0) {
+                i32 target = b.instr_offsets[patch->target_instr - b.start_instr];
+                *(i32 *) &b.buffer.data[patch->offset] = target - (patch->offset + 4);
+            } else {
+                i32 base = -patch->target_instr - b.start_instr;
+                *(u64 *) &b.buffer.data[patch->offset] = (u64) (code + table_offset + base * 8);
+            }
+        }
+
+        if (b.needs_jump_table) {
+            fori (i, 0, instr_count) {
+                *(u64 *) &b.buffer.data[table_offset + i * 8] = (u64) (code + b.instr_offsets[i]);
+            }
+        }
+
+        if (!ovm_jit_write_code(code, b.buffer.data, b.buffer.length)) {
+            b.failure = "failed to make native code executable";
+            success = false;
+        }
+    }
+
+    if (success) {
+        __atomic_store_n(&func->jit_func, (ovm_jit_func_t) code, __ATOMIC_RELEASE);
+    } else {
+        func->jit_failure = b.failure ? b.failure : "unknown";
+    }
+
+    bh_buffer_free(&b.buffer);
+    bh_arr_free(b.patches);
+    bh_free(bh_heap_allocator(), b.instr_offsets);
+
+    pthread_mutex_unlock(&jit->lock);
+    return success;
+}
+
+#else
+
+bool ovm_jit_compile_func(ovm_jit_t *jit, ovm_program_t *program, ovm_func_t *func) {
+    func->jit_failure = "unsupported architecture";
+    return false;
+}
+
+#endif
+
+
+//
+// Statistics
+//
+
+static int jit_func_compare(const void *a, const void *b) {
+    u32 ca = (*(ovm_func_t **) a)->call_count;
+    u32 cb = (*(ovm_func_t **) b)->call_count;
+    return (ca < cb) - (ca > cb);
+}
+
+void ovm_program_print_jit_stats(ovm_program_t *program) {
+    bh_arr(ovm_func_t *) called = NULL;
+    bh_arr_new(bh_heap_allocator(), called, 64);
+
+    i32 jitted_count = 0;
+    bh_arr_each(ovm_func_t, func, program->funcs) {
+        if (func->kind != OVM_FUNC_INTERNAL || func->call_count == 0) continue;
+
+        bh_arr_push(called, func);
+        if (func->jit_func) jitted_count++;
+    }
+
+    qsort(called, bh_arr_length(called), sizeof(ovm_func_t *), jit_func_compare);
+
+    fprintf(stderr, "\nOVM JIT: %d of %d called functions jitted:\n", jitted_count, bh_arr_length(called));
+    bh_arr_each(ovm_func_t *, pfunc, called) {
+        ovm_func_t *func = *pfunc;
+
+        if (func->jit_func) {
+            fprintf(stderr, "  %12u  %-24s  jitted\n", func->call_count, func->name);
+        } else if (func->jit_failure) {
+            fprintf(stderr, "  %12u  %-24s  interpreted (%s)\n", func->call_count, func->name, func->jit_failure);
+        } else {
+            fprintf(stderr, "  %12u  %-24s  interpreted\n", func->call_count, func->name);
+        }
+    }
+
+    bh_arr_free(called);
+}
@@ -0,0 +1,274 @@
+#include "vm.h"
+
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+//
+// Sampling profiler
+//
+// A CPU time timer (ITIMER_PROF) sends SIGPROF to whichever thread is using
+// the CPU when it expires. The handler records the function of every stack
+// frame of the state that is running on that thread, and the pc of the
+// innermost one. Threads that are blocked do not use CPU time, so they are
+// never sampled.
+//
+// Samples are appended to a large reservation that is only committed as it
+// is used. Nothing is allocated, looked up or formatted in the handler; that
+// all happens in ovm_engine_write_profile, once the program is finished.
+//
+// Each sample is stored as:
+//
+//     u32 depth | OVM_PROFILER_SAMPLE_DONE
+//     u32 pc
+//     u32 func id, for each frame from the outermost to the innermost
+//
+// The depth is written last, with OVM_PROFILER_SAMPLE_DONE set, so a sample
+// that was not finished is never read.
+//
+
+#define OVM_PROFILER_SAMPLE_DONE  0x80000000
+#define OVM_PROFILER_RESERVATION  (1ll << 30)
+#define OVM_PROFILER_MAX_DEPTH    512
+
+static ovm_profiler_t *ovm__profiler = NULL;
+
+static void ovm__profiler_signal_handler(int signo) {
+    ovm_profiler_t *profiler = ovm__profiler;
+    ovm_state_t *state = ovm__current_state;
+    if (!profiler || !state) return;
+
+    //
+    // Only the innermost frames of a very deep stack are kept.
+    i32 frame_count = state->stack_frame_count;
+    i32 depth = bh_min(frame_count, OVM_PROFILER_MAX_DEPTH);
+    if (depth <= 0) return;
+
+    u64 word_count = depth + 2;
+    u64 offset = __atomic_fetch_add(&profiler->sample_words, word_count, __ATOMIC_RELAXED);
+    if (offset + word_count > profiler->sample_capacity) {
+        __atomic_fetch_add(&profiler->dropped_samples, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    u32 *sample = profiler->samples + offset;
+    sample[1] = state->pc;
+
+    ovm_stack_frame_t *frames = state->stack_frames + (frame_count - depth);
+    fori (i, 0, depth) {
+        sample[2 + i] = frames[i].func->id;
+    }
+
+    __atomic_store_n(&sample[0], depth | OVM_PROFILER_SAMPLE_DONE, __ATOMIC_RELEASE);
+}
+
+void ovm_engine_enable_profiler(ovm_engine_t *engine, i32 interval_us) {
+    if (engine->profiler) return;
+
+    //
+    // Only one engine can be profiled at a time, because the timer is shared
+    // by the whole process.
+    if (ovm__profiler) return;
+
+    ovm_profiler_t *profiler = bh_alloc_item(bh_heap_allocator(), ovm_profiler_t);
+    memset(profiler, 0, sizeof(*profiler));
+
+    profiler->samples = mmap(NULL, OVM_PROFILER_RESERVATION, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (profiler->samples == MAP_FAILED) {
+        bh_free(bh_heap_allocator(), profiler);
+        return;
+    }
+
+    profiler->sample_capacity = OVM_PROFILER_RESERVATION / sizeof(u32);
+    profiler->interval_us = interval_us > 0 ? interval_us : 1000;
+
+    engine->profiler = profiler;
+    ovm__profiler = profiler;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ovm__profiler_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec  = profiler->interval_us / 1000000;
+    timer.it_interval.tv_usec = profiler->interval_us % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+static void ovm__profiler_stop() {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void ovm_profiler_delete(ovm_profiler_t *profiler) {
+    ovm__profiler_stop();
+    if (ovm__profiler == profiler) ovm__profiler = NULL;
+
+    munmap(profiler->samples, OVM_PROFILER_RESERVATION);
+    bh_free(bh_heap_allocator(), profiler);
+}
+
+//
+// Samples are sorted so that identical stacks are next to each other, and
+// can be counted in one pass.
+static int ovm__profiler_compare_samples(const void *a, const void *b) {
+    u32 *sa = *(u32 **) a;
+    u32 *sb = *(u32 **) b;
+
+    u32 depth_a = sa[0] & ~OVM_PROFILER_SAMPLE_DONE;
+    u32 depth_b = sb[0] & ~OVM_PROFILER_SAMPLE_DONE;
+    if (depth_a != depth_b) return depth_a < depth_b ? -1 : 1;
+
+    fori (i, 1, (i32) depth_a + 2) {
+        if (sa[i] != sb[i]) return sa[i] < sb[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static void ovm__profiler_append_name(bh_buffer *out, char *name) {
+    // ';' separates frames in the output, so it cannot appear in a name.
+    for (char *c = name; *c; c++) {
+        bh_buffer_write_byte(out, *c == ';' ? ',' : *c);
+    }
+}
+
+static void ovm__profiler_append_func(bh_buffer *out, ovm_program_t *program, debug_info_t *info, u32 func_id) {
+    debug_func_info_t func_info;
+    if (debug_info_lookup_func(info, func_id, &func_info) && func_info.name) {
+        ovm__profiler_append_name(out, func_info.name);
+        return;
+    }
+
+    if (func_id < (u32) bh_arr_length(program->funcs) && program->funcs[func_id].name) {
+        ovm__profiler_append_name(out, program->funcs[func_id].name);
+        return;
+    }
+
+    ovm__profiler_append_name(out, bh_bprintf("func_%d", func_id));
+}
+
+typedef struct ovm_profiler_stack_t {
+    char *frames;
+    i32   count;
+} ovm_profiler_stack_t;
+
+static int ovm__profiler_compare_stacks(const void *a, const void *b) {
+    return strcmp(((ovm_profiler_stack_t *) a)->frames, ((ovm_profiler_stack_t *) b)->frames);
+}
+
+//
+// Writes every sample in the "collapsed stack" format that flamegraph tools
+// read: one line for every distinct stack, with the frames from the outermost
+// to the innermost separated by ';', followed by the number of samples. When
+// there is debug info, the source line of the innermost pc is added as one more
+// frame, so the hottest lines show up at the top of the flamegraph.
+bool ovm_engine_write_profile(ovm_engine_t *engine, ovm_program_t *program, debug_info_t *info, char *filename) {
+    ovm_profiler_t *profiler = engine->profiler;
+    if (!profiler) return false;
+
+    ovm__profiler_stop();
+
+    FILE *out = fopen(filename, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to open '%s' to write the profile.\n", filename);
+        return false;
+    }
+
+    bh_arr(u32 *) samples = NULL;
+    bh_arr_new(bh_heap_allocator(), samples, 1024);
+
+    u64 end = bh_min(profiler->sample_words, profiler->sample_capacity);
+    u64 offset = 0;
+    while (offset + 2 <= end) {
+        u32 *sample = profiler->samples + offset;
+        u32 header = __atomic_load_n(&sample[0], __ATOMIC_ACQUIRE);
+        if (!(header & OVM_PROFILER_SAMPLE_DONE)) break;
+
+        bh_arr_push(samples, sample);
+        offset += (header & ~OVM_PROFILER_SAMPLE_DONE) + 2;
+    }
+
+    //
+    // Identical samples are counted first, so every distinct stack only has
+    // to be formatted once. Different pcs can still format to the same stack,
+    // so the formatted stacks are sorted and counted again.
+    qsort(samples, bh_arr_length(samples), sizeof(u32 *), ovm__profiler_compare_samples);
+
+    bh_arr(ovm_profiler_stack_t) stacks = NULL;
+    bh_arr_new(bh_heap_allocator(), stacks, 256);
+
+    bh_buffer frames;
+    bh_buffer_init(&frames, bh_heap_allocator(), 256);
+
+    i32 i = 0;
+    while (i < bh_arr_length(samples)) {
+        i32 count = 1;
+        while (i + count < bh_arr_length(samples)
+            && !ovm__profiler_compare_samples(&samples[i], &samples[i + count])) {
+            count += 1;
+        }
+
+        u32 *sample = samples[i];
+        u32 depth = sample[0] & ~OVM_PROFILER_SAMPLE_DONE;
+
+        bh_buffer_clear(&frames);
+        fori (j, 0, (i32) depth) {
+            if (j > 0) bh_buffer_write_byte(&frames, ';');
+            ovm__profiler_append_func(&frames, program, info, sample[2 + j]);
+        }
+
+        debug_loc_info_t loc;
+        debug_file_info_t file_info;
+        if (sample[1] < (u32) bh_arr_length(info->instruction_reducer)
+            && debug_info_lookup_location(info, sample[1], &loc)
+            && debug_info_lookup_file(info, loc.file_id, &file_info)) {
+            bh_buffer_write_byte(&frames, ';');
+            ovm__profiler_append_name(&frames, file_info.name);
+            ovm__profiler_append_name(&frames, bh_bprintf(":%d", loc.line));
+        }
+
+        bh_buffer_write_byte(&frames, 0);
+
+        ovm_profiler_stack_t stack;
+        stack.frames = bh_alloc_array(bh_heap_allocator(), char, frames.length);
+        stack.count  = count;
+        memcpy(stack.frames, frames.data, frames.length);
+        bh_arr_push(stacks, stack);
+
+        i += count;
+    }
+
+    qsort(stacks, bh_arr_length(stacks), sizeof(ovm_profiler_stack_t), ovm__profiler_compare_stacks);
+
+    i = 0;
+    while (i < bh_arr_length(stacks)) {
+        i32 total = stacks[i].count;
+        i32 j = i + 1;
+        while (j < bh_arr_length(stacks) && !strcmp(stacks[i].frames, stacks[j].frames)) {
+            total += stacks[j].count;
+            j += 1;
+        }
+
+        fprintf(out, "%s %d\n", stacks[i].frames, total);
+        i = j;
+    }
+
+    fclose(out);
+
+    if (profiler->dropped_samples > 0) {
+        fprintf(stderr, "OVM profiler: %llu samples were dropped, because the sample buffer was full.\n",
+            (u64) profiler->dropped_samples);
+    }
+
+    bh_arr_each(ovm_profiler_stack_t, stack, stacks) bh_free(bh_heap_allocator(), stack->frames);
+    bh_arr_free(stacks);
+    bh_arr_free(samples);
+    bh_buffer_free(&frames);
+    return true;
+}
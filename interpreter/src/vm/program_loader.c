@@ -1,5 +1,14 @@
 #include "vm.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef MAP_POPULATE
+    #define MAP_POPULATE 0
+#endif
+
 //
 // I'm very lazy and silly, so this code make the drastic assumption that the
 // endianness of the machine that the file was built on and the machine the
@@ -7,6 +16,10 @@
 // well could be f-ed up. Might be worth switching all integers to use ntohl,
 // so at least that part is consistent...               -brendanfh 06/13/2022
 //
+// Program images (version 2, below) store a byte order marker and the size of
+// an instruction in their header, and are rejected instead of misread when
+// either does not match the running VM.
+//
 
 //
 // I wish this didn't take the engine as a parameter... but currently the memory
@@ -53,6 +66,7 @@ bool ovm_program_load_from_file(ovm_program_t *program, ovm_engine_t *engine, ch
 
         assert(engine);
         assert(engine->memory);
+        if (!ovm_engine_memory_ensure_capacity(engine, (i64) offset + size)) return false;
         bh_file_read(&file, ((u8 *) engine->memory) + offset, size);
     }
 
@@ -124,3 +138,412 @@ void ovm_state_link_external_funcs(ovm_program_t *program, ovm_state_t *state, o
         }
     }
 }
+
+
+//
+// Program images
+//
+// An image is a header followed by a list of sections. Every section is a u32
+// element count and a u32 element size followed by the elements, padded to a
+// multiple of 8 bytes. Integers are stored in the byte order of the machine
+// that wrote the image, which is why the byte order marker is checked first.
+//
+//     code                  ovm_instr_t
+//     funcs                 ovm_program_image_func_t
+//     func names            char, every name is NUL terminated
+//     static data           ovm_static_integer_array_t
+//     static integers       i32
+//     line info             debug_loc_info_t
+//     instruction reducer   u32
+//     line to instruction   u32, the whole array
+//     file line offsets     i32, one for every file
+//     symbol scopes         ovm_program_image_scope_t
+//     scope symbols         u32
+//
+// Images are only valid for the build of the VM that wrote them, because the
+// encoding of instructions is not stable between builds. The build stamp is
+// part of the key for this reason.
+//
+
+#define OVM_PROGRAM_IMAGE_BYTE_ORDER 0x01020304
+#define OVM_PROGRAM_IMAGE_BUILD_STAMP (__DATE__ " " __TIME__)
+
+typedef struct ovm_program_image_header_t {
+    char magic[4];
+    u8   version[4];
+    u32  byte_order;
+    u32  instr_size;
+    u64  key;
+    ovm_program_mark_t mark;
+} ovm_program_image_header_t;
+
+typedef struct ovm_program_image_func_t {
+    i32 kind;
+    i32 param_count;
+    i32 value_number_count;
+    i32 index; // start_instr or external_func_idx
+} ovm_program_image_func_t;
+
+typedef struct ovm_program_image_scope_t {
+    i32 parent;
+    i32 symbol_count;
+} ovm_program_image_scope_t;
+
+typedef struct ovm_program_image_reader_t {
+    u8 *data;
+    u64 size;
+    u64 offset;
+    bool failed;
+} ovm_program_image_reader_t;
+
+//
+// When an image is loaded into an empty program, the code is used directly from
+// the mapping instead of being copied. The bytes just before the code hold the
+// end of the header, which is not needed once it has been validated, so they
+// are overwritten with a bh_arr header (the mapping is private, so the file is
+// not changed). The array is given this allocator, which unmaps the image when
+// the array is freed, and moves the array to the heap if it ever needs to grow.
+typedef struct ovm_program_image_mapping_t {
+    u8 *data;
+    u64 size;
+} ovm_program_image_mapping_t;
+
+static BH_ALLOCATOR_PROC(image_mapping_allocator_proc) {
+    ovm_program_image_mapping_t *mapping = data;
+
+    switch (action) {
+        case bh_allocator_action_alloc: return NULL;
+
+        case bh_allocator_action_resize: {
+            u64 available = mapping->data + mapping->size - (u8 *) prev_memory;
+            void *new_memory = bh_alloc(bh_heap_allocator(), size);
+            memcpy(new_memory, prev_memory, bh_min((u64) size, available));
+
+            ((bh__arr *) new_memory)->allocator = bh_heap_allocator();
+
+            munmap(mapping->data, mapping->size);
+            bh_free(bh_heap_allocator(), mapping);
+            return new_memory;
+        }
+
+        case bh_allocator_action_free: {
+            munmap(mapping->data, mapping->size);
+            bh_free(bh_heap_allocator(), mapping);
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+void ovm_program_mark(ovm_program_t *program, debug_info_t *debug, ovm_program_mark_t *mark) {
+    memset(mark, 0, sizeof(*mark));
+    mark->code_count           = bh_arr_length(program->code);
+    mark->func_count           = bh_arr_length(program->funcs);
+    mark->static_data_count    = bh_arr_length(program->static_data);
+    mark->static_integer_count = bh_arr_length(program->static_integers);
+
+    mark->line_info_count           = bh_arr_length(debug->line_info);
+    mark->instruction_reducer_count = bh_arr_length(debug->instruction_reducer);
+    mark->symbol_scope_count        = bh_arr_length(debug->symbol_scopes);
+    mark->file_count                = bh_arr_length(debug->files);
+}
+
+u64 ovm_program_image_key(u8 *data, i64 size, u32 flags) {
+    // FNV-1a, but mixing in 8 bytes at a time, with a final avalanche step
+    // so every bit of the input can affect every bit of the key.
+    u64 hash = 0xcbf29ce484222325ull;
+    #define MIX(x) (hash = (hash ^ (x)) * 0x100000001b3ull)
+
+    char *stamp = OVM_PROGRAM_IMAGE_BUILD_STAMP;
+    while (*stamp) MIX((u8) *stamp++);
+
+    MIX(OVM_PROGRAM_IMAGE_VERSION);
+    MIX(flags);
+    MIX((u64) size);
+
+    i64 i = 0;
+    for (; i + 8 <= size; i += 8) {
+        u64 word;
+        memcpy(&word, data + i, 8);
+        MIX(word);
+    }
+
+    for (; i < size; i++) MIX(data[i]);
+
+    #undef MIX
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static void image_write_section(bh_buffer *buffer, void *data, u32 count, u32 elem_size) {
+    bh_buffer_write_u32(buffer, count);
+    bh_buffer_write_u32(buffer, elem_size);
+    if (count > 0) bh_buffer_append(buffer, data, count * elem_size);
+
+    while (buffer->length % 8 != 0) bh_buffer_write_byte(buffer, 0);
+}
+
+static void *image_read_section(ovm_program_image_reader_t *reader, u32 elem_size, u32 *out_count) {
+    *out_count = 0;
+    if (reader->failed) return NULL;
+
+    if (reader->offset + 8 > reader->size) goto failed;
+
+    u32 count, size;
+    memcpy(&count, reader->data + reader->offset, 4);
+    memcpy(&size,  reader->data + reader->offset + 4, 4);
+    reader->offset += 8;
+
+    if (size != elem_size) goto failed;
+
+    u64 byte_count = (u64) count * size;
+    if (byte_count > reader->size - reader->offset) goto failed;
+
+    void *data = reader->data + reader->offset;
+    reader->offset = bh_min(reader->size, (reader->offset + byte_count + 7) & ~7ull);
+
+    *out_count = count;
+    return data;
+
+  failed:
+    reader->failed = true;
+    return NULL;
+}
+
+bool ovm_program_image_save(ovm_program_t *program, debug_info_t *debug, ovm_program_mark_t *mark, u64 key, char *filename) {
+    bh_buffer buffer;
+    bh_buffer_init(&buffer, bh_heap_allocator(), 1 << 16);
+
+    ovm_program_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "OVMI", 4);
+    header.version[3]  = OVM_PROGRAM_IMAGE_VERSION;
+    header.byte_order  = OVM_PROGRAM_IMAGE_BYTE_ORDER;
+    header.instr_size  = sizeof(ovm_instr_t);
+    header.key         = key;
+    header.mark        = *mark;
+    bh_buffer_append(&buffer, &header, sizeof(header));
+
+    image_write_section(&buffer, program->code + mark->code_count,
+        bh_arr_length(program->code) - mark->code_count, sizeof(ovm_instr_t));
+
+    //
+    // Funcs are written as fixed size records, followed by all of their names.
+    i32 func_count = bh_arr_length(program->funcs) - mark->func_count;
+    ovm_program_image_func_t *funcs = bh_alloc_array(bh_heap_allocator(), ovm_program_image_func_t, bh_max(func_count, 1));
+
+    bh_buffer names;
+    bh_buffer_init(&names, bh_heap_allocator(), 1024);
+
+    fori (i, 0, func_count) {
+        ovm_func_t *func = &program->funcs[mark->func_count + i];
+        funcs[i].kind = func->kind;
+        funcs[i].param_count = func->param_count;
+        funcs[i].value_number_count = func->value_number_count;
+        funcs[i].index = func->kind == OVM_FUNC_INTERNAL ? func->start_instr : func->external_func_idx;
+
+        bh_buffer_write_string(&names, func->name ? func->name : "");
+        bh_buffer_write_byte(&names, 0);
+    }
+
+    image_write_section(&buffer, funcs, func_count, sizeof(ovm_program_image_func_t));
+    image_write_section(&buffer, names.data, names.length, 1);
+    bh_free(bh_heap_allocator(), funcs);
+    bh_buffer_free(&names);
+
+    image_write_section(&buffer, program->static_data + mark->static_data_count,
+        bh_arr_length(program->static_data) - mark->static_data_count, sizeof(ovm_static_integer_array_t));
+
+    image_write_section(&buffer, program->static_integers + mark->static_integer_count,
+        bh_arr_length(program->static_integers) - mark->static_integer_count, sizeof(i32));
+
+    //
+    // Debug info
+    image_write_section(&buffer, debug->line_info + mark->line_info_count,
+        bh_arr_length(debug->line_info) - mark->line_info_count, sizeof(debug_loc_info_t));
+
+    image_write_section(&buffer, debug->instruction_reducer + mark->instruction_reducer_count,
+        bh_arr_length(debug->instruction_reducer) - mark->instruction_reducer_count, sizeof(u32));
+
+    image_write_section(&buffer, debug->line_to_instruction,
+        bh_arr_length(debug->line_to_instruction), sizeof(u32));
+
+    i32 file_count = bh_arr_length(debug->files);
+    i32 *file_offsets = bh_alloc_array(bh_heap_allocator(), i32, bh_max(file_count, 1));
+    fori (i, 0, file_count) file_offsets[i] = debug->files[i].line_buffer_offset;
+    image_write_section(&buffer, file_offsets, file_count, sizeof(i32));
+    bh_free(bh_heap_allocator(), file_offsets);
+
+    i32 scope_count = bh_arr_length(debug->symbol_scopes) - mark->symbol_scope_count;
+    ovm_program_image_scope_t *scopes = bh_alloc_array(bh_heap_allocator(), ovm_program_image_scope_t, bh_max(scope_count, 1));
+    bh_arr(u32) symbols = NULL;
+    bh_arr_new(bh_heap_allocator(), symbols, 128);
+
+    fori (i, 0, scope_count) {
+        debug_sym_scope_t *scope = &debug->symbol_scopes[mark->symbol_scope_count + i];
+        scopes[i].parent = scope->parent;
+        scopes[i].symbol_count = bh_arr_length(scope->symbols);
+
+        bh_arr_each(u32, sym, scope->symbols) bh_arr_push(symbols, *sym);
+    }
+
+    image_write_section(&buffer, scopes, scope_count, sizeof(ovm_program_image_scope_t));
+    image_write_section(&buffer, symbols, bh_arr_length(symbols), sizeof(u32));
+    bh_free(bh_heap_allocator(), scopes);
+    bh_arr_free(symbols);
+
+    //
+    // The image is written to a temporary file and then renamed into place, so
+    // a process reading the image never sees a partially written one.
+    char *temp_name = bh_aprintf(bh_heap_allocator(), "%s.%d.tmp", filename, (i32) getpid());
+
+    bool success = false;
+    bh_file file;
+    if (bh_file_create(&file, temp_name) == BH_FILE_ERROR_NONE) {
+        success = bh_file_write(&file, buffer.data, buffer.length);
+        bh_file_close(&file);
+
+        if (success) success = rename(temp_name, filename) == 0;
+        if (!success) bh_file_remove(temp_name);
+    }
+
+    bh_free(bh_heap_allocator(), temp_name);
+    bh_buffer_free(&buffer);
+    return success;
+}
+
+bool ovm_program_image_load(ovm_program_t *program, debug_info_t *debug, u64 key, char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (i64) sizeof(ovm_program_image_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    u8 *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    bool success = false;
+    bool keep_mapping = false;
+
+    ovm_program_image_header_t header;
+    memcpy(&header, data, sizeof(header));
+
+    if (strncmp(header.magic, "OVMI", 4)) goto done;
+    if (header.version[0] || header.version[1] || header.version[2] || header.version[3] != OVM_PROGRAM_IMAGE_VERSION) goto done;
+    if (header.byte_order != OVM_PROGRAM_IMAGE_BYTE_ORDER) goto done;
+    if (header.instr_size != sizeof(ovm_instr_t)) goto done;
+    if (header.key != key) goto done;
+
+    ovm_program_mark_t mark;
+    ovm_program_mark(program, debug, &mark);
+    if (memcmp(&mark, &header.mark, sizeof(mark))) goto done;
+
+    ovm_program_image_reader_t reader;
+    reader.data   = data;
+    reader.size   = st.st_size;
+    reader.offset = sizeof(header);
+    reader.failed = false;
+
+    u32 code_count, func_count, names_length, static_data_count, static_integer_count;
+    u32 line_info_count, reducer_count, line_to_instruction_count, file_count, scope_count, symbol_count;
+
+    ovm_instr_t                 *code         = image_read_section(&reader, sizeof(ovm_instr_t), &code_count);
+    ovm_program_image_func_t    *funcs        = image_read_section(&reader, sizeof(ovm_program_image_func_t), &func_count);
+    char                        *names        = image_read_section(&reader, 1, &names_length);
+    ovm_static_integer_array_t  *static_data  = image_read_section(&reader, sizeof(ovm_static_integer_array_t), &static_data_count);
+    i32                         *static_ints  = image_read_section(&reader, sizeof(i32), &static_integer_count);
+    debug_loc_info_t            *line_info    = image_read_section(&reader, sizeof(debug_loc_info_t), &line_info_count);
+    u32                         *reducer      = image_read_section(&reader, sizeof(u32), &reducer_count);
+    u32                         *line_to_instr = image_read_section(&reader, sizeof(u32), &line_to_instruction_count);
+    i32                         *file_offsets = image_read_section(&reader, sizeof(i32), &file_count);
+    ovm_program_image_scope_t   *scopes       = image_read_section(&reader, sizeof(ovm_program_image_scope_t), &scope_count);
+    u32                         *symbols      = image_read_section(&reader, sizeof(u32), &symbol_count);
+
+    if (reader.failed) goto done;
+    if ((i32) file_count != mark.file_count) goto done;
+    if (names_length > 0 && names[names_length - 1] != 0) goto done;
+
+    // Every name has to be present, and every symbol has to belong to a scope.
+    u32 name_count = 0, scope_symbol_count = 0;
+    fori (i, 0, (i32) names_length) if (names[i] == 0) name_count++;
+    fori (i, 0, (i32) scope_count)  scope_symbol_count += scopes[i].symbol_count;
+    if (name_count != func_count || scope_symbol_count != symbol_count) goto done;
+
+    //
+    // Everything has been validated, so nothing below can fail.
+    if (mark.code_count == 0 && (u8 *) code - data == sizeof(header) + 8 && sizeof(bh__arr) <= sizeof(header) + 8) {
+        ovm_program_image_mapping_t *mapping = bh_alloc_item(bh_heap_allocator(), ovm_program_image_mapping_t);
+        mapping->data = data;
+        mapping->size = st.st_size;
+
+        bh__arr *code_header = (bh__arr *) code - 1;
+        code_header->allocator.proc = image_mapping_allocator_proc;
+        code_header->allocator.data = mapping;
+        code_header->length   = code_count;
+        code_header->capacity = code_count;
+
+        bh_arr_free(program->code);
+        program->code = code;
+        keep_mapping = true;
+
+    } else {
+        bh_arr_insert_end(program->code, code_count);
+        memcpy(program->code + mark.code_count, code, code_count * sizeof(ovm_instr_t));
+    }
+
+    fori (i, 0, (i32) func_count) {
+        i32 name_len = strlen(names);
+        char *name = bh_alloc_array(program->store->arena_allocator, char, name_len + 1);
+        memcpy(name, names, name_len + 1);
+        names += name_len + 1;
+
+        if (funcs[i].kind == OVM_FUNC_INTERNAL) {
+            ovm_program_register_func(program, name, funcs[i].index, funcs[i].param_count, funcs[i].value_number_count);
+        } else {
+            ovm_program_register_external_func(program, name, funcs[i].param_count, funcs[i].index);
+        }
+    }
+
+    fori (i, 0, (i32) static_data_count) bh_arr_push(program->static_data, static_data[i]);
+
+    bh_arr_insert_end(program->static_integers, static_integer_count);
+    memcpy(program->static_integers + mark.static_integer_count, static_ints, static_integer_count * sizeof(i32));
+
+    bh_arr_insert_end(debug->line_info, line_info_count);
+    memcpy(debug->line_info + mark.line_info_count, line_info, line_info_count * sizeof(debug_loc_info_t));
+
+    bh_arr_insert_end(debug->instruction_reducer, reducer_count);
+    memcpy(debug->instruction_reducer + mark.instruction_reducer_count, reducer, reducer_count * sizeof(u32));
+
+    bh_arr_set_length(debug->line_to_instruction, 0);
+    bh_arr_insert_end(debug->line_to_instruction, line_to_instruction_count);
+    memcpy(debug->line_to_instruction, line_to_instr, line_to_instruction_count * sizeof(u32));
+
+    fori (i, 0, (i32) file_count) debug->files[i].line_buffer_offset = file_offsets[i];
+
+    fori (i, 0, (i32) scope_count) {
+        debug_sym_scope_t scope;
+        scope.parent = scopes[i].parent;
+        scope.symbols = NULL;
+        bh_arr_new(debug->alloc, scope.symbols, bh_max(scopes[i].symbol_count, 4));
+
+        fori (j, 0, scopes[i].symbol_count) bh_arr_push(scope.symbols, *symbols++);
+        bh_arr_push(debug->symbol_scopes, scope);
+    }
+
+    success = true;
+
+  done:
+    if (!keep_mapping) munmap(data, st.st_size);
+    return success;
+}
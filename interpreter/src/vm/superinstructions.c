@@ -0,0 +1,118 @@
+#include "vm.h"
+
+//
+// Superinstruction fusion
+//
+// This pass runs over the instructions of a single function after it has been
+// translated from WASM, and replaces common pairs/runs of instructions with a
+// single "superinstruction" that does the work of all of them with one dispatch.
+//
+// Only the opcode of the first instruction in a run is rewritten. The rest of the
+// instructions are left as they were, and the superinstruction reads its extra
+// operands from them and then skips over them. This means no instruction moves,
+// so relative branches, branch tables and the pc -> source location mapping are
+// all still valid, and a branch into the middle of a fused run still executes
+// the original instructions.
+//
+// The pairs that are fused here were chosen by looking at the output of
+// --ovm-stats (see ovm_engine_print_instr_stats) on real programs.
+//
+
+static u32 compare_to_branch(u32 instr) {
+    switch (instr) {
+        case OVMI_EQ:   return OVMI_BR_EQ;
+        case OVMI_NE:   return OVMI_BR_NE;
+        case OVMI_LT:   return OVMI_BR_LT;
+        case OVMI_LT_S: return OVMI_BR_LT_S;
+        case OVMI_LE:   return OVMI_BR_LE;
+        case OVMI_LE_S: return OVMI_BR_LE_S;
+        case OVMI_GT:   return OVMI_BR_GT;
+        case OVMI_GT_S: return OVMI_BR_GT_S;
+        case OVMI_GE:   return OVMI_BR_GE;
+        case OVMI_GE_S: return OVMI_BR_GE_S;
+        default:        return 0;
+    }
+}
+
+void ovm_program_fuse_superinstructions(ovm_program_t *program, i32 start_instr, i32 end_instr) {
+    ovm_instr_t *code = program->code;
+
+    for (i32 i = start_instr; i < end_instr - 1; i++) {
+        ovm_instr_t *instr = &code[i];
+        ovm_instr_t *next  = &code[i + 1];
+
+        u32 kind = OVM_INSTR_INSTR(*instr);
+        u32 type = OVM_INSTR_TYPE(*instr);
+
+        switch (kind) {
+            //
+            // %t = imm K
+            // %r = add %a, %t
+            case OVMI_IMM: {
+                if (type != OVM_TYPE_I32 && type != OVM_TYPE_I64) break;
+                if (next->full_instr != OVM_TYPED_INSTR(OVMI_ADD, type)) break;
+
+                if (next->b != instr->r) {
+                    if (next->a != instr->r) break;
+
+                    // Addition is commutative, so the immediate is always made the
+                    // second operand to simplify the superinstruction.
+                    next->a = next->b;
+                    next->b = instr->r;
+                }
+
+                instr->full_instr = OVM_TYPED_INSTR(OVMI_ADD_IMM, type);
+                break;
+            }
+
+            //
+            // %t = add.i32 %a, %b
+            // %r = load [%t + off]
+            case OVMI_ADD: {
+                if (type != OVM_TYPE_I32) break;
+                if (OVM_INSTR_INSTR(*next) != OVMI_LOAD) break;
+                if (next->a != instr->r) break;
+                if (OVM_INSTR_TYPE(*next) == OVM_TYPE_V128) break;
+
+                instr->full_instr = OVM_TYPED_INSTR(OVMI_LOAD_IDX, OVM_INSTR_TYPE(*next));
+                break;
+            }
+
+            //
+            // %t = cmp %a, %b
+            // br_z/br_nz %t
+            case OVMI_EQ: case OVMI_NE:
+            case OVMI_LT: case OVMI_LT_S:
+            case OVMI_LE: case OVMI_LE_S:
+            case OVMI_GT: case OVMI_GT_S:
+            case OVMI_GE: case OVMI_GE_S: {
+                u32 next_kind = OVM_INSTR_INSTR(*next);
+                if (next_kind != OVMI_BR_Z && next_kind != OVMI_BR_NZ) break;
+                if (next->b != instr->r) break;
+
+                instr->full_instr = OVM_TYPED_INSTR(compare_to_branch(kind), type);
+                break;
+            }
+
+            //
+            // param %a
+            // ...
+            // call a
+            case OVMI_PARAM: {
+                i32 j = i;
+                while (j < end_instr && code[j].full_instr == OVM_TYPED_INSTR(OVMI_PARAM, OVM_TYPE_NONE)) j++;
+
+                if (j >= end_instr) break;
+                if (code[j].full_instr != OVM_TYPED_INSTR(OVMI_CALL, OVM_TYPE_NONE)) break;
+
+                instr->full_instr = OVM_TYPED_INSTR(OVMI_PARAM_CALL, OVM_TYPE_NONE);
+                instr->r = j - i;
+
+                // The remaining params can only be reached through this instruction,
+                // so there is no reason to fuse them as well.
+                i = j;
+                break;
+            }
+        }
+    }
+}
@@ -5,6 +5,11 @@
 #include <sys/mman.h>
 #include <signal.h>
 
+#if defined(_BH_LINUX)
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+#endif
+
 #if defined(__arm64__)
     #include <arm_neon.h>
 #elif defined(__x86_64__)
@@ -24,6 +29,8 @@
 #include <math.h> // REMOVE THIS!!!  only needed for sqrt
 #include <pthread.h>
 
+#include "./vm_simd.h"
+
 #ifdef OVM_DEBUG
 #define ovm_assert(c) assert((c))
 #else
@@ -118,6 +125,9 @@ int ovm_program_register_func(ovm_program_t *program, char *name, i32 instr, i32
     func.start_instr = instr;
     func.param_count = param_count;
     func.value_number_count = value_number_count;
+    func.call_count = 0;
+    func.jit_func = NULL;
+    func.jit_failure = NULL;
 
     bh_arr_push(program->funcs, func);
     return func.id;
@@ -131,6 +141,9 @@ int ovm_program_register_external_func(ovm_program_t *program, char *name, i32 p
     func.param_count = param_count;
     func.external_func_idx = external_func_idx;
     func.value_number_count = param_count;
+    func.call_count = 0;
+    func.jit_func = NULL;
+    func.jit_failure = NULL;
 
     bh_arr_push(program->funcs, func);
     return func.id;
@@ -143,6 +156,9 @@ void ovm_program_begin_func(ovm_program_t *program, char *name, i32 param_count,
     func.start_instr = bh_arr_length(program->code);
     func.param_count = param_count;
     func.value_number_count = value_number_count;
+    func.call_count = 0;
+    func.jit_func = NULL;
+    func.jit_failure = NULL;
 
     bh_arr_push(program->funcs, func);
 }
@@ -154,6 +170,97 @@ void ovm_program_add_instructions(ovm_program_t *program, i32 instr_count, ovm_i
 }
 
 
+#ifdef MAP_NORESERVE
+    #define OVM_MEMORY_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE)
+#else
+    #define OVM_MEMORY_MAP_FLAGS (MAP_PRIVATE | MAP_ANONYMOUS)
+#endif
+
+//
+// The state that is running on this thread, if any. This is used to report
+// where a memory fault happened, and by the profiler.
+_Thread_local ovm_state_t *ovm__current_state = NULL;
+
+//
+// The value numbers and the stack frames of a state share one reservation,
+// each followed by an inaccessible guard page:
+//
+//     [ value numbers | guard | stack frames | guard ]
+//
+#define OVM_STACK_GUARD_SIZE (1 << 16)
+
+static inline i64 ovm__round_to_guard_size(i64 size) {
+    return (size + OVM_STACK_GUARD_SIZE - 1) & ~((i64) OVM_STACK_GUARD_SIZE - 1);
+}
+
+static inline i64 ovm__value_stack_size() {
+    return ovm__round_to_guard_size(OVM_MAX_VALUE_NUMBERS * sizeof(ovm_value_t));
+}
+
+static inline i64 ovm__frame_stack_size() {
+    return ovm__round_to_guard_size(OVM_MAX_STACK_FRAMES * sizeof(ovm_stack_frame_t));
+}
+
+static inline i64 ovm__stack_reservation_size() {
+    return ovm__value_stack_size() + ovm__frame_stack_size() + 2 * OVM_STACK_GUARD_SIZE;
+}
+
+static void ovm__trap_stack_overflow(ovm_state_t *state) {
+    fflush(stdout);
+    fprintf(stderr, "OVM trap: stack overflow (%d frames deep)\n", state->stack_frame_count);
+
+    ovm_print_stack_trace(state->engine, state, state->program);
+    fflush(stdout);
+    _exit(1);
+}
+
+static void memory_fault_handler(int signo, siginfo_t *info, void *context) {
+    ovm_state_t *state = ovm__current_state;
+
+    if (state) {
+        u8 *memory = state->engine->memory;
+        u8 *addr   = info->si_addr;
+
+        if (addr >= memory && addr < memory + state->engine->memory_reserved) {
+            fflush(stdout);
+            fprintf(stderr, "OVM trap: out of bounds memory access at 0x%llx (memory size is 0x%llx)\n",
+                (u64) (addr - memory), state->engine->memory_size);
+
+            ovm_print_stack_trace(state->engine, state, state->program);
+            fflush(stdout);
+            _exit(1);
+        }
+
+        //
+        // Everything in the stack reservation is writable except for the guard
+        // pages, so any fault in it means one of the stacks ran out.
+        u8 *stacks = (u8 *) state->numbered_values;
+        if (addr >= stacks && addr < stacks + ovm__stack_reservation_size()) {
+            ovm__trap_stack_overflow(state);
+        }
+    }
+
+    //
+    // Not a fault in linear memory, so fall back to the default behavior. The
+    // faulting instruction runs again when this handler returns and crashes
+    // the process as usual.
+    signal(signo, SIG_DFL);
+}
+
+static void ovm__install_memory_fault_handler() {
+    static bool installed = false;
+    if (installed) return;
+    installed = true;
+
+    struct sigaction sa;
+    sa.sa_sigaction = memory_fault_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO;
+
+    sigaction(SIGSEGV, &sa, NULL);
+    sigaction(SIGBUS, &sa, NULL);
+}
+
 //
 // Engine
 ovm_engine_t *ovm_engine_new(ovm_store_t *store) {
@@ -161,21 +268,33 @@ ovm_engine_t *ovm_engine_new(ovm_store_t *store) {
 
     engine->store = store;
     engine->memory_size = 0;
+    engine->memory_reserved = 0;
     engine->memory = NULL;
     engine->debug = NULL;
-    pthread_mutex_init(&engine->atomic_mutex, NULL);
+    engine->instr_pair_counts = NULL;
+    engine->fuse_superinstructions = true;
+    engine->jit = NULL;
+    engine->profiler = NULL;
 
     //
-    // HACK: This should not be necessary, but because moving the memory around
-    // causes issues with other standard libraries (like STBTT and STBI), it is
-    // better to allocate a large amount here and avoid needing to reallocate.
-    // A solution should be possible, because other runtimes like Wasmer support
-    // this.
-    i64 attempt_to_allocate = 1ull << 32;
-    while (!ovm_engine_memory_ensure_capacity(engine, attempt_to_allocate)) {
-        attempt_to_allocate /= 2;
+    // The whole reservation is made up front so memory never has to move when
+    // it grows, as other libraries (like STBTT and STBI) hold pointers into it.
+    // If the address space is limited, fall back to smaller reservations; past
+    // the end of the reservation, out of bounds accesses are no longer caught.
+    i64 attempt_to_reserve = OVM_MEMORY_RESERVATION_SIZE;
+    while (attempt_to_reserve >= (1ll << 16)) {
+        void *addr = mmap(NULL, attempt_to_reserve, PROT_NONE, OVM_MEMORY_MAP_FLAGS, -1, 0);
+        if (addr != MAP_FAILED) {
+            engine->memory = addr;
+            engine->memory_reserved = attempt_to_reserve;
+            break;
+        }
+
+        attempt_to_reserve /= 2;
     }
 
+    ovm__install_memory_fault_handler();
+
     return engine;
 }
 
@@ -183,12 +302,77 @@ void ovm_engine_delete(ovm_engine_t *engine) {
     ovm_store_t *store = engine->store;
 
     if (engine->memory) {
-        munmap(engine->memory, engine->memory_size);
+        munmap(engine->memory, engine->memory_reserved);
+    }
+
+    if (engine->instr_pair_counts) {
+        bh_free(store->heap_allocator, engine->instr_pair_counts);
+    }
+
+    if (engine->jit) {
+        ovm_jit_delete(engine->jit);
+    }
+
+    if (engine->profiler) {
+        ovm_profiler_delete(engine->profiler);
     }
 
     bh_free(store->heap_allocator, engine);
 }
 
+void ovm_engine_enable_instr_stats(ovm_engine_t *engine) {
+    if (engine->instr_pair_counts) return;
+
+    engine->instr_pair_counts = bh_alloc_array(engine->store->heap_allocator, u64, 256 * 256);
+    memset(engine->instr_pair_counts, 0, sizeof(u64) * 256 * 256);
+}
+
+void ovm_engine_enable_jit(ovm_engine_t *engine) {
+    if (engine->jit) return;
+
+    engine->jit = ovm_jit_new();
+}
+
+typedef struct instr_pair_stat_t {
+    u32 pair;
+    u64 count;
+} instr_pair_stat_t;
+
+static int instr_pair_stat_compare(const void *a, const void *b) {
+    u64 ca = ((instr_pair_stat_t *) a)->count;
+    u64 cb = ((instr_pair_stat_t *) b)->count;
+    return (ca < cb) - (ca > cb);
+}
+
+void ovm_engine_print_instr_stats(ovm_engine_t *engine) {
+    if (!engine->instr_pair_counts) return;
+
+    bh_arr(instr_pair_stat_t) stats = NULL;
+    bh_arr_new(bh_heap_allocator(), stats, 256);
+
+    u64 total = 0;
+    fori (i, 0, 256 * 256) {
+        u64 count = engine->instr_pair_counts[i];
+        if (count == 0) continue;
+
+        instr_pair_stat_t stat = { i, count };
+        bh_arr_push(stats, stat);
+        total += count;
+    }
+
+    qsort(stats, bh_arr_length(stats), sizeof(instr_pair_stat_t), instr_pair_stat_compare);
+
+    fprintf(stderr, "\nOVM instruction pair frequencies (%llu pairs executed):\n", total);
+    fori (i, 0, bh_min(bh_arr_length(stats), 40)) {
+        instr_pair_stat_t *stat = &stats[i];
+        fprintf(stderr, "  %14llu  %5.2f%%  %12s -> %s\n",
+            stat->count, 100.0 * (f64) stat->count / (f64) total,
+            ovm_instr_name(stat->pair >> 8), ovm_instr_name(stat->pair & 0xff));
+    }
+
+    bh_arr_free(stats);
+}
+
 static i32 hit_signaled_exception = 0;
 static void signal_handler(int signo, siginfo_t *info, void *context) {
     hit_signaled_exception = 1;
@@ -197,6 +381,15 @@ static void signal_handler(int signo, siginfo_t *info, void *context) {
 void ovm_engine_enable_debug(ovm_engine_t *engine, debug_state_t *debug) {
     engine->debug = debug;
 
+    //
+    // The debugger follows arbitrary pointers when inspecting variables, and
+    // does so from its own thread where a fault cannot be reported as a trap.
+    // The debug dispatch table still checks for null accesses itself, so the
+    // guard pages below 4GiB are not needed when debugging.
+    if (engine->memory) {
+        mprotect(engine->memory, bh_min(engine->memory_reserved, 1ll << 32), PROT_READ | PROT_WRITE);
+    }
+
     struct sigaction sa;
     sa.sa_sigaction = signal_handler;
     sigemptyset(&sa.sa_mask);
@@ -207,41 +400,23 @@ void ovm_engine_enable_debug(ovm_engine_t *engine, debug_state_t *debug) {
     sigaction(SIGTERM, &sa, NULL);
     sigaction(SIGHUP, &sa, NULL);
 
-    // sigaction(SIGSEGV, &sa, NULL);
     // sigaction(SIGFPE, &sa, NULL);
     // sigaction(SIGINT, &sa, NULL);   Don't overload Ctrl+C
 }
 
 bool ovm_engine_memory_ensure_capacity(ovm_engine_t *engine, i64 minimum_size) {
     if (engine->memory_size >= minimum_size) return true;
+    if (engine->memory == NULL || minimum_size > engine->memory_reserved) return false;
 
-    void *new_addr;
-
-    if (engine->memory == NULL) {
-        new_addr = mmap(NULL, minimum_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    } else {
-        #ifdef _BH_DARWIN // Darwin doesn't support mremap so we need to map and copy it manually
-            new_addr = mmap(engine->memory, minimum_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-            if (new_addr == MAP_FAILED) return false;
-
-            memcpy(new_addr, engine->memory, engine->memory_size);
-            munmap(engine->memory, engine->memory_size);
-        #elif defined(_BH_LINUX)
-            new_addr = mremap(engine->memory, engine->memory_size, minimum_size, MREMAP_MAYMOVE);
-        #else
-            #error "Unhandled platform."
-        #endif
-    }
-
-    if (new_addr == MAP_FAILED) {
-        // Something went wrong...
-        // At this point the program should probably horifically crash.
-
+    //
+    // Growing only changes the protection of the pages past the current end.
+    // The new size is always a multiple of the wasm page size, which is a
+    // multiple of the system page size.
+    if (mprotect(engine->memory, minimum_size, PROT_READ | PROT_WRITE)) {
         return false;
     }
 
     engine->memory_size = minimum_size;
-    engine->memory = new_addr;
 
     return true;
 }
@@ -271,11 +446,23 @@ ovm_state_t *ovm_state_new(ovm_engine_t *engine, ovm_program_t *program) {
     state->pc = 0;
     state->value_number_offset = 0;
 
-    state->numbered_values = NULL;
-    state->stack_frames = NULL;
+    //
+    // Only the pages that are actually used are ever committed, so the
+    // reservation can be much larger than any real program needs.
+    u8 *stacks = mmap(NULL, ovm__stack_reservation_size(), PROT_READ | PROT_WRITE, OVM_MEMORY_MAP_FLAGS, -1, 0);
+    assert(stacks != MAP_FAILED);
+
+    u8 *value_guard = stacks + ovm__value_stack_size();
+    u8 *frame_guard = value_guard + OVM_STACK_GUARD_SIZE + ovm__frame_stack_size();
+    mprotect(value_guard, OVM_STACK_GUARD_SIZE, PROT_NONE);
+    mprotect(frame_guard, OVM_STACK_GUARD_SIZE, PROT_NONE);
+
+    state->numbered_values = (ovm_value_t *) stacks;
+    state->numbered_values_count = 0;
+    state->stack_frames = (ovm_stack_frame_t *) (value_guard + OVM_STACK_GUARD_SIZE);
+    state->stack_frame_count = 0;
+
     state->registers = NULL;
-    bh_arr_new(store->heap_allocator, state->numbered_values, 128);
-    bh_arr_new(store->heap_allocator, state->stack_frames, 32);
     bh_arr_new(store->heap_allocator, state->registers, program->register_count);
     bh_arr_insert_end(state->registers, program->register_count);
 
@@ -285,6 +472,9 @@ ovm_state_t *ovm_state_new(ovm_engine_t *engine, ovm_program_t *program) {
     state->external_funcs = NULL;
     bh_arr_new(store->heap_allocator, state->external_funcs, 8);
 
+    state->call_depth = 0;
+    state->jit_depth = 0;
+
     if (engine->debug) {
         u32 thread_id = debug_host_register_thread(engine->debug, state);
         state->debug = debug_host_lookup_thread(engine->debug, thread_id);
@@ -296,8 +486,7 @@ ovm_state_t *ovm_state_new(ovm_engine_t *engine, ovm_program_t *program) {
 void ovm_state_delete(ovm_state_t *state) {
     ovm_store_t *store = state->store;
 
-    bh_arr_free(state->numbered_values);
-    bh_arr_free(state->stack_frames);
+    munmap(state->numbered_values, ovm__stack_reservation_size());
     bh_arr_free(state->registers);
     bh_arr_free(state->external_funcs);
 }
@@ -328,21 +517,29 @@ void ovm_state_register_set(ovm_state_t *state, i32 idx, ovm_value_t val) {
 static void ovm__func_setup_stack_frame(ovm_state_t *state, ovm_func_t *func, i32 result_number) {
     //
     // Push a stack frame
-    ovm_stack_frame_t frame;
-    frame.func = func;
-    frame.value_number_count = func->value_number_count;
-    frame.value_number_base  = bh_arr_length(state->numbered_values);
-    frame.return_address = state->pc;
-    frame.return_number_value = result_number;
-    bh_arr_push(state->stack_frames, frame);
+    // A frame past the end of the frame stack lands in the guard page.
+    // The value numbers are checked here instead, because one large frame
+    // could skip over the guard page entirely.
+    if (state->numbered_values_count + func->value_number_count > OVM_MAX_VALUE_NUMBERS) {
+        ovm__trap_stack_overflow(state);
+    }
+
+    ovm_stack_frame_t *frame = &state->stack_frames[state->stack_frame_count];
+    frame->func = func;
+    frame->value_number_count = func->value_number_count;
+    frame->value_number_base  = state->numbered_values_count;
+    frame->return_address = state->pc;
+    frame->return_number_value = result_number;
+    frame->return_to_jit = false;
+    state->stack_frame_count++;
 
     //
     // Move the base pointer to the value numbers.
-    state->value_number_offset = frame.value_number_base;
+    state->value_number_offset = frame->value_number_base;
 
     //
     // Setup value numbers
-    bh_arr_insert_end(state->numbered_values, func->value_number_count);
+    state->numbered_values_count += func->value_number_count;
 
     state->__frame_values = &state->numbered_values[state->value_number_offset];
 
@@ -354,13 +551,13 @@ static void ovm__func_setup_stack_frame(ovm_state_t *state, ovm_func_t *func, i3
 }
 
 static ovm_stack_frame_t ovm__func_teardown_stack_frame(ovm_state_t *state) {
-    ovm_stack_frame_t frame = bh_arr_pop(state->stack_frames);
-    bh_arr_fastdeleten(state->numbered_values, frame.value_number_count);
+    ovm_stack_frame_t frame = state->stack_frames[--state->stack_frame_count];
+    state->numbered_values_count = frame.value_number_base;
 
-    if (bh_arr_length(state->stack_frames) == 0) {
+    if (state->stack_frame_count == 0) {
         state->value_number_offset = 0;
     } else {
-        state->value_number_offset = bh_arr_last(state->stack_frames).value_number_base;
+        state->value_number_offset = state->stack_frames[state->stack_frame_count - 1].value_number_base;
     }
 
     state->__frame_values = &state->numbered_values[state->value_number_offset];
@@ -375,6 +572,113 @@ static ovm_stack_frame_t ovm__func_teardown_stack_frame(ovm_state_t *state) {
     return frame;
 }
 
+//
+// Runs `func` as native code, if it has been or can now be jitted. The stack
+// frame for `func` must already be set up, with the parameters in place. If this
+// returns true, the frame has been torn down and `state->pc` is back at the
+// return address.
+static bool ovm__jit_try_run(ovm_state_t *state, ovm_func_t *func, ovm_value_t *result) {
+    ovm_jit_t *jit = state->engine->jit;
+    if (!jit || state->debug) return false;
+
+    func->call_count++;
+
+    ovm_jit_func_t jit_func = __atomic_load_n(&func->jit_func, __ATOMIC_ACQUIRE);
+    if (!jit_func) {
+        if (func->call_count < OVM_JIT_CALL_THRESHOLD || func->jit_failure) return false;
+        if (!ovm_jit_compile_func(jit, state->program, func)) return false;
+
+        jit_func = func->jit_func;
+    }
+
+    if (state->jit_depth >= OVM_JIT_MAX_DEPTH) return false;
+
+    state->jit_depth++;
+    jit_func(state, state->__frame_values, state->engine->memory, result);
+    state->jit_depth--;
+
+    ovm_stack_frame_t frame = ovm__func_teardown_stack_frame(state);
+    state->pc = frame.return_address;
+    return true;
+}
+
+//
+// Called by jitted code to call another function. Internal functions that are
+// not jitted are interpreted, and the interpreter returns here when they return.
+void ovm__jit_call(ovm_state_t *state, i32 func_idx, i32 result_number) {
+    ovm_func_t *func = &state->program->funcs[func_idx];
+    i32 extra_params = state->param_count - func->param_count;
+    ovm_assert(extra_params >= 0);
+
+    ovm__func_setup_stack_frame(state, func, result_number);
+    state->param_count -= func->param_count;
+
+    ovm_value_t result = {0};
+    if (func->kind == OVM_FUNC_INTERNAL) {
+        memcpy(state->__frame_values, &state->param_buf[extra_params], func->param_count * sizeof(ovm_value_t));
+
+        if (!ovm__jit_try_run(state, func, &result)) {
+            state->stack_frames[state->stack_frame_count - 1].return_to_jit = true;
+            state->pc = func->start_instr;
+            result = ovm_run_code(state->engine, state, state->program);
+        }
+
+    } else {
+        ovm_external_func_t external_func = state->external_funcs[func->external_func_idx];
+        external_func.native_func(external_func.userdata, &state->param_buf[extra_params], &result);
+
+        ovm__func_teardown_stack_frame(state);
+    }
+
+    if (result_number >= 0) {
+        state->__frame_values[result_number] = result;
+    }
+}
+
+//
+// Calls an external function whose arguments were written to the start of the
+// frame it would have if it was an internal function (see OVMI_CALLI_INTERNAL).
+// External functions take their arguments as one array, which is placed in the
+// parameter buffer, as if they had been passed with `param`.
+static void ovm__call_external_with_frame_args(ovm_state_t *state, ovm_func_t *func, i32 result_number, ovm_value_t *result) {
+    ovm_assert((state->param_count + func->param_count <= OVM_MAX_PARAM_COUNT));
+
+    ovm_value_t *params = &state->param_buf[state->param_count];
+    memcpy(params, &state->numbered_values[state->numbered_values_count], func->param_count * sizeof(ovm_value_t));
+
+    ovm__func_setup_stack_frame(state, func, result_number);
+
+    *result = (ovm_value_t) {0};
+    ovm_external_func_t external_func = state->external_funcs[func->external_func_idx];
+    external_func.native_func(external_func.userdata, params, result);
+
+    ovm__func_teardown_stack_frame(state);
+}
+
+//
+// Called by jitted code for OVMI_CALL_INTERNAL and OVMI_CALLI_INTERNAL.
+void ovm__jit_call_internal(ovm_state_t *state, i32 func_idx, i32 result_number) {
+    ovm_func_t *func = &state->program->funcs[func_idx];
+
+    ovm_value_t result = {0};
+    if (func->kind == OVM_FUNC_EXTERNAL) {
+        ovm__call_external_with_frame_args(state, func, result_number, &result);
+
+    } else {
+        ovm__func_setup_stack_frame(state, func, result_number);
+
+        if (!ovm__jit_try_run(state, func, &result)) {
+            state->stack_frames[state->stack_frame_count - 1].return_to_jit = true;
+            state->pc = func->start_instr;
+            result = ovm_run_code(state->engine, state, state->program);
+        }
+    }
+
+    if (result_number >= 0) {
+        state->__frame_values[result_number] = result;
+    }
+}
+
 ovm_value_t ovm_func_call(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program, i32 func_idx, i32 param_count, ovm_value_t *params) {
     ovm_func_t *func = &program->funcs[func_idx];
     ovm_assert(func->value_number_count >= func->param_count);
@@ -389,8 +693,16 @@ ovm_value_t ovm_func_call(ovm_engine_t *engine, ovm_state_t *state, ovm_program_
                 state->numbered_values[i + state->value_number_offset] = params[i];
             }
 
-            state->pc = func->start_instr;
-            ovm_value_t result = ovm_run_code(engine, state, program);
+            ovm_state_t *prev_state = ovm__current_state;
+            ovm__current_state = state;
+
+            ovm_value_t result;
+            if (!ovm__jit_try_run(state, func, &result)) {
+                state->pc = func->start_instr;
+                result = ovm_run_code(engine, state, program);
+            }
+
+            ovm__current_state = prev_state;
 
             state->call_depth -= 1;
             return result;
@@ -465,6 +777,7 @@ static void __ovm_trigger_exception(ovm_state_t *state) {
     }
 }
 
+__attribute__((noinline, cold))
 static void __ovm_debug_hook(ovm_engine_t *engine, ovm_state_t *state) {
     if (!state->debug) return;
 
@@ -488,13 +801,10 @@ static void __ovm_debug_hook(ovm_engine_t *engine, ovm_state_t *state) {
     }
 
     if (state->debug->pause_at_next_line) {
-        if (state->debug->pause_within == -1 || state->debug->pause_within == bh_arr_last(state->stack_frames).func->id) {
-
-            debug_loc_info_t l1, l2;
-            debug_info_lookup_location(engine->debug->info, state->pc - 1, &l1);
-            debug_info_lookup_location(engine->debug->info, state->pc,     &l2);
+        if (state->debug->pause_within == -1 || state->debug->pause_within == state->stack_frames[state->stack_frame_count - 1].func->id) {
+            ovm_assert(engine->debug);
 
-            if (l1.file_id != l2.file_id || l1.line != l2.line) {
+            if (debug_host_is_line_boundary(engine->debug, state->pc)) {
                 state->debug->pause_at_next_line = false;
                 state->debug->pause_reason = debug_pause_step;
                 state->debug->state = debug_state_pausing;
@@ -503,15 +813,6 @@ static void __ovm_debug_hook(ovm_engine_t *engine, ovm_state_t *state) {
         }
     }
 
-    ovm_assert(engine->debug);
-    bh_arr_each(debug_breakpoint_t, bp, engine->debug->breakpoints) {
-        if (bp->instr == (u32) state->pc) {
-            state->debug->state = debug_state_hit_breakpoint;
-            state->debug->last_breakpoint_hit = bp->id;
-            goto should_wait;
-        }
-    }
-
     goto shouldnt_wait;
 
     should_wait:
@@ -519,24 +820,151 @@ static void __ovm_debug_hook(ovm_engine_t *engine, ovm_state_t *state) {
     semaphore_wait(state->debug->wait_semaphore);
     state->debug->state = debug_state_running;
 
+    if (OVM_INSTR_INSTR(state->program->code[state->pc]) == OVMI_BREAKPOINT) {
+        state->debug->skip_breakpoint_at = state->pc;
+    }
+
     shouldnt_wait:
     if (state->debug->run_count > 0) state->debug->run_count--;
 }
 
+//
+// The debug hook only has to run while the thread is being stepped, has been
+// asked to pause, or a signal was caught. Breakpoints do not need it, as they
+// are patched into the code, so in every other case this is all the debug
+// dispatch table does on top of the normal one.
+static inline bool __ovm_debug_hook_needed(ovm_state_t *state) {
+    debug_thread_state_t *debug = state->debug;
+    return debug->run_count >= 0 || debug->pause_at_next_line || hit_signaled_exception;
+}
+
+//
+// Runs when an OVMI_BREAKPOINT is executed, and returns the original
+// instruction to run in its place. `state->pc` has already moved past the
+// breakpoint, but while the thread is paused it has to point at it, as that is
+// where the debugger reports the thread to be.
+static ovm_instr_t *__ovm_debug_breakpoint(ovm_state_t *state) {
+    debug_state_t *debug = state->engine->debug;
+    u32 pc = state->pc - 1;
+
+    if (state->debug->skip_breakpoint_at == (i32) pc) {
+        state->debug->skip_breakpoint_at = -1;
+        return &debug->original_code[pc];
+    }
+
+    bh_arr_each(debug_breakpoint_t, bp, debug->breakpoints) {
+        if (bp->instr == pc) {
+            state->debug->state = debug_state_hit_breakpoint;
+            state->debug->last_breakpoint_hit = bp->id;
+
+            state->pc = pc;
+            assert(write(state->debug->state_change_write_fd, "1", 1));
+            semaphore_wait(state->debug->wait_semaphore);
+            state->debug->state = debug_state_running;
+            state->pc = pc + 1;
+
+            if (state->debug->run_count > 0) state->debug->run_count--;
+            break;
+        }
+    }
+
+    return &debug->original_code[pc];
+}
+
+//
+// memory.atomic.wait and memory.atomic.notify
+//
+// Linear memory never moves, so the address in linear memory is used as the
+// futex directly. The results match what WASM expects: wait returns 0 when
+// woken up, 1 when the value was not the expected one and 2 on timeout, and
+// notify returns the number of threads that were woken up.
+//
+static i32 ovm__atomic_wait(u32 *addr, u32 expected, i64 timeout_ns) {
+#if defined(_BH_LINUX)
+    struct timespec timeout;
+    struct timespec *t = NULL;
+    if (timeout_ns >= 0) {
+        timeout.tv_sec  = timeout_ns / 1000000000;
+        timeout.tv_nsec = timeout_ns % 1000000000;
+        t = &timeout;
+    }
+
+    if (syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, t, NULL, 0) == 0) return 0;
+
+    if (errno == EAGAIN)    return 1;
+    if (errno == ETIMEDOUT) return 2;
+    return 0;
+
+#else
+    //
+    // There is no futex to wait on, so this has to poll.
+    if (__atomic_load_n(addr, __ATOMIC_SEQ_CST) != expected) return 1;
+
+    u64 end = bh_time_curr() + (timeout_ns >= 0 ? timeout_ns / 1000000 : (u64) -1 / 2);
+    while (__atomic_load_n(addr, __ATOMIC_SEQ_CST) == expected) {
+        if (bh_time_curr() >= end) return 2;
+        sched_yield();
+    }
+
+    return 0;
+#endif
+}
+
+static i32 ovm__atomic_notify(u32 *addr, u32 count) {
+#if defined(_BH_LINUX)
+    long woken = syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, (i32) bh_min(count, INT32_MAX), NULL, NULL, 0);
+    return woken < 0 ? 0 : (i32) woken;
+#else
+    return 0;
+#endif
+}
+
 #define OVMI_FUNC_NAME(n) ovmi_exec_##n
 #define OVMI_DISPATCH_NAME ovmi_dispatch
 #define OVMI_DEBUG_HOOK ((void)0)
 #define OVMI_EXCEPTION_HOOK ((void)0)
+#define OVMI_NULL_CHECK_HOOK(_) ((void)0)
 #define OVMI_DIVIDE_CHECK_HOOK(_) ((void)0)
 #include "./vm_instrs.h"
 
 #define OVMI_FUNC_NAME(n) ovmi_exec_debug_##n
 #define OVMI_DISPATCH_NAME ovmi_debug_dispatch
-#define OVMI_DEBUG_HOOK __ovm_debug_hook(state->engine, state)
+#define OVMI_DEBUG_HOOK if (__ovm_debug_hook_needed(state)) __ovm_debug_hook(state->engine, state)
+#define OVMI_BREAKPOINT_HOOK __ovm_debug_breakpoint(state)
 #define OVMI_EXCEPTION_HOOK __ovm_trigger_exception(state)
+#define OVMI_NULL_CHECK_HOOK(addr) if ((addr) == 0) __ovm_trigger_exception(state)
 #define OVMI_DIVIDE_CHECK_HOOK(ctype) if (VAL(instr->b).ctype == 0) __ovm_trigger_exception(state)
 #include "./vm_instrs.h"
 
+//
+// The statistics dispatch table reuses the debug hook slot to count which
+// instruction follows which. At the point the hook runs, `instr` is the
+// instruction that just executed and `state->pc` is the one that will run next.
+#define OVMI_FUNC_NAME(n) ovmi_exec_stats_##n
+#define OVMI_DISPATCH_NAME ovmi_stats_dispatch
+#define OVMI_DEBUG_HOOK \
+    state->engine->instr_pair_counts[(OVM_INSTR_INSTR(*instr) << 8) | OVM_INSTR_INSTR(code[state->pc])]++
+#define OVMI_EXCEPTION_HOOK ((void)0)
+#define OVMI_NULL_CHECK_HOOK(_) ((void)0)
+#define OVMI_DIVIDE_CHECK_HOOK(_) ((void)0)
+#include "./vm_instrs.h"
+
+//
+// This table executes only a single instruction and then returns. It is used by
+// jitted code for instructions that the JIT does not translate itself.
+#define OVMI_FUNC_NAME(n) ovmi_exec_single_##n
+#define OVMI_DISPATCH_NAME ovmi_single_dispatch
+#define OVMI_DEBUG_HOOK ((void)0)
+#define OVMI_EXCEPTION_HOOK ((void)0)
+#define OVMI_NULL_CHECK_HOOK(_) ((void)0)
+#define OVMI_DIVIDE_CHECK_HOOK(_) ((void)0)
+#define OVMI_SINGLE_INSTR
+#include "./vm_instrs.h"
+
+void *ovm__single_instr_handler(u32 full_instr) {
+    return ovmi_single_dispatch[full_instr & OVM_INSTR_MASK];
+}
+
 ovm_value_t ovm_run_code(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program) {
     ovm_assert(engine);
     ovm_assert(state);
@@ -545,6 +973,8 @@ ovm_value_t ovm_run_code(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t
     ovmi_instr_exec_t *exec_table = ovmi_dispatch;
     if (state->debug) {
         exec_table = ovmi_debug_dispatch;
+    } else if (engine->instr_pair_counts) {
+        exec_table = ovmi_stats_dispatch;
     }
 
     ovm_instr_t *code = program->code;
@@ -552,15 +982,27 @@ ovm_value_t ovm_run_code(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t
     ovm_value_t *values = state->__frame_values;
     ovm_instr_t *instr = &code[state->pc];
 
-    return exec_table[instr->full_instr & 0x7ff](instr, state, values, memory, code);
+    exec_table[instr->full_instr & 0x7ff](instr, state, values, memory, code);
+    return state->__return_value;
 }
 
 
 void ovm_print_stack_trace(ovm_engine_t *engine, ovm_state_t *state, ovm_program_t *program) {
-    int i = 0;
-    bh_arr_rev_each(ovm_stack_frame_t, frame, state->stack_frames) {
-        ovm_func_t *func = frame->func;
-        printf("[%03d] %s\n", i++, func->name);
+    //
+    // After a stack overflow there can be a huge number of frames, so only the
+    // innermost and outermost ones are printed.
+    const i32 shown_at_each_end = 32;
+
+    for (i32 i = 0; i < state->stack_frame_count; i++) {
+        if (i == shown_at_each_end && state->stack_frame_count > 2 * shown_at_each_end) {
+            i32 skipped = state->stack_frame_count - 2 * shown_at_each_end;
+            printf("      ... %d more frames ...\n", skipped);
+            i += skipped - 1;
+            continue;
+        }
+
+        ovm_func_t *func = state->stack_frames[state->stack_frame_count - 1 - i].func;
+        printf("[%03d] %s\n", i, func->name);
     }
 }
 
@@ -12,14 +12,20 @@
 //
 // There are several things that break this however. Chief among which is the __ovm_debug_hook
 // function call which must be present in ALL instructions for debugging to work properly.
-// When this hook is present, the compiler MUST emit many `push` and `pop` instructions to preserve
-// the needed registers because it cannot know what will happen in the function. This more than
-// doubles the instruction count of all operations and slows down the runner by at least 20 percent.
+// When this hook is called unconditionally, the compiler MUST emit many `push` and `pop`
+// instructions to preserve the needed registers because it cannot know what will happen in the
+// function. This is why the debug dispatch table only calls it when it is needed, and the hook
+// is kept out of line, so the common path does not have to preserve anything.
+//
+// Another is the return type. A value that does not fit in two registers is returned through
+// a hidden pointer, and GCC will not tail call a function that does that. Since ovm_value_t is
+// larger than that, the exec functions return nothing, and the value that ovm_run_code returns
+// is left in state->__return_value.
 //
 
 
 #define OVMI_INSTR_PROTO(name) \
-    ovm_value_t name(ovm_instr_t *instr, ovm_state_t *state, ovm_value_t *values, u8 *memory, ovm_instr_t *code)
+    void name(ovm_instr_t *instr, ovm_state_t *state, ovm_value_t *values, u8 *memory, ovm_instr_t *code)
 
 #define OVMI_INSTR_EXEC(name) \
     static OVMI_INSTR_PROTO(OVMI_FUNC_NAME(name))
@@ -30,10 +36,17 @@
     #define FORCE_TAILCALL
 #endif
 
-#define NEXT_OP \
-    OVMI_DEBUG_HOOK; \
-    instr = &code[state->pc++]; \
-    FORCE_TAILCALL return OVMI_DISPATCH_NAME[instr->full_instr & OVM_INSTR_MASK](instr, state, values, memory, code);
+#ifdef OVMI_SINGLE_INSTR
+    // Execute only this instruction and return to the caller.
+    #define NEXT_OP \
+        OVMI_DEBUG_HOOK; \
+        return;
+#else
+    #define NEXT_OP \
+        OVMI_DEBUG_HOOK; \
+        instr = &code[state->pc++]; \
+        FORCE_TAILCALL return OVMI_DISPATCH_NAME[instr->full_instr & OVM_INSTR_MASK](instr, state, values, memory, code);
+#endif
 
 #define VAL(loc) values[loc]
 
@@ -215,6 +228,15 @@ OVMI_INSTR_EXEC(imm_i64) { OVM_IMM(OVM_TYPE_I64, u64, l); NEXT_OP; }
 OVMI_INSTR_EXEC(imm_f32) { OVM_IMM(OVM_TYPE_F32, f32, f); NEXT_OP; }
 OVMI_INSTR_EXEC(imm_f64) { OVM_IMM(OVM_TYPE_F64, f64, d); NEXT_OP; }
 
+// The upper half of a v128 immediate is stored in the NOP following it.
+OVMI_INSTR_EXEC(imm_v128) {
+    VAL(instr->r).u64x2[0] = instr->l;
+    VAL(instr->r).u64x2[1] = instr[1].l;
+    VAL(instr->r).type = OVM_TYPE_V128;
+    state->pc += 1;
+    NEXT_OP;
+}
+
 #undef OVM_IMM
 
 OVMI_INSTR_EXEC(mov) {
@@ -222,11 +244,18 @@ OVMI_INSTR_EXEC(mov) {
     NEXT_OP;
 }
 
+//
+// Loads and stores do not bounds check their address. Everything past the end of
+// linear memory is left inaccessible (see ovm_engine_new), so an out of bounds
+// access faults and is reported as a trap instead. Null pointer accesses are
+// only caught by the debug table, because Onyx places data in the first page.
+//
+
 #define OVM_LOAD(otype, type_, stype) \
     OVMI_INSTR_EXEC(load_##otype) { \
         ovm_assert(VAL(instr->a).type == OVM_TYPE_I32); \
         u32 dest = VAL(instr->a).u32 + (u32) instr->b; \
-        if (dest == 0) OVMI_EXCEPTION_HOOK; \
+        OVMI_NULL_CHECK_HOOK(dest); \
         VAL(instr->r).stype = * (stype *) &memory[dest]; \
         VAL(instr->r).type = type_; \
         NEXT_OP; \
@@ -239,13 +268,21 @@ OVM_LOAD(i64, OVM_TYPE_I64, u64)
 OVM_LOAD(f32, OVM_TYPE_F32, f32)
 OVM_LOAD(f64, OVM_TYPE_F64, f64)
 
+OVMI_INSTR_EXEC(load_v128) {
+    u32 dest = VAL(instr->a).u32 + (u32) instr->b;
+    OVMI_NULL_CHECK_HOOK(dest);
+    memcpy(VAL(instr->r).u8x16, &memory[dest], 16);
+    VAL(instr->r).type = OVM_TYPE_V128;
+    NEXT_OP;
+}
+
 #undef OVM_LOAD
 
 #define OVM_STORE(otype, type_, stype) \
     OVMI_INSTR_EXEC(store_##otype) { \
         ovm_assert(VAL(instr->r).type == OVM_TYPE_I32); \
         u32 dest = VAL(instr->r).u32 + (u32) instr->b; \
-        if (dest == 0) OVMI_EXCEPTION_HOOK; \
+        OVMI_NULL_CHECK_HOOK(dest); \
         *(stype *) &memory[dest] = VAL(instr->a).stype; \
         NEXT_OP; \
     }
@@ -258,6 +295,13 @@ OVM_STORE(i64, OVM_TYPE_I64, u64)
 OVM_STORE(f32, OVM_TYPE_F32, f32)
 OVM_STORE(f64, OVM_TYPE_F64, f64)
 
+OVMI_INSTR_EXEC(store_v128) {
+    u32 dest = VAL(instr->r).u32 + (u32) instr->b;
+    OVMI_NULL_CHECK_HOOK(dest);
+    memcpy(&memory[dest], VAL(instr->a).u8x16, 16);
+    NEXT_OP;
+}
+
 #undef OVM_STORE
 
 OVMI_INSTR_EXEC(copy) {
@@ -265,7 +309,8 @@ OVMI_INSTR_EXEC(copy) {
     u32 src   = VAL(instr->a).u32;
     u32 count = VAL(instr->b).u32;
 
-    if (!dest || !src) OVMI_EXCEPTION_HOOK;
+    OVMI_NULL_CHECK_HOOK(dest);
+    OVMI_NULL_CHECK_HOOK(src);
 
     memmove(&memory[dest], &memory[src], count);
 
@@ -277,7 +322,7 @@ OVMI_INSTR_EXEC(fill) {
     u8  byte  = VAL(instr->a).u8;
     i32 count = VAL(instr->b).i32;
 
-    if (!dest) OVMI_EXCEPTION_HOOK;
+    OVMI_NULL_CHECK_HOOK(dest);
 
     memset(&memory[dest], byte, count);
 
@@ -300,9 +345,8 @@ OVMI_INSTR_EXEC(idx_arr) {
     ovm_static_integer_array_t data_elem = state->program->static_data[instr->a];
     if (VAL(instr->b).u32 >= (u32) data_elem.len) {
         OVMI_EXCEPTION_HOOK;
-        ovm_value_t bad_val;
-        bad_val.type = OVM_TYPE_ERR;
-        return bad_val;
+        state->__return_value.type = OVM_TYPE_ERR;
+        return;
     }
 
     VAL(instr->r).i32 = state->program->static_integers[data_elem.start_idx + VAL(instr->b).u32];
@@ -330,13 +374,15 @@ OVMI_INSTR_EXEC(return) {
     state->pc = frame.return_address;
     values = state->__frame_values;
 
-    if (bh_arr_length(state->stack_frames) == 0) {
-        return val;
+    if (state->stack_frame_count == 0 || frame.return_to_jit) {
+        state->__return_value = val;
+        return;
     }
 
-    ovm_func_t *new_func = bh_arr_last(state->stack_frames).func;
+    ovm_func_t *new_func = state->stack_frames[state->stack_frame_count - 1].func;
     if (new_func->kind == OVM_FUNC_EXTERNAL) {
-        return val;
+        state->__return_value = val;
+        return;
     }
 
     if (frame.return_number_value >= 0) {
@@ -344,7 +390,7 @@ OVMI_INSTR_EXEC(return) {
     }
 
 #ifdef OVM_VERBOSE
-    printf("Returning from %s to %s: ", frame.func->name, bh_arr_last(state->stack_frames).func->name);
+    printf("Returning from %s to %s: ", frame.func->name, new_func->name);
     ovm_print_val(val);
     printf("\n\n");
 #endif
@@ -364,6 +410,14 @@ OVMI_INSTR_EXEC(return) {
         values = state->__frame_values; \
         memcpy(&VAL(0), &state->param_buf[extra_params], func->param_count * sizeof(ovm_value_t)); \
         state->pc = func->start_instr; \
+\
+        if (state->engine->jit && ovm__jit_try_run(state, func, &state->__tmp_value)) { \
+            values = state->__frame_values; \
+            memory = state->engine->memory; \
+            if (instr->r >= 0) { \
+                VAL(instr->r) = state->__tmp_value; \
+            } \
+        } \
     } else { \
         ovm_external_func_t external_func = state->external_funcs[func->external_func_idx]; \
         external_func.native_func(external_func.userdata, &state->param_buf[extra_params], &state->__tmp_value); \
@@ -387,9 +441,70 @@ OVMI_INSTR_EXEC(calli) {
     NEXT_OP;
 }
 
+//
+// Superinstruction for a run of `param`s followed by a `call`.
+// The number of params is stored in `r`, which `param` does not use.
+OVMI_INSTR_EXEC(param_call) {
+    i32 count = instr->r;
+    ovm_assert((state->param_count + count <= OVM_MAX_PARAM_COUNT));
+
+    fori (i, 0, count) {
+        state->param_buf[state->param_count++] = VAL(instr[i].a);
+    }
+
+    state->pc += count;
+    instr = &instr[count];
+
+    OVM_CALL_CODE(instr->a);
+    NEXT_OP;
+}
+
 #undef OVM_CALL_CODE
 
 
+//
+// The arguments are already in place, so entering an internal function only
+// needs its stack frame. See OVMI_CALL_INTERNAL.
+#define OVM_CALL_INTERNAL_CODE(func) \
+    ovm__func_setup_stack_frame(state, func, instr->r); \
+    values = state->__frame_values; \
+    state->pc = func->start_instr; \
+\
+    if (state->engine->jit && ovm__jit_try_run(state, func, &state->__tmp_value)) { \
+        values = state->__frame_values; \
+        memory = state->engine->memory; \
+        if (instr->r >= 0) { \
+            VAL(instr->r) = state->__tmp_value; \
+        } \
+    }
+
+OVMI_INSTR_EXEC(call_internal) {
+    ovm_func_t *func = &state->program->funcs[instr->a];
+    OVM_CALL_INTERNAL_CODE(func);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(calli_internal) {
+    ovm_func_t *func = &state->program->funcs[VAL(instr->a).i32];
+
+    if (func->kind == OVM_FUNC_EXTERNAL) {
+        ovm__call_external_with_frame_args(state, func, instr->r, &state->__tmp_value);
+        memory = state->engine->memory;
+
+        if (instr->r >= 0) {
+            VAL(instr->r) = state->__tmp_value;
+        }
+
+        NEXT_OP;
+    }
+
+    OVM_CALL_INTERNAL_CODE(func);
+    NEXT_OP;
+}
+
+#undef OVM_CALL_INTERNAL_CODE
+
+
 
 //
 // Branching Instructions
@@ -485,31 +600,110 @@ OVM_CVT(f64, i64, f64, u64, OVM_TYPE_I64, u64);
 
 
 //
-// Compare exchange
+// Atomics
+//
+// Every atomic access is sequentially consistent. The result of a narrow
+// access is zero extended to the full width of the value, because the code
+// builder does not follow these with a conversion like it does for loads.
 //
 
-#define CMPXCHG(otype, ctype) \
-    OVMI_INSTR_EXEC(cmpxchg_##ctype) { \
-        pthread_mutex_lock(&state->engine->atomic_mutex); \
-        if (VAL(instr->r).u32 == 0) OVMI_EXCEPTION_HOOK; \
-        ctype *addr = (ctype *) &memory[VAL(instr->r).u32]; \
+#define ATOMIC_RESULT(otype, x) \
+    VAL(instr->r).u64 = (u64) (x); \
+    VAL(instr->r).type = otype;
+
+#define ATOMIC_LOAD_STORE(otype, rtype, ctype) \
+    OVMI_INSTR_EXEC(atomic_load_##otype) { \
+        u32 dest = VAL(instr->a).u32 + (u32) instr->b; \
+        OVMI_NULL_CHECK_HOOK(dest); \
+        ATOMIC_RESULT(rtype, __atomic_load_n((ctype *) &memory[dest], __ATOMIC_SEQ_CST)); \
+        NEXT_OP; \
+    } \
  \
-        VAL(instr->r).u64 = 0; \
-        VAL(instr->r).type = otype; \
-        VAL(instr->r).ctype = *addr; \
+    OVMI_INSTR_EXEC(atomic_store_##otype) { \
+        u32 dest = VAL(instr->r).u32 + (u32) instr->b; \
+        OVMI_NULL_CHECK_HOOK(dest); \
+        __atomic_store_n((ctype *) &memory[dest], VAL(instr->a).ctype, __ATOMIC_SEQ_CST); \
+        NEXT_OP; \
+    }
+
+#define ATOMIC_RMW(name, builtin, otype, rtype, ctype) \
+    OVMI_INSTR_EXEC(atomic_##name##_##otype) { \
+        OVMI_NULL_CHECK_HOOK(VAL(instr->r).u32); \
+        ctype *addr = (ctype *) &memory[VAL(instr->r).u32]; \
+        ATOMIC_RESULT(rtype, builtin(addr, VAL(instr->a).ctype, __ATOMIC_SEQ_CST)); \
+        NEXT_OP; \
+    }
+
+#define CMPXCHG(otype, rtype, ctype) \
+    OVMI_INSTR_EXEC(cmpxchg_##otype) { \
+        OVMI_NULL_CHECK_HOOK(VAL(instr->r).u32); \
+        ctype *addr = (ctype *) &memory[VAL(instr->r).u32]; \
  \
-        if (*addr == VAL(instr->a).ctype) { \
-            *addr = VAL(instr->b).ctype ; \
-        } \
+        ctype expected = VAL(instr->a).ctype; \
+        __atomic_compare_exchange_n(addr, &expected, VAL(instr->b).ctype, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
  \
-        pthread_mutex_unlock(&state->engine->atomic_mutex); \
+        /* On failure, expected holds the value that was in memory. */ \
+        ATOMIC_RESULT(rtype, expected); \
         NEXT_OP; \
     }
 
-CMPXCHG(OVM_TYPE_I32, i32)
-CMPXCHG(OVM_TYPE_I64, i64)
-
+#define ATOMIC_OPS(otype, rtype, ctype) \
+    ATOMIC_LOAD_STORE(otype, rtype, ctype) \
+    ATOMIC_RMW(add,  __atomic_fetch_add, otype, rtype, ctype) \
+    ATOMIC_RMW(sub,  __atomic_fetch_sub, otype, rtype, ctype) \
+    ATOMIC_RMW(and,  __atomic_fetch_and, otype, rtype, ctype) \
+    ATOMIC_RMW(or,   __atomic_fetch_or,  otype, rtype, ctype) \
+    ATOMIC_RMW(xor,  __atomic_fetch_xor, otype, rtype, ctype) \
+    ATOMIC_RMW(xchg, __atomic_exchange_n, otype, rtype, ctype) \
+    CMPXCHG(otype, rtype, ctype)
+
+ATOMIC_OPS(i8,  OVM_TYPE_I32, u8)
+ATOMIC_OPS(i16, OVM_TYPE_I32, u16)
+ATOMIC_OPS(i32, OVM_TYPE_I32, u32)
+ATOMIC_OPS(i64, OVM_TYPE_I64, u64)
+
+#undef ATOMIC_OPS
 #undef CMPXCHG
+#undef ATOMIC_RMW
+#undef ATOMIC_LOAD_STORE
+
+OVMI_INSTR_EXEC(atomic_wait_i32) {
+    OVMI_NULL_CHECK_HOOK(VAL(instr->r).u32);
+    u32 *addr = (u32 *) &memory[VAL(instr->r).u32];
+    ATOMIC_RESULT(OVM_TYPE_I32, ovm__atomic_wait(addr, VAL(instr->a).u32, VAL(instr->b).i64));
+    NEXT_OP;
+}
+
+//
+// Futexes are only 32 bits, so this waits on the low half of the value, after
+// checking the whole value. A notify on the same address still wakes it up.
+OVMI_INSTR_EXEC(atomic_wait_i64) {
+    OVMI_NULL_CHECK_HOOK(VAL(instr->r).u32);
+    u64 *addr = (u64 *) &memory[VAL(instr->r).u32];
+    u64 expected = VAL(instr->a).u64;
+
+    i32 result = 1;
+    if (__atomic_load_n(addr, __ATOMIC_SEQ_CST) == expected) {
+        result = ovm__atomic_wait((u32 *) addr, (u32) expected, VAL(instr->b).i64);
+    }
+
+    ATOMIC_RESULT(OVM_TYPE_I32, result);
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(atomic_notify) {
+    OVMI_NULL_CHECK_HOOK(VAL(instr->r).u32);
+    u32 *addr = (u32 *) &memory[VAL(instr->r).u32];
+    ATOMIC_RESULT(OVM_TYPE_I32, ovm__atomic_notify(addr, VAL(instr->a).u32));
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(atomic_fence) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    NEXT_OP;
+}
+
+#undef ATOMIC_RESULT
 
 
 //
@@ -537,9 +731,444 @@ OVMI_INSTR_EXEC(mem_grow) {
 }
 
 
+//
+// SIMD
+//
+// See vm_simd.h for how these are implemented. Every instruction reads all of
+// its operands before writing its result, because %r can be the same value
+// number as one of the operands.
+//
+
+#define V128(vtype, v)    OVM_V128_GET(vtype, VAL(v))
+#define V128_SET(v, x)    OVM_V128_SET(VAL(v), x)
+
+#define OVM_V_OP(name, lane, vtype, op) \
+    OVMI_INSTR_EXEC(v_##name##_##lane) { \
+        ovm_assert(VAL(instr->a).type == OVM_TYPE_V128 && VAL(instr->b).type == OVM_TYPE_V128); \
+        V128_SET(instr->r, V128(vtype, instr->a) op V128(vtype, instr->b)); \
+        NEXT_OP; \
+    }
+
+#define OVM_V_FUNC(name, lane, vtype, func) \
+    OVMI_INSTR_EXEC(v_##name##_##lane) { \
+        ovm_assert(VAL(instr->a).type == OVM_TYPE_V128 && VAL(instr->b).type == OVM_TYPE_V128); \
+        V128_SET(instr->r, func(V128(vtype, instr->a), V128(vtype, instr->b))); \
+        NEXT_OP; \
+    }
+
+#define OVM_V_UNOP(name, lane, stype, func) \
+    OVMI_INSTR_EXEC(v_##name##_##lane) { \
+        ovm_assert(VAL(instr->a).type == OVM_TYPE_V128); \
+        V128_SET(instr->r, func(V128(stype, instr->a))); \
+        NEXT_OP; \
+    }
+
+#define OVM_V_EXEC(name, op) \
+    OVM_V_OP(name, i8,  ovm_i8x16, op) \
+    OVM_V_OP(name, i16, ovm_i16x8, op) \
+    OVM_V_OP(name, i32, ovm_i32x4, op) \
+    OVM_V_OP(name, i64, ovm_i64x2, op) \
+    OVM_V_OP(name, f32, ovm_f32x4, op) \
+    OVM_V_OP(name, f64, ovm_f64x2, op)
+
+#define OVM_V_UNSIGNED_EXEC(name, op) \
+    OVM_V_OP(name, i8,  ovm_u8x16, op) \
+    OVM_V_OP(name, i16, ovm_u16x8, op) \
+    OVM_V_OP(name, i32, ovm_u32x4, op) \
+    OVM_V_OP(name, i64, ovm_u64x2, op) \
+    OVM_V_OP(name, f32, ovm_f32x4, op) \
+    OVM_V_OP(name, f64, ovm_f64x2, op)
+
+OVM_V_EXEC(add, +)
+OVM_V_EXEC(sub, -)
+OVM_V_EXEC(mul, *)
+OVM_V_OP(div, f32, ovm_f32x4, /)
+OVM_V_OP(div, f64, ovm_f64x2, /)
+
+// Comparisons produce a lane of all ones for true, and all zeros for false.
+OVM_V_EXEC(eq, ==)
+OVM_V_EXEC(ne, !=)
+OVM_V_UNSIGNED_EXEC(lt, <)
+OVM_V_UNSIGNED_EXEC(le, <=)
+OVM_V_UNSIGNED_EXEC(gt, >)
+OVM_V_UNSIGNED_EXEC(ge, >=)
+OVM_V_EXEC(lt_s, <)
+OVM_V_EXEC(le_s, <=)
+OVM_V_EXEC(gt_s, >)
+OVM_V_EXEC(ge_s, >=)
+
+OVM_V_OP(and,    v128, ovm_u64x2, &)
+OVM_V_OP(or,     v128, ovm_u64x2, |)
+OVM_V_OP(xor,    v128, ovm_u64x2, ^)
+OVM_V_OP(andnot, v128, ovm_u64x2, &~)
+
+OVM_V_FUNC(add_sat,   i8,  ovm_u8x16, __ovm_v128_add_sat_u8)
+OVM_V_FUNC(add_sat,   i16, ovm_u16x8, __ovm_v128_add_sat_u16)
+OVM_V_FUNC(add_sat_s, i8,  ovm_i8x16, __ovm_v128_add_sat_i8)
+OVM_V_FUNC(add_sat_s, i16, ovm_i16x8, __ovm_v128_add_sat_i16)
+OVM_V_FUNC(sub_sat,   i8,  ovm_u8x16, __ovm_v128_sub_sat_u8)
+OVM_V_FUNC(sub_sat,   i16, ovm_u16x8, __ovm_v128_sub_sat_u16)
+OVM_V_FUNC(sub_sat_s, i8,  ovm_i8x16, __ovm_v128_sub_sat_i8)
+OVM_V_FUNC(sub_sat_s, i16, ovm_i16x8, __ovm_v128_sub_sat_i16)
+
+OVM_V_FUNC(narrow,   i8,  ovm_i16x8, __ovm_v128_narrow_u_i8)
+OVM_V_FUNC(narrow_s, i8,  ovm_i16x8, __ovm_v128_narrow_s_i8)
+OVM_V_FUNC(narrow,   i16, ovm_i32x4, __ovm_v128_narrow_u_i16)
+OVM_V_FUNC(narrow_s, i16, ovm_i32x4, __ovm_v128_narrow_s_i16)
+
+#undef OVM_V_OP
+#undef OVM_V_FUNC
+
+//
+// Integer min and max select with the mask from the comparison.
+#define OVM_V_OP(name, lane, vtype, op) \
+    OVMI_INSTR_EXEC(v_##name##_##lane) { \
+        vtype a = V128(vtype, instr->a); \
+        vtype b = V128(vtype, instr->b); \
+        vtype m = (vtype) (a op b); \
+        V128_SET(instr->r, (a & m) | (b & ~m)); \
+        NEXT_OP; \
+    }
+
+OVM_V_OP(min,   i8,  ovm_u8x16, <)
+OVM_V_OP(min,   i16, ovm_u16x8, <)
+OVM_V_OP(min,   i32, ovm_u32x4, <)
+OVM_V_OP(min_s, i8,  ovm_i8x16, <)
+OVM_V_OP(min_s, i16, ovm_i16x8, <)
+OVM_V_OP(min_s, i32, ovm_i32x4, <)
+OVM_V_OP(max,   i8,  ovm_u8x16, >)
+OVM_V_OP(max,   i16, ovm_u16x8, >)
+OVM_V_OP(max,   i32, ovm_u32x4, >)
+OVM_V_OP(max_s, i8,  ovm_i8x16, >)
+OVM_V_OP(max_s, i16, ovm_i16x8, >)
+OVM_V_OP(max_s, i32, ovm_i32x4, >)
+
+#undef OVM_V_OP
+
+//
+// Float min and max behave like the scalar versions, lane by lane.
+#define OVM_V_OP(name, lane, vtype, lanes, func) \
+    OVMI_INSTR_EXEC(v_##name##_##lane) { \
+        vtype a = V128(vtype, instr->a); \
+        vtype b = V128(vtype, instr->b); \
+        fori (i, 0, lanes) a[i] = func(a[i], b[i]); \
+        V128_SET(instr->r, a); \
+        NEXT_OP; \
+    }
+
+OVM_V_OP(min, f32, ovm_f32x4, 4, bh_min)
+OVM_V_OP(min, f64, ovm_f64x2, 2, bh_min)
+OVM_V_OP(max, f32, ovm_f32x4, 4, bh_max)
+OVM_V_OP(max, f64, ovm_f64x2, 2, bh_max)
+
+#undef OVM_V_OP
+
+// (a + b + 1) / 2, without overflowing the lane.
+#define OVM_V_OP(lane, vtype) \
+    OVMI_INSTR_EXEC(v_avgr_##lane) { \
+        vtype a = V128(vtype, instr->a); \
+        vtype b = V128(vtype, instr->b); \
+        V128_SET(instr->r, (a | b) - ((a ^ b) >> 1)); \
+        NEXT_OP; \
+    }
+
+OVM_V_OP(i8,  ovm_u8x16)
+OVM_V_OP(i16, ovm_u16x8)
+
+#undef OVM_V_OP
+
+//
+// Shift amounts are taken modulo the lane width.
+#define OVM_V_OP(name, lane, vtype, op, bits) \
+    OVMI_INSTR_EXEC(v_##name##_##lane) { \
+        ovm_assert(VAL(instr->a).type == OVM_TYPE_V128 && VAL(instr->b).type == OVM_TYPE_I32); \
+        V128_SET(instr->r, V128(vtype, instr->a) op (i32) (VAL(instr->b).u32 & (bits - 1))); \
+        NEXT_OP; \
+    }
+
+OVM_V_OP(shl, i8,  ovm_u8x16, <<, 8)
+OVM_V_OP(shl, i16, ovm_u16x8, <<, 16)
+OVM_V_OP(shl, i32, ovm_u32x4, <<, 32)
+OVM_V_OP(shl, i64, ovm_u64x2, <<, 64)
+OVM_V_OP(shr, i8,  ovm_u8x16, >>, 8)
+OVM_V_OP(shr, i16, ovm_u16x8, >>, 16)
+OVM_V_OP(shr, i32, ovm_u32x4, >>, 32)
+OVM_V_OP(shr, i64, ovm_u64x2, >>, 64)
+OVM_V_OP(sar, i8,  ovm_i8x16, >>, 8)
+OVM_V_OP(sar, i16, ovm_i16x8, >>, 16)
+OVM_V_OP(sar, i32, ovm_i32x4, >>, 32)
+OVM_V_OP(sar, i64, ovm_i64x2, >>, 64)
+
+#undef OVM_V_OP
+
+
+#define OVM_V_NEG(a)            (-(a))
+#define OVM_V_NOT(a)            (~(a))
+#define OVM_V_ABS(a)            (((a) ^ ((a) >> (sizeof((a)[0]) * 8 - 1))) - ((a) >> (sizeof((a)[0]) * 8 - 1)))
+#define OVM_V_FABS32(a)         ((ovm_u32x4) (a) & 0x7fffffff)
+#define OVM_V_FABS64(a)         ((ovm_u64x2) (a) & 0x7fffffffffffffffull)
+#define OVM_V_CONVERT_F32(a)    __builtin_convertvector((a), ovm_f32x4)
+
+OVM_V_UNOP(not, v128, ovm_u64x2, OVM_V_NOT)
+OVM_V_UNOP(neg, i8,  ovm_i8x16, OVM_V_NEG)
+OVM_V_UNOP(neg, i16, ovm_i16x8, OVM_V_NEG)
+OVM_V_UNOP(neg, i32, ovm_i32x4, OVM_V_NEG)
+OVM_V_UNOP(neg, i64, ovm_i64x2, OVM_V_NEG)
+OVM_V_UNOP(neg, f32, ovm_f32x4, OVM_V_NEG)
+OVM_V_UNOP(neg, f64, ovm_f64x2, OVM_V_NEG)
+OVM_V_UNOP(abs, i8,  ovm_i8x16, OVM_V_ABS)
+OVM_V_UNOP(abs, i16, ovm_i16x8, OVM_V_ABS)
+OVM_V_UNOP(abs, i32, ovm_i32x4, OVM_V_ABS)
+OVM_V_UNOP(abs, i64, ovm_i64x2, OVM_V_ABS)
+OVM_V_UNOP(abs, f32, ovm_f32x4, OVM_V_FABS32)
+OVM_V_UNOP(abs, f64, ovm_f64x2, OVM_V_FABS64)
+OVM_V_UNOP(sqrt, f32, ovm_f32x4, __ovm_v128_sqrt_f32)
+OVM_V_UNOP(sqrt, f64, ovm_f64x2, __ovm_v128_sqrt_f64)
+
+// For conversions, the lane in the name is the lane type of the result.
+OVM_V_UNOP(widen_low,    i16, ovm_i8x16, __ovm_v128_widen_low_i16)
+OVM_V_UNOP(widen_low_s,  i16, ovm_i8x16, __ovm_v128_widen_low_s_i16)
+OVM_V_UNOP(widen_high,   i16, ovm_i8x16, __ovm_v128_widen_high_i16)
+OVM_V_UNOP(widen_high_s, i16, ovm_i8x16, __ovm_v128_widen_high_s_i16)
+OVM_V_UNOP(widen_low,    i32, ovm_i16x8, __ovm_v128_widen_low_i32)
+OVM_V_UNOP(widen_low_s,  i32, ovm_i16x8, __ovm_v128_widen_low_s_i32)
+OVM_V_UNOP(widen_high,   i32, ovm_i16x8, __ovm_v128_widen_high_i32)
+OVM_V_UNOP(widen_high_s, i32, ovm_i16x8, __ovm_v128_widen_high_s_i32)
+OVM_V_UNOP(widen_low,    i64, ovm_i32x4, __ovm_v128_widen_low_i64)
+OVM_V_UNOP(widen_low_s,  i64, ovm_i32x4, __ovm_v128_widen_low_s_i64)
+OVM_V_UNOP(widen_high,   i64, ovm_i32x4, __ovm_v128_widen_high_i64)
+OVM_V_UNOP(widen_high_s, i64, ovm_i32x4, __ovm_v128_widen_high_s_i64)
+OVM_V_UNOP(trunc_sat,    i32, ovm_f32x4, __ovm_v128_trunc_sat_u)
+OVM_V_UNOP(trunc_sat_s,  i32, ovm_f32x4, __ovm_v128_trunc_sat_s)
+OVM_V_UNOP(convert,      f32, ovm_u32x4, OVM_V_CONVERT_F32)
+OVM_V_UNOP(convert_s,    f32, ovm_i32x4, OVM_V_CONVERT_F32)
+
+#undef OVM_V_NEG
+#undef OVM_V_NOT
+#undef OVM_V_ABS
+#undef OVM_V_FABS32
+#undef OVM_V_FABS64
+#undef OVM_V_CONVERT_F32
+#undef OVM_V_UNOP
+
+OVMI_INSTR_EXEC(v_bitselect_v128) {
+    ovm_u64x2 mask = V128(ovm_u64x2, instr[1].a);
+    ovm_u64x2 a    = V128(ovm_u64x2, instr->a);
+    ovm_u64x2 b    = V128(ovm_u64x2, instr->b);
+    V128_SET(instr->r, (a & mask) | (b & ~mask));
+    state->pc += 1;
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(v_any_true_v128) {
+    bool result = __ovm_v128_any_true(V128(ovm_u8x16, instr->a));
+    VAL(instr->r).u64 = 0;
+    VAL(instr->r).i32 = result;
+    VAL(instr->r).type = OVM_TYPE_I32;
+    NEXT_OP;
+}
+
+#define OVM_V_OP(lane, vtype) \
+    OVMI_INSTR_EXEC(v_all_true_##lane) { \
+        bool result = !__ovm_v128_any_true((ovm_u8x16) (V128(vtype, instr->a) == 0)); \
+        VAL(instr->r).u64 = 0; \
+        VAL(instr->r).i32 = result; \
+        VAL(instr->r).type = OVM_TYPE_I32; \
+        NEXT_OP; \
+    } \
+ \
+    OVMI_INSTR_EXEC(v_bitmask_##lane) { \
+        u32 result = __ovm_v128_bitmask_##lane(V128(vtype, instr->a)); \
+        VAL(instr->r).u64 = 0; \
+        VAL(instr->r).u32 = result; \
+        VAL(instr->r).type = OVM_TYPE_I32; \
+        NEXT_OP; \
+    }
+
+OVM_V_OP(i8,  ovm_i8x16)
+OVM_V_OP(i16, ovm_i16x8)
+OVM_V_OP(i32, ovm_i32x4)
+OVM_V_OP(i64, ovm_i64x2)
+
+#undef OVM_V_OP
+
+//
+// Lane access
+//
+
+#define OVM_V_OP(lane, t, field, lanes, stype) \
+    OVMI_INSTR_EXEC(v_splat_##lane) { \
+        stype x = VAL(instr->a).stype; \
+        fori (i, 0, lanes) VAL(instr->r).field[i] = x; \
+        VAL(instr->r).type = OVM_TYPE_V128; \
+        NEXT_OP; \
+    } \
+ \
+    OVMI_INSTR_EXEC(v_replace_##lane) { \
+        ovm_value_t r = VAL(instr->a); \
+        r.field[instr[1].i] = VAL(instr->b).stype; \
+        VAL(instr->r) = r; \
+        state->pc += 1; \
+        NEXT_OP; \
+    }
+
+OVM_V_OP(i8,  OVM_TYPE_I8,  i8x16, 16, i8)
+OVM_V_OP(i16, OVM_TYPE_I16, i16x8, 8,  i16)
+OVM_V_OP(i32, OVM_TYPE_I32, i32x4, 4,  i32)
+OVM_V_OP(i64, OVM_TYPE_I64, i64x2, 2,  i64)
+OVM_V_OP(f32, OVM_TYPE_F32, f32x4, 4,  f32)
+OVM_V_OP(f64, OVM_TYPE_F64, f64x2, 2,  f64)
+
+#undef OVM_V_OP
+
+#define OVM_V_OP(name, lane, t, field, dtype) \
+    OVMI_INSTR_EXEC(name##_##lane) { \
+        ovm_value_t r = {0}; \
+        r.dtype = VAL(instr->a).field[instr->b]; \
+        r.type = t; \
+        VAL(instr->r) = r; \
+        NEXT_OP; \
+    }
+
+OVM_V_OP(v_extract,   i8,  OVM_TYPE_I32, u8x16, u32)
+OVM_V_OP(v_extract_s, i8,  OVM_TYPE_I32, i8x16, i32)
+OVM_V_OP(v_extract,   i16, OVM_TYPE_I32, u16x8, u32)
+OVM_V_OP(v_extract_s, i16, OVM_TYPE_I32, i16x8, i32)
+OVM_V_OP(v_extract,   i32, OVM_TYPE_I32, i32x4, i32)
+OVM_V_OP(v_extract,   i64, OVM_TYPE_I64, i64x2, i64)
+OVM_V_OP(v_extract,   f32, OVM_TYPE_F32, f32x4, f32)
+OVM_V_OP(v_extract,   f64, OVM_TYPE_F64, f64x2, f64)
+
+#undef OVM_V_OP
+
+OVMI_INSTR_EXEC(v_shuffle_v128) {
+    u8 mask[16];
+    memcpy(&mask[0], &instr[1].l, 8);
+    memcpy(&mask[8], &instr[2].l, 8);
+
+    ovm_value_t r;
+    fori (i, 0, 16) {
+        u8 idx = mask[i];
+        r.u8x16[i] = idx < 16 ? VAL(instr->a).u8x16[idx] : VAL(instr->b).u8x16[(idx - 16) & 15];
+    }
+
+    r.type = OVM_TYPE_V128;
+    VAL(instr->r) = r;
+    state->pc += 2;
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(v_swizzle_v128) {
+    ovm_value_t r;
+    fori (i, 0, 16) {
+        u8 idx = VAL(instr->b).u8x16[i];
+        r.u8x16[i] = idx < 16 ? VAL(instr->a).u8x16[idx] : 0;
+    }
+
+    r.type = OVM_TYPE_V128;
+    VAL(instr->r) = r;
+    NEXT_OP;
+}
+
+#undef OVM_V_EXEC
+#undef OVM_V_UNSIGNED_EXEC
+#undef V128
+#undef V128_SET
+
+
+//
+// Superinstructions
+//
+// See ovm_program_fuse_superinstructions for where these come from. Each one
+// performs the work of the instruction it replaced, then the work of the
+// instruction(s) after it, and skips over them.
+//
+
+OVMI_INSTR_EXEC(add_imm_i32) {
+    VAL(instr->r).u64 = 0;
+    VAL(instr->r).u32 = instr->i;
+    VAL(instr->r).type = OVM_TYPE_I32;
+
+    VAL(instr[1].r).u32 = VAL(instr[1].a).u32 + (u32) instr->i;
+    VAL(instr[1].r).type = OVM_TYPE_I32;
+
+    state->pc += 1;
+    NEXT_OP;
+}
+
+OVMI_INSTR_EXEC(add_imm_i64) {
+    VAL(instr->r).u64 = instr->l;
+    VAL(instr->r).type = OVM_TYPE_I64;
+
+    VAL(instr[1].r).u64 = VAL(instr[1].a).u64 + (u64) instr->l;
+    VAL(instr[1].r).type = OVM_TYPE_I64;
+
+    state->pc += 1;
+    NEXT_OP;
+}
+
+#define OVM_LOAD_IDX(otype, type_, stype) \
+    OVMI_INSTR_EXEC(load_idx_##otype) { \
+        VAL(instr->r).u32 = VAL(instr->a).u32 + VAL(instr->b).u32; \
+        VAL(instr->r).type = OVM_TYPE_I32; \
+        u32 dest = VAL(instr->r).u32 + (u32) instr[1].b; \
+        OVMI_NULL_CHECK_HOOK(dest); \
+        VAL(instr[1].r).stype = * (stype *) &memory[dest]; \
+        VAL(instr[1].r).type = type_; \
+        state->pc += 1; \
+        NEXT_OP; \
+    }
+
+OVM_LOAD_IDX(i8,  OVM_TYPE_I8,  u8)
+OVM_LOAD_IDX(i16, OVM_TYPE_I16, u16)
+OVM_LOAD_IDX(i32, OVM_TYPE_I32, u32)
+OVM_LOAD_IDX(i64, OVM_TYPE_I64, u64)
+OVM_LOAD_IDX(f32, OVM_TYPE_F32, f32)
+OVM_LOAD_IDX(f64, OVM_TYPE_F64, f64)
+
+#undef OVM_LOAD_IDX
+
+//
+// Compare-and-branch. The following instruction is either a `br_z` or a `br_nz`
+// on the result of the comparison.
+#define OVM_OP(t, op, ctype) \
+    ovm_assert(VAL(instr->a).type == t && VAL(instr->b).type == t); \
+    VAL(instr->r).type = OVM_TYPE_I32; \
+    VAL(instr->r).i32 = ((VAL(instr->a).ctype op VAL(instr->b).ctype)) ? 1 : 0; \
+    state->pc += 1; \
+    if (VAL(instr->r).i32 == (OVM_INSTR_INSTR(instr[1]) == OVMI_BR_NZ)) state->pc += instr[1].a;
+
+OVM_OP_EXEC(br_eq, ==)
+OVM_OP_EXEC(br_ne, !=)
+OVM_OP_UNSIGNED_EXEC(br_lt, <)
+OVM_OP_UNSIGNED_EXEC(br_le, <=)
+OVM_OP_UNSIGNED_EXEC(br_gt, >)
+OVM_OP_UNSIGNED_EXEC(br_ge, >=)
+OVM_OP_EXEC(br_lt_s, <)
+OVM_OP_EXEC(br_le_s, <=)
+OVM_OP_EXEC(br_gt_s, >)
+OVM_OP_EXEC(br_ge_s, >=)
+
+#undef OVM_OP
+
+
+//
+// The original instruction is run from the unpatched copy of the code, so the
+// instructions that read operands from the instructions after them still see
+// the right ones. Only the debug dispatch table knows about breakpoints.
+OVMI_INSTR_EXEC(breakpoint) {
+#ifdef OVMI_BREAKPOINT_HOOK
+    instr = OVMI_BREAKPOINT_HOOK;
+    FORCE_TAILCALL return OVMI_DISPATCH_NAME[instr->full_instr & OVM_INSTR_MASK](instr, state, values, memory, code);
+#else
+    OVMI_EXCEPTION_HOOK;
+    state->__return_value = (ovm_value_t) {0};
+#endif
+}
+
 OVMI_INSTR_EXEC(illegal) {
     OVMI_EXCEPTION_HOOK;
-    return ((ovm_value_t) {0});
+    state->__return_value = (ovm_value_t) {0};
 }
 
 //
@@ -554,6 +1183,12 @@ OVMI_INSTR_EXEC(illegal) {
 #define IROW_INT(name)     NULL, NULL, NULL, D(name##_i32), D(name##_i64), NULL, NULL, NULL,
 #define IROW_FLOAT(name)   NULL, NULL, NULL, NULL, NULL, D(name##_f32), D(name##_f64), NULL,
 #define IROW_SAME(name)    D(name),D(name),D(name),D(name),D(name),D(name),D(name),NULL,
+#define IROW_V128(name)    NULL, NULL, NULL, NULL, NULL, NULL, NULL, D(name##_v128),
+#define IROW_VINT(name)    NULL, D(name##_i8), D(name##_i16), D(name##_i32), D(name##_i64), NULL, NULL, NULL,
+#define IROW_VSMALL(name)  NULL, D(name##_i8), D(name##_i16), NULL, NULL, NULL, NULL, NULL,
+#define IROW_VWIDE(name)   NULL, NULL, D(name##_i16), D(name##_i32), D(name##_i64), NULL, NULL, NULL,
+#define IROW_VMINMAX(name) NULL, D(name##_i8), D(name##_i16), D(name##_i32), NULL, D(name##_f32), D(name##_f64), NULL,
+#define IROW_VMINMAX_S(name) NULL, D(name##_i8), D(name##_i16), D(name##_i32), NULL, NULL, NULL, NULL,
 
 static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
     IROW_UNTYPED(nop) // 0x00
@@ -572,10 +1207,10 @@ static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
     IROW_INT(sar)
     IROW_SAME(illegal)
     IROW_SAME(illegal)
-    IROW_PARTIAL(imm) // 0x10
+    NULL, NULL, NULL, D(imm_i32), D(imm_i64), D(imm_f32), D(imm_f64), D(imm_v128), // 0x10
     IROW_UNTYPED(mov)
-    IROW_TYPED(load)
-    IROW_TYPED(store)
+    NULL, D(load_i8),  D(load_i16),  D(load_i32),  D(load_i64),  D(load_f32),  D(load_f64),  D(load_v128),
+    NULL, D(store_i8), D(store_i16), D(store_i32), D(store_i64), D(store_f32), D(store_f64), D(store_v128),
     IROW_UNTYPED(copy)
     IROW_UNTYPED(fill)
     IROW_UNTYPED(reg_get)
@@ -632,10 +1267,91 @@ static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
     NULL, NULL, NULL, NULL, D(transmute_i64_f64), NULL, NULL, NULL,
     NULL, NULL, NULL, NULL, NULL, D(transmute_f32_i32), NULL, NULL,
     NULL, NULL, NULL, NULL, NULL, NULL, D(transmute_f64_i64), NULL,
-    IROW_INT(cmpxchg)
+    IROW_VINT(cmpxchg)
     IROW_SAME(illegal)
     IROW_UNTYPED(mem_size)
     IROW_UNTYPED(mem_grow)
+    IROW_INT(add_imm)  // 0x50
+    IROW_TYPED(load_idx)
+    IROW_UNTYPED(param_call)
+    IROW_PARTIAL(br_eq)
+    IROW_PARTIAL(br_ne)
+    IROW_PARTIAL(br_lt)
+    IROW_PARTIAL(br_lt_s)
+    IROW_PARTIAL(br_le)
+    IROW_PARTIAL(br_le_s)
+    IROW_PARTIAL(br_gt)
+    IROW_PARTIAL(br_gt_s)
+    IROW_PARTIAL(br_ge)
+    IROW_PARTIAL(br_ge_s)
+    IROW_UNTYPED(breakpoint)
+    IROW_UNTYPED(call_internal)
+    IROW_UNTYPED(calli_internal)
+    IROW_TYPED(v_splat)  // 0x60
+    IROW_TYPED(v_extract)
+    IROW_VSMALL(v_extract_s)
+    IROW_TYPED(v_replace)
+    IROW_V128(v_shuffle)
+    IROW_V128(v_swizzle)
+    IROW_V128(v_not)
+    IROW_V128(v_and)
+    IROW_V128(v_andnot)
+    IROW_V128(v_or)
+    IROW_V128(v_xor)
+    IROW_V128(v_bitselect)
+    IROW_V128(v_any_true)
+    IROW_VINT(v_all_true)
+    IROW_VINT(v_bitmask)
+    IROW_TYPED(v_eq)
+    IROW_TYPED(v_ne)  // 0x70
+    IROW_TYPED(v_lt)
+    IROW_TYPED(v_lt_s)
+    IROW_TYPED(v_le)
+    IROW_TYPED(v_le_s)
+    IROW_TYPED(v_gt)
+    IROW_TYPED(v_gt_s)
+    IROW_TYPED(v_ge)
+    IROW_TYPED(v_ge_s)
+    IROW_TYPED(v_abs)
+    IROW_TYPED(v_neg)
+    IROW_FLOAT(v_sqrt)
+    IROW_TYPED(v_add)
+    IROW_VSMALL(v_add_sat)
+    IROW_VSMALL(v_add_sat_s)
+    IROW_TYPED(v_sub)
+    IROW_VSMALL(v_sub_sat)  // 0x80
+    IROW_VSMALL(v_sub_sat_s)
+    IROW_TYPED(v_mul)
+    IROW_FLOAT(v_div)
+    IROW_VMINMAX(v_min)
+    IROW_VMINMAX_S(v_min_s)
+    IROW_VMINMAX(v_max)
+    IROW_VMINMAX_S(v_max_s)
+    IROW_VSMALL(v_avgr)
+    IROW_VINT(v_shl)
+    IROW_VINT(v_shr)
+    IROW_VINT(v_sar)
+    IROW_VSMALL(v_narrow)
+    IROW_VSMALL(v_narrow_s)
+    IROW_VWIDE(v_widen_low)
+    IROW_VWIDE(v_widen_low_s)
+    IROW_VWIDE(v_widen_high)  // 0x90
+    IROW_VWIDE(v_widen_high_s)
+    NULL, NULL, NULL, D(v_trunc_sat_i32),   NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, D(v_trunc_sat_s_i32), NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, NULL, NULL, D(v_convert_f32),   NULL, NULL,
+    NULL, NULL, NULL, NULL, NULL, D(v_convert_s_f32), NULL, NULL,
+    IROW_VINT(atomic_load)
+    IROW_VINT(atomic_store)
+    IROW_VINT(atomic_add)
+    IROW_VINT(atomic_sub)
+    IROW_VINT(atomic_and)
+    IROW_VINT(atomic_or)
+    IROW_VINT(atomic_xor)
+    IROW_VINT(atomic_xchg)
+    IROW_INT(atomic_wait)
+    IROW_UNTYPED(atomic_notify)
+    IROW_UNTYPED(atomic_fence)  // 0xa0
 };
 
 #undef D
@@ -645,6 +1361,12 @@ static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
 #undef IROW_INT
 #undef IROW_FLOAT
 #undef IROW_SAME
+#undef IROW_V128
+#undef IROW_VINT
+#undef IROW_VSMALL
+#undef IROW_VWIDE
+#undef IROW_VMINMAX
+#undef IROW_VMINMAX_S
 
 #undef OVM_OP_EXEC
 #undef OVM_OP_UNSIGNED_EXEC
@@ -660,5 +1382,8 @@ static ovmi_instr_exec_t OVMI_DISPATCH_NAME[] = {
 #undef OVMI_DISPATCH_NAME
 #undef OVMI_DEBUG_HOOK
 #undef OVMI_EXCEPTION_HOOK
+#undef OVMI_BREAKPOINT_HOOK
+#undef OVMI_NULL_CHECK_HOOK
 #undef OVMI_DIVIDE_CHECK_HOOK
+#undef OVMI_SINGLE_INSTR
 
@@ -0,0 +1,244 @@
+//
+// Helpers for the v128 instructions in vm_instrs.h.
+//
+// Lane-wise arithmetic and comparisons are written with the GCC/Clang vector
+// extensions, which compile to SSE2 on x86-64 and NEON on ARM64. The operations
+// below have no operator, so they are written with the intrinsics directly. Where
+// SSE2 does not have an instruction for something, a loop over the lanes is used.
+//
+// This file is only included by vm.c, after the intrinsic headers.
+//
+
+#ifndef _OVM_VM_SIMD_H
+#define _OVM_VM_SIMD_H
+
+typedef i8  ovm_i8x16 __attribute__((vector_size(16)));
+typedef u8  ovm_u8x16 __attribute__((vector_size(16)));
+typedef i16 ovm_i16x8 __attribute__((vector_size(16)));
+typedef u16 ovm_u16x8 __attribute__((vector_size(16)));
+typedef i32 ovm_i32x4 __attribute__((vector_size(16)));
+typedef u32 ovm_u32x4 __attribute__((vector_size(16)));
+typedef i64 ovm_i64x2 __attribute__((vector_size(16)));
+typedef u64 ovm_u64x2 __attribute__((vector_size(16)));
+typedef f32 ovm_f32x4 __attribute__((vector_size(16)));
+typedef f64 ovm_f64x2 __attribute__((vector_size(16)));
+
+//
+// ovm_value_t is only 8-byte aligned, so values are moved in and out of the
+// vector types with memcpy, which compiles to an unaligned load or store.
+#define OVM_V128_GET(vtype, value) \
+    ({ vtype __v; memcpy(&__v, (value).u8x16, 16); __v; })
+
+#define OVM_V128_SET(value, x) { \
+    __typeof__(x) __x = (x); \
+    memcpy((value).u8x16, &__x, 16); \
+    (value).type = OVM_TYPE_V128; \
+}
+
+
+#if defined(__x86_64__)
+
+#define OVM_V128_SAT_OP(name, vtype, intrin) \
+    static inline vtype name(vtype a, vtype b) { \
+        return (vtype) intrin((__m128i) a, (__m128i) b); \
+    }
+
+OVM_V128_SAT_OP(__ovm_v128_add_sat_i8,  ovm_i8x16, _mm_adds_epi8)
+OVM_V128_SAT_OP(__ovm_v128_add_sat_u8,  ovm_u8x16, _mm_adds_epu8)
+OVM_V128_SAT_OP(__ovm_v128_add_sat_i16, ovm_i16x8, _mm_adds_epi16)
+OVM_V128_SAT_OP(__ovm_v128_add_sat_u16, ovm_u16x8, _mm_adds_epu16)
+OVM_V128_SAT_OP(__ovm_v128_sub_sat_i8,  ovm_i8x16, _mm_subs_epi8)
+OVM_V128_SAT_OP(__ovm_v128_sub_sat_u8,  ovm_u8x16, _mm_subs_epu8)
+OVM_V128_SAT_OP(__ovm_v128_sub_sat_i16, ovm_i16x8, _mm_subs_epi16)
+OVM_V128_SAT_OP(__ovm_v128_sub_sat_u16, ovm_u16x8, _mm_subs_epu16)
+
+#undef OVM_V128_SAT_OP
+
+#define OVM_V128_NARROW(name, dtype, stype, intrin) \
+    static inline dtype name(stype a, stype b) { \
+        return (dtype) intrin((__m128i) a, (__m128i) b); \
+    }
+
+OVM_V128_NARROW(__ovm_v128_narrow_s_i8,  ovm_i8x16, ovm_i16x8, _mm_packs_epi16)
+OVM_V128_NARROW(__ovm_v128_narrow_u_i8,  ovm_u8x16, ovm_i16x8, _mm_packus_epi16)
+OVM_V128_NARROW(__ovm_v128_narrow_s_i16, ovm_i16x8, ovm_i32x4, _mm_packs_epi32)
+
+#undef OVM_V128_NARROW
+
+// packusdw is SSE4.1, so this one is done by hand.
+static inline ovm_u16x8 __ovm_v128_narrow_u_i16(ovm_i32x4 a, ovm_i32x4 b) {
+    ovm_u16x8 r;
+    fori (i, 0, 4) {
+        r[i]     = (u16) bh_clamp(a[i], 0, 0xffff);
+        r[i + 4] = (u16) bh_clamp(b[i], 0, 0xffff);
+    }
+    return r;
+}
+
+static inline bool __ovm_v128_any_true(ovm_u8x16 a) {
+    __m128i zero = _mm_setzero_si128();
+    return _mm_movemask_epi8(_mm_cmpeq_epi8((__m128i) a, zero)) != 0xffff;
+}
+
+static inline u32 __ovm_v128_bitmask_i8(ovm_i8x16 a) {
+    return _mm_movemask_epi8((__m128i) a);
+}
+
+static inline u32 __ovm_v128_bitmask_i16(ovm_i16x8 a) {
+    return _mm_movemask_epi8(_mm_packs_epi16((__m128i) a, _mm_setzero_si128())) & 0xff;
+}
+
+static inline u32 __ovm_v128_bitmask_i32(ovm_i32x4 a) {
+    return _mm_movemask_ps(_mm_castsi128_ps((__m128i) a));
+}
+
+static inline u32 __ovm_v128_bitmask_i64(ovm_i64x2 a) {
+    return _mm_movemask_pd(_mm_castsi128_pd((__m128i) a));
+}
+
+//
+// Widening interleaves the lanes with either zero or their sign.
+#define OVM_V128_WIDEN(name, dtype, stype, unpack, cmpgt, is_signed) \
+    static inline dtype name(stype a) { \
+        __m128i zero = _mm_setzero_si128(); \
+        __m128i high = is_signed ? cmpgt(zero, (__m128i) a) : zero; \
+        return (dtype) unpack((__m128i) a, high); \
+    }
+
+OVM_V128_WIDEN(__ovm_v128_widen_low_i16,    ovm_i16x8, ovm_i8x16, _mm_unpacklo_epi8,  _mm_cmpgt_epi8,  0)
+OVM_V128_WIDEN(__ovm_v128_widen_low_s_i16,  ovm_i16x8, ovm_i8x16, _mm_unpacklo_epi8,  _mm_cmpgt_epi8,  1)
+OVM_V128_WIDEN(__ovm_v128_widen_high_i16,   ovm_i16x8, ovm_i8x16, _mm_unpackhi_epi8,  _mm_cmpgt_epi8,  0)
+OVM_V128_WIDEN(__ovm_v128_widen_high_s_i16, ovm_i16x8, ovm_i8x16, _mm_unpackhi_epi8,  _mm_cmpgt_epi8,  1)
+OVM_V128_WIDEN(__ovm_v128_widen_low_i32,    ovm_i32x4, ovm_i16x8, _mm_unpacklo_epi16, _mm_cmpgt_epi16, 0)
+OVM_V128_WIDEN(__ovm_v128_widen_low_s_i32,  ovm_i32x4, ovm_i16x8, _mm_unpacklo_epi16, _mm_cmpgt_epi16, 1)
+OVM_V128_WIDEN(__ovm_v128_widen_high_i32,   ovm_i32x4, ovm_i16x8, _mm_unpackhi_epi16, _mm_cmpgt_epi16, 0)
+OVM_V128_WIDEN(__ovm_v128_widen_high_s_i32, ovm_i32x4, ovm_i16x8, _mm_unpackhi_epi16, _mm_cmpgt_epi16, 1)
+OVM_V128_WIDEN(__ovm_v128_widen_low_i64,    ovm_i64x2, ovm_i32x4, _mm_unpacklo_epi32, _mm_cmpgt_epi32, 0)
+OVM_V128_WIDEN(__ovm_v128_widen_low_s_i64,  ovm_i64x2, ovm_i32x4, _mm_unpacklo_epi32, _mm_cmpgt_epi32, 1)
+OVM_V128_WIDEN(__ovm_v128_widen_high_i64,   ovm_i64x2, ovm_i32x4, _mm_unpackhi_epi32, _mm_cmpgt_epi32, 0)
+OVM_V128_WIDEN(__ovm_v128_widen_high_s_i64, ovm_i64x2, ovm_i32x4, _mm_unpackhi_epi32, _mm_cmpgt_epi32, 1)
+
+#undef OVM_V128_WIDEN
+
+static inline ovm_f32x4 __ovm_v128_sqrt_f32(ovm_f32x4 a) { return (ovm_f32x4) _mm_sqrt_ps((__m128) a); }
+static inline ovm_f64x2 __ovm_v128_sqrt_f64(ovm_f64x2 a) { return (ovm_f64x2) _mm_sqrt_pd((__m128d) a); }
+
+
+#elif defined(__arm64__)
+
+#define OVM_V128_SAT_OP(name, vtype, ntype, intrin) \
+    static inline vtype name(vtype a, vtype b) { \
+        return (vtype) intrin((ntype) a, (ntype) b); \
+    }
+
+OVM_V128_SAT_OP(__ovm_v128_add_sat_i8,  ovm_i8x16, int8x16_t,  vqaddq_s8)
+OVM_V128_SAT_OP(__ovm_v128_add_sat_u8,  ovm_u8x16, uint8x16_t, vqaddq_u8)
+OVM_V128_SAT_OP(__ovm_v128_add_sat_i16, ovm_i16x8, int16x8_t,  vqaddq_s16)
+OVM_V128_SAT_OP(__ovm_v128_add_sat_u16, ovm_u16x8, uint16x8_t, vqaddq_u16)
+OVM_V128_SAT_OP(__ovm_v128_sub_sat_i8,  ovm_i8x16, int8x16_t,  vqsubq_s8)
+OVM_V128_SAT_OP(__ovm_v128_sub_sat_u8,  ovm_u8x16, uint8x16_t, vqsubq_u8)
+OVM_V128_SAT_OP(__ovm_v128_sub_sat_i16, ovm_i16x8, int16x8_t,  vqsubq_s16)
+OVM_V128_SAT_OP(__ovm_v128_sub_sat_u16, ovm_u16x8, uint16x8_t, vqsubq_u16)
+
+#undef OVM_V128_SAT_OP
+
+static inline ovm_i8x16 __ovm_v128_narrow_s_i8(ovm_i16x8 a, ovm_i16x8 b) {
+    return (ovm_i8x16) vcombine_s8(vqmovn_s16((int16x8_t) a), vqmovn_s16((int16x8_t) b));
+}
+
+static inline ovm_u8x16 __ovm_v128_narrow_u_i8(ovm_i16x8 a, ovm_i16x8 b) {
+    return (ovm_u8x16) vcombine_u8(vqmovun_s16((int16x8_t) a), vqmovun_s16((int16x8_t) b));
+}
+
+static inline ovm_i16x8 __ovm_v128_narrow_s_i16(ovm_i32x4 a, ovm_i32x4 b) {
+    return (ovm_i16x8) vcombine_s16(vqmovn_s32((int32x4_t) a), vqmovn_s32((int32x4_t) b));
+}
+
+static inline ovm_u16x8 __ovm_v128_narrow_u_i16(ovm_i32x4 a, ovm_i32x4 b) {
+    return (ovm_u16x8) vcombine_u16(vqmovun_s32((int32x4_t) a), vqmovun_s32((int32x4_t) b));
+}
+
+static inline bool __ovm_v128_any_true(ovm_u8x16 a) {
+    return vmaxvq_u8((uint8x16_t) a) != 0;
+}
+
+//
+// NEON does not have a movemask, so the sign bits are collected by hand.
+#define OVM_V128_BITMASK(name, vtype, lanes) \
+    static inline u32 name(vtype a) { \
+        u32 mask = 0; \
+        fori (i, 0, lanes) mask |= (a[i] < 0) << i; \
+        return mask; \
+    }
+
+OVM_V128_BITMASK(__ovm_v128_bitmask_i8,  ovm_i8x16, 16)
+OVM_V128_BITMASK(__ovm_v128_bitmask_i16, ovm_i16x8, 8)
+OVM_V128_BITMASK(__ovm_v128_bitmask_i32, ovm_i32x4, 4)
+OVM_V128_BITMASK(__ovm_v128_bitmask_i64, ovm_i64x2, 2)
+
+#undef OVM_V128_BITMASK
+
+#define OVM_V128_WIDEN(name, dtype, stype, ntype, intrin) \
+    static inline dtype name(stype a) { \
+        return (dtype) intrin((ntype) a); \
+    }
+
+#define vmovl_low_s8(a)  vmovl_s8(vget_low_s8(a))
+#define vmovl_low_u8(a)  vmovl_u8(vget_low_u8(a))
+#define vmovl_low_s16(a) vmovl_s16(vget_low_s16(a))
+#define vmovl_low_u16(a) vmovl_u16(vget_low_u16(a))
+#define vmovl_low_s32(a) vmovl_s32(vget_low_s32(a))
+#define vmovl_low_u32(a) vmovl_u32(vget_low_u32(a))
+
+OVM_V128_WIDEN(__ovm_v128_widen_low_i16,    ovm_i16x8, ovm_i8x16, uint8x16_t,  vmovl_low_u8)
+OVM_V128_WIDEN(__ovm_v128_widen_low_s_i16,  ovm_i16x8, ovm_i8x16, int8x16_t,   vmovl_low_s8)
+OVM_V128_WIDEN(__ovm_v128_widen_high_i16,   ovm_i16x8, ovm_i8x16, uint8x16_t,  vmovl_high_u8)
+OVM_V128_WIDEN(__ovm_v128_widen_high_s_i16, ovm_i16x8, ovm_i8x16, int8x16_t,   vmovl_high_s8)
+OVM_V128_WIDEN(__ovm_v128_widen_low_i32,    ovm_i32x4, ovm_i16x8, uint16x8_t,  vmovl_low_u16)
+OVM_V128_WIDEN(__ovm_v128_widen_low_s_i32,  ovm_i32x4, ovm_i16x8, int16x8_t,   vmovl_low_s16)
+OVM_V128_WIDEN(__ovm_v128_widen_high_i32,   ovm_i32x4, ovm_i16x8, uint16x8_t,  vmovl_high_u16)
+OVM_V128_WIDEN(__ovm_v128_widen_high_s_i32, ovm_i32x4, ovm_i16x8, int16x8_t,   vmovl_high_s16)
+OVM_V128_WIDEN(__ovm_v128_widen_low_i64,    ovm_i64x2, ovm_i32x4, uint32x4_t,  vmovl_low_u32)
+OVM_V128_WIDEN(__ovm_v128_widen_low_s_i64,  ovm_i64x2, ovm_i32x4, int32x4_t,   vmovl_low_s32)
+OVM_V128_WIDEN(__ovm_v128_widen_high_i64,   ovm_i64x2, ovm_i32x4, uint32x4_t,  vmovl_high_u32)
+OVM_V128_WIDEN(__ovm_v128_widen_high_s_i64, ovm_i64x2, ovm_i32x4, int32x4_t,   vmovl_high_s32)
+
+#undef vmovl_low_s8
+#undef vmovl_low_u8
+#undef vmovl_low_s16
+#undef vmovl_low_u16
+#undef vmovl_low_s32
+#undef vmovl_low_u32
+#undef OVM_V128_WIDEN
+
+static inline ovm_f32x4 __ovm_v128_sqrt_f32(ovm_f32x4 a) { return (ovm_f32x4) vsqrtq_f32((float32x4_t) a); }
+static inline ovm_f64x2 __ovm_v128_sqrt_f64(ovm_f64x2 a) { return (ovm_f64x2) vsqrtq_f64((float64x2_t) a); }
+
+#endif
+
+
+//
+// These match the saturating behavior of the scalar trunc_sat instructions in
+// WebAssembly: NaN becomes 0 and out of range values are clamped.
+static inline ovm_i32x4 __ovm_v128_trunc_sat_s(ovm_f32x4 a) {
+    ovm_i32x4 r;
+    fori (i, 0, 4) {
+        if (a[i] != a[i])                 r[i] = 0;
+        else if (a[i] <= -2147483648.0f)  r[i] = INT32_MIN;
+        else if (a[i] >=  2147483648.0f)  r[i] = INT32_MAX;
+        else                              r[i] = (i32) a[i];
+    }
+    return r;
+}
+
+static inline ovm_u32x4 __ovm_v128_trunc_sat_u(ovm_f32x4 a) {
+    ovm_u32x4 r;
+    fori (i, 0, 4) {
+        if (a[i] != a[i] || a[i] <= 0)    r[i] = 0;
+        else if (a[i] >= 4294967296.0f)   r[i] = UINT32_MAX;
+        else                              r[i] = (u32) a[i];
+    }
+    return r;
+}
+
+#endif
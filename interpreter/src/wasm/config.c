@@ -5,6 +5,11 @@ wasm_config_t *wasm_config_new() {
     wasm_config_t *config = malloc(sizeof(*config));
     config->debug_enabled = false;
     config->listen_path   = "/tmp/ovm-debug.0000";
+    config->instr_stats_enabled = false;
+    config->superinstructions_enabled = true;
+    config->jit_enabled = false;
+    config->program_cache_dir = NULL;
+    config->profile_path = NULL;
     return config;
 }
 
@@ -20,3 +25,23 @@ void wasm_config_set_listen_path(wasm_config_t *config, char *listen_path) {
     config->listen_path = listen_path;
 }
 
+void wasm_config_enable_instr_stats(wasm_config_t *config, bool enabled) {
+    config->instr_stats_enabled = enabled;
+}
+
+void wasm_config_enable_superinstructions(wasm_config_t *config, bool enabled) {
+    config->superinstructions_enabled = enabled;
+}
+
+void wasm_config_enable_jit(wasm_config_t *config, bool enabled) {
+    config->jit_enabled = enabled;
+}
+
+
+void wasm_config_set_program_cache_dir(wasm_config_t *config, char *dir) {
+    config->program_cache_dir = dir;
+}
+
+void wasm_config_set_profile_path(wasm_config_t *config, char *path) {
+    config->profile_path = path;
+}
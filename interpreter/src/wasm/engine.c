@@ -17,6 +17,27 @@ wasm_engine_t *wasm_engine_new_with_config(wasm_config_t *config) {
     ovm_engine_t *ovm_engine = ovm_engine_new(store);
     engine->engine = ovm_engine;
 
+    if (config) {
+        // Breakpoints are set by patching the opcode of a single instruction,
+        // which a superinstruction that reads the instructions after it would
+        // not notice, so nothing is fused when debugging.
+        ovm_engine->fuse_superinstructions = config->superinstructions_enabled && !config->debug_enabled;
+
+        if (config->instr_stats_enabled) {
+            ovm_engine_enable_instr_stats(ovm_engine);
+        }
+
+        // Jitted code cannot be stepped through, so the JIT is never used
+        // when debugging.
+        if (config->jit_enabled && !config->debug_enabled) {
+            ovm_engine_enable_jit(ovm_engine);
+        }
+
+        if (config->profile_path) {
+            ovm_engine_enable_profiler(ovm_engine, 1000);
+        }
+    }
+
     if (config && config->debug_enabled) {
         // This should maybe be moved elsewhere?
         debug_state_t *debug  = bh_alloc_item(store->heap_allocator, debug_state_t);
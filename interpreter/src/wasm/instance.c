@@ -4,8 +4,6 @@
 #include "vm.h"
 #include <alloca.h>
 
-static_assert(sizeof(ovm_value_t) == sizeof(wasm_val_t), "Size of ovm_value_t should match size of wasm_val_t");
-
 typedef struct wasm_ovm_binding wasm_ovm_binding;
 struct wasm_ovm_binding {
     int func_idx;
@@ -283,6 +281,13 @@ static void prepare_instance(wasm_instance_t *instance, const wasm_extern_vec_t
     }
 
 
+    //
+    // Linear memory is only accessible up to its current size, so it has to be
+    // grown to the initial size before any data is placed in it.
+    assert(bh_arr_length(instance->memories) == 1);
+    u32 memory_size = (instance->memories[0]->inner.type->memory.limits.min) * MEMORY_PAGE_SIZE;
+    ovm_engine_memory_ensure_capacity(ovm_engine, memory_size);
+
     //
     // Initialize all non-passive data segments
     fori (i, 0, (int) instance->module->data_count) {
@@ -348,10 +353,6 @@ wasm_instance_t *wasm_instance_new(wasm_store_t *store, const wasm_module_t *mod
 
     prepare_instance(instance, imports);
 
-    assert(bh_arr_length(instance->memories) == 1);
-    u32 memory_size = (instance->memories[0]->inner.type->memory.limits.min) * MEMORY_PAGE_SIZE;
-    ovm_engine_memory_ensure_capacity(store->engine->engine, memory_size);
-
     if (trap) *trap = NULL;
 
     return instance;
@@ -6,6 +6,40 @@
 
 #include "./module_parsing.h"
 
+#include <sys/stat.h>
+
+//
+// Translated programs are cached on disk as program images, named by a key
+// that covers the bytes of the module and every option that changes the
+// translation. The next time the same module is loaded, the code section is
+// loaded from the image instead of being translated.
+static char *module_image_path(wasm_engine_t *engine, const wasm_byte_vec_t *binary, u64 *out_key) {
+    if (!engine->config || !engine->config->program_cache_dir) return NULL;
+
+    char *dir = engine->config->program_cache_dir;
+
+    // Create the cache directory and all of its parents.
+    char *path = bh_aprintf(bh_heap_allocator(), "%s", dir);
+    for (char *c = path + 1; *c; c++) {
+        if (*c != '/') continue;
+
+        *c = 0;
+        mkdir(path, 0755);
+        *c = '/';
+    }
+    mkdir(path, 0755);
+    bh_free(bh_heap_allocator(), path);
+
+    u32 flags = 0;
+    if (engine->engine->fuse_superinstructions) flags |= 1;
+    if (engine->engine->debug)                  flags |= 2;
+
+    *out_key = ovm_program_image_key((u8 *) binary->data, binary->size, flags);
+    char key_str[17];
+    snprintf(key_str, sizeof(key_str), "%016llx", (unsigned long long) *out_key);
+    return bh_aprintf(bh_heap_allocator(), "%s/%s.ovmi", dir, key_str);
+}
+
 static bool module_build(wasm_module_t *module, const wasm_byte_vec_t *binary) {
     wasm_engine_t *engine = module->store->engine;
     module->program = ovm_program_new(engine->store);
@@ -17,6 +51,9 @@ static bool module_build(wasm_module_t *module, const wasm_byte_vec_t *binary) {
     ctx.program = module->program;
     ctx.store   = engine->store;
     ctx.next_external_func_idx = 0;
+    ctx.image_path   = module_image_path(engine, binary, &ctx.image_key);
+    ctx.image_loaded = false;
+    memset(&ctx.image_mark, 0, sizeof(ctx.image_mark));
 
     debug_info_builder_init(&ctx.debug_builder, &module->debug_info);
     sh_new_arena(module->custom_sections);
@@ -29,6 +66,14 @@ static bool module_build(wasm_module_t *module, const wasm_byte_vec_t *binary) {
     // But Onyx does not do this, so I don't care at the moment.
     module->program->register_count = module->globaltypes.size;
 
+    if (ctx.image_path) {
+        if (!ctx.image_loaded) {
+            ovm_program_image_save(module->program, &module->debug_info, &ctx.image_mark, ctx.image_key, ctx.image_path);
+        }
+
+        bh_free(bh_heap_allocator(), ctx.image_path);
+    }
+
     #if 0
         printf("Program instruction count: %d\n", bh_arr_length(module->program->code));
     #endif
@@ -81,6 +126,11 @@ wasm_module_t *wasm_module_new(wasm_store_t *store, const wasm_byte_vec_t *binar
     }
 
     bool success = module_build(module, binary); 
+
+    if (store->engine->engine->debug) {
+        debug_host_attach_program(store->engine->engine->debug, module->program);
+    }
+
     return module;
 }
 
@@ -88,6 +138,26 @@ void wasm_module_delete(wasm_module_t *module) {
     ovm_program_delete(module->program);
 }
 
+//
+// Reports everything that was collected while the module was running. This
+// is separate from deleting the module, because the module (and the engine)
+// are not deleted when other threads could still be using them.
+void wasm_module_report(wasm_module_t *module) {
+    ovm_engine_t *engine = module->store->engine->engine;
+    if (engine->jit && engine->instr_pair_counts) {
+        ovm_program_print_jit_stats(module->program);
+    }
+
+    if (engine->instr_pair_counts) {
+        ovm_engine_print_instr_stats(engine);
+    }
+
+    wasm_config_t *config = module->store->engine->config;
+    if (engine->profiler && config && config->profile_path) {
+        ovm_engine_write_profile(engine, module->program, &module->debug_info, config->profile_path);
+    }
+}
+
 bool wasm_module_validate(wasm_store_t *store, const wasm_byte_vec_t *binary) {
     // Hmmm...
     return false;
@@ -23,6 +23,13 @@ struct build_context {
 
     debug_info_builder_t debug_builder;
 
+    // When set, the code section is loaded from (or saved to) this program image
+    // instead of being translated. See module_build.
+    char *image_path;
+    u64   image_key;
+    bool  image_loaded;
+    ovm_program_mark_t image_mark;
+
     // This will be set/reset for every code (function) entry.
     ovm_code_builder_t builder;
 };
@@ -52,7 +59,7 @@ static inline wasm_valkind_t parse_valtype(build_context *ctx) {
         case 0x7e: return WASM_I64;
         case 0x7d: return WASM_F32;
         case 0x7c: return WASM_F64;
-        case 0x7b: assert(0 && "SIMD values are not currently supported");
+        case 0x7b: return WASM_V128;
         case 0x70: return WASM_FUNCREF;
         case 0x6F: return WASM_ANYREF;
         default:   assert(0 && "Invalid valtype.");
@@ -449,10 +456,237 @@ static void parse_fc_instruction(build_context *ctx) {
     }
 }
 
+//
+// The SIMD opcodes are the ones the Onyx compiler emits (see wasm_emit.h), which
+// follow an earlier draft of the SIMD proposal.
+static void parse_fd_instruction(build_context *ctx) {
+    int instr_num = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+
+    switch (instr_num) {
+
+#define BINOP(num, instr, type) \
+        case num: ovm_code_builder_add_binop(&ctx->builder, OVM_TYPED_INSTR(instr, type)); break;
+#define UNOP(num, instr, type) \
+        case num: ovm_code_builder_add_unop (&ctx->builder, OVM_TYPED_INSTR(instr, type)); break;
+
+        case 0: {
+            int alignment = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+            int offset    = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+            ovm_code_builder_add_load(&ctx->builder, OVM_TYPE_V128, offset);
+            break;
+        }
+
+        case 11: {
+            int alignment = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+            int offset    = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+            ovm_code_builder_add_store(&ctx->builder, OVM_TYPE_V128, offset);
+            break;
+        }
+
+        case 12: {
+            u8 value[16];
+            memcpy(value, &ctx->binary.data[ctx->offset], 16);
+            ctx->offset += 16;
+            ovm_code_builder_add_imm(&ctx->builder, OVM_TYPE_V128, value);
+            break;
+        }
+
+        case 13: {
+            u8 mask[16];
+            memcpy(mask, &ctx->binary.data[ctx->offset], 16);
+            ctx->offset += 16;
+            ovm_code_builder_add_v128_shuffle(&ctx->builder, mask);
+            break;
+        }
+
+        BINOP(14, OVMI_V_SWIZZLE, OVM_TYPE_V128)
+
+        UNOP(15, OVMI_V_SPLAT, OVM_TYPE_I8)
+        UNOP(16, OVMI_V_SPLAT, OVM_TYPE_I16)
+        UNOP(17, OVMI_V_SPLAT, OVM_TYPE_I32)
+        UNOP(18, OVMI_V_SPLAT, OVM_TYPE_I64)
+        UNOP(19, OVMI_V_SPLAT, OVM_TYPE_F32)
+        UNOP(20, OVMI_V_SPLAT, OVM_TYPE_F64)
+
+#define EXTRACT_CASE(num, instr, type) \
+        case num: ovm_code_builder_add_v128_extract(&ctx->builder, OVM_TYPED_INSTR(instr, type), CONSUME_BYTE(ctx)); break;
+#define REPLACE_CASE(num, type) \
+        case num: ovm_code_builder_add_v128_replace(&ctx->builder, OVM_TYPED_INSTR(OVMI_V_REPLACE, type), CONSUME_BYTE(ctx)); break;
+
+        EXTRACT_CASE(21, OVMI_V_EXTRACT_S, OVM_TYPE_I8)
+        EXTRACT_CASE(22, OVMI_V_EXTRACT,   OVM_TYPE_I8)
+        REPLACE_CASE(23, OVM_TYPE_I8)
+        EXTRACT_CASE(24, OVMI_V_EXTRACT_S, OVM_TYPE_I16)
+        EXTRACT_CASE(25, OVMI_V_EXTRACT,   OVM_TYPE_I16)
+        REPLACE_CASE(26, OVM_TYPE_I16)
+        EXTRACT_CASE(27, OVMI_V_EXTRACT,   OVM_TYPE_I32)
+        REPLACE_CASE(28, OVM_TYPE_I32)
+        EXTRACT_CASE(29, OVMI_V_EXTRACT,   OVM_TYPE_I64)
+        REPLACE_CASE(30, OVM_TYPE_I64)
+        EXTRACT_CASE(31, OVMI_V_EXTRACT,   OVM_TYPE_F32)
+        REPLACE_CASE(32, OVM_TYPE_F32)
+        EXTRACT_CASE(33, OVMI_V_EXTRACT,   OVM_TYPE_F64)
+        REPLACE_CASE(34, OVM_TYPE_F64)
+
+#undef EXTRACT_CASE
+#undef REPLACE_CASE
+
+#define INT_COMPARE_CASES(base, type) \
+        BINOP(base + 0, OVMI_V_EQ,   type) \
+        BINOP(base + 1, OVMI_V_NE,   type) \
+        BINOP(base + 2, OVMI_V_LT_S, type) \
+        BINOP(base + 3, OVMI_V_LT,   type) \
+        BINOP(base + 4, OVMI_V_GT_S, type) \
+        BINOP(base + 5, OVMI_V_GT,   type) \
+        BINOP(base + 6, OVMI_V_LE_S, type) \
+        BINOP(base + 7, OVMI_V_LE,   type) \
+        BINOP(base + 8, OVMI_V_GE_S, type) \
+        BINOP(base + 9, OVMI_V_GE,   type)
+
+#define FLOAT_COMPARE_CASES(base, type) \
+        BINOP(base + 0, OVMI_V_EQ, type) \
+        BINOP(base + 1, OVMI_V_NE, type) \
+        BINOP(base + 2, OVMI_V_LT, type) \
+        BINOP(base + 3, OVMI_V_GT, type) \
+        BINOP(base + 4, OVMI_V_LE, type) \
+        BINOP(base + 5, OVMI_V_GE, type)
+
+        INT_COMPARE_CASES(35, OVM_TYPE_I8)
+        INT_COMPARE_CASES(45, OVM_TYPE_I16)
+        INT_COMPARE_CASES(55, OVM_TYPE_I32)
+        FLOAT_COMPARE_CASES(65, OVM_TYPE_F32)
+        FLOAT_COMPARE_CASES(71, OVM_TYPE_F64)
+
+#undef INT_COMPARE_CASES
+#undef FLOAT_COMPARE_CASES
+
+        UNOP (77, OVMI_V_NOT,    OVM_TYPE_V128)
+        BINOP(78, OVMI_V_AND,    OVM_TYPE_V128)
+        BINOP(79, OVMI_V_ANDNOT, OVM_TYPE_V128)
+        BINOP(80, OVMI_V_OR,     OVM_TYPE_V128)
+        BINOP(81, OVMI_V_XOR,    OVM_TYPE_V128)
+
+        case 82: ovm_code_builder_add_v128_bitselect(&ctx->builder); break;
+
+        // v128.any_true in the final version of the proposal.
+        UNOP(83, OVMI_V_ANY_TRUE, OVM_TYPE_V128)
+
+        //
+        // i8x16 and i16x8 have the same operations at the same offsets.
+#define SMALL_INT_CASES(base, type) \
+        UNOP (base + 0,  OVMI_V_ABS,       type) \
+        UNOP (base + 1,  OVMI_V_NEG,       type) \
+        UNOP (base + 2,  OVMI_V_ANY_TRUE,  OVM_TYPE_V128) \
+        UNOP (base + 3,  OVMI_V_ALL_TRUE,  type) \
+        UNOP (base + 4,  OVMI_V_BITMASK,   type) \
+        BINOP(base + 5,  OVMI_V_NARROW_S,  type) \
+        BINOP(base + 6,  OVMI_V_NARROW,    type) \
+        BINOP(base + 11, OVMI_V_SHL,       type) \
+        BINOP(base + 12, OVMI_V_SAR,       type) \
+        BINOP(base + 13, OVMI_V_SHR,       type) \
+        BINOP(base + 14, OVMI_V_ADD,       type) \
+        BINOP(base + 15, OVMI_V_ADD_SAT_S, type) \
+        BINOP(base + 16, OVMI_V_ADD_SAT,   type) \
+        BINOP(base + 17, OVMI_V_SUB,       type) \
+        BINOP(base + 18, OVMI_V_SUB_SAT_S, type) \
+        BINOP(base + 19, OVMI_V_SUB_SAT,   type) \
+        BINOP(base + 22, OVMI_V_MIN_S,     type) \
+        BINOP(base + 23, OVMI_V_MIN,       type) \
+        BINOP(base + 24, OVMI_V_MAX_S,     type) \
+        BINOP(base + 25, OVMI_V_MAX,       type) \
+        BINOP(base + 27, OVMI_V_AVGR,      type)
+
+        SMALL_INT_CASES(96,  OVM_TYPE_I8)
+        SMALL_INT_CASES(128, OVM_TYPE_I16)
+
+#undef SMALL_INT_CASES
+
+        UNOP (135, OVMI_V_WIDEN_LOW_S,  OVM_TYPE_I16)
+        UNOP (136, OVMI_V_WIDEN_HIGH_S, OVM_TYPE_I16)
+        UNOP (137, OVMI_V_WIDEN_LOW,    OVM_TYPE_I16)
+        UNOP (138, OVMI_V_WIDEN_HIGH,   OVM_TYPE_I16)
+        BINOP(149, OVMI_V_MUL,          OVM_TYPE_I16)
+
+        UNOP (160, OVMI_V_ABS,          OVM_TYPE_I32)
+        UNOP (161, OVMI_V_NEG,          OVM_TYPE_I32)
+        UNOP (162, OVMI_V_ANY_TRUE,     OVM_TYPE_V128)
+        UNOP (163, OVMI_V_ALL_TRUE,     OVM_TYPE_I32)
+        UNOP (164, OVMI_V_BITMASK,      OVM_TYPE_I32)
+        UNOP (167, OVMI_V_WIDEN_LOW_S,  OVM_TYPE_I32)
+        UNOP (168, OVMI_V_WIDEN_HIGH_S, OVM_TYPE_I32)
+        UNOP (169, OVMI_V_WIDEN_LOW,    OVM_TYPE_I32)
+        UNOP (170, OVMI_V_WIDEN_HIGH,   OVM_TYPE_I32)
+        BINOP(171, OVMI_V_SHL,          OVM_TYPE_I32)
+        BINOP(172, OVMI_V_SAR,          OVM_TYPE_I32)
+        BINOP(173, OVMI_V_SHR,          OVM_TYPE_I32)
+        BINOP(174, OVMI_V_ADD,          OVM_TYPE_I32)
+        BINOP(177, OVMI_V_SUB,          OVM_TYPE_I32)
+        BINOP(181, OVMI_V_MUL,          OVM_TYPE_I32)
+        BINOP(182, OVMI_V_MIN_S,        OVM_TYPE_I32)
+        BINOP(183, OVMI_V_MIN,          OVM_TYPE_I32)
+        BINOP(184, OVMI_V_MAX_S,        OVM_TYPE_I32)
+        BINOP(185, OVMI_V_MAX,          OVM_TYPE_I32)
+
+        UNOP (193, OVMI_V_NEG,          OVM_TYPE_I64)
+        BINOP(203, OVMI_V_SHL,          OVM_TYPE_I64)
+        BINOP(204, OVMI_V_SAR,          OVM_TYPE_I64)
+        BINOP(205, OVMI_V_SHR,          OVM_TYPE_I64)
+        BINOP(206, OVMI_V_ADD,          OVM_TYPE_I64)
+        BINOP(209, OVMI_V_SUB,          OVM_TYPE_I64)
+        BINOP(213, OVMI_V_MUL,          OVM_TYPE_I64)
+
+#define FLOAT_CASES(base, type) \
+        UNOP (base + 0, OVMI_V_ABS,  type) \
+        UNOP (base + 1, OVMI_V_NEG,  type) \
+        UNOP (base + 3, OVMI_V_SQRT, type) \
+        BINOP(base + 4, OVMI_V_ADD,  type) \
+        BINOP(base + 5, OVMI_V_SUB,  type) \
+        BINOP(base + 6, OVMI_V_MUL,  type) \
+        BINOP(base + 7, OVMI_V_DIV,  type) \
+        BINOP(base + 8, OVMI_V_MIN,  type) \
+        BINOP(base + 9, OVMI_V_MAX,  type)
+
+        FLOAT_CASES(224, OVM_TYPE_F32)
+        FLOAT_CASES(236, OVM_TYPE_F64)
+
+#undef FLOAT_CASES
+
+        UNOP(248, OVMI_V_TRUNC_SAT_S, OVM_TYPE_I32)
+        UNOP(249, OVMI_V_TRUNC_SAT,   OVM_TYPE_I32)
+        UNOP(250, OVMI_V_CONVERT_S,   OVM_TYPE_F32)
+        UNOP(251, OVMI_V_CONVERT,     OVM_TYPE_F32)
+
+#undef BINOP
+#undef UNOP
+
+        default: assert(0 && "UNHANDLED SIMD INSTRUCTION");
+    }
+}
+
 static void parse_fe_instruction(build_context *ctx) {
     int instr_num = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
 
     switch (instr_num) {
+        case 0x00: {
+            int alignment = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+            int offset    = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+            ovm_code_builder_add_atomic_notify(&ctx->builder, offset);
+            break;
+        }
+
+        case 0x01:
+        case 0x02: {
+            int alignment = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+            int offset    = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+            ovm_code_builder_add_atomic_wait(&ctx->builder, instr_num == 0x01 ? OVM_TYPE_I32 : OVM_TYPE_I64, offset);
+            break;
+        }
+
+        case 0x03: {
+            CONSUME_BYTE(ctx);
+            ovm_code_builder_add_atomic_fence(&ctx->builder);
+            break;
+        }
 
 #define LOAD_CASE(num, type) \
         case num : { \
@@ -490,6 +724,33 @@ static void parse_fe_instruction(build_context *ctx) {
 
 #undef STORE_CASE
 
+#define RMW_CASES(base, instr) \
+        RMW_CASE(base + 0, instr, OVM_TYPE_I32) \
+        RMW_CASE(base + 1, instr, OVM_TYPE_I64) \
+        RMW_CASE(base + 2, instr, OVM_TYPE_I8) \
+        RMW_CASE(base + 3, instr, OVM_TYPE_I16) \
+        RMW_CASE(base + 4, instr, OVM_TYPE_I8) \
+        RMW_CASE(base + 5, instr, OVM_TYPE_I16) \
+        RMW_CASE(base + 6, instr, OVM_TYPE_I32)
+
+#define RMW_CASE(num, instr, type) \
+        case num : { \
+            int alignment = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset); \
+            int offset    = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset); \
+            ovm_code_builder_add_atomic_rmw(&ctx->builder, instr, type, offset); \
+            break; \
+        }
+
+        RMW_CASES(0x1E, OVMI_ATOMIC_ADD)
+        RMW_CASES(0x25, OVMI_ATOMIC_SUB)
+        RMW_CASES(0x2C, OVMI_ATOMIC_AND)
+        RMW_CASES(0x33, OVMI_ATOMIC_OR)
+        RMW_CASES(0x3A, OVMI_ATOMIC_XOR)
+        RMW_CASES(0x41, OVMI_ATOMIC_XCHG)
+
+#undef RMW_CASE
+#undef RMW_CASES
+
 #define CMPXCHG_CASE(num, type) \
         case num : { \
             int alignment = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset); \
@@ -610,7 +871,15 @@ static void parse_instruction(build_context *ctx) {
             wasm_functype_t *functype = wasm_module_index_functype(ctx->module, func_idx);
             int param_count = functype->type.func.params.size;
 
-            ovm_code_builder_add_call(&ctx->builder, func_idx, param_count, functype->type.func.results.size != 0);
+            //
+            // Imported functions are registered before any code is parsed, so
+            // a function that is not registered yet is defined in this module.
+            bool has_return_value = functype->type.func.results.size != 0;
+            if (func_idx < bh_arr_length(ctx->program->funcs) && ctx->program->funcs[func_idx].kind == OVM_FUNC_EXTERNAL) {
+                ovm_code_builder_add_call(&ctx->builder, func_idx, param_count, has_return_value);
+            } else {
+                ovm_code_builder_add_internal_call(&ctx->builder, func_idx, param_count, has_return_value);
+            }
             break;
         }
 
@@ -899,6 +1168,7 @@ static void parse_instruction(build_context *ctx) {
         case 0xC4: ovm_code_builder_add_unop (&ctx->builder, OVM_TYPED_INSTR(OVMI_CVT_I32_S, OVM_TYPE_I64)); break;
 
         case 0xFC: parse_fc_instruction(ctx); break;
+        case 0xFD: parse_fd_instruction(ctx); break;
         case 0xFE: parse_fe_instruction(ctx); break;
 
         default: assert(0 && "UNHANDLED INSTRUCTION");
@@ -913,6 +1183,7 @@ static void parse_expression(build_context *ctx) {
 
 static void parse_code_section(build_context *ctx) {
     unsigned int section_size = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
+    unsigned int section_start = ctx->offset;
     unsigned int code_count = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
     assert(ctx->module->functypes.size == code_count);
 
@@ -921,6 +1192,16 @@ static void parse_code_section(build_context *ctx) {
     // HACK HACK HACK THIS IS SUCH A BAD WAY OF DOING THIS
     ctx->module->memory_init_idx = bh_arr_length(ctx->program->funcs) + code_count;
 
+    if (ctx->image_path) {
+        ovm_program_mark(ctx->program, &ctx->module->debug_info, &ctx->image_mark);
+
+        if (ovm_program_image_load(ctx->program, &ctx->module->debug_info, ctx->image_key, ctx->image_path)) {
+            ctx->image_loaded = true;
+            ctx->offset = section_start + section_size;
+            return;
+        }
+    }
+
     fori (i, 0, (int) code_count) {
         unsigned int code_size = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
         unsigned int local_sections_count = uleb128_to_uint((u8 *)ctx->binary.data, (i32 *)&ctx->offset);
@@ -947,6 +1228,14 @@ static void parse_code_section(build_context *ctx) {
         ovm_code_builder_push_label_target(&ctx->builder, label_kind_func);
         parse_expression(ctx);
         ovm_code_builder_add_return(&ctx->builder);
+        ovm_code_builder_finish(&ctx->builder);
+
+        // Superinstructions are not used when debugging, because the debugger
+        // expects to be able to stop on every instruction.
+        ovm_engine_t *engine = ctx->module->store->engine->engine;
+        if (engine->fuse_superinstructions && !engine->debug) {
+            ovm_program_fuse_superinstructions(ctx->program, ctx->builder.start_instr, bh_arr_length(ctx->program->code));
+        }
 
         char *func_name = bh_aprintf(bh_heap_allocator(), "wasm_loaded_%d", func_idx);
         ovm_program_register_func(ctx->program, func_name, ctx->builder.start_instr, ctx->builder.param_count, ctx->builder.highest_value_number + 1);
@@ -2997,13 +2997,34 @@ void bh_imap_free(bh_imap* imap) {
     imap->entries = NULL;
 }
 
-bh__imap_lookup_result bh__imap_lookup(bh_imap* imap, bh_imap_entry_t key) {
-    bh__imap_lookup_result lr = { -1, -1, -1 };
-
+static u64 bh__imap_hash_index(bh_imap* imap, bh_imap_entry_t key) {
     u64 hash = 0xcbf29ce484222325ull ^ key;
     u64 n = bh_arr_capacity(imap->hashes);
 
-    lr.hash_index  = hash % n;
+    return hash % n;
+}
+
+// The number of buckets is doubled when there are more than four entries per bucket,
+// so the chains stay short no matter how many entries are put into the map.
+static void bh__imap_grow(bh_imap* imap) {
+    i32 hash_count = bh_arr_capacity(imap->hashes) * 2 + 1;
+
+    bh_arr_free(imap->hashes);
+    imap->hashes = NULL;
+    bh_arr_new(imap->allocator, imap->hashes, hash_count);
+    fori(count, 0, hash_count) bh_arr_push(imap->hashes, -1);
+
+    fori(i, 0, bh_arr_length(imap->entries)) {
+        u64 hash_index = bh__imap_hash_index(imap, imap->entries[i].key);
+        imap->entries[i].next = imap->hashes[hash_index];
+        imap->hashes[hash_index] = i;
+    }
+}
+
+bh__imap_lookup_result bh__imap_lookup(bh_imap* imap, bh_imap_entry_t key) {
+    bh__imap_lookup_result lr = { -1, -1, -1 };
+
+    lr.hash_index  = bh__imap_hash_index(imap, key);
     lr.entry_index = imap->hashes[lr.hash_index];
     while (lr.entry_index >= 0) {
         if (imap->entries[lr.entry_index].key == key) {
@@ -3032,6 +3053,10 @@ void bh_imap_put(bh_imap* imap, bh_imap_entry_t key, bh_imap_entry_t value) {
     bh_arr_push(imap->entries, entry);
 
     imap->hashes[lr.hash_index] = bh_arr_length(imap->entries) - 1;
+
+    if (bh_arr_length(imap->entries) > 4 * bh_arr_capacity(imap->hashes)) {
+        bh__imap_grow(imap);
+    }
 }
 
 b32 bh_imap_has(bh_imap* imap, bh_imap_entry_t key) {